@@ -0,0 +1,349 @@
+/* aclbench.c - Measure the lookups of the tcpacl longest prefix match
+ * lists. A list of random IPv4 and IPv6 prefixes, mostly /24 and /32
+ * networks like the block lists of a public server, is written to a
+ * temporary file and loaded. A sample of addresses is checked against a
+ * linear scan of the prefixes, then the lookup rate is measured for each
+ * family, and again while another thread reloads the list over and over.
+ *
+ * Build:
+ * % make aclbench
+ *
+ * Usage:
+ * % ./aclbench
+ * % ./aclbench -n 1000000 -m 50000000 -p 20 -r 10
+ * % ./aclbench -a 1024
+ *
+ * Options:
+ * -n count    number of prefixes (default: 300000)
+ * -m count    number of lookups per run (default: 20000000)
+ * -p percent  share of IPv6 prefixes (default: 10)
+ * -r count    number of reloads during the last run (default: 5)
+ * -a count    number of distinct addresses looked up (default: 65536);
+ *             with few addresses their paths through the list stay in
+ *             the CPU caches, with many most lookups miss them
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcpacl.h"
+
+/* the number of addresses checked against the linear scan */
+#define BENCH_NCHECK 1000
+
+struct benchpfx {
+    unsigned char a[16];
+    int v6;
+    int len;
+    int action;
+};
+
+union benchaddr {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+};
+
+struct benchreload {
+    struct tcpacl *acl;
+    const char *path;
+    int count;
+    int done;
+    uint64_t ns;
+    int err;
+};
+
+static uint64_t seed = 0x2545f4914f6cdd1dULL;
+
+static uint64_t benchrand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static uint64_t nowns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void benchprefix(struct benchpfx *p, int v6)
+{
+    int r = benchrand() % 100;
+    p->v6 = v6;
+    if(!v6) {
+        p->len = r < 60 ? 24 : r < 85 ? 32 : 8 + benchrand() % 24;
+    } else {
+        p->len = r < 50 ? 48 : r < 80 ? 64 : r < 90 ? 128 :
+            32 + benchrand() % 96;
+    }
+    memset(p->a, 0, sizeof p->a);
+    /* keep IPv6 prefixes in 2000::/3 like global unicast */
+    for(int i = 0; i < (v6 ? 16 : 4); i++) p->a[i] = benchrand();
+    if(v6) p->a[0] = 0x20 | (p->a[0] & 0x1f);
+    for(int bit = p->len; bit < (v6 ? 128 : 32); bit++) {
+        p->a[bit / 8] &= ~(0x80 >> bit % 8);
+    }
+    p->action = benchrand() % 100 < 80 ? TCP_ACLDENY : TCP_ACLALLOW;
+}
+
+/* benchaddr writes an address into sa: most fall into one of the prefixes,
+ * the others anywhere */
+static void benchaddr(union benchaddr *sa, struct benchpfx *pfx, int n,
+        int v6)
+{
+    unsigned char a[16];
+    struct benchpfx *p = NULL;
+    for(int tries = 0; tries < 64 && n > 0; tries++) {
+        struct benchpfx *q = &pfx[benchrand() % n];
+        if(q->v6 == v6) {
+            p = q;
+            break;
+        }
+    }
+    for(int i = 0; i < 16; i++) a[i] = benchrand();
+    if(p != NULL && benchrand() % 4 != 0) {
+        for(int bit = 0; bit < p->len; bit++) {
+            unsigned char m = 0x80 >> bit % 8;
+            a[bit / 8] = (a[bit / 8] & ~m) | (p->a[bit / 8] & m);
+        }
+    }
+    memset(sa, 0, sizeof *sa);
+    if(!v6) {
+        sa->in.sin_family = AF_INET;
+        memcpy(&sa->in.sin_addr, a, 4);
+    } else {
+        sa->in6.sin6_family = AF_INET6;
+        memcpy(&sa->in6.sin6_addr, a, 16);
+    }
+}
+
+/* benchscan returns the result of the longest prefix that matches sa, the
+ * later one of equal prefixes */
+static int benchscan(struct benchpfx *pfx, int n, union benchaddr *sa)
+{
+    const unsigned char *a;
+    int v6 = sa->sa.sa_family == AF_INET6;
+    if(v6) {
+        a = sa->in6.sin6_addr.s6_addr;
+    } else {
+        a = (const unsigned char *)&sa->in.sin_addr;
+    }
+    int best = -1, res = TCP_ACLNONE;
+    for(int i = 0; i < n; i++) {
+        struct benchpfx *p = &pfx[i];
+        if(p->v6 != v6 || p->len < best) continue;
+        int bit;
+        for(bit = 0; bit < p->len; bit++) {
+            unsigned char m = 0x80 >> bit % 8;
+            if((a[bit / 8] & m) != (p->a[bit / 8] & m)) break;
+        }
+        if(bit < p->len) continue;
+        best = p->len;
+        res = p->action;
+    }
+    return res;
+}
+
+static void *benchreloader(void *arg)
+{
+    struct benchreload *r = arg;
+    uint64_t t0 = nowns();
+    for(int i = 0; i < r->count && r->err == 0; i++) {
+        if(tcpaclload(r->acl, r->path, NULL) != 0) r->err = errno;
+    }
+    r->ns = nowns() - t0;
+    __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* benchlookups checks m addresses, cycling through the naddrs of addrs,
+ * and returns the nanoseconds it took; the results are summed into *sum so
+ * they are not optimized away */
+static uint64_t benchlookups(struct tcpacl *acl, union benchaddr *addrs,
+        long naddrs, long m, long *sum)
+{
+    long s = 0;
+    uint64_t t0 = nowns();
+    for(long i = 0, k = 0; i < m; i++) {
+        s += tcpaclcheck(acl, &addrs[k].sa);
+        if(++k == naddrs) k = 0;
+    }
+    uint64_t t1 = nowns();
+    *sum += s;
+    return t1 - t0;
+}
+
+int main(int argc, char **argv)
+{
+    long n = 300000;
+    long m = 20000000;
+    int pct = 10;
+    int reloads = 5;
+    long naddrs = 65536;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:m:p:r:a:")) != -1) {
+        switch(opt) {
+            case 'n':
+                n = atol(optarg);
+                break;
+            case 'm':
+                m = atol(optarg);
+                break;
+            case 'p':
+                pct = atoi(optarg);
+                break;
+            case 'r':
+                reloads = atoi(optarg);
+                break;
+            case 'a':
+                naddrs = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-m count] "
+                        "[-p percent] [-r count] [-a count]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(n < 0 || n > 100000000 || m < 1 || pct < 0 || pct > 100 ||
+            reloads < 0 || naddrs < BENCH_NCHECK) {
+        fprintf(stderr, "Usage: %s [-n count] [-m count] [-p percent] "
+                "[-r count] [-a count]\n", argv[0]);
+        return 1;
+    }
+
+    struct benchpfx *pfx = malloc((n > 0 ? n : 1) * sizeof *pfx);
+    union benchaddr *addrs4 = malloc(naddrs * sizeof *addrs4);
+    union benchaddr *addrs6 = malloc(naddrs * sizeof *addrs6);
+    if(pfx == NULL || addrs4 == NULL || addrs6 == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    char path[] = "/tmp/aclbench.XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd != -1 ? fdopen(fd, "w") : NULL;
+    if(f == NULL) {
+        perror("mkstemp");
+        return 1;
+    }
+    for(long i = 0; i < n; i++) {
+        char s[INET6_ADDRSTRLEN];
+        benchprefix(&pfx[i], (long)(benchrand() % 100) < pct);
+        inet_ntop(pfx[i].v6 ? AF_INET6 : AF_INET, pfx[i].a, s, sizeof s);
+        fprintf(f, "%s %s/%d\n", pfx[i].action == TCP_ACLALLOW ? "allow" :
+                "deny", s, pfx[i].len);
+    }
+    if(fclose(f) != 0) {
+        perror("write");
+        unlink(path);
+        return 1;
+    }
+    for(long i = 0; i < naddrs; i++) {
+        benchaddr(&addrs4[i], pfx, n, 0);
+        benchaddr(&addrs6[i], pfx, n, 1);
+    }
+
+    struct tcpacl *acl;
+    size_t line = 0;
+    uint64_t t0 = nowns();
+    if(tcpaclnew(&acl) != 0 || tcpaclload(acl, path, &line) != 0) {
+        fprintf(stderr, "error: load: line %zu: %s\n", line, strerror(errno));
+        unlink(path);
+        return 1;
+    }
+    uint64_t t1 = nowns();
+    size_t nprefixes, bytes;
+    tcpaclinfo(acl, &nprefixes, &bytes);
+    printf("%zu prefixes loaded in %.1f ms, %.1f MiB\n", nprefixes,
+            (t1 - t0) / 1e6, bytes / 1048576.0);
+
+    int bad = 0;
+    for(int i = 0; i < BENCH_NCHECK; i++) {
+        union benchaddr *sa = i % 2 ? &addrs6[i] : &addrs4[i];
+        if(tcpaclcheck(acl, &sa->sa) != benchscan(pfx, n, sa)) {
+            bad++;
+        }
+    }
+    printf("%d of %d lookups differ from a linear scan\n", bad,
+            BENCH_NCHECK);
+
+    long sum = 0;
+    printf("%-14s %10s %10s\n", "run", "ns/lookup", "Mlookups/s");
+    uint64_t ns = benchlookups(acl, addrs4, naddrs, m, &sum);
+    printf("%-14s %10.1f %10.1f\n", "ipv4", (double)ns / m, m / (ns / 1e3));
+    ns = benchlookups(acl, addrs6, naddrs, m, &sum);
+    printf("%-14s %10.1f %10.1f\n", "ipv6", (double)ns / m, m / (ns / 1e3));
+
+    struct benchreload r = { acl, path, reloads, 0, 0, 0 };
+    pthread_t th;
+    long mr = 0;
+    ns = 0;
+    pthread_create(&th, NULL, benchreloader, &r);
+    do {
+        ns += benchlookups(acl, addrs4, naddrs, naddrs, &sum);
+        mr += naddrs;
+    } while(!__atomic_load_n(&r.done, __ATOMIC_ACQUIRE) || mr < m);
+    pthread_join(th, NULL);
+    printf("%-14s %10.1f %10.1f\n", "ipv4+reload", (double)ns / mr,
+            mr / (ns / 1e3));
+    if(r.err != 0) {
+        printf("reload error: %s\n", strerror(r.err));
+    } else if(reloads > 0) {
+        printf("%d reloads, %.1f ms each\n", reloads,
+                r.ns / 1e6 / reloads);
+    }
+
+    tcpaclfree(acl);
+    unlink(path);
+    free(pfx);
+    free(addrs4);
+    free(addrs6);
+    return sum == -1 || bad != 0;
+}
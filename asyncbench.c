@@ -0,0 +1,461 @@
+/* asyncbench.c - Measure the cost of the tcpasync operations and of the
+ * tcpfiber context switch. The benchmark first times a fiber suspending
+ * and being resumed, then has c connections to an echo server, itself
+ * built on tcpasync callbacks in a thread of its own, exchange m messages
+ * each: from a single thread with blocking calls, one connection after
+ * the other, with tcpasync completion callbacks and with one fiber per
+ * connection, both of which multiplex every connection on one thread.
+ *
+ * Build:
+ * % make asyncbench
+ *
+ * Usage:
+ * % ./asyncbench
+ * % ./asyncbench -c 1000 -m 200 -s 128
+ *
+ * Options:
+ * -n count  number of context switches (default: 1000000)
+ * -c count  number of connections (default: 64); each connection needs
+ *           two descriptors, raise ulimit -n for large counts
+ * -m count  messages per connection (default: 1000)
+ * -s size   size of the messages in bytes (default: 64)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tcp.h"
+#include "tcphist.h"
+#include "tcploop.h"
+#include "tcpasync.h"
+#include "tcpfiber.h"
+
+struct echosrv {
+    struct tcpev ln;
+    struct tcploop *loop;
+    struct tcpasync *as;
+    size_t size;
+};
+
+struct echoconn {
+    struct echosrv *srv;
+    char *buf;
+};
+
+struct bench {
+    struct tcploop *loop;
+    struct tcpasync *as;
+    struct tcphist hist;
+    char *port;
+    long rounds;
+    size_t size;
+    int active;
+    int err;
+};
+
+struct benchconn {
+    struct bench *b;
+    int fd;
+    long round;
+    size_t got;
+    uint64_t t0;
+    char *out;
+    char *in;
+};
+
+static uint64_t nowns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* full reads or writes exactly len bytes, it returns 0 or an errno
+ * value; ECONNRESET stands for an early end of file */
+static int full(int fd, char *buf, size_t len, int wr)
+{
+    while(len > 0) {
+        ssize_t n = wr ? send(fd, buf, len, MSG_NOSIGNAL) :
+            recv(fd, buf, len, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) return errno;
+        if(n == 0) return ECONNRESET;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void echoread(struct tcpasync *as, int fd, ssize_t res, void *arg);
+
+static void echowrite(struct tcpasync *as, int fd, ssize_t res, void *arg)
+{
+    struct echoconn *c = arg;
+    int err = res < 0 ? (int)-res : tcpreadasync(as, fd, c->buf,
+            c->srv->size, 0, echoread, c);
+    if(err != 0) {
+        tcpcloseasync(as, fd);
+        free(c);
+    }
+}
+
+static void echoread(struct tcpasync *as, int fd, ssize_t res, void *arg)
+{
+    struct echoconn *c = arg;
+    int err = res <= 0 ? ECONNRESET : tcpwriteasync(as, fd, c->buf, res, 0,
+            echowrite, c);
+    if(err != 0) {
+        tcpcloseasync(as, fd);
+        free(c);
+    }
+}
+
+static void echoaccept(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echosrv *srv = (struct echosrv *)ev;
+    (void)loop;
+    (void)events;
+    for(;;) {
+        int conn;
+        int err = tcpaccept(&conn, ev->fd, TCP_NONBLOCK);
+        if(err == EINTR || err == ECONNABORTED) continue;
+        if(err != 0) return;
+        struct echoconn *c = malloc(sizeof *c + srv->size);
+        if(c == NULL) {
+            close(conn);
+            continue;
+        }
+        c->srv = srv;
+        c->buf = (char *)(c + 1);
+        if(tcpreadasync(srv->as, conn, c->buf, srv->size, 0, echoread,
+                    c) != 0) {
+            tcpcloseasync(srv->as, conn);
+            free(c);
+        }
+    }
+}
+
+static void *echorun(void *arg)
+{
+    struct echosrv *srv = arg;
+    if(tcpasyncnew(&srv->as, srv->loop) == 0) {
+        tcplooprun(srv->loop);
+        tcpasyncfree(srv->as);
+    }
+    return NULL;
+}
+
+/* benchend retires a connection of the callback and fiber modes. */
+static void benchend(struct bench *b, int err)
+{
+    if(err != 0 && b->err == 0) b->err = err;
+    if(--b->active == 0) tcploopstop(b->loop);
+}
+
+static void cbsend(struct benchconn *c);
+
+static void cbread(struct tcpasync *as, int fd, ssize_t res, void *arg)
+{
+    struct benchconn *c = arg;
+    struct bench *b = c->b;
+    int err = res < 0 ? (int)-res : res == 0 ? ECONNRESET : 0;
+    if(err == 0) {
+        c->got += res;
+        if(c->got < b->size) {
+            err = tcpreadasync(as, fd, c->in + c->got, b->size - c->got, 0,
+                    cbread, c);
+            if(err == 0) return;
+        }
+    }
+    if(err != 0) {
+        tcpcloseasync(as, fd);
+        benchend(b, err);
+        return;
+    }
+    tcphistadd(&b->hist, nowns() - c->t0);
+    if(++c->round == b->rounds) {
+        tcpcloseasync(as, fd);
+        benchend(b, 0);
+        return;
+    }
+    cbsend(c);
+}
+
+static void cbwrite(struct tcpasync *as, int fd, ssize_t res, void *arg)
+{
+    struct benchconn *c = arg;
+    int err = res < 0 ? (int)-res : tcpreadasync(as, fd, c->in, c->b->size,
+            0, cbread, c);
+    if(err != 0) {
+        tcpcloseasync(as, fd);
+        benchend(c->b, err);
+    }
+}
+
+static void cbsend(struct benchconn *c)
+{
+    c->t0 = nowns();
+    c->got = 0;
+    int err = tcpwriteasync(c->b->as, c->fd, c->out, c->b->size, 0,
+            cbwrite, c);
+    if(err != 0) {
+        tcpcloseasync(c->b->as, c->fd);
+        benchend(c->b, err);
+    }
+}
+
+static void cbdial(struct tcpasync *as, int fd, ssize_t res, void *arg)
+{
+    struct benchconn *c = arg;
+    (void)as;
+    if(res < 0) {
+        benchend(c->b, -res);
+        return;
+    }
+    c->fd = fd;
+    cbsend(c);
+}
+
+static void fiberconn(void *arg)
+{
+    struct benchconn *c = arg;
+    struct bench *b = c->b;
+    int conn;
+    int err = tcpfiberdial(&conn, "127.0.0.1", b->port, 5000);
+    if(err != 0) {
+        benchend(b, err);
+        return;
+    }
+    for(long r = 0; r < b->rounds && err == 0; r++) {
+        uint64_t t0 = nowns();
+        err = tcpfiberwrite(conn, c->out, b->size, 0);
+        for(size_t got = 0, n; err == 0 && got < b->size; got += n) {
+            err = tcpfiberread(conn, c->in + got, b->size - got, &n, 0);
+            if(err == 0 && n == 0) err = ECONNRESET;
+        }
+        if(err == 0) tcphistadd(&b->hist, nowns() - t0);
+    }
+    tcpfiberclose(conn);
+    benchend(b, err);
+}
+
+struct switcher {
+    long n;
+    struct tcpfiber *f;
+};
+
+static void switcher(void *arg)
+{
+    struct switcher *s = arg;
+    s->f = tcpfiberself();
+    for(long i = 0; i < s->n; i++) tcpfibersuspend();
+}
+
+/* benchswitch returns the cost of a context switch in nanoseconds. */
+static double benchswitch(struct tcpasync *as, long n)
+{
+    struct switcher s = { n, NULL };
+    /* the fiber runs up to its first suspend */
+    int err = tcpfiberstart(as, switcher, &s, 0);
+    if(err != 0) {
+        errno = err;
+        return -1;
+    }
+    uint64_t t0 = nowns();
+    for(long i = 0; i < n; i++) tcpfiberresume(s.f);
+    return (double)(nowns() - t0) / (2 * n);
+}
+
+static int benchblocking(struct bench *b, struct benchconn *conns, int c)
+{
+    int err = 0;
+    int n;
+    for(n = 0; n < c && err == 0; n++) {
+        err = tcpdial(&conns[n].fd, "127.0.0.1", b->port);
+    }
+    if(err != 0) n--;
+    for(long r = 0; r < b->rounds && err == 0; r++) {
+        for(int i = 0; i < n && err == 0; i++) {
+            uint64_t t0 = nowns();
+            err = full(conns[i].fd, conns[i].out, b->size, 1);
+            if(err == 0) err = full(conns[i].fd, conns[i].in, b->size, 0);
+            tcphistadd(&b->hist, nowns() - t0);
+        }
+    }
+    for(int i = 0; i < n; i++) close(conns[i].fd);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    long nswitch = 1000000;
+    int nconns = 64;
+    long rounds = 1000;
+    size_t size = 64;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:c:m:s:")) != -1) {
+        switch(opt) {
+            case 'n':
+                nswitch = atol(optarg);
+                break;
+            case 'c':
+                nconns = atoi(optarg);
+                break;
+            case 'm':
+                rounds = atol(optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-c count] "
+                        "[-m count] [-s size]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(nswitch < 1 || nconns < 1 || rounds < 1 || size == 0) {
+        fprintf(stderr, "Usage: %s [-n count] [-c count] [-m count] "
+                "[-s size]\n", argv[0]);
+        return 1;
+    }
+
+    static struct echosrv srv;
+    static struct bench b;
+    srv.size = size;
+    srv.ln.fn = echoaccept;
+    int err = tcplisten(&srv.ln.fd, "127.0.0.1", "0", TCP_NONBLOCK);
+    if(err == 0) err = tcploopnew(&srv.loop);
+    if(err == 0) err = tcploopadd(srv.loop, &srv.ln, TCP_EVIN);
+    if(err == 0) err = tcploopnew(&b.loop);
+    if(err == 0) err = tcpasyncnew(&b.as, b.loop);
+    struct benchconn *conns = calloc(nconns, sizeof *conns);
+    char *bufs = malloc(2 * size);
+    if(err == 0 && (conns == NULL || bufs == NULL)) err = ENOMEM;
+    if(err != 0) {
+        fprintf(stderr, "E: setup %s\n", strerror(err));
+        return 1;
+    }
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof addr;
+    getsockname(srv.ln.fd, (struct sockaddr *)&addr, &addrlen);
+    char port[8];
+    snprintf(port, sizeof port, "%d", ntohs(addr.sin_port));
+    memset(bufs, 'x', 2 * size);
+    pthread_t thread;
+    pthread_create(&thread, NULL, echorun, &srv);
+
+    double ns = benchswitch(b.as, nswitch);
+    if(ns < 0) {
+        fprintf(stderr, "E: tcpfiberstart %s\n", strerror(errno));
+    } else {
+        printf("context switch: %.1f ns\n", ns);
+    }
+    tcpasyncfree(b.as);
+    tcploopfree(b.loop);
+
+    static const char *modes[] = { "blocking", "callback", "fiber" };
+    printf("%d connections, %ld messages of %zu bytes each\n", nconns,
+            rounds, size);
+    printf("%-10s %12s %10s %10s\n", "mode", "msgs/s", "p50 us",
+            "p99 us");
+    for(int m = 0; m < 3; m++) {
+        tcphistinit(&b.hist);
+        b.port = port;
+        b.rounds = rounds;
+        b.size = size;
+        b.active = nconns;
+        b.err = 0;
+        /* the echo reply is not checked, every connection shares the
+         * buffers */
+        for(int i = 0; i < nconns; i++) {
+            conns[i].b = &b;
+            conns[i].round = 0;
+            conns[i].out = bufs;
+            conns[i].in = bufs + size;
+        }
+
+        uint64_t t0 = nowns();
+        if(m == 0) {
+            b.err = benchblocking(&b, conns, nconns);
+        } else {
+            /* a stopped loop stays stopped, run each mode on a new one */
+            err = tcploopnew(&b.loop);
+            if(err == 0) {
+                err = tcpasyncnew(&b.as, b.loop);
+                if(err != 0) tcploopfree(b.loop);
+            }
+            if(err != 0) {
+                printf("%-10s error: %s\n", modes[m], strerror(err));
+                continue;
+            }
+            for(int i = 0; i < nconns; i++) {
+                err = m == 1 ? tcpdialasync(b.as, "127.0.0.1", port, 5000,
+                        cbdial, &conns[i]) :
+                    tcpfiberstart(b.as, fiberconn, &conns[i], 0);
+                if(err != 0) benchend(&b, err);
+            }
+            if(b.active > 0) tcplooprun(b.loop);
+            tcpasyncfree(b.as);
+            tcploopfree(b.loop);
+        }
+        uint64_t t1 = nowns();
+        if(b.err != 0) {
+            printf("%-10s error: %s\n", modes[m], strerror(b.err));
+            continue;
+        }
+        printf("%-10s %12.0f %10.2f %10.2f\n", modes[m],
+                b.hist.n / ((t1 - t0) / 1e9), tcphistpct(&b.hist, 50) / 1e3,
+                tcphistpct(&b.hist, 99) / 1e3);
+    }
+
+    tcploopstop(srv.loop);
+    pthread_join(thread, NULL);
+    tcploopfree(srv.loop);
+    close(srv.ln.fd);
+    free(conns);
+    free(bufs);
+    return 0;
+}
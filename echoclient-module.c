@@ -1,6 +1,15 @@
 /* echoclient-module
  * This is different version of echoclient.c. All functionality of TCP is
- * extracted to tcp.o module.
+ * extracted to tcp.o module. Every message is sent as a line over a
+ * connection borrowed from a tcppool, so the connection is dialed once and
+ * reused for the following messages. The reply is read with tcpreadline,
+ * which waits for the whole echoed line.
+ *
+ * With -k, -f or -s the client pipelines instead: it dials one connection and
+ * keeps up to K messages in flight on it. The messages waiting to be sent
+ * are coalesced by the tcpwr buffer into one sendmsg(2) per batch, and the
+ * replies are matched to the messages by their order. Over a link with a
+ * long round trip this turns the latency of every message into throughput.
  *
  * Build:
  * % make tcp.o
@@ -8,6 +17,19 @@
  *
  * Usage:
  * % ./echoclient-module localhost 8080 hello
+ * % ./echoclient-module localhost 8080 hello world
+ * % ./echoclient-module -k 16 localhost 8080 hello world
+ * % ./echoclient-module -k 64 -f messages.txt localhost 8080
+ * % ./echoclient-module -k 64 localhost 8080 - < messages.txt
+ *
+ * Options:
+ * -k K      the number of messages in flight (default: 1)
+ * -f file   send every line of file as a message; "-" reads stdin
+ * -s fmt    at the end, dump the TCP_INFO of the connection and the
+ *           counters of the tcp module to stderr; fmt is prom or json
+ *
+ * The input is read ahead of the replies, so a K above 1 is meant for
+ * files and pipes rather than for typing at a terminal.
  *
  * License:
  * BSD 3-clause Revised
@@ -39,43 +61,296 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string.h>
  
 #include "tcp.h"
+#include "tcppool.h"
+#include "tcpbuf.h"
+#include "tcpstat.h"
 
-int main(int argc, char **argv)
+/* msgsrc yields the messages, from the command line or from a file */
+struct msgsrc {
+    FILE *f;
+    char **argv;
+    int argc;
+};
+
+/* inflight is a message that was written but not answered yet */
+struct inflight {
+    char *msg;
+    size_t len;
+};
+
+/* nextmsg writes the next message into *msg, which the caller frees. It
+ * returns 0, TCP_EOF after the last message, or an errno value. */
+static int nextmsg(struct msgsrc *src, char **msg, size_t *n)
 {
-    if(argc != 4) {
-        fprintf(stderr, "Usage: %s host port message\n", argv[0]);
-        return 1;
+    if(src->f == NULL) {
+        if(src->argc == 0) return TCP_EOF;
+        *n = strlen(src->argv[0]);
+        *msg = strdup(src->argv[0]);
+        src->argv++;
+        src->argc--;
+        return *msg == NULL ? ENOMEM : 0;
     }
 
+    size_t cap = 0;
+    *msg = NULL;
+    ssize_t len = getline(msg, &cap, src->f);
+    if(len == -1) {
+        int err = ferror(src->f) ? errno : TCP_EOF;
+        free(*msg);
+        return err;
+    }
+    if(len > 0 && (*msg)[len-1] == '\n') len--;
+    *n = len;
+    return 0;
+}
+
+/* pipeline sends the messages of src over one connection with up to k of
+ * them in flight. If statfmt is not -1 it dumps the statistics of the
+ * connection in that format. It returns 0 or an errno value. */
+static int pipeline(char host[], char port[], struct msgsrc *src, int k,
+        int statfmt)
+{
     int conn;
-    errno = tcpdial(&conn, argv[1], argv[2]);
-    if(errno != 0) {
-        fprintf(stderr, "error: %s\n", strerror(errno));
-        return 1;
+    int err = tcpdial(&conn, host, port);
+    if(err != 0) return err;
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+
+    struct tcprd rd;
+    struct tcpwr wr;
+    struct inflight *ring = calloc(k, sizeof *ring);
+    if(ring == NULL || tcprdinit(&rd, conn, 0, 0) != 0) {
+        free(ring);
+        close(conn);
+        return ENOMEM;
+    }
+    if(tcpwrinit(&wr, conn, 0) != 0) {
+        tcprdfree(&rd);
+        free(ring);
+        close(conn);
+        return ENOMEM;
     }
 
-    /* send message to a socket */
-    int retsend = send(conn, argv[3], strlen(argv[3]), MSG_DONTWAIT);
-    if(retsend == -1) {
-        fprintf(stderr, "error: %s\n", strerror(errno));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* ring[head] is the oldest message in flight */
+    int head = 0, n = 0, eof = 0;
+    long nmsgs = 0;
+    err = 0;
+    while(err == 0 && (!eof || n > 0)) {
+        /* queue messages until k are in flight */
+        while(!eof && n < k) {
+            struct inflight *m = &ring[(head + n) % k];
+            int errmsg = nextmsg(src, &m->msg, &m->len);
+            if(errmsg == TCP_EOF) {
+                eof = 1;
+                break;
+            }
+            if(errmsg != 0) {
+                err = errmsg;
+                break;
+            }
+            n++;
+            struct iovec iov[2];
+            iov[0].iov_base = m->msg;
+            iov[0].iov_len = m->len;
+            iov[1].iov_base = "\n";
+            iov[1].iov_len = 1;
+            int errwrite = tcpwritev(&wr, iov, 2);
+            if(errwrite != 0 && errwrite != EAGAIN) err = errwrite;
+        }
+        if(err != 0) break;
+
+        int errflush = tcpflush(&wr);
+        if(errflush != 0 && errflush != EAGAIN) {
+            err = errflush;
+            break;
+        }
+
+        /* match every complete reply with the oldest message */
+        int nread = 0;
+        char *line;
+        size_t len;
+        while(n > 0 && (err = tcpreadline(&rd, &line, &len)) == 0) {
+            struct inflight *m = &ring[head];
+            if(len - 1 != m->len || memcmp(line, m->msg, m->len) != 0) {
+                fprintf(stderr, "error: reply does not match \"%.*s\"\n",
+                        (int)m->len, m->msg);
+            }
+            printf("message: %.*s", (int)len, line);
+            free(m->msg);
+            head = (head + 1) % k;
+            n--;
+            nmsgs++;
+            nread++;
+        }
+        if(err == TCP_EOF) err = ECONNRESET;
+        if(err == EAGAIN) err = 0;
+        if(err != 0 || nread > 0 || (eof && n == 0)) continue;
+
+        struct pollfd pfd;
+        pfd.fd = conn;
+        pfd.events = POLLIN | (wr.buf.len > 0 ? POLLOUT : 0);
+        if(poll(&pfd, 1, -1) == -1 && errno != EINTR) err = errno;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct tcpconnstat cs;
+    if(statfmt != -1 && tcpstatconn(conn, &cs) == 0) {
+        char name[256];
+        snprintf(name, sizeof name, "%s:%s", host, port);
+        tcpstatdumpconn(STDERR_FILENO, statfmt, name, &cs);
+    }
+
+    for(; n > 0; n--, head = (head + 1) % k) free(ring[head].msg);
+    free(ring);
+    tcprdfree(&rd);
+    tcpwrfree(&wr);
+    close(conn);
+
+    double secs = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld messages, %.3f s, %.0f messages/s\n", nmsgs, secs,
+            secs > 0 ? nmsgs / secs : 0);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    int k = 0;
+    char *file = NULL;
+    int statfmt = -1;
+    int opt;
+    while((opt = getopt(argc, argv, "k:f:s:")) != -1) {
+        switch(opt) {
+            case 'k':
+                k = atoi(optarg);
+                break;
+            case 'f':
+                file = optarg;
+                break;
+            case 's':
+                if(strcmp(optarg, "prom") == 0) {
+                    statfmt = TCP_STATPROM;
+                } else if(strcmp(optarg, "json") == 0) {
+                    statfmt = TCP_STATJSON;
+                } else {
+                    fprintf(stderr, "error: unknown format %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-k K] [-f file] [-s fmt] host "
+                        "port message...|-\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if(argc == 4 && strcmp(argv[3], "-") == 0) {
+        file = argv[3];
+        argc--;
+    }
+    if((file == NULL && argc < 4) || (file != NULL && argc != 3) || k < 0) {
+        fprintf(stderr, "Usage: %s [-k K] [-f file] [-s fmt] host port "
+                "message...|-\n", argv[0]);
         return 1;
     }
 
-    /* read a message from socket */
-    char buf[100];
-    int retrecv = recv(conn, buf, 100, MSG_DONTWAIT);
-    if(retrecv == -1) {
+    if(k > 0 || file != NULL || statfmt != -1) {
+        struct msgsrc src;
+        memset(&src, 0, sizeof src);
+        src.argv = argv + 3;
+        src.argc = argc - 3;
+        if(file != NULL) {
+            src.f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+            if(src.f == NULL) {
+                fprintf(stderr, "error: %s: %s\n", file, strerror(errno));
+                return 1;
+            }
+        }
+        int err = pipeline(argv[1], argv[2], &src, k > 0 ? k : 1, statfmt);
+        if(src.f != NULL && src.f != stdin) fclose(src.f);
+        if(statfmt != -1) tcpstatdump(STDERR_FILENO, statfmt);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            return 1;
+        }
+        return 0;
+    }
+
+    struct tcppool *pool;
+    errno = tcppoolnew(&pool, 4, 30000);
+    if(errno != 0) {
         fprintf(stderr, "error: %s\n", strerror(errno));
         return 1;
     }
 
-    printf("message: %s\n", buf);
+    for(int i = 3; i < argc; i++) {
+        int conn;
+        errno = tcppoolget(pool, &conn, argv[1], argv[2], NULL);
+        if(errno != 0) {
+            fprintf(stderr, "error: %s\n", strerror(errno));
+            return 1;
+        }
+
+        struct tcprd rd;
+        struct tcpwr wr;
+        if(tcprdinit(&rd, conn, 0, 0) != 0 || tcpwrinit(&wr, conn, 0) != 0) {
+            fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+            return 1;
+        }
+
+        /* send the message as a single line */
+        struct iovec iov[2];
+        iov[0].iov_base = argv[i];
+        iov[0].iov_len = strlen(argv[i]);
+        iov[1].iov_base = "\n";
+        iov[1].iov_len = 1;
+        int errwrite = tcpwritev(&wr, iov, 2);
+        if(errwrite == 0) errwrite = tcpflush(&wr);
+        if(errwrite != 0) {
+            fprintf(stderr, "error: %s\n", strerror(errwrite));
+            tcppoolput(pool, conn, 1);
+            return 1;
+        }
+
+        /* read the echoed line */
+        char *line;
+        size_t n;
+        int errread = tcpreadline(&rd, &line, &n);
+        if(errread != 0) {
+            fprintf(stderr, "error: %s\n", errread == TCP_EOF ?
+                    "connection closed" : strerror(errread));
+            tcppoolput(pool, conn, 1);
+            return 1;
+        }
+
+        printf("message: %.*s", (int)n, line);
+
+        /* a connection with unread data cannot serve the next request */
+        int broken = rd.buf.len > 0;
+        tcprdfree(&rd);
+        tcpwrfree(&wr);
+        tcppoolput(pool, conn, broken);
+    }
+
+    tcppoolfree(pool);
     return 0;
 }
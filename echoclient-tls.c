@@ -0,0 +1,191 @@
+/* echoclient-tls.c - Send a line to a TLS echo server and read the echo
+ * back, over connections dialed with tcpdialtls. Every connection after the
+ * first resumes the session cached for host:port, and whether the kernel
+ * took over the records of the connection is reported.
+ *
+ * Build:
+ * % make echoclient-tls
+ *
+ * Usage:
+ * % ./echoclient-tls -a cert.pem localhost 8443 hello
+ * % ./echoclient-tls -n 5 -2 -a cert.pem localhost 8443 hello
+ *
+ * Options:
+ * -a ca     trust the PEM certificates in ca, such as the self-signed
+ *           certificate of the server (default: the system ones)
+ * -n count  the number of connections made one after another (default: 1)
+ * -2        use TLS 1.2, whose records the kernel can also decrypt
+ *
+ * The handshake time, whether the session was resumed and the kernel TLS
+ * directions of every connection are printed on stderr.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcp.h"
+#include "tcptls.h"
+
+/* the timeout of every dial and handshake, in milliseconds */
+#define ECHO_DIALMS 5000
+#define ECHO_LINELN 4096
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *ktlsname(int ktls)
+{
+    switch(ktls) {
+        case TCP_KTLSTX | TCP_KTLSRX:
+            return "tx+rx";
+        case TCP_KTLSTX:
+            return "tx";
+        case TCP_KTLSRX:
+            return "rx";
+    }
+    return "none";
+}
+
+/* echo sends msg as a line over tls and reads the echoed line into line. */
+static int echo(struct tcptls *tls, char msg[], char line[], size_t *len)
+{
+    size_t msglen = strlen(msg);
+    char *out = malloc(msglen + 1);
+    if(out == NULL) return ENOMEM;
+    memcpy(out, msg, msglen);
+    out[msglen] = '\n';
+
+    int err = 0;
+    for(size_t off = 0; off < msglen + 1 && err == 0; ) {
+        size_t n;
+        err = tcptlswrite(tls, out + off, msglen + 1 - off, &n);
+        off += n;
+    }
+    free(out);
+
+    *len = 0;
+    while(err == 0 && (*len == 0 || line[*len-1] != '\n')) {
+        size_t n;
+        if(*len == ECHO_LINELN) return EMSGSIZE;
+        err = tcptlsread(tls, line + *len, ECHO_LINELN - *len, &n);
+        if(err == 0 && n == 0) return ECONNRESET;
+        *len += n;
+    }
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    char *ca = NULL;
+    int count = 1;
+    int flags = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "a:n:2")) != -1) {
+        switch(opt) {
+            case 'a':
+                ca = optarg;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case '2':
+                flags |= TCP_TLS12;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a ca] [-n count] [-2] "
+                        "host port message\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if(argc != 4 || count < 1) {
+        fprintf(stderr, "Usage: %s [-a ca] [-n count] [-2] "
+                "host port message\n", argv[0]);
+        return 1;
+    }
+
+    /* OpenSSL writes to the socket without MSG_NOSIGNAL */
+    signal(SIGPIPE, SIG_IGN);
+
+    struct tcptlsctx *ctx;
+    int err = tcptlsctxnew(&ctx, flags, NULL, NULL, ca);
+    if(err != 0) {
+        fprintf(stderr, "error: tls: %s\n", strerror(err));
+        return 1;
+    }
+
+    static char line[ECHO_LINELN];
+    for(int i = 0; i < count; i++) {
+        struct tcptls *tls;
+        struct timespec dl;
+        tcpdeadline(&dl, ECHO_DIALMS);
+        double start = now();
+        err = tcpdialtls(&tls, ctx, argv[1], argv[2], &dl);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            break;
+        }
+        double hs = now() - start;
+
+        size_t len;
+        err = echo(tls, argv[3], line, &len);
+        if(err == 0) {
+            printf("message: %.*s", (int)len, line);
+            fprintf(stderr, "tls: connection %d handshake %.2f ms "
+                    "resumed %s ktls %s\n", i + 1, hs * 1e3,
+                    tcptlsresumed(tls) ? "yes" : "no",
+                    ktlsname(tcptlsktls(tls)));
+        } else {
+            fprintf(stderr, "error: %s\n", strerror(err));
+        }
+        tcptlsclose(tls);
+        if(err != 0) break;
+    }
+
+    tcptlsctxfree(ctx);
+    return err != 0;
+}
@@ -0,0 +1,226 @@
+/* echoclient-udp.c - Send datagrams to a UDP echo server and read the
+ * echoes back. Many copies of the message are sent in batches of
+ * sendmmsg(2), or with -g as runs of datagrams the kernel segments (GSO).
+ *
+ * Build:
+ * % make echoclient-udp
+ *
+ * Usage:
+ * % ./echoclient-udp localhost 8080 hello
+ * % ./echoclient-udp -n 100000 -g localhost 8080 hello
+ * % ./echoclient-udp -n 100000 -w 64 localhost 8080 "$(seq -s, 300)"
+ *
+ * Options:
+ * -n count  send count copies of the message and count the echoes
+ *           (default: 1, the echo is printed)
+ * -g        send with GSO where the kernel supports it
+ * -w window  the most datagrams sent but not echoed yet (default: 256);
+ *           beyond the socket buffers they would be dropped
+ *
+ * The number of echoes and the time they took are printed on stderr. An
+ * echo that does not arrive within a second is counted as lost.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "udp.h"
+
+/* how long to wait for the next echo, in milliseconds */
+#define ECHO_WAITMS 1000
+#define ECHO_WINDOW 256
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* echocheck returns the number of echoes of msg in the received message m,
+ * or -1 if one of them differs. */
+static int echocheck(struct udpmsg *m, char msg[], size_t msglen)
+{
+    size_t seg = m->seg != 0 ? m->seg : m->len;
+    int n = 0;
+    for(size_t off = 0; off < m->len; off += seg, n++) {
+        size_t len = m->len - off < seg ? m->len - off : seg;
+        if(len != msglen || memcmp((char *)m->buf + off, msg, len) != 0) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 1;
+    int gso = 0;
+    int window = ECHO_WINDOW;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:gw:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'g':
+                gso = 1;
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-g] [-w window] "
+                        "host port message\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if(argc != 4 || count < 1 || window < 1) {
+        fprintf(stderr, "Usage: %s [-n count] [-g] [-w window] host port "
+                "message\n", argv[0]);
+        return 1;
+    }
+    char *msg = argv[3];
+    size_t msglen = strlen(msg);
+    if(msglen == 0 || msglen > UDP_MAXLN) {
+        fprintf(stderr, "error: %s\n", strerror(EMSGSIZE));
+        return 1;
+    }
+
+    int sock;
+    int err = udpdial(&sock, argv[1], argv[2], UDP_NONBLOCK | UDP_COALESCE);
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        return 1;
+    }
+
+    /* a GSO run repeats the message up to UDP_GSOSEGS times */
+    int segs = 1;
+    if(gso && udpgso(sock)) {
+        segs = UDP_MAXLN / msglen;
+        if(segs > UDP_GSOSEGS) segs = UDP_GSOSEGS;
+        if(segs > window) segs = window;
+    }
+    char *out = malloc(segs * msglen);
+    char *in = malloc((size_t)UDP_BATCH * UDP_MAXLN);
+    if(out == NULL || in == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    for(int i = 0; i < segs; i++) memcpy(out + i * msglen, msg, msglen);
+
+    struct udpmsg sendq[UDP_BATCH], recvq[UDP_BATCH];
+    int sent = 0, echoed = 0;
+    double start = now(), last = start;
+    while(echoed < count) {
+        /* queue the next batch while the socket buffer takes it */
+        int n = 0;
+        int left = count - sent;
+        if(left > window - (sent - echoed)) left = window - (sent - echoed);
+        for(; n < UDP_BATCH && left > 0; n++) {
+            int k = left < segs ? left : segs;
+            sendq[n].buf = out;
+            sendq[n].len = k * msglen;
+            sendq[n].seg = k > 1 ? msglen : 0;
+            sendq[n].addr.len = 0;
+            left -= k;
+        }
+        int full = 0;
+        if(n > 0) {
+            int nsent;
+            err = udpsend(sock, sendq, n, &nsent);
+            if(err != 0 && err != EAGAIN) break;
+            full = err == EAGAIN;
+            for(int i = 0; err == 0 && i < nsent; i++) {
+                sent += sendq[i].seg != 0 ? sendq[i].len / msglen : 1;
+            }
+        }
+
+        int nrecv = 0;
+        for(int i = 0; i < UDP_BATCH; i++) {
+            recvq[i].buf = in + (size_t)i * UDP_MAXLN;
+            recvq[i].len = UDP_MAXLN;
+        }
+        err = udprecv(sock, recvq, UDP_BATCH, &nrecv);
+        if(err != 0 && err != EAGAIN) break;
+        for(int i = 0; i < nrecv; i++) {
+            int k = echocheck(&recvq[i], msg, msglen);
+            if(k < 0) {
+                fprintf(stderr, "error: unexpected echo\n");
+                return 1;
+            }
+            echoed += k;
+            last = now();
+            if(count == 1) {
+                printf("message: %.*s\n", (int)recvq[i].len,
+                        (char *)recvq[i].buf);
+            }
+        }
+
+        /* wait for the echoes still on their way, or for room to send */
+        if(err == EAGAIN && (sent - echoed >= window || sent == count ||
+                    full)) {
+            struct pollfd pfd = { sock, POLLIN, 0 };
+            if(sent < count) pfd.events |= POLLOUT;
+            if(poll(&pfd, 1, ECHO_WAITMS) == 0) {
+                err = 0;
+                break;
+            }
+        }
+        err = 0;
+    }
+    double elapsed = last - start;
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        return 1;
+    }
+
+    fprintf(stderr, "echoed %d/%d datagrams in %.2f ms (%.0f datagrams/s, "
+            "gso %s)\n", echoed, count, elapsed * 1e3, echoed / elapsed,
+            segs > 1 ? "on" : "off");
+    free(out);
+    free(in);
+    close(sock);
+    return echoed != count;
+}
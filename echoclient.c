@@ -1,4 +1,6 @@
 /* echoclient.c - Connect, write and read reply data from echo server.
+ * The message is sent as a line and the reply is read through the buffered
+ * reader of tcpbuf.o.
  *
  * Build:
  * % make echoclient
@@ -46,6 +48,9 @@
 #include <string.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/uio.h>
+
+#include "tcpbuf.h"
 
 int main(int argc, char **argv)
 {
@@ -100,21 +105,36 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    /* send message to a socket */
-    int retsend = send(sockfd, argv[3], strlen(argv[3]), MSG_DONTWAIT);
-    if(retsend == -1) {
-        fprintf(stderr, "error: %s\n", strerror(errno));
+    /* send the message as a single line; tcpwritev sends both parts with
+     * one system call and retries short writes */
+    struct tcprd rd;
+    struct tcpwr wr;
+    if(tcprdinit(&rd, sockfd, 0, 0) != 0 || tcpwrinit(&wr, sockfd, 0) != 0) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = argv[3];
+    iov[0].iov_len = strlen(argv[3]);
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    int errwrite = tcpwritev(&wr, iov, 2);
+    if(errwrite == 0) errwrite = tcpflush(&wr);
+    if(errwrite != 0) {
+        fprintf(stderr, "error: %s\n", strerror(errwrite));
         return 1;
     }
 
-    /* read a message from socket */
-    char buf[100];
-    int retrecv = recv(sockfd, buf, 100, MSG_DONTWAIT);
-    if(retrecv == -1) {
-        fprintf(stderr, "error: %s\n", strerror(errno));
+    /* read the echoed line, however many segments it arrives in */
+    char *line;
+    size_t n;
+    int errread = tcpreadline(&rd, &line, &n);
+    if(errread != 0) {
+        fprintf(stderr, "error: %s\n", errread == TCP_EOF ?
+                "connection closed" : strerror(errread));
         return 1;
     }
 
-    printf("message: %s\n", buf);
+    printf("message: %.*s", (int)n, line);
     return 0;
 }
@@ -0,0 +1,277 @@
+/* echoserver-fd.c - A TCP echo server split into processes. The front
+ * process accepts every connection and passes it with tcpsendfd over a
+ * Unix domain socket pair to one of its worker processes, in turn. A
+ * worker serves the connections it receives through its own event loop
+ * and never sees the listener, so it may run with fewer privileges, and a
+ * crashed worker only loses its own connections.
+ *
+ * Build:
+ * % make echoserver-fd
+ *
+ * Usage:
+ * % ./echoserver-fd 8080
+ * % ./echoserver-fd -p 4 localhost 8080
+ * % ./echoserver-fd unix:/tmp/echo.sock 0
+ *
+ * Options:
+ * -p workers  number of worker processes (default: one per CPU)
+ *
+ * The host may be a Unix domain socket address, unix:/path or unix:@name;
+ * the port is then ignored.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "tcp.h"
+#include "tcploop.h"
+#include "tcpsaddr.h"
+
+#define ECHO_BUFLN 4096
+
+struct echoconn {
+    struct tcpev ev;
+    size_t off;
+    size_t len;
+    char buf[ECHO_BUFLN];
+};
+
+static volatile sig_atomic_t stop;
+
+static void echoclose(struct echoconn *c)
+{
+    close(c->ev.fd);
+    free(c);
+}
+
+/* echoconn echoes until the socket would block, like the copy mode of
+ * echoserver. */
+static void echoconn(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+    for(;;) {
+        if(c->off < c->len) {
+            ssize_t n = send(c->ev.fd, c->buf + c->off, c->len - c->off,
+                    MSG_NOSIGNAL);
+            if(n == -1 && errno == EINTR) continue;
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if(n == -1) {
+                echoclose(c);
+                return;
+            }
+            c->off += n;
+            continue;
+        }
+        ssize_t n = recv(c->ev.fd, c->buf, sizeof c->buf, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if(n <= 0) {
+            echoclose(c);
+            return;
+        }
+        c->off = 0;
+        c->len = n;
+    }
+}
+
+/* echoctl receives the connections the front process passes to this
+ * worker. The worker stops when the front closes its end. */
+static void echoctl(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    for(;;) {
+        int conn;
+        int err = tcprecvfd(ev->fd, &conn);
+        if(err == EAGAIN) return;
+        if(err == EBADMSG) continue;
+        if(err != 0) {
+            tcploopstop(loop);
+            return;
+        }
+
+        struct echoconn *c = malloc(sizeof *c);
+        if(c == NULL) {
+            close(conn);
+            continue;
+        }
+        fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+        c->ev.fd = conn;
+        c->ev.fn = echoconn;
+        c->off = 0;
+        c->len = 0;
+        int erradd = tcploopadd(loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+        if(erradd != 0) {
+            fprintf(stderr, "error: loop: %s\n", strerror(erradd));
+            echoclose(c);
+        }
+    }
+}
+
+/* echoworker runs the event loop of a worker process. Connections that are
+ * still open when it stops are closed by the exit. */
+static int echoworker(int ctl)
+{
+    struct tcploop *loop;
+    int err = tcploopnew(&loop);
+    if(err != 0) {
+        fprintf(stderr, "error: loop: %s\n", strerror(err));
+        return 1;
+    }
+    fcntl(ctl, F_SETFL, fcntl(ctl, F_GETFL) | O_NONBLOCK);
+    struct tcpev ev = { ctl, echoctl };
+    err = tcploopadd(loop, &ev, TCP_EVIN);
+    if(err == 0) err = tcplooprun(loop);
+    tcploopfree(loop);
+    if(err != 0) {
+        fprintf(stderr, "error: worker: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+static void echostop(int sig)
+{
+    stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    long nworkers = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "p:")) != -1) {
+        switch(opt) {
+            case 'p':
+                nworkers = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p workers] [host] port\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if((argc != 2 && argc != 3) || nworkers < 0) {
+        fprintf(stderr, "Usage: %s [-p workers] [host] port\n", argv[0]);
+        return 1;
+    }
+    char *host = argc == 3 ? argv[1] : NULL;
+    char *port = argv[argc-1];
+    if(nworkers == 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nworkers < 1) nworkers = 1;
+
+    int ln;
+    int err = tcplisten(&ln, host, port, 0);
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        return 1;
+    }
+
+    int *ctls = calloc(nworkers, sizeof *ctls);
+    pid_t *pids = calloc(nworkers, sizeof *pids);
+    if(ctls == NULL || pids == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    for(long i = 0; i < nworkers; i++) {
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+            perror("socketpair");
+            return 1;
+        }
+        pids[i] = fork();
+        if(pids[i] == -1) {
+            perror("fork");
+            return 1;
+        }
+        if(pids[i] == 0) {
+            /* the worker keeps nothing of the front but its own end */
+            close(ln);
+            for(long j = 0; j < i; j++) close(ctls[j]);
+            close(sv[0]);
+            free(ctls);
+            free(pids);
+            return echoworker(sv[1]);
+        }
+        close(sv[1]);
+        ctls[i] = sv[0];
+    }
+
+    /* no SA_RESTART: a signal interrupts accept(2) */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = echostop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("echoserver-fd: listening on port :%s with %ld workers\n", port,
+            nworkers);
+    fflush(stdout);
+    long next = 0;
+    while(!stop) {
+        int conn;
+        err = tcpaccept(&conn, ln, 0);
+        if(err == EINTR || err == ECONNABORTED) continue;
+        if(err != 0) {
+            fprintf(stderr, "error: accept: %s\n", strerror(err));
+            break;
+        }
+        err = tcpsendfd(ctls[next], conn);
+        close(conn);
+        if(err != 0) {
+            fprintf(stderr, "error: worker %ld: %s\n", next, strerror(err));
+            break;
+        }
+        next = (next + 1) % nworkers;
+    }
+
+    close(ln);
+    if(tcpsunix(NULL, NULL, host) > 0 && host[sizeof TCP_UNIXPFX - 1] != '@') {
+        unlink(host + sizeof TCP_UNIXPFX - 1);
+    }
+    for(long i = 0; i < nworkers; i++) close(ctls[i]);
+    for(long i = 0; i < nworkers; i++) waitpid(pids[i], NULL, 0);
+    free(ctls);
+    free(pids);
+    return err != 0 && !stop;
+}
@@ -0,0 +1,320 @@
+/* echoserver-io.c - A TCP echo server built on the tcpio engine. Every
+ * worker thread has its own SO_REUSEPORT listener and its own engine. With
+ * io_uring a worker accepts with one multishot accept, receives into the
+ * kernel's provided buffers and submits its sends in linked chains, so a
+ * busy worker makes one io_uring_enter(2) per batch of completions instead
+ * of one system call per operation.
+ *
+ * Build:
+ * % make echoserver-io
+ *
+ * Usage:
+ * % ./echoserver-io 8080
+ * % ./echoserver-io -t 4 -e epoll localhost 8080
+ *
+ * Options:
+ * -t workers  number of worker threads (default: one per CPU)
+ * -e engine   auto, uring or epoll (default: auto, io_uring when the kernel
+ *             supports it)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "tcp.h"
+#include "tcpio.h"
+
+struct echoworker {
+    pthread_t thread;
+    struct tcpio *io;
+    char *host;
+    char *port;
+    int engine;
+    int err;
+    int ln;
+    /* set when accepting stopped for want of descriptors; a closed
+     * connection starts it again */
+    int paused;
+};
+
+static pthread_barrier_t ready;
+
+/* echoconn counts the sends the engine still holds, so the connection is
+ * only released once every copy was sent or failed. */
+struct echoconn {
+    struct echoworker *w;
+    int pending;
+    int eof;
+    int closed;
+};
+
+static void echoput(struct echoconn *c)
+{
+    if(c->closed && c->pending == 0) free(c);
+}
+
+static void echoaccept(struct tcpio *io, int ln, ssize_t res, char *buf,
+        void *arg);
+
+/* echoclose closes the connection. The engine fails the pending sends
+ * from within tcpioclose, so c is held until it returns. */
+static void echoclose(struct tcpio *io, int fd, struct echoconn *c)
+{
+    struct echoworker *w = c->w;
+    c->closed = 1;
+    c->pending++;
+    tcpioclose(io, fd);
+    c->pending--;
+    echoput(c);
+    if(w->paused) {
+        w->paused = 0;
+        tcpioaccept(io, w->ln, echoaccept, w);
+    }
+}
+
+static void echosent(struct tcpio *io, int fd, ssize_t res, char *buf,
+        void *arg)
+{
+    struct echoconn *c = arg;
+    free(buf);
+    c->pending--;
+    if(!c->closed && (res < 0 || (c->eof && c->pending == 0))) {
+        echoclose(io, fd, c);
+        return;
+    }
+    echoput(c);
+}
+
+/* echorecv sends a copy of every chunk back; the chunk itself belongs to
+ * the engine. On EOF the connection is closed once the echo is out. */
+static void echorecv(struct tcpio *io, int fd, ssize_t res, char *buf,
+        void *arg)
+{
+    struct echoconn *c = arg;
+    if(res < 0 || (res == 0 && c->pending == 0)) {
+        echoclose(io, fd, c);
+        return;
+    }
+    if(res == 0) {
+        c->eof = 1;
+        return;
+    }
+
+    char *out = malloc(res);
+    if(out == NULL) {
+        echoclose(io, fd, c);
+        return;
+    }
+    memcpy(out, buf, res);
+    /* counted first, the epoll engine may call echosent right away */
+    c->pending++;
+    if(tcpiosend(io, fd, out, res, echosent, c) != 0) {
+        c->pending--;
+        free(out);
+        echoclose(io, fd, c);
+    }
+}
+
+static void echoaccept(struct tcpio *io, int ln, ssize_t res, char *buf,
+        void *arg)
+{
+    struct echoworker *w = arg;
+    if(res < 0) {
+        fprintf(stderr, "error: accept: %s\n", strerror(-res));
+        /* out of descriptors even for the engine's spare one: accepting
+         * again at once would fail at once, wait until a connection
+         * closes */
+        if(res == -EMFILE || res == -ENFILE) {
+            w->paused = 1;
+        } else {
+            tcpioaccept(io, ln, echoaccept, w);
+        }
+        return;
+    }
+    /* the connections of both engines: an echo longer than TCP_IOBUFLN
+     * is sent in pieces, and Nagle would hold the last one back until the
+     * client's delayed ACK */
+    int one = 1;
+    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    struct echoconn *c = calloc(1, sizeof *c);
+    if(c == NULL) {
+        close(res);
+        return;
+    }
+    c->w = w;
+    if(tcpiorecv(io, res, echorecv, c) != 0) echoclose(io, res, c);
+}
+
+/* echowork creates the engine in the worker thread, since an io_uring
+ * engine is bound to the thread that created it. The engine is released by
+ * the main thread once the worker has exited. */
+static void *echowork(void *arg)
+{
+    struct echoworker *w = arg;
+    int ln = -1;
+
+    w->err = tcpionew(&w->io, w->engine);
+    if(w->err == 0) {
+        w->err = tcplisten(&ln, w->host, w->port,
+                TCP_NONBLOCK | TCP_REUSEPORT);
+    }
+    w->ln = ln;
+    if(w->err == 0) w->err = tcpioaccept(w->io, ln, echoaccept, w);
+    if(w->err != 0) {
+        if(ln != -1) close(ln);
+        if(w->io != NULL) tcpiofree(w->io);
+        w->io = NULL;
+    }
+    pthread_barrier_wait(&ready);
+    if(w->io == NULL) return NULL;
+
+    w->err = tcpiorun(w->io);
+    tcpioclose(w->io, ln);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int nworkers = 0;
+    int engine = TCP_IOAUTO;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:e:")) != -1) {
+        switch(opt) {
+            case 't':
+                nworkers = atoi(optarg);
+                break;
+            case 'e':
+                if(strcmp(optarg, "auto") == 0) {
+                    engine = TCP_IOAUTO;
+                } else if(strcmp(optarg, "uring") == 0) {
+                    engine = TCP_IOURING;
+                } else if(strcmp(optarg, "epoll") == 0) {
+                    engine = TCP_IOEPOLL;
+                } else {
+                    fprintf(stderr, "error: unknown engine %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t workers] [-e engine] "
+                        "[host] port\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if(argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s [-t workers] [-e engine] [host] port\n",
+                argv[0]);
+        return 1;
+    }
+    if(nworkers <= 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nworkers <= 0) nworkers = 1;
+
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct echoworker *workers = calloc(nworkers, sizeof *workers);
+    if(workers == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    /* the workers inherit this mask; only the main thread takes the
+     * signals, with sigwait */
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    pthread_barrier_init(&ready, NULL, nworkers + 1);
+    for(int i = 0; i < nworkers; i++) {
+        workers[i].host = argc == 3 ? argv[1] : NULL;
+        workers[i].port = argv[argc-1];
+        workers[i].engine = engine;
+        int err = pthread_create(&workers[i].thread, NULL, echowork,
+                &workers[i]);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&ready);
+
+    int failed = 0;
+    for(int i = 0; i < nworkers; i++) {
+        if(workers[i].err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(workers[i].err));
+            failed = 1;
+            break;
+        }
+    }
+    if(!failed) {
+        printf("echoserver-io: listening on port :%s with %d workers (%s)\n",
+                argv[argc-1], nworkers,
+                tcpioengine(workers[0].io) == TCP_IOURING ?
+                "io_uring" : "epoll");
+        fflush(stdout);
+        int sig;
+        sigwait(&sigs, &sig);
+    }
+
+    for(int i = 0; i < nworkers; i++) {
+        if(workers[i].io != NULL) tcpiostop(workers[i].io);
+    }
+    for(int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if(workers[i].io != NULL) tcpiofree(workers[i].io);
+        if(workers[i].err != 0) failed = 1;
+    }
+    free(workers);
+    return failed;
+}
@@ -0,0 +1,194 @@
+/* echoserver-udp.c - A UDP echo server built on the udp module. Every
+ * worker thread has its own SO_REUSEPORT socket and moves a batch of
+ * datagrams with one recvmmsg(2) and one sendmmsg(2). With GRO a run of
+ * datagrams of the same flow arrives as one buffer, which is echoed as is
+ * with GSO, so the kernel splits it again into the same datagrams.
+ *
+ * Build:
+ * % make echoserver-udp
+ *
+ * Usage:
+ * % ./echoserver-udp 8080
+ * % ./echoserver-udp -t 4 -b 1 -G localhost 8080
+ *
+ * Options:
+ * -t workers  number of worker threads (default: 1)
+ * -b batch    datagrams moved per system call, at most 64 (default: 64)
+ * -G          do not use GRO and GSO
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "udp.h"
+
+struct echoworker {
+    pthread_t thread;
+    int sock;
+    int err;
+};
+
+static int batch = UDP_BATCH;
+static int stop;
+
+/* echowork echoes every datagram back to its source until the socket is
+ * shut down. A datagram that cannot be sent is dropped, as the network
+ * would. */
+static void *echowork(void *arg)
+{
+    struct echoworker *w = arg;
+    struct udpmsg msgs[UDP_BATCH];
+    char *bufs = malloc((size_t)batch * UDP_MAXLN);
+    if(bufs == NULL) {
+        w->err = ENOMEM;
+        return NULL;
+    }
+
+    for(;;) {
+        for(int i = 0; i < batch; i++) {
+            msgs[i].buf = bufs + (size_t)i * UDP_MAXLN;
+            msgs[i].len = UDP_MAXLN;
+        }
+        int n;
+        int err = udprecv(w->sock, msgs, batch, &n);
+        if(__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) break;
+        if(err != 0) {
+            w->err = err;
+            break;
+        }
+
+        for(int off = 0; off < n; ) {
+            int sent;
+            err = udpsend(w->sock, msgs + off, n - off, &sent);
+            off += err != 0 ? 1 : sent;
+        }
+    }
+    free(bufs);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int nworkers = 1;
+    int flags = UDP_REUSEPORT | UDP_COALESCE;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:b:G")) != -1) {
+        switch(opt) {
+            case 't':
+                nworkers = atoi(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'G':
+                flags &= ~UDP_COALESCE;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t workers] [-b batch] [-G] "
+                        "[host] port\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if((argc != 2 && argc != 3) || nworkers < 1 || batch < 1 ||
+            batch > UDP_BATCH) {
+        fprintf(stderr, "Usage: %s [-t workers] [-b batch] [-G] "
+                "[host] port\n", argv[0]);
+        return 1;
+    }
+
+    struct echoworker *workers = calloc(nworkers, sizeof *workers);
+    if(workers == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    for(int i = 0; i < nworkers; i++) {
+        int err = udplisten(&workers[i].sock, argc == 3 ? argv[1] : NULL,
+                argv[argc-1], flags);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            return 1;
+        }
+    }
+
+    /* the workers inherit the blocked signals, only main receives them */
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    for(int i = 0; i < nworkers; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, echowork,
+                &workers[i]);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            return 1;
+        }
+    }
+    printf("echoserver-udp: listening on port :%s with %d workers "
+            "(batch %d, gro %s, gso %s)\n", argv[argc-1], nworkers, batch,
+            udpgro(workers[0].sock) ? "on" : "off",
+            (flags & UDP_COALESCE) && udpgso(workers[0].sock) ?
+            "on" : "off");
+    fflush(stdout);
+    int sig;
+    sigwait(&sigs, &sig);
+
+    /* shutting a UDP socket down wakes up the worker blocked on it */
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for(int i = 0; i < nworkers; i++) shutdown(workers[i].sock, SHUT_RDWR);
+    int failed = 0;
+    for(int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].sock);
+        if(workers[i].err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(workers[i].err));
+            failed = 1;
+        }
+    }
+    free(workers);
+    return failed;
+}
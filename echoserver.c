@@ -0,0 +1,792 @@
+/* echoserver.c - A TCP echo server built on the tcp module. The server runs
+ * one worker thread per CPU. Every worker has its own SO_REUSEPORT listener
+ * and serves its connections through an edge-triggered event loop.
+ *
+ * Every worker allocates its connections from its own slab and borrows the
+ * echo buffer from its own pool only while data is in flight, so an idle
+ * connection costs a slab object and the kernel socket, not a buffer.
+ *
+ * Idle connections, and slowloris clients that keep a connection open by
+ * trickling a line or by never reading their echo, are dropped on time by
+ * the deadlines of the timer wheel of the worker loop.
+ *
+ * With a certificate the server speaks TLS. After the handshake the kernel
+ * takes over the records where it can; a connection it encrypts and
+ * decrypts is echoed by the plain copy or splice path, the others through
+ * OpenSSL.
+ *
+ * With an access list, connections from denied addresses are reset as
+ * they are accepted. SIGHUP reloads the list in the background; accepts
+ * go on against the old list until the new one is swapped in.
+ *
+ * SIGUSR2 restarts the server without refusing a connection: the program
+ * is started again from its path, takes over the listening sockets, and
+ * once it accepts, this process stops accepting, finishes its connections
+ * within the drain deadline and exits. A new binary can so be deployed
+ * under load.
+ *
+ * Build:
+ * % make echoserver
+ *
+ * Usage:
+ * % ./echoserver 8080
+ * % ./echoserver -t 4 localhost 8080
+ * % ./echoserver -m splice 8080
+ * % ./echoserver -i 60000 -r 5000 -w 5000 8080
+ * % ./echoserver -c cert.pem -k key.pem 8443
+ * % ./echoserver unix:/tmp/echo.sock 0
+ * % ./echoserver -g 10000 8080 & kill -USR2 $!
+ * % ./echoserver -a deny.acl 8080 & kill -HUP $!
+ *
+ * Options:
+ * -t workers  number of worker threads (default: one per CPU)
+ * -m mode     how data is echoed back (default: copy)
+ *             copy      recv(2) into a buffer and send(2) it back
+ *             splice    move the data socket to pipe to socket with
+ *                       splice(2), it never enters user space
+ *             zerocopy  recv(2) into a large buffer and send it back with
+ *                       MSG_ZEROCOPY
+ * -i ms       close connections that neither sent nor received anything for
+ *             ms milliseconds (default: never)
+ * -r ms       close connections that take more than ms milliseconds to send
+ *             a line, from its first byte to its newline, or to complete
+ *             the TLS handshake (copy and zerocopy modes only, default:
+ *             never)
+ * -w ms       close connections whose echo could not be sent for ms
+ *             milliseconds because they do not read (copy and zerocopy
+ *             modes only, default: never)
+ * -c cert     serve TLS with the PEM certificate chain cert
+ * -k key      the PEM private key of the certificate
+ * -g ms       after a restart, wait at most ms milliseconds for the
+ *             connections of the old process to finish (default: 30000)
+ * -a file     reset connections from the addresses file denies, one
+ *             "[allow|deny] prefix[/len]" per line; the longest matching
+ *             prefix wins and unmatched addresses are allowed
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "tcp.h"
+#include "tcpsaddr.h"
+#include "tcploop.h"
+#include "tcpsrv.h"
+#include "tcpzc.h"
+#include "tcpmem.h"
+#include "tcptimer.h"
+#include "tcptls.h"
+#include "tcpacl.h"
+
+/* the size of the per-connection echo buffer */
+#define ECHO_BUFLN 4096
+/* zerocopy sends pin the buffer, so it pays to send as much as possible at
+ * once */
+#define ECHO_ZCBUFLN 65536
+/* the number of free echo buffers every worker keeps for reuse */
+#define ECHO_KEEPBUFS 64
+/* how long a restarted server may take to accept */
+#define ECHO_READYMS 10000
+
+enum { ECHO_COPY, ECHO_SPLICE, ECHO_ZEROCOPY };
+
+struct echoconn {
+    struct tcpev ev;
+    /* the connection table of the worker */
+    struct echoconn *prev;
+    struct echoconn *next;
+    struct echoshard *sh;
+    size_t off;
+    size_t len;
+    struct tcppipe pipe;
+    struct tcpzc zc;
+    /* buflen bytes borrowed from the pool of the worker, or NULL */
+    char *buf;
+    /* the idle timer is only moved when it expires, it compares the time
+     * of the last transfer with the idle timeout */
+    uint64_t active;
+    struct tcptimer idle;
+    struct tcptimer rd;
+    struct tcptimer wr;
+    /* the TLS state, or NULL for a plain connection */
+    struct tcptls *tls;
+};
+
+/* echoshard is the per-worker state; it is only touched by its worker */
+struct echoshard {
+    struct echoconn conns;
+    size_t nconns;
+    struct tcpslab slab;
+    struct tcpbpool bufs;
+    struct tcpwheel *wheel;
+};
+
+static struct tcpsrv *srv;
+static int mode = ECHO_COPY;
+static size_t buflen = ECHO_BUFLN;
+/* the idle timeout and the read and write deadlines, 0 when disabled */
+static int idlems;
+static int rdms;
+static int wrms;
+static struct tcptlsctx *tlsctx;
+/* the command line, to restart with */
+static char **args;
+static int drainms = 30000;
+/* the access list and the file it is reloaded from on SIGHUP */
+static struct tcpacl *acl;
+static char *aclpath;
+/* the connections of every worker, for the drain after a restart */
+static long nlive;
+static int handedoff;
+static int done;
+
+/* echobuf borrows the echo buffer of c unless it already has it. */
+static int echobuf(struct echoconn *c)
+{
+    if(c->buf == NULL) c->buf = tcpbpoolget(&c->sh->bufs);
+    return c->buf != NULL ? 0 : ENOMEM;
+}
+
+/* echoidle gives the echo buffer of c back once nothing is left in it. */
+static void echoidle(struct echoconn *c)
+{
+    if(c->buf == NULL) return;
+    tcpbpoolput(&c->sh->bufs, c->buf);
+    c->buf = NULL;
+}
+
+static void echoclose(struct echoconn *c)
+{
+    tcptimercancel(c->sh->wheel, &c->idle);
+    tcptimercancel(c->sh->wheel, &c->rd);
+    tcptimercancel(c->sh->wheel, &c->wr);
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    c->sh->nconns--;
+    __atomic_sub_fetch(&nlive, 1, __ATOMIC_RELAXED);
+    if(mode == ECHO_SPLICE) tcppipefree(&c->pipe);
+    if(c->tls != NULL) {
+        tcptlsclose(c->tls);
+    } else {
+        close(c->ev.fd);
+    }
+    echoidle(c);
+    tcpslabfree(&c->sh->slab, c);
+}
+
+/* echoidleexpired closes the connection if nothing was transferred for
+ * idlems, or waits for the rest of the timeout otherwise. */
+static void echoidleexpired(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct echoconn *c = (struct echoconn *)
+        ((char *)t - offsetof(struct echoconn, idle));
+    uint64_t quiet = tcpwheelnow(w) - c->active;
+    if(quiet < (uint64_t)idlems) {
+        tcptimerarm(w, t, idlems - quiet);
+        return;
+    }
+    echoclose(c);
+}
+
+static void echordexpired(struct tcpwheel *w, struct tcptimer *t)
+{
+    echoclose((struct echoconn *)((char *)t - offsetof(struct echoconn, rd)));
+}
+
+static void echowrexpired(struct tcpwheel *w, struct tcptimer *t)
+{
+    echoclose((struct echoconn *)((char *)t - offsetof(struct echoconn, wr)));
+}
+
+/* echoread notes that n bytes were received into the buffer. The read
+ * deadline runs from the first byte of a line to its newline, so a client
+ * cannot hold the connection by sending a line one byte at a time. */
+static void echoread(struct echoconn *c, size_t n)
+{
+    c->active = tcpwheelnow(c->sh->wheel);
+    if(rdms == 0) return;
+    if(c->buf[n-1] == '\n') {
+        tcptimercancel(c->sh->wheel, &c->rd);
+    } else if(!tcptimerarmed(&c->rd) || memchr(c->buf, '\n', n) != NULL) {
+        /* a new line was started */
+        tcptimerarm(c->sh->wheel, &c->rd, rdms);
+    }
+}
+
+/* echoblocked starts the write deadline when the echo of c cannot be sent
+ * because the client does not read it. */
+static void echoblocked(struct echoconn *c)
+{
+    if(wrms != 0 && !tcptimerarmed(&c->wr)) {
+        tcptimerarm(c->sh->wheel, &c->wr, wrms);
+    }
+}
+
+/* echoconn reads from the connection and writes the data back until either
+ * side would block. Unsent data is kept in the buffer and flushed on the
+ * next writable event; reading is suspended until then. Once everything was
+ * written and the connection has nothing more to read, the buffer goes back
+ * to the pool. */
+static void echoconn(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+
+    if(events & TCP_EVERR) {
+        echoclose(c);
+        return;
+    }
+
+    for(;;) {
+        if(c->off < c->len) {
+            ssize_t n = send(c->ev.fd, c->buf + c->off, c->len - c->off,
+                    MSG_NOSIGNAL);
+            if(n == -1) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    echoblocked(c);
+                    return;
+                }
+                if(errno == EINTR) continue;
+                echoclose(c);
+                return;
+            }
+            c->off += n;
+            c->active = tcpwheelnow(c->sh->wheel);
+            continue;
+        }
+
+        /* everything was sent */
+        tcptimercancel(c->sh->wheel, &c->wr);
+        if(echobuf(c) != 0) {
+            echoclose(c);
+            return;
+        }
+        ssize_t n = recv(c->ev.fd, c->buf, buflen, 0);
+        if(n == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                echoidle(c);
+                return;
+            }
+            if(errno == EINTR) continue;
+            echoclose(c);
+            return;
+        }
+        if(n == 0) {
+            echoclose(c);
+            return;
+        }
+        echoread(c, n);
+        c->off = 0;
+        c->len = n;
+    }
+}
+
+/* echosplice echoes the connection through its pipe. tcpsplice keeps the
+ * bytes the socket cannot take yet in the pipe. */
+static void echosplice(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+
+    if(events & TCP_EVERR) {
+        echoclose(c);
+        return;
+    }
+
+    size_t n;
+    int err = tcpsplice(c->ev.fd, c->ev.fd, &c->pipe, &n);
+    if(n > 0) c->active = tcpwheelnow(c->sh->wheel);
+    if(err == EAGAIN) return;
+    /* EOF or an error */
+    echoclose(c);
+}
+
+/* echozc works like echoconn but sends with MSG_ZEROCOPY. The buffer is
+ * only reused or given back once the kernel has released it; completions
+ * arrive on the error queue, which the loop reports as TCP_EVERR. Real
+ * errors surface from tcpzcreap, recv(2) or send(2). */
+static void echozc(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+
+    if((events & TCP_EVERR) && tcpzcreap(&c->zc, c->ev.fd) != 0) {
+        echoclose(c);
+        return;
+    }
+
+    for(;;) {
+        if(c->off < c->len) {
+            size_t n;
+            int err = tcpzcsend(&c->zc, c->ev.fd, c->buf + c->off,
+                    c->len - c->off, &n);
+            if(err == EAGAIN) {
+                echoblocked(c);
+                return;
+            }
+            if(err != 0) {
+                echoclose(c);
+                return;
+            }
+            c->off += n;
+            c->active = tcpwheelnow(c->sh->wheel);
+            continue;
+        }
+
+        if(tcpzcbusy(&c->zc)) {
+            if(tcpzcreap(&c->zc, c->ev.fd) != 0) {
+                echoclose(c);
+                return;
+            }
+            /* the next completion wakes us up again */
+            if(tcpzcbusy(&c->zc)) return;
+        }
+
+        /* everything was sent */
+        tcptimercancel(c->sh->wheel, &c->wr);
+        if(echobuf(c) != 0) {
+            echoclose(c);
+            return;
+        }
+        ssize_t n = recv(c->ev.fd, c->buf, buflen, 0);
+        if(n == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                echoidle(c);
+                return;
+            }
+            if(errno == EINTR) continue;
+            echoclose(c);
+            return;
+        }
+        if(n == 0) {
+            echoclose(c);
+            return;
+        }
+        echoread(c, n);
+        c->off = 0;
+        c->len = n;
+    }
+}
+
+/* echotls works like echoconn for a TLS connection whose records are not
+ * all handled by the kernel. OpenSSL keeps no buffers while the connection
+ * is idle, like the echo buffer. */
+static void echotls(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+
+    if(events & TCP_EVERR) {
+        echoclose(c);
+        return;
+    }
+
+    for(;;) {
+        size_t n;
+        if(c->off < c->len) {
+            int err = tcptlswrite(c->tls, c->buf + c->off, c->len - c->off,
+                    &n);
+            if(err == EAGAIN) {
+                echoblocked(c);
+                return;
+            }
+            if(err != 0) {
+                echoclose(c);
+                return;
+            }
+            c->off += n;
+            c->active = tcpwheelnow(c->sh->wheel);
+            continue;
+        }
+
+        tcptimercancel(c->sh->wheel, &c->wr);
+        if(echobuf(c) != 0) {
+            echoclose(c);
+            return;
+        }
+        int err = tcptlsread(c->tls, c->buf, buflen, &n);
+        if(err == EAGAIN) {
+            echoidle(c);
+            return;
+        }
+        if(err != 0 || n == 0) {
+            echoclose(c);
+            return;
+        }
+        echoread(c, n);
+        c->off = 0;
+        c->len = n;
+    }
+}
+
+/* echohandshake drives the TLS handshake of a new connection, bounded by
+ * the read deadline. Then the connection is echoed by the plain path if
+ * the kernel took over both directions, or by echotls. */
+static void echohandshake(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct echoconn *c = (struct echoconn *)ev;
+
+    int err = tcptlshandshake(c->tls);
+    if(err == EAGAIN) return;
+    if(err != 0) {
+        echoclose(c);
+        return;
+    }
+    tcptimercancel(c->sh->wheel, &c->rd);
+    c->active = tcpwheelnow(c->sh->wheel);
+
+    c->ev.fn = echotls;
+    if(tcptlsktls(c->tls) == (TCP_KTLSTX | TCP_KTLSRX)) {
+        c->ev.fn = mode == ECHO_SPLICE ? echosplice : echoconn;
+    }
+    /* data may already be queued and the loop is edge-triggered */
+    c->ev.fn(loop, ev, events);
+}
+
+/* echoaccept registers a new connection to the worker that accepted it. */
+static void echoaccept(struct tcpshard *sh, int conn)
+{
+    struct echoshard *es = sh->data;
+    struct echoconn *c = tcpslaballoc(&es->slab);
+    if(c == NULL) {
+        close(conn);
+        return;
+    }
+
+    /* a line longer than the buffer is echoed in several sends; without
+     * NODELAY Nagle holds the last one back until the client's delayed
+     * ACK. It fails harmlessly on a Unix domain socket. */
+    int one = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    int err = 0;
+    c->ev.fn = echoconn;
+    if(mode == ECHO_SPLICE) {
+        c->ev.fn = echosplice;
+        err = tcppipeinit(&c->pipe);
+    } else if(mode == ECHO_ZEROCOPY) {
+        c->ev.fn = echozc;
+        err = tcpzcinit(&c->zc, conn);
+    }
+    c->tls = NULL;
+    if(err == 0 && tlsctx != NULL) {
+        c->ev.fn = echohandshake;
+        err = tcptlsnew(&c->tls, tlsctx, conn);
+        if(err != 0 && mode == ECHO_SPLICE) tcppipefree(&c->pipe);
+    }
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        close(conn);
+        tcpslabfree(&es->slab, c);
+        return;
+    }
+
+    c->ev.fd = conn;
+    c->buf = NULL;
+    c->sh = es;
+    c->off = 0;
+    c->len = 0;
+    c->prev = &es->conns;
+    c->next = es->conns.next;
+    c->next->prev = c;
+    es->conns.next = c;
+    es->nconns++;
+    __atomic_add_fetch(&nlive, 1, __ATOMIC_RELAXED);
+
+    c->active = tcpwheelnow(es->wheel);
+    tcptimerinit(&c->idle, echoidleexpired);
+    tcptimerinit(&c->rd, echordexpired);
+    tcptimerinit(&c->wr, echowrexpired);
+    if(idlems != 0) tcptimerarm(es->wheel, &c->idle, idlems);
+    if(rdms != 0 && c->tls != NULL) tcptimerarm(es->wheel, &c->rd, rdms);
+
+    int erradd = tcploopadd(sh->loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+    if(erradd != 0) {
+        fprintf(stderr, "error: loop: %s\n", strerror(erradd));
+        echoclose(c);
+    }
+}
+
+/* echoinit allocates the connection table, the slab and the buffer pool in
+ * the worker thread, so their memory is local to the CPU that uses it. */
+static void echoinit(struct tcpshard *sh)
+{
+    struct echoshard *es = malloc(sizeof *es);
+    if(es == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        exit(1);
+    }
+    es->conns.prev = &es->conns;
+    es->conns.next = &es->conns;
+    es->nconns = 0;
+    es->wheel = tcploopwheel(sh->loop);
+    tcpslabinit(&es->slab, sizeof(struct echoconn));
+    /* the splice mode has no buffers; its pool stays empty */
+    tcpbpoolinit(&es->bufs, buflen > 0 ? buflen : 1, ECHO_KEEPBUFS);
+    sh->data = es;
+}
+
+static void echofini(struct tcpshard *sh)
+{
+    struct echoshard *es = sh->data;
+    while(es->conns.next != &es->conns) echoclose(es->conns.next);
+    tcpbpooldestroy(&es->bufs);
+    tcpslabdestroy(&es->slab);
+    free(es);
+}
+
+/* echodrain waits until the connections are finished, the drain deadline
+ * passed or the server stopped by itself. */
+static void echodrain(void)
+{
+    struct timespec dl, now;
+    tcpdeadline(&dl, drainms);
+    struct timespec tick = { 0, 10000000 };
+    for(;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(__atomic_load_n(&nlive, __ATOMIC_RELAXED) == 0 ||
+                __atomic_load_n(&done, __ATOMIC_RELAXED) ||
+                now.tv_sec > dl.tv_sec || (now.tv_sec == dl.tv_sec &&
+                    now.tv_nsec >= dl.tv_nsec)) {
+            break;
+        }
+        nanosleep(&tick, NULL);
+    }
+}
+
+/* echoaclload loads the access list and reports how it went. */
+static int echoaclload(void)
+{
+    size_t line = 0;
+    if(tcpaclload(acl, aclpath, &line) != 0) {
+        if(errno == EINVAL) {
+            fprintf(stderr, "error: %s:%zu: invalid prefix\n", aclpath, line);
+        } else {
+            fprintf(stderr, "error: %s: %s\n", aclpath, strerror(errno));
+        }
+        return -1;
+    }
+    size_t n, bytes;
+    tcpaclinfo(acl, &n, &bytes);
+    printf("echoserver: loaded %zu prefixes from %s (%zu KiB)\n", n,
+            aclpath, bytes / 1024);
+    fflush(stdout);
+    return 0;
+}
+
+/* echosignals waits for the signals in a thread of its own, so that a
+ * restart or a reload can block. SIGINT and SIGTERM stop the server.
+ * SIGHUP reloads the access list. SIGUSR2 hands the listeners to a new
+ * process, drains and then stops the server. */
+static void *echosignals(void *arg)
+{
+    sigset_t *set = arg;
+    for(;;) {
+        int sig;
+        if(sigwait(set, &sig) != 0) continue;
+        if(sig == SIGHUP) {
+            /* the old list stays in place if the file is broken */
+            if(acl != NULL) echoaclload();
+            continue;
+        }
+        if(sig != SIGUSR2) break;
+
+        int err = tcpsrvhandoff(srv, args, ECHO_READYMS);
+        if(err != 0) {
+            fprintf(stderr, "error: restart: %s\n", strerror(err));
+            continue;
+        }
+        handedoff = 1;
+        printf("echoserver: restarted, draining %ld connections\n",
+                __atomic_load_n(&nlive, __ATOMIC_RELAXED));
+        fflush(stdout);
+        echodrain();
+        break;
+    }
+    tcpsrvstop(srv);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct tcpsrvcfg cfg;
+    memset(&cfg, 0, sizeof cfg);
+    cfg.accept = echoaccept;
+    cfg.init = echoinit;
+    cfg.fini = echofini;
+
+    char *cert = NULL, *key = NULL;
+    args = argv;
+    int opt;
+    while((opt = getopt(argc, argv, "t:m:i:r:w:c:k:g:a:")) != -1) {
+        switch(opt) {
+            case 't':
+                cfg.nshards = atoi(optarg);
+                break;
+            case 'm':
+                if(strcmp(optarg, "copy") == 0) {
+                    mode = ECHO_COPY;
+                } else if(strcmp(optarg, "splice") == 0) {
+                    mode = ECHO_SPLICE;
+                    buflen = 0;
+                } else if(strcmp(optarg, "zerocopy") == 0) {
+                    mode = ECHO_ZEROCOPY;
+                    buflen = ECHO_ZCBUFLN;
+                } else {
+                    fprintf(stderr, "error: unknown mode %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'i':
+                idlems = atoi(optarg);
+                break;
+            case 'r':
+                rdms = atoi(optarg);
+                break;
+            case 'w':
+                wrms = atoi(optarg);
+                break;
+            case 'c':
+                cert = optarg;
+                break;
+            case 'k':
+                key = optarg;
+                break;
+            case 'g':
+                drainms = atoi(optarg);
+                break;
+            case 'a':
+                aclpath = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t workers] [-m mode] "
+                        "[-i ms] [-r ms] [-w ms] [-c cert -k key] "
+                        "[-g ms] [-a file] [host] port\n", argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if((argc != 2 && argc != 3) || (cert == NULL) != (key == NULL)) {
+        fprintf(stderr, "Usage: %s [-t workers] [-m mode] [-i ms] [-r ms] "
+                "[-w ms] [-c cert -k key] [-g ms] [-a file] [host] port\n",
+                argv[0]);
+        return 1;
+    }
+    cfg.host = argc == 3 ? argv[1] : NULL;
+    cfg.port = argv[argc-1];
+
+    /* every connection is a descriptor, raise the soft limit as far as the
+     * hard limit allows */
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if(cert != NULL) {
+        if(mode == ECHO_ZEROCOPY) {
+            fprintf(stderr, "error: zerocopy mode does not support TLS\n");
+            return 1;
+        }
+        int errtls = tcptlsctxnew(&tlsctx, TCP_TLSSERVER, cert, key, NULL);
+        if(errtls != 0) {
+            fprintf(stderr, "error: tls: %s\n", strerror(errtls));
+            return 1;
+        }
+        /* the splice mode falls back to a buffer when the kernel cannot
+         * decrypt */
+        if(mode == ECHO_SPLICE) buflen = ECHO_BUFLN;
+    }
+    /* splice(2) and OpenSSL write to the socket without MSG_NOSIGNAL, a
+     * client that closes with its echo in flight would kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    if(aclpath != NULL) {
+        if(tcpaclnew(&acl) != 0) {
+            fprintf(stderr, "error: acl: %s\n", strerror(errno));
+            return 1;
+        }
+        if(echoaclload() != 0) return 1;
+        cfg.acl = acl;
+    }
+
+    /* the workers inherit the mask, only echosignals takes the signals */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    int errsrv = tcpsrvnew(&srv, &cfg);
+    if(errsrv != 0) {
+        fprintf(stderr, "error: %s\n", strerror(errsrv));
+        return 1;
+    }
+    pthread_t sigthread;
+    pthread_create(&sigthread, NULL, echosignals, &set);
+
+    printf("echoserver: listening on port :%s with %d workers\n", cfg.port,
+            srv->nshards);
+    fflush(stdout);
+    errsrv = tcpsrvrun(srv);
+    __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+    pthread_kill(sigthread, SIGTERM);
+    pthread_join(sigthread, NULL);
+    tcpsrvfree(srv);
+    /* after a restart the socket file belongs to the new process */
+    if(!handedoff && tcpsunix(NULL, NULL, cfg.host) > 0 &&
+            cfg.host[sizeof TCP_UNIXPFX - 1] != '@') {
+        unlink(cfg.host + sizeof TCP_UNIXPFX - 1);
+    }
+    if(tlsctx != NULL) tcptlsctxfree(tlsctx);
+    if(acl != NULL) tcpaclfree(acl);
+    if(errsrv != 0) {
+        fprintf(stderr, "error: %s\n", strerror(errsrv));
+        return 1;
+    }
+    return 0;
+}
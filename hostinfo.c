@@ -1,11 +1,29 @@
 /* hostinfo.c - Retrieve and prints DNS Host entry for the specified hostname
- * or ip address.
+ * or ip address. Given a list of names it resolves them in bulk, with a
+ * bounded number of lookups in flight, and prints every result as soon as
+ * it is known, with its latency.
  *
  * Build:
  * % make hostinfo
  *
  * Usage:
  * % ./hostinfo localhost
+ * % ./hostinfo localhost example.com
+ * % ./hostinfo -c 256 -f names.txt
+ * % ./hostinfo - < names.txt
+ * % ./hostinfo -s hosts.snap -f names.txt
+ *
+ * Options:
+ * -f file   read the names from file, one per line; "-" reads stdin
+ * -c count  the maximum number of lookups in flight (default: 64)
+ * -s file   keep the results in the snapshot file; the names it holds are
+ *           printed at once and looked up again in the background, while
+ *           the other names are resolved
+ *
+ * Every name gets one line on stdout: the name, the lookup time and its
+ * IPv4 and IPv6 addresses, or on stderr the error. Blank lines and lines
+ * starting with '#' are skipped. The total and the rate of lookups are
+ * printed on stderr at the end.
  *
  * License:
  * BSD 3-clause Revised
@@ -42,35 +60,212 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
-#include <sys/socket.h>
-#include <netdb.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "tcpresolv.h"
+
+#define HOSTINFO_CONC 64
+
+/* lookup is one name in flight */
+struct lookup {
+    struct bulk *b;
+    struct timespec start;
+    char name[];
+};
+
+/* bulk bounds the lookups in flight and counts the results */
+struct bulk {
+    struct tcpresolv *r;
+    pthread_mutex_t mu;
+    pthread_cond_t done;
+    int inflight;
+    int maxinflight;
+    long nnames;
+    long nfailed;
+};
+
+static double msince(struct timespec *t0)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) * 1e3 +
+        (now.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/* printaddrs prints the line of one finished lookup. It is called from
+ * the resolver workers, so it builds the line first and writes it with a
+ * single call to keep the lines of concurrent lookups apart. */
+static void printaddrs(struct tcpaddrs *addrs, int err, void *arg)
+{
+    struct lookup *l = arg;
+    struct bulk *b = l->b;
+    double ms = msince(&l->start);
+
+    if(err != 0) {
+        /* tcpresolv maps EAI_NONAME to EINVAL */
+        fprintf(stderr, "%s %.3f ms Error: %s\n", l->name, ms,
+                err == EINVAL ? "Unknown host" : strerror(err));
+    } else {
+        char line[TCP_RESOLVMAX * (INET6_ADDRSTRLEN + 1) + 64];
+        int n = snprintf(line, sizeof line, "%.3f ms", ms);
+        for(int i = 0; i < addrs->n; i++) {
+            struct tcpaddr *a = &addrs->addr[i];
+            line[n++] = ' ';
+            if(a->u.sa.sa_family == AF_INET6) {
+                inet_ntop(AF_INET6, &a->u.in6.sin6_addr, line + n,
+                        INET6_ADDRSTRLEN);
+            } else {
+                inet_ntop(AF_INET, &a->u.in.sin_addr, line + n,
+                        INET_ADDRSTRLEN);
+            }
+            n += strlen(line + n);
+        }
+        printf("%s %s\n", l->name, line);
+    }
+
+    pthread_mutex_lock(&b->mu);
+    if(err != 0) b->nfailed++;
+    b->inflight--;
+    pthread_cond_signal(&b->done);
+    pthread_mutex_unlock(&b->mu);
+    free(l);
+}
+
+/* lookup starts the lookup of name once fewer than maxinflight are in
+ * flight. */
+static void lookup(struct bulk *b, char *name)
+{
+    pthread_mutex_lock(&b->mu);
+    while(b->inflight >= b->maxinflight) pthread_cond_wait(&b->done, &b->mu);
+    b->inflight++;
+    b->nnames++;
+    pthread_mutex_unlock(&b->mu);
+
+    size_t len = strlen(name);
+    struct lookup *l = malloc(sizeof *l + len + 1);
+    int err = ENOMEM;
+    if(l != NULL) {
+        l->b = b;
+        memcpy(l->name, name, len + 1);
+        clock_gettime(CLOCK_MONOTONIC, &l->start);
+        err = tcpresolveasync(b->r, l->name, NULL, printaddrs, l);
+        if(err == 0) return;
+        free(l);
+    }
+
+    fprintf(stderr, "%s Error: %s\n", name, strerror(err));
+    pthread_mutex_lock(&b->mu);
+    b->nfailed++;
+    b->inflight--;
+    pthread_mutex_unlock(&b->mu);
+}
+
+/* lookupfile starts the lookup of every name in f. */
+static void lookupfile(struct bulk *b, FILE *f)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while((n = getline(&line, &cap, f)) != -1) {
+        char *name = line;
+        while(*name == ' ' || *name == '\t') name++;
+        while(n > 0 && (line[n-1] == '\n' || line[n-1] == '\r' ||
+                    line[n-1] == ' ' || line[n-1] == '\t')) {
+            line[--n] = '\0';
+        }
+        if(*name == '\0' || *name == '#') continue;
+        lookup(b, name);
+    }
+    free(line);
+}
+
 int main(int argc, char **argv)
 {
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <hostname or ip addr>\n", argv[0]);
+    char *file = NULL;
+    char *snap = NULL;
+    int conc = HOSTINFO_CONC;
+    int opt;
+    while((opt = getopt(argc, argv, "f:c:s:")) != -1) {
+        switch(opt) {
+            case 'f':
+                file = optarg;
+                break;
+            case 'c':
+                conc = atoi(optarg);
+                break;
+            case 's':
+                snap = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s file] <hostname or ip "
+                        "addr>...\n       %s [-c count] [-s file] "
+                        "-f file | -\n", argv[0], argv[0]);
+                return 1;
+        }
+    }
+    if(optind == argc - 1 && strcmp(argv[optind], "-") == 0) {
+        file = argv[optind++];
+    }
+    if((file == NULL) == (optind == argc) || conc <= 0) {
+        fprintf(stderr, "Usage: %s [-s file] <hostname or ip addr>...\n"
+                "       %s [-c count] [-s file] -f file | -\n", argv[0],
+                argv[0]);
         return 1;
     }
 
-    /* Get address information */
-    struct addrinfo hints, *addri;
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    int gairet = getaddrinfo(argv[1], NULL, &hints, &addri);
-    if(gairet != 0) {
-        fprintf(stderr, "Error: %s\n", gai_strerror(gairet));
+    FILE *f = NULL;
+    if(file != NULL) {
+        f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+        if(f == NULL) {
+            fprintf(stderr, "Error: %s: %s\n", file, strerror(errno));
+            return 1;
+        }
+    }
+
+    /* one resolver worker per lookup in flight; getaddrinfo(3) blocks.
+     * Nothing is cached but the snapshot, and concurrent lookups of the
+     * same name are still merged. */
+    struct bulk b;
+    memset(&b, 0, sizeof b);
+    b.maxinflight = conc;
+    pthread_mutex_init(&b.mu, NULL);
+    pthread_cond_init(&b.done, NULL);
+    if(tcpresolvnew(&b.r, conc, 0, 0) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        return 1;
+    }
+    /* an unusable snapshot is replaced when the resolver is freed */
+    if(snap != NULL && tcpresolvsnap(b.r, snap) != 0) {
+        fprintf(stderr, "Warning: %s: %s\n", snap, strerror(errno));
     }
 
-    /* loop all through returned address */
-    for(struct addrinfo *addr = addri; addr != NULL; addr = addr->ai_next) {
-        struct sockaddr_in *sa = (struct sockaddr_in *)addr->ai_addr;
-        char ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &sa->sin_addr, ip, INET_ADDRSTRLEN);
-        printf("ip: %s\n", ip);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(f != NULL) {
+        lookupfile(&b, f);
+        if(f != stdin) fclose(f);
+    } else {
+        for(; optind < argc; optind++) lookup(&b, argv[optind]);
     }
 
-    return 0;
+    pthread_mutex_lock(&b.mu);
+    while(b.inflight > 0) pthread_cond_wait(&b.done, &b.mu);
+    pthread_mutex_unlock(&b.mu);
+    double ms = msince(&start);
+    tcpresolvfree(b.r);
+
+    if(b.nnames > 1) {
+        fprintf(stderr, "%ld names, %ld failed, %.3f s, %.1f lookups/s\n",
+                b.nnames, b.nfailed, ms / 1e3,
+                ms > 0 ? b.nnames / (ms / 1e3) : 0);
+    }
+    return b.nfailed > 0;
 }
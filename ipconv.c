@@ -0,0 +1,704 @@
+/* ipconv - Bulk conversion of IPv4 addresses between the dotted-decimal
+ * and the hexadecimal notation.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IPCONV_X86
+#endif
+
+#include "ipconv.h"
+
+static const char ipconvhex[] = "0123456789abcdef";
+
+/* ipddparse parses the dotted-decimal address in the n bytes of s and
+ * write it into *addr in host byte order. It accepts what inet_pton(3)
+ * accepts for AF_INET: four decimal numbers up to 255 separated by dots,
+ * without leading zeros.
+ *
+ * It returns 0, or EINVAL if s is not a valid address.
+ */
+int ipddparse(const char *s, size_t n, uint32_t *addr)
+{
+    uint32_t a = 0;
+    size_t i = 0;
+    for(int part = 0; part < 4; part++) {
+        if(part > 0) {
+            if(i >= n || s[i] != '.') return EINVAL;
+            i++;
+        }
+        size_t start = i;
+        unsigned v = 0;
+        while(i < n && i - start < 3 && s[i] >= '0' && s[i] <= '9') {
+            v = v * 10 + (s[i] - '0');
+            i++;
+        }
+        size_t len = i - start;
+        if(len == 0 || v > 255 || (len > 1 && s[start] == '0')) {
+            return EINVAL;
+        }
+        a = a << 8 | v;
+    }
+    if(i != n) return EINVAL;
+    *addr = a;
+    return 0;
+}
+
+/* ipddfmt writes the dotted-decimal form of addr, given in host byte
+ * order, into out without a terminating null byte. out must have room for
+ * 15 bytes. It returns the number of bytes written. */
+size_t ipddfmt(uint32_t addr, char *out)
+{
+    char *o = out;
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        unsigned b = addr >> shift & 0xff;
+        if(b >= 100) {
+            *o++ = '0' + b / 100;
+            b %= 100;
+            *o++ = '0' + b / 10;
+        } else if(b >= 10) {
+            *o++ = '0' + b / 10;
+        }
+        *o++ = '0' + b % 10;
+        if(shift > 0) *o++ = '.';
+    }
+    return o - out;
+}
+
+/* iphexparse parses the hexadecimal address in the n bytes of s, with an
+ * optional 0x or 0X prefix and one to eight digits, and write it into
+ * *addr. Unlike sscanf(3) with %x it rejects trailing characters and values
+ * wider than 32 bits instead of ignoring or truncating them.
+ *
+ * It returns 0, or EINVAL if s is not a valid address.
+ */
+int iphexparse(const char *s, size_t n, uint32_t *addr)
+{
+    size_t i = 0;
+    if(n > 2 && s[0] == '0' && (s[1] | 0x20) == 'x') i = 2;
+    if(n - i == 0 || n - i > 8) return EINVAL;
+
+    uint32_t a = 0;
+    for(; i < n; i++) {
+        int c = s[i];
+        int d;
+        if(c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            d = (c | 0x20) - 'a' + 10;
+        } else {
+            return EINVAL;
+        }
+        a = a << 4 | d;
+    }
+    *addr = a;
+    return 0;
+}
+
+/* iphexfmt writes addr like printf(3) with %#x: 0x and the digits without
+ * leading zeros, or a single 0. out must have room for 10 bytes. It returns
+ * the number of bytes written. */
+size_t iphexfmt(uint32_t addr, char *out)
+{
+    if(addr == 0) {
+        out[0] = '0';
+        return 1;
+    }
+    int nd = (32 - __builtin_clz(addr) + 3) / 4;
+    out[0] = '0';
+    out[1] = 'x';
+    for(int i = nd + 1; i >= 2; i--) {
+        out[i] = ipconvhex[addr & 0xf];
+        addr >>= 4;
+    }
+    return nd + 2;
+}
+
+static char *ipconvgood(struct ipconv *cv, uint32_t a, char *o)
+{
+    cv->lines++;
+    if(cv->dir == IPCONV_DD2HEX) {
+        o += iphexfmt(a, o);
+    } else {
+        o += ipddfmt(a, o);
+    }
+    *o++ = '\n';
+    return o;
+}
+
+static char *ipconvbad(struct ipconv *cv, const char *s, size_t n, char *o)
+{
+    cv->lines++;
+    cv->nbad++;
+    if(cv->bad != NULL) cv->bad(cv->lines, s, n);
+    return o;
+}
+
+/* ipconvline converts the line s of n bytes without its newline. */
+static char *ipconvline(struct ipconv *cv, const char *s, size_t n, char *o)
+{
+    if(n > 0 && s[n-1] == '\r') n--;
+    uint32_t a;
+    int err = cv->dir == IPCONV_DD2HEX ? ipddparse(s, n, &a) :
+        iphexparse(s, n, &a);
+    if(err != 0) return ipconvbad(cv, s, n, o);
+    return ipconvgood(cv, a, o);
+}
+
+/* ipconvslow converts the line at *p with the scalar code and advances *p
+ * past it. It returns NULL if the line does not end before end. */
+static char *ipconvslow(struct ipconv *cv, const char **p, const char *end,
+        char *o)
+{
+    const char *nl = memchr(*p, '\n', end - *p);
+    if(nl == NULL) return NULL;
+    o = ipconvline(cv, *p, nl - *p, o);
+    *p = nl + 1;
+    return o;
+}
+
+static size_t ipconvscalar(struct ipconv *cv, const char *in, size_t n,
+        char *out, size_t *used)
+{
+    const char *p = in, *end = in + n;
+    char *o = out;
+    while(p < end) {
+        char *next = ipconvslow(cv, &p, end, o);
+        if(next == NULL) break;
+        o = next;
+    }
+    *used = p - in;
+    return o - out;
+}
+
+#ifdef IPCONV_X86
+
+/* The vector parsers handle lines of at most 15 bytes whose newline is in
+ * the same 16 byte load, which covers every valid address; other lines go
+ * to the scalar code. Both parsers move the digits of every field into a
+ * fixed lane with one pshufb and combine them with pmaddubsw.
+ *
+ * The per-line helpers are always inlined so that the AVX2 loop gets them
+ * VEX encoded; calling legacy SSE code from it costs a state transition
+ * per call. */
+
+/* ipconvterm finds the end of the line loaded into v. It sets *len to the
+ * length of the line without its line ending and *next to the length with
+ * it. It returns -1 if the line ending is not within the load. */
+__attribute__((target("sse4.1"), always_inline))
+static inline int ipconvterm(__m128i v, const char *p, int *len, int *next)
+{
+    __m128i t = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    unsigned m = _mm_movemask_epi8(t);
+    if(m == 0) return -1;
+    *len = __builtin_ctz(m);
+    if(p[*len] == '\n') {
+        *next = *len + 1;
+        return 0;
+    }
+    if(p[*len+1] != '\n') return -1;
+    *next = *len + 2;
+    return 0;
+}
+
+/* ipddplan validates the layout of a dotted-decimal line from its digit and
+ * dot masks and computes the pshufb control that right-aligns the digits of
+ * field i in bytes 4i to 4i+3. */
+static int ipddplan(const char *p, int len, unsigned digits, unsigned dots,
+        uint32_t w[4])
+{
+    /* the control bytes of a field of 1, 2 and 3 digits starting at byte
+     * 0; 0x80 zeroes the lane and stays above 0x80 when the start is
+     * added */
+    static const uint32_t pat[4] = { 0, 0x00808080, 0x01008080, 0x02010080 };
+
+    unsigned valid = (1u << len) - 1;
+    if((digits | dots) != valid || __builtin_popcount(dots) != 3) {
+        return EINVAL;
+    }
+    int st[4], ln[4];
+    st[0] = 0;
+    for(int i = 1; i < 4; i++) {
+        st[i] = __builtin_ctz(dots) + 1;
+        dots &= dots - 1;
+        ln[i-1] = st[i] - st[i-1] - 1;
+    }
+    ln[3] = len - st[3];
+    for(int i = 0; i < 4; i++) {
+        if(ln[i] < 1 || ln[i] > 3 || (ln[i] > 1 && p[st[i]] == '0')) {
+            return EINVAL;
+        }
+        w[i] = pat[ln[i]] + st[i] * 0x01010101u;
+    }
+    return 0;
+}
+
+/* iphexplan validates a hexadecimal line from its digit mask and computes
+ * the pshufb control that right-aligns its digits in bytes 0 to 7. */
+static int iphexplan(const char *p, int len, unsigned hex, uint64_t *ctl)
+{
+    int skip = len > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' ? 2 : 0;
+    int ndig = len - skip;
+    if(ndig < 1 || ndig > 8) return EINVAL;
+    unsigned want = ((1u << len) - 1) & ~((1u << skip) - 1);
+    if((hex & want) != want) return EINVAL;
+
+    /* lane i takes byte len - 8 + i; the lanes before the first digit get
+     * 0xf0 first, so they keep their high bit through the subtraction and
+     * no lane borrows from its neighbour */
+    int z = 8 - ndig;
+    uint64_t zmask = z > 0 ? 0xf0f0f0f0f0f0f0f0ull >> (64 - 8 * z) : 0;
+    *ctl = ((0x0706050403020100ull + len * 0x0101010101010101ull) | zmask) -
+        0x0808080808080808ull;
+    return 0;
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline char *ipddsse(struct ipconv *cv, const char *p, __m128i v, int len,
+        char *o)
+{
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    unsigned valid = (1u << len) - 1;
+    unsigned digits = _mm_movemask_epi8(isd) & valid;
+    unsigned dots = _mm_movemask_epi8(_mm_cmpeq_epi8(v,
+                _mm_set1_epi8('.'))) & valid;
+
+    uint32_t w[4];
+    if(ipddplan(p, len, digits, dots, w) != 0) {
+        return ipconvbad(cv, p, len, o);
+    }
+    __m128i f = _mm_shuffle_epi8(d, _mm_setr_epi32(w[0], w[1], w[2], w[3]));
+    __m128i s = _mm_madd_epi16(_mm_maddubs_epi16(f,
+                _mm_setr_epi8(0, 100, 10, 1, 0, 100, 10, 1,
+                    0, 100, 10, 1, 0, 100, 10, 1)), _mm_set1_epi16(1));
+    if(_mm_movemask_epi8(_mm_cmpgt_epi32(s, _mm_set1_epi32(255)))) {
+        return ipconvbad(cv, p, len, o);
+    }
+    s = _mm_packus_epi16(_mm_packus_epi32(s, s), s);
+    return ipconvgood(cv, __builtin_bswap32(_mm_cvtsi128_si32(s)), o);
+}
+
+/* iphexval turns hexadecimal characters into their values and reports
+ * which lanes are hexadecimal digits in *hex. */
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i iphexval(__m128i v, __m128i *hex)
+{
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+            _mm_set1_epi8('a'));
+    __m128i isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    *hex = _mm_or_si128(isd, isl);
+    return _mm_blendv_epi8(_mm_add_epi8(l, _mm_set1_epi8(10)), d, isd);
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline char *iphexsse(struct ipconv *cv, const char *p, __m128i v, int len,
+        char *o)
+{
+    __m128i hex;
+    __m128i val = iphexval(v, &hex);
+    uint64_t ctl;
+    if(iphexplan(p, len, _mm_movemask_epi8(hex), &ctl) != 0) {
+        return ipconvbad(cv, p, len, o);
+    }
+    __m128i nib = _mm_shuffle_epi8(val,
+            _mm_set_epi64x(0x8080808080808080ll, ctl));
+    __m128i b = _mm_maddubs_epi16(nib, _mm_set1_epi16(0x0110));
+    b = _mm_packus_epi16(b, b);
+    return ipconvgood(cv, __builtin_bswap32(_mm_cvtsi128_si32(b)), o);
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline char *ipconvsseline(struct ipconv *cv, const char *p, __m128i v,
+        int len, char *o)
+{
+    if(cv->dir == IPCONV_DD2HEX) return ipddsse(cv, p, v, len, o);
+    return iphexsse(cv, p, v, len, o);
+}
+
+__attribute__((target("sse4.1")))
+static size_t ipconvsse(struct ipconv *cv, const char *in, size_t n,
+        char *out, size_t *used)
+{
+    const char *p = in, *end = in + n;
+    char *o = out;
+    while(p < end) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int len, next;
+        if(ipconvterm(v, p, &len, &next) != 0) {
+            char *slow = ipconvslow(cv, &p, end, o);
+            if(slow == NULL) break;
+            o = slow;
+            continue;
+        }
+        /* the line ending is in the padding past the input */
+        if(p + next > end) break;
+        o = ipconvsseline(cv, p, v, len, o);
+        p += next;
+    }
+    *used = p - in;
+    return o - out;
+}
+
+/* The AVX2 versions parse two lines at once, one per 128 bit lane; pshufb
+ * and the pack instructions work within lanes, so every step of the SSE
+ * version carries over. If either line needs the slow path, both are
+ * handed to the SSE version. */
+
+__attribute__((target("avx2")))
+static char *ipddavx2(struct ipconv *cv, const char *p, __m128i va, int lena,
+        const char *q, __m128i vb, int lenb, char *o)
+{
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(va), vb, 1);
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d,
+                _mm256_set1_epi8(9)), d);
+    unsigned digits = _mm256_movemask_epi8(isd);
+    unsigned dots = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,
+                _mm256_set1_epi8('.')));
+
+    uint32_t wa[4], wb[4];
+    unsigned va16 = (1u << lena) - 1, vb16 = (1u << lenb) - 1;
+    if(ipddplan(p, lena, digits & va16, dots & va16, wa) != 0 ||
+            ipddplan(q, lenb, digits >> 16 & vb16, dots >> 16 & vb16,
+                wb) != 0) {
+        o = ipddsse(cv, p, va, lena, o);
+        return ipddsse(cv, q, vb, lenb, o);
+    }
+    __m256i f = _mm256_shuffle_epi8(d, _mm256_setr_epi32(wa[0], wa[1], wa[2],
+                wa[3], wb[0], wb[1], wb[2], wb[3]));
+    __m256i s = _mm256_madd_epi16(_mm256_maddubs_epi16(f,
+                _mm256_set1_epi32(0x010a6400)), _mm256_set1_epi16(1));
+    if(_mm256_movemask_epi8(_mm256_cmpgt_epi32(s, _mm256_set1_epi32(255)))) {
+        o = ipddsse(cv, p, va, lena, o);
+        return ipddsse(cv, q, vb, lenb, o);
+    }
+    s = _mm256_packus_epi16(_mm256_packus_epi32(s, s), s);
+    o = ipconvgood(cv, __builtin_bswap32(_mm256_extract_epi32(s, 0)), o);
+    return ipconvgood(cv, __builtin_bswap32(_mm256_extract_epi32(s, 4)), o);
+}
+
+__attribute__((target("avx2")))
+static char *iphexavx2(struct ipconv *cv, const char *p, __m128i va,
+        int lena, const char *q, __m128i vb, int lenb, char *o)
+{
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(va), vb, 1);
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d,
+                _mm256_set1_epi8(9)), d);
+    __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+            _mm256_set1_epi8('a'));
+    __m256i isl = _mm256_cmpeq_epi8(_mm256_min_epu8(l,
+                _mm256_set1_epi8(5)), l);
+    unsigned hex = _mm256_movemask_epi8(_mm256_or_si256(isd, isl));
+    __m256i val = _mm256_blendv_epi8(_mm256_add_epi8(l,
+                _mm256_set1_epi8(10)), d, isd);
+
+    uint64_t ca, cb;
+    if(iphexplan(p, lena, hex & 0xffff, &ca) != 0 ||
+            iphexplan(q, lenb, hex >> 16, &cb) != 0) {
+        o = iphexsse(cv, p, va, lena, o);
+        return iphexsse(cv, q, vb, lenb, o);
+    }
+    __m256i nib = _mm256_shuffle_epi8(val, _mm256_setr_epi64x(ca,
+                0x8080808080808080ll, cb, 0x8080808080808080ll));
+    __m256i b = _mm256_maddubs_epi16(nib, _mm256_set1_epi16(0x0110));
+    b = _mm256_packus_epi16(b, b);
+    o = ipconvgood(cv, __builtin_bswap32(_mm256_extract_epi32(b, 0)), o);
+    return ipconvgood(cv, __builtin_bswap32(_mm256_extract_epi32(b, 4)), o);
+}
+
+__attribute__((target("avx2")))
+static size_t ipconvavx2(struct ipconv *cv, const char *in, size_t n,
+        char *out, size_t *used)
+{
+    const char *p = in, *end = in + n;
+    char *o = out;
+    while(p < end) {
+        __m128i va = _mm_loadu_si128((const __m128i *)p);
+        int lena, nexta;
+        if(ipconvterm(va, p, &lena, &nexta) != 0) {
+            char *slow = ipconvslow(cv, &p, end, o);
+            if(slow == NULL) break;
+            o = slow;
+            continue;
+        }
+        if(p + nexta > end) break;
+
+        const char *q = p + nexta;
+        __m128i vb;
+        int lenb, nextb;
+        if(q >= end || (vb = _mm_loadu_si128((const __m128i *)q),
+                    ipconvterm(vb, q, &lenb, &nextb) != 0) ||
+                q + nextb > end) {
+            o = ipconvsseline(cv, p, va, lena, o);
+            p = q;
+            continue;
+        }
+        if(cv->dir == IPCONV_DD2HEX) {
+            o = ipddavx2(cv, p, va, lena, q, vb, lenb, o);
+        } else {
+            o = iphexavx2(cv, p, va, lena, q, vb, lenb, o);
+        }
+        p = q + nextb;
+    }
+    *used = p - in;
+    return o - out;
+}
+
+#endif
+
+static int ipconvcpu(void)
+{
+#ifdef IPCONV_X86
+    if(__builtin_cpu_supports("avx2")) return IPCONV_AVX2;
+    if(__builtin_cpu_supports("sse4.1")) return IPCONV_SSE4;
+#endif
+    return IPCONV_SCALAR;
+}
+
+/* ipconvinit prepares cv to convert in the direction dir, IPCONV_DD2HEX or
+ * IPCONV_HEX2DD. isa picks the parser: IPCONV_AUTO takes the best one the
+ * CPU supports, the others force one. bad, if not NULL, is called with
+ * every line that is not a valid address; those lines produce no output.
+ *
+ * It returns 0, EINVAL for an unknown direction, or ENOTSUP if the CPU
+ * does not support the forced instruction set.
+ */
+int ipconvinit(struct ipconv *cv, int dir, int isa, ipconvbadfn *bad)
+{
+    if(dir != IPCONV_DD2HEX && dir != IPCONV_HEX2DD) {
+        errno = EINVAL;
+        return errno;
+    }
+    int best = ipconvcpu();
+    if(isa == IPCONV_AUTO) isa = best;
+    if(isa < IPCONV_SCALAR || isa > best) {
+        errno = ENOTSUP;
+        return errno;
+    }
+    memset(cv, 0, sizeof *cv);
+    cv->dir = dir;
+    cv->isa = isa;
+    cv->bad = bad;
+    return 0;
+}
+
+static const char *ipconvnames[] = { "auto", "scalar", "sse4", "avx2" };
+
+/* ipconvisa looks up the instruction set called name, one of auto, scalar,
+ * sse4 and avx2. It returns 0 or EINVAL. */
+int ipconvisa(const char *name, int *isa)
+{
+    for(int i = IPCONV_AUTO; i <= IPCONV_AVX2; i++) {
+        if(strcmp(name, ipconvnames[i]) == 0) {
+            *isa = i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return errno;
+}
+
+/* ipconvname returns the name of the instruction set isa. */
+const char *ipconvname(int isa)
+{
+    if(isa < IPCONV_AUTO || isa > IPCONV_AVX2) return "unknown";
+    return ipconvnames[isa];
+}
+
+/* ipconvlines converts the complete lines in the n bytes of in and writes
+ * one output line per valid address into out, which must have room for
+ * IPCONV_OUTMUL * n bytes. IPCONV_PAD bytes past the end of in must be
+ * readable. It sets *used to the number of bytes consumed; a last line
+ * without a newline is left for the next call.
+ *
+ * It returns the number of bytes written into out.
+ *
+ * Example:
+ *
+ *     struct ipconv cv;
+ *     ipconvinit(&cv, IPCONV_DD2HEX, IPCONV_AUTO, NULL);
+ *     size_t used;
+ *     size_t outn = ipconvlines(&cv, in, n, out, &used);
+ *     fwrite(out, 1, outn, stdout);
+ */
+size_t ipconvlines(struct ipconv *cv, const char *in, size_t n, char *out,
+        size_t *used)
+{
+    switch(cv->isa) {
+#ifdef IPCONV_X86
+        case IPCONV_AVX2:
+            return ipconvavx2(cv, in, n, out, used);
+        case IPCONV_SSE4:
+            return ipconvsse(cv, in, n, out, used);
+#endif
+        default:
+            return ipconvscalar(cv, in, n, out, used);
+    }
+}
+
+static int ipconvwrite(int fd, const char *b, size_t n)
+{
+    while(n > 0) {
+        ssize_t w = write(fd, b, n);
+        if(w == -1) {
+            if(errno == EINTR) continue;
+            return errno;
+        }
+        b += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* ipconvchunk converts the lines of a chunk, writes the result to fd and
+ * sets *used to the bytes consumed. *skip is set while the rest of a line
+ * longer than a chunk is being discarded; such a line is reported once. */
+static int ipconvchunk(struct ipconv *cv, const char *in, size_t n,
+        char *out, int fd, size_t *used, int *skip)
+{
+    size_t off = 0;
+    if(*skip) {
+        const char *nl = memchr(in, '\n', n);
+        if(nl == NULL) {
+            *used = n;
+            return 0;
+        }
+        off = nl + 1 - in;
+        *skip = 0;
+    }
+
+    size_t u;
+    size_t outn = ipconvlines(cv, in + off, n - off, out, &u);
+    *used = off + u;
+    if(*used == 0 && n >= IPCONV_CHUNK) {
+        ipconvbad(cv, in, n, out);
+        *used = n;
+        *skip = 1;
+    }
+    return ipconvwrite(fd, out, outn);
+}
+
+/* ipconvfd converts the lines read from in and writes the result to out.
+ * A regular file is mapped into memory instead of being read; anything
+ * else, such as a pipe, is read in chunks of IPCONV_CHUNK bytes. The
+ * output is written in blocks of up to IPCONV_CHUNK * IPCONV_OUTMUL bytes.
+ *
+ * It returns 0, or the error of mmap(2), read(2) or write(2). Invalid
+ * addresses are not an error; they are counted in cv->nbad.
+ */
+int ipconvfd(struct ipconv *cv, int in, int out)
+{
+    char *obuf = malloc((size_t)IPCONV_CHUNK * IPCONV_OUTMUL + IPCONV_PAD);
+    /* the tail of a mapping, or the read buffer, with room for a final
+     * newline and the padding */
+    char *ibuf = malloc(2 * (size_t)IPCONV_CHUNK + 2 * IPCONV_PAD);
+    if(obuf == NULL || ibuf == NULL) {
+        free(obuf);
+        free(ibuf);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    int err = 0;
+    int skip = 0;
+    size_t used;
+    struct stat st;
+    if(fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t size = st.st_size;
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, 0);
+        if(map == MAP_FAILED) {
+            err = errno;
+            goto done;
+        }
+        posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+        size_t off = 0;
+        /* convert in place while the padding is part of the mapping */
+        while(err == 0 && size - off > (size_t)IPCONV_CHUNK + IPCONV_PAD) {
+            err = ipconvchunk(cv, map + off, IPCONV_CHUNK, obuf, out, &used,
+                    &skip);
+            off += used;
+        }
+        size_t n = size - off;
+        memcpy(ibuf, map + off, n);
+        munmap(map, size);
+        if(n > 0 && ibuf[n-1] != '\n') ibuf[n++] = '\n';
+        while(err == 0 && n > 0) {
+            err = ipconvchunk(cv, ibuf, n, obuf, out, &used, &skip);
+            memmove(ibuf, ibuf + used, n - used);
+            n -= used;
+        }
+        goto done;
+    }
+
+    size_t have = 0;
+    for(;;) {
+        ssize_t r = read(in, ibuf + have, IPCONV_CHUNK - have);
+        if(r == -1) {
+            if(errno == EINTR) continue;
+            err = errno;
+            break;
+        }
+        if(r == 0) {
+            if(have > 0 && ibuf[have-1] != '\n') ibuf[have++] = '\n';
+            if(have > 0) err = ipconvchunk(cv, ibuf, have, obuf, out, &used,
+                    &skip);
+            break;
+        }
+        have += r;
+        err = ipconvchunk(cv, ibuf, have, obuf, out, &used, &skip);
+        if(err != 0) break;
+        memmove(ibuf, ibuf + used, have - used);
+        have -= used;
+    }
+
+done:
+    free(obuf);
+    free(ibuf);
+    errno = err;
+    return err;
+}
@@ -0,0 +1,87 @@
+/* ipconv - Bulk conversion of IPv4 addresses between the dotted-decimal
+ * and the hexadecimal notation, one address per line. The parsers have
+ * SSE4.1 and AVX2 versions that are picked at run time; the scalar versions
+ * are used on other CPUs and for lines the vector code does not handle.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IPCONV_H
+#define IPCONV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* conversion directions */
+enum {
+    IPCONV_DD2HEX,
+    IPCONV_HEX2DD
+};
+
+/* instruction sets for ipconvinit */
+enum {
+    IPCONV_AUTO,
+    IPCONV_SCALAR,
+    IPCONV_SSE4,
+    IPCONV_AVX2
+};
+
+/* the number of readable bytes ipconvlines needs past the end of its
+ * input; the vector code loads whole registers */
+#define IPCONV_PAD 64
+/* the size of the input chunks of ipconvfd; the output buffer is
+ * IPCONV_OUTMUL times larger */
+#define IPCONV_CHUNK (1 << 20)
+#define IPCONV_OUTMUL 4
+
+/* ipconvbadfn receives a line that is not a valid address, without its
+ * newline. lineno counts from 1. */
+typedef void ipconvbadfn(uint64_t lineno, const char *line, size_t n);
+
+struct ipconv {
+    int dir;
+    int isa;
+    ipconvbadfn *bad;
+    /* the number of lines converted and of the invalid ones */
+    uint64_t lines;
+    uint64_t nbad;
+};
+
+int ipconvinit(struct ipconv *cv, int dir, int isa, ipconvbadfn *bad);
+int ipconvisa(const char *name, int *isa);
+const char *ipconvname(int isa);
+size_t ipconvlines(struct ipconv *cv, const char *in, size_t n, char *out,
+        size_t *used);
+int ipconvfd(struct ipconv *cv, int in, int out);
+
+int ipddparse(const char *s, size_t n, uint32_t *addr);
+size_t ipddfmt(uint32_t addr, char *out);
+int iphexparse(const char *s, size_t n, uint32_t *addr);
+size_t iphexfmt(uint32_t addr, char *out);
+
+#endif
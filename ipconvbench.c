@@ -0,0 +1,217 @@
+/* ipconvbench.c - Compare the batch IPv4 converters of the ipconv module
+ * with the libc functions the single-address tools use. For each
+ * direction it converts a buffer of random addresses with inet_pton(3) or
+ * sscanf(3) and printf(3), then with ipconvlines for every instruction set
+ * the CPU supports, checks that the outputs are identical and reports the
+ * throughput in millions of addresses per second.
+ *
+ * Build:
+ * % make ipconvbench
+ *
+ * Usage:
+ * % ./ipconvbench
+ * % ./ipconvbench -n 4000000 -r 5
+ *
+ * Options:
+ * -n count  number of addresses (default: 1000000)
+ * -r runs   number of timed runs; the fastest is reported (default: 3)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ipconv.h"
+
+struct text {
+    char *buf;
+    size_t len;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* textnew fills t with count random addresses, one per line, in the
+ * format of dir's input. */
+static int textnew(struct text *t, int dir, long count)
+{
+    t->buf = malloc((size_t)count * 16 + IPCONV_PAD);
+    if(t->buf == NULL) return -1;
+    t->len = 0;
+    for(long i = 0; i < count; i++) {
+        uint32_t a = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+        /* keep the short forms common; they are the branchy ones */
+        if(i % 4 == 1) a >>= 16;
+        if(i % 4 == 2) a &= 0xff00ff00;
+        if(dir == IPCONV_DD2HEX) t->len += ipddfmt(a, t->buf + t->len);
+        else t->len += iphexfmt(a, t->buf + t->len);
+        t->buf[t->len++] = '\n';
+    }
+    memset(t->buf + t->len, 0, IPCONV_PAD);
+    return 0;
+}
+
+/* libcconv converts in the way ipdd2hex and iphex2dd convert a single
+ * address. */
+static size_t libcconv(int dir, const char *in, size_t n, char *out)
+{
+    char line[64];
+    char *o = out;
+    const char *end = in + n;
+    while(in < end) {
+        const char *nl = memchr(in, '\n', end - in);
+        size_t len = nl - in;
+        memcpy(line, in, len);
+        line[len] = '\0';
+        in = nl + 1;
+        struct in_addr addr;
+        if(dir == IPCONV_DD2HEX) {
+            if(inet_pton(AF_INET, line, &addr) != 1) continue;
+            o += sprintf(o, "%#x\n", ntohl(addr.s_addr));
+        } else {
+            unsigned int h;
+            if(sscanf(line, "%x", &h) != 1) continue;
+            addr.s_addr = htonl(h);
+            inet_ntop(AF_INET, &addr, o, INET_ADDRSTRLEN);
+            o += strlen(o);
+            *o++ = '\n';
+        }
+    }
+    return o - out;
+}
+
+static void report(const char *name, long count, double best)
+{
+    printf("  %-8s %8.2f Maddr/s %8.1f ns/addr\n", name,
+            count / best / 1e6, best * 1e9 / count);
+}
+
+static int bench(int dir, long count, int runs)
+{
+    struct text t;
+    if(textnew(&t, dir, count) == -1) {
+        perror("malloc");
+        return -1;
+    }
+    size_t outcap = t.len * IPCONV_OUTMUL;
+    char *want = malloc(outcap);
+    char *got = malloc(outcap);
+    if(want == NULL || got == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    printf("%s, %ld addresses\n",
+            dir == IPCONV_DD2HEX ? "dd2hex" : "hex2dd", count);
+
+    size_t wantn = 0;
+    double best = 0;
+    for(int r = 0; r < runs; r++) {
+        double t0 = now();
+        wantn = libcconv(dir, t.buf, t.len, want);
+        double d = now() - t0;
+        if(r == 0 || d < best) best = d;
+    }
+    report("libc", count, best);
+
+    int rc = 0;
+    for(int isa = IPCONV_SCALAR; isa <= IPCONV_AVX2; isa++) {
+        struct ipconv cv;
+        if(ipconvinit(&cv, dir, isa, NULL) != 0) {
+            printf("  %-8s unsupported\n", ipconvname(isa));
+            continue;
+        }
+        size_t gotn = 0;
+        for(int r = 0; r < runs; r++) {
+            size_t used;
+            double t0 = now();
+            gotn = ipconvlines(&cv, t.buf, t.len, got, &used);
+            double d = now() - t0;
+            if(r == 0 || d < best) best = d;
+        }
+        report(ipconvname(isa), count, best);
+        if(gotn != wantn || memcmp(got, want, wantn) != 0) {
+            fprintf(stderr, "%s: output differs from libc\n",
+                    ipconvname(isa));
+            rc = -1;
+        }
+    }
+
+    free(t.buf);
+    free(want);
+    free(got);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    long count = 1000000;
+    int runs = 3;
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-r runs]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(count <= 0 || runs <= 0) {
+        fprintf(stderr, "Invalid count or runs\n");
+        return 1;
+    }
+
+    srand(1);
+    int rc = 0;
+    if(bench(IPCONV_DD2HEX, count, runs) == -1) rc = 1;
+    if(bench(IPCONV_HEX2DD, count, runs) == -1) rc = 1;
+    return rc;
+}
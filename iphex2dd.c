@@ -6,6 +6,14 @@
  *
  * Usage:
  * % ./iphex2dd 0x8002c2f2
+ * % ./iphex2dd -f addresses.txt
+ * % cat addresses.txt | ./iphex2dd -
+ *
+ * Options:
+ * -f file  convert every line of file, which is mapped into memory
+ * -        convert every line of the standard input
+ * -i isa   force the parser: scalar, sse4 or avx2 (default: the best one
+ *          the CPU supports)
  *
  * License:
  * BSD 3-clause Revised
@@ -36,22 +44,86 @@
  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <string.h>
 
+#include "ipconv.h"
+
+static void badline(uint64_t lineno, const char *line, size_t n)
+{
+    fprintf(stderr, "line %llu: Invalid hexadecimal: %.*s\n",
+            (unsigned long long)lineno, (int)n, line);
+}
+
+/* batch converts every line of file, or of the standard input if file is
+ * NULL. */
+static int batch(char *file, int isa)
+{
+    struct ipconv cv;
+    if(ipconvinit(&cv, IPCONV_HEX2DD, isa, badline) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        return 1;
+    }
+    int in = 0;
+    if(file != NULL) {
+        in = open(file, O_RDONLY);
+        if(in == -1) {
+            fprintf(stderr, "Error: %s: %s\n", file, strerror(errno));
+            return 1;
+        }
+    }
+    int err = ipconvfd(&cv, in, 1);
+    if(in != 0) close(in);
+    if(err != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(err));
+        return 1;
+    }
+    return cv.nbad > 0;
+}
+
 int main(int argc, char **argv)
 {
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <hexadecimal>\n", argv[0]);
+    char *file = NULL;
+    int isa = IPCONV_AUTO;
+    int opt;
+    while((opt = getopt(argc, argv, "f:i:")) != -1) {
+        switch(opt) {
+            case 'f':
+                file = optarg;
+                break;
+            case 'i':
+                if(ipconvisa(optarg, &isa) != 0) {
+                    fprintf(stderr, "Error: unknown isa %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s <hexadecimal> | -f file | -\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(file != NULL && optind == argc) return batch(file, isa);
+    if(file != NULL || optind != argc - 1) {
+        fprintf(stderr, "Usage: %s <hexadecimal> | -f file | -\n", argv[0]);
         return 1;
     }
+    if(strcmp(argv[optind], "-") == 0) return batch(NULL, isa);
 
     /* Convert hexadecimal to integer */
     unsigned int input;
-    if(sscanf(argv[1], "%x", &input) == EOF) {
+    if(sscanf(argv[optind], "%x", &input) == EOF) {
         fprintf(stderr, "Error: %s\n", strerror(errno));
         return 1;
     }
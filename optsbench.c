@@ -0,0 +1,309 @@
+/* optsbench.c - Show the effect of the tcpopts presets on loopback. For
+ * every preset a connection is dialed with tcpdialopt to a listener made
+ * by tcplistenopt with the same preset, and served by a thread, which
+ * either echoes or reads and discards. The benchmark reports the round
+ * trip latency of small messages and the throughput of a stream of small
+ * and of large writes.
+ *
+ * Build:
+ * % make optsbench
+ *
+ * Usage:
+ * % ./optsbench
+ * % ./optsbench -n 200000 -s 128 -m 2048 -p low-latency
+ *
+ * Options:
+ * -n count   number of round trips of the latency test (default: 50000)
+ * -s size    size of the small messages in bytes (default: 64)
+ * -m MB      megabytes of the large write stream (default: 1024); the
+ *            small write stream sends a sixteenth of it
+ * -b bytes   size of the large writes (default: 1048576)
+ * -p preset  run only this preset
+ *
+ * Loopback has no NIC: SO_BUSY_POLL has no device queue to poll there,
+ * and the latency is that of the scheduler and the stack alone.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tcp.h"
+#include "tcphist.h"
+
+enum { BENCH_ECHO, BENCH_SINK };
+
+struct bench {
+    int mode;
+    /* the server side of the connection */
+    int srv;
+    size_t size;
+    int err;
+};
+
+static const char *presets[] = {
+    "default", "low-latency", "bulk-throughput"
+};
+
+static uint64_t nowns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* full reads or writes exactly len bytes, it returns 0 or an errno
+ * value; ECONNRESET stands for an early end of file */
+static int full(int fd, char *buf, size_t len, int wr)
+{
+    while(len > 0) {
+        ssize_t n = wr ? send(fd, buf, len, MSG_NOSIGNAL) :
+            recv(fd, buf, len, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) return errno;
+        if(n == 0) return ECONNRESET;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* benchsrv echoes messages of b->size bytes, or reads and discards until
+ * end of file and then answers with a byte, so the client can stop its
+ * clock when everything arrived. */
+static void *benchsrv(void *arg)
+{
+    struct bench *b = arg;
+    char *buf = malloc(b->size);
+    if(buf == NULL) {
+        b->err = ENOMEM;
+        close(b->srv);
+        return NULL;
+    }
+    if(b->mode == BENCH_ECHO) {
+        while(full(b->srv, buf, b->size, 0) == 0 &&
+                full(b->srv, buf, b->size, 1) == 0) {
+        }
+    } else {
+        for(;;) {
+            ssize_t n = recv(b->srv, buf, b->size, 0);
+            if(n == -1 && errno == EINTR) continue;
+            if(n == -1) b->err = errno;
+            if(n <= 0) break;
+        }
+        if(b->err == 0) b->err = full(b->srv, buf, 1, 1);
+    }
+    free(buf);
+    close(b->srv);
+    return NULL;
+}
+
+/* benchconn dials the listener ln at port with o, and starts the server
+ * thread on the accepted side. */
+static int benchconn(int *cli, int ln, char *port, struct tcpopts *o,
+        struct bench *b, pthread_t *thread)
+{
+    int err = tcpdialopt(cli, "127.0.0.1", port, NULL, o);
+    if(err != 0) return err;
+    err = tcpaccept(&b->srv, ln, 0);
+    if(err != 0) {
+        close(*cli);
+        return err;
+    }
+    /* quick ack mode is not inherited from the listener */
+    if(o->quickack) tcpoptsapply(b->srv, o, 0);
+    b->err = 0;
+    err = pthread_create(thread, NULL, benchsrv, b);
+    if(err != 0) {
+        close(b->srv);
+        close(*cli);
+    }
+    return err;
+}
+
+/* benchrtt times count round trips of size bytes into h. */
+static int benchrtt(int ln, char *port, struct tcpopts *o,
+        struct tcphist *h, long count, size_t size)
+{
+    struct bench b = { BENCH_ECHO, -1, size, 0 };
+    int cli;
+    pthread_t thread;
+    int err = benchconn(&cli, ln, port, o, &b, &thread);
+    if(err != 0) return err;
+
+    char *buf = calloc(1, size);
+    if(buf == NULL) err = ENOMEM;
+    for(long i = 0; i < count && err == 0; i++) {
+        uint64_t t0 = nowns();
+        err = full(cli, buf, size, 1);
+        if(err == 0) err = full(cli, buf, size, 0);
+        tcphistadd(h, nowns() - t0);
+        /* the delayed ack timer is rearmed once quick ack mode ends */
+        if(o->quickack) tcpoptsapply(cli, o, 0);
+    }
+    free(buf);
+    close(cli);
+    pthread_join(thread, NULL);
+    return err != 0 ? err : b.err;
+}
+
+/* benchstream sends total bytes in writes of chunk bytes and returns the
+ * MB/s, or a negative value with errno set. */
+static double benchstream(int ln, char *port, struct tcpopts *o,
+        size_t total, size_t chunk)
+{
+    struct bench b = { BENCH_SINK, -1, chunk > 65536 ? chunk : 65536, 0 };
+    int cli;
+    pthread_t thread;
+    int err = benchconn(&cli, ln, port, o, &b, &thread);
+    if(err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    char *buf = calloc(1, chunk);
+    if(buf == NULL) err = ENOMEM;
+    uint64_t t0 = nowns();
+    for(size_t sent = 0; sent < total && err == 0; sent += chunk) {
+        err = full(cli, buf, chunk, 1);
+    }
+    shutdown(cli, SHUT_WR);
+    char done;
+    if(err == 0) err = full(cli, &done, 1, 0);
+    uint64_t t1 = nowns();
+    free(buf);
+    close(cli);
+    pthread_join(thread, NULL);
+    if(err == 0) err = b.err;
+    if(err != 0) {
+        errno = err;
+        return -1;
+    }
+    return total / 1048576.0 / ((t1 - t0) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    long count = 50000;
+    size_t size = 64;
+    size_t mb = 1024;
+    size_t chunk = 1 << 20;
+    char *only = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:m:b:p:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                chunk = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                only = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-s size] [-m MB] "
+                        "[-b bytes] [-p preset]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(count < 1 || size == 0 || mb == 0 || chunk == 0) {
+        fprintf(stderr, "Usage: %s [-n count] [-s size] [-m MB] "
+                "[-b bytes] [-p preset]\n", argv[0]);
+        return 1;
+    }
+    size_t total = mb << 20;
+    /* whole messages only */
+    size_t small = (total / 16) / size * size;
+    total = total / chunk * chunk;
+
+    printf("%-16s %10s %10s %12s %12s\n", "preset", "p50 us", "p99 us",
+            "small MB/s", "large MB/s");
+    for(size_t p = 0; p < sizeof presets / sizeof presets[0]; p++) {
+        if(only != NULL && strcmp(only, presets[p]) != 0) continue;
+        struct tcpopts o;
+        tcpoptspreset(&o, presets[p]);
+
+        int ln;
+        int err = tcplistenopt(&ln, "127.0.0.1", "0", 0, &o);
+        if(err != 0) {
+            printf("%-16s error: %s\n", presets[p], strerror(err));
+            continue;
+        }
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof addr;
+        getsockname(ln, (struct sockaddr *)&addr, &addrlen);
+        char port[8];
+        snprintf(port, sizeof port, "%d", ntohs(addr.sin_port));
+
+        static struct tcphist h;
+        tcphistinit(&h);
+        err = benchrtt(ln, port, &o, &h, count, size);
+        double smallmbs = -1, largembs = -1;
+        if(err == 0) {
+            smallmbs = benchstream(ln, port, &o, small, size);
+            if(smallmbs < 0) err = errno;
+        }
+        if(err == 0) {
+            largembs = benchstream(ln, port, &o, total, chunk);
+            if(largembs < 0) err = errno;
+        }
+        close(ln);
+        if(err != 0) {
+            printf("%-16s error: %s\n", presets[p], strerror(err));
+            continue;
+        }
+        printf("%-16s %10.2f %10.2f %12.1f %12.1f\n", presets[p],
+                tcphistpct(&h, 50) / 1e3, tcphistpct(&h, 99) / 1e3,
+                smallmbs, largembs);
+    }
+    return 0;
+}
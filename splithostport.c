@@ -1,172 +1,266 @@
+/* splithostport.c - Tests for the tcpsaddr module. Every check is an
+ * assert(3); the program prints the number of passed checks and exits 0,
+ * or aborts on the first failure.
+ *
+ * Build:
+ * % make splithostport
+ *
+ * Usage:
+ * % make test
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
 #include <stdio.h>
-#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-/* The maximum length of TCP hostname are 253 ASCII character; specified 
- * by RFC 952. */
-#define TCP_HOSTLN 254
-/* TCP port is stored in 16-bit integer, the maximum value is 65535; 5
- * digit characters long. */
-#define TCP_PORTLN 6
+#include "tcpsaddr.h"
 
-int tcpsh(char *host, char addr[]);
-int tcpsp(char *port, int colon_i, char addr[]);
-int tcpsaddr(char *host, char *port, char addr[]);
+static int nchecks;
 
-enum {
-    TCP_INVH = 1,
-    TCP_INVP
-};
+#define CHECK(e) do { assert(e); nchecks++; } while(0)
 
-int main()
+/* valid splits the valid address addr and checks the host and the port. */
+static void valid(char addr[], char *wanthost, char *wantport)
 {
     char host[TCP_HOSTLN];
     char port[TCP_PORTLN];
 
-    /* valid example */
-    char addr1[] = "localhost:8080";
-    char addr2[] = "some.example.com:80";
-
-    assert(tcpsaddr(host, port, addr1) == 0);
-    printf("host: %s; port: %s\n", host, port);
-    assert(tcpsaddr(host, port, addr2) == 0);
-    printf("host: %s; port: %s\n", host, port);
-
-    /* invalid host */
-    char addr3[] = "*invalidch^r:8080";
-    char addr4[] = "invalid8080";
-    char addr5[] = ":8080";
-    char addr6[] = "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz0123456789"
-                       "abcdefijklmnopqrstuvwxyz01234:5678";
-
-    assert(tcpsaddr(host, port, addr3) == TCP_INVH);
-    assert(tcpsaddr(host, port, addr4) == TCP_INVH);
-    assert(tcpsaddr(host, port, addr5) == TCP_INVH);
-    assert(tcpsaddr(host, port, addr6) == TCP_INVH);
-
-
-    /* invalid port */
-    char addr7[] = "host:abc";
-    char addr8[] = "host:123456";
-    char addr9[] = "host:";
-    char addr10[] = "host:8080:extra";
-
-    assert(tcpsaddr(host, port, addr7) == TCP_INVP);
-    assert(tcpsaddr(host, port, addr8) == TCP_INVP);
-    assert(tcpsaddr(host, port, addr9) == TCP_INVP);
-    assert(tcpsaddr(host, port, addr10) == TCP_INVP);
+    CHECK(tcpsaddr(host, port, addr) == 0);
+    CHECK(strcmp(host, wanthost) == 0);
+    CHECK(strcmp(port, wantport) == 0);
 
+    struct tcpsplit sp;
+    CHECK(tcpsplit(&sp, addr) == 0);
+    CHECK(sp.err == 0);
+    CHECK(sp.hostlen == (int)strlen(wanthost));
+    CHECK(memcmp(addr + sp.hostoff, wanthost, sp.hostlen) == 0);
+    int portnum = 0;
+    sscanf(wantport, "%d", &portnum);
+    CHECK(sp.port == portnum);
 }
 
-/* tcpsh: splits TCP hostname from the host:port address format and write to
- * *host. This function will start reading the hostport[] from the first index 
- * until the ':' character.
- * 
- * Valid ASCII character for hostname are a-zA-Z0-9 and {'.','-'} as specified 
- * by RFC 952. The maximum length of hostname are 253 ASCII characters.
- *
- * This function do not write more than TCP_HOSTLN bytes (including the
- * terminating null byte ('\0')) to *host. The size of *host should equal 
- * to or greater than TCP_HOSTLN bytes.
- *
- * Upon successful return, this function return the number or bytes that 
- * succesfully written to *host. If the hostname is invalid or ':' character
- * is not found in hostport[], -1 will be returned. */
-int tcpsh(char *host, char hostport[])
+/* invalid checks that addr is rejected with err by both interfaces. */
+static void invalid(char addr[], int err)
 {
-    int nbytes = 0;
+    char host[TCP_HOSTLN];
+    char port[TCP_PORTLN];
+
+    CHECK(tcpsaddr(host, port, addr) == err);
+    CHECK(host[0] == '\0' && port[0] == '\0');
 
-    for(int i = 0; hostport[i] != '\0' && hostport[i] != ':'; i++) {
-        /* current character */
-        char c = hostport[i];
+    struct tcpsplit sp;
+    CHECK(tcpsplit(&sp, addr) == err);
+    CHECK(sp.err == err);
+}
 
-        /* hostname validation */
-        if(!(isalnum(c) || (c == '-') || (c == '.')) || (i >= (TCP_HOSTLN-1))) {
-            host[0] = '\0';
-            return -1;
-        };
+static void testhost(void)
+{
+    valid("localhost:8080", "localhost", "8080");
+    valid("some.example.com:80", "some.example.com", "80");
+    valid("A-Z.example.COM:1", "A-Z.example.COM", "1");
+    valid("10.0.0.1:0", "10.0.0.1", "0");
 
-        /* write to *host */
-        host[i] = c;
-        nbytes = i + 1;
-    }
+    /* the vector code classifies 16 bytes at a time; put the separator
+     * and the bad characters on both sides of every block boundary */
+    char addr[TCP_HOSTLN + 16];
+    char want[TCP_HOSTLN];
+    for(int n = 1; n <= TCP_HOSTLN - 1; n++) {
+        memset(addr, 'a', n);
+        strcpy(addr + n, ":9");
+        memcpy(want, addr, n);
+        want[n] = '\0';
+        valid(addr, want, "9");
 
-    if(nbytes == 0 || hostport[nbytes] != ':') {
-        host[0] = '\0';
-        return -1;
+        for(int bad = 0; bad < n; bad += 7) {
+            addr[bad] = '_';
+            invalid(addr, TCP_INVH);
+            addr[bad] = 'a';
+        }
     }
+    memset(addr, 'a', TCP_HOSTLN);
+    strcpy(addr + TCP_HOSTLN, ":9");
+    invalid(addr, TCP_INVH);
+
+    /* bytes with the high bit set are not letters in any locale */
+    invalid("h\xc3\xa9llo:80", TCP_INVH);
+    invalid("host\x80:80", TCP_INVH);
+    invalid("ho/st:80", TCP_INVH);
+    invalid("ho@st:80", TCP_INVH);
 
-    host[nbytes] = '\0';
-    return nbytes;
+    invalid("*invalidch^r:8080", TCP_INVH);
+    invalid("invalid8080", TCP_INVH);
+    invalid(":8080", TCP_INVH);
+    invalid("", TCP_INVH);
+    invalid("abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz0123456789"
+            "abcdefijklmnopqrstuvwxyz01234:5678", TCP_INVH);
 }
 
-/* tcpsp: splits port from the host:port format address and write to *port.
- * This function will start reading the hostport[] from colon_i index until
- * the null character.
- * 
- * Since port is stored in 16-bit interger, valid port are only a 5 digit 
- * ASCII characters long.
- * 
- * This function do not write more than TCP_PORTLN bytes (including the
- * terminating null byte ('\0')) to *port. The length of *port should 
- * equal to or greater than TCP_PORTLN bytes.
- * 
- * Upon successful return, this function returns the number of bytes that
- * succesfully written to *port. If the port is invalid, -1 is returned */
-int tcpsp(char *port, int colon_i, char hostport[])
+static void testport(void)
+{
+    valid("host:65535", "host", "65535");
+    valid("host:00080", "host", "00080");
+
+    invalid("host:abc", TCP_INVP);
+    invalid("host:123456", TCP_INVP);
+    invalid("host:65536", TCP_INVP);
+    invalid("host:99999", TCP_INVP);
+    invalid("host:", TCP_INVP);
+    invalid("host:8080:extra", TCP_INVP);
+    invalid("host:-1", TCP_INVP);
+    invalid("host: 80", TCP_INVP);
+    invalid("host:80 ", TCP_INVP);
+}
+
+static void testv6(void)
+{
+    valid("[::1]:8080", "::1", "8080");
+    valid("[::]:80", "::", "80");
+    valid("[2001:db8::ff00:42:8329]:443", "2001:db8::ff00:42:8329", "443");
+    valid("[::ffff:192.0.2.128]:25", "::ffff:192.0.2.128", "25");
+    valid("[fe80::1%eth0]:22", "fe80::1%eth0", "22");
+    valid("[1:2:3:4:5:6:7:8]:1", "1:2:3:4:5:6:7:8", "1");
+
+    invalid("::1:8080", TCP_INVH);
+    invalid("[::1]", TCP_INVH);
+    invalid("[::1]8080", TCP_INVH);
+    invalid("[::1:8080", TCP_INVH);
+    invalid("[]:80", TCP_INVH);
+    invalid("[localhost]:80", TCP_INVH);
+    invalid("[1.2.3.4]:80", TCP_INVH);
+    invalid("[1:2:3:4:5:6:7:8:9]:80", TCP_INVH);
+    invalid("[fe80::1%]:22", TCP_INVH);
+    invalid("[fe80::1%e^h0]:22", TCP_INVH);
+    invalid("[::1]:", TCP_INVP);
+    invalid("[::1]:70000", TCP_INVP);
+}
+
+static void testsplit(void)
 {
-    int port_i = 0;
+    char host[TCP_HOSTLN];
+    char port[TCP_PORTLN];
 
-    /* handle invalid "host:" format */
-    if(hostport[colon_i] != ':') return -1;
+    CHECK(tcpsh(host, "localhost:8080") == 9);
+    CHECK(strcmp(host, "localhost") == 0);
+    CHECK(tcpsp(port, 9, "localhost:8080") == 4);
+    CHECK(strcmp(port, "8080") == 0);
 
-    for(int i = colon_i+1; hostport[i] != '\0'; i++) {
-        /* current character */
-        char c = hostport[i];
+    CHECK(tcpsh(host, "[::1]:8080") == 5);
+    CHECK(strcmp(host, "::1") == 0);
+    CHECK(tcpsp(port, 5, "[::1]:8080") == 4);
 
-        /* validate the port */
-        if(!isdigit(c) || port_i >= (TCP_PORTLN-1)) {
-            port[0] = '\0';
-            return -1;
-        }
+    CHECK(tcpsh(host, "no-port") == -1);
+    CHECK(host[0] == '\0');
+    CHECK(tcpsp(port, 4, "host-8080") == -1);
+    CHECK(tcpsp(port, 4, "host:123456") == -1);
+    CHECK(port[0] == '\0');
+}
 
-        /* write to _port_ */
-        port[port_i] = c;
-        port_i++;
-    }
+static void testbatch(void)
+{
+    char *addrs[] = {
+        "localhost:8080", "[::1]:80", "bad", "host:99999", "a:1"
+    };
+    int want[] = { 0, 0, TCP_INVH, TCP_INVP, 0 };
+    int n = sizeof addrs / sizeof addrs[0];
+    struct tcpsplit sp[sizeof addrs / sizeof addrs[0]];
 
-    if(port_i == 0) {
-        port[0] = '\0';
-        return -1;
+    CHECK(tcpsaddrv(sp, addrs, n) == 2);
+    for(int i = 0; i < n; i++) {
+        struct tcpsplit one;
+        tcpsplit(&one, addrs[i]);
+        CHECK(sp[i].err == want[i]);
+        CHECK(memcmp(&sp[i], &one, sizeof one) == 0);
     }
+    CHECK(sp[1].hostoff == 1 && sp[1].hostlen == 3 && sp[1].port == 80);
+    CHECK(tcpsaddrv(sp, addrs, 0) == 0);
+}
+
+static void testunix(void)
+{
+    struct sockaddr_un sun;
+    socklen_t len;
+    socklen_t base = offsetof(struct sockaddr_un, sun_path);
+
+    CHECK(tcpsunix(&sun, &len, "unix:/tmp/echo.sock") == 14);
+    CHECK(sun.sun_family == AF_UNIX);
+    CHECK(strcmp(sun.sun_path, "/tmp/echo.sock") == 0);
+    CHECK(len == base + 15);
+
+    /* an abstract name starts with a null byte and is not terminated */
+    CHECK(tcpsunix(&sun, &len, "unix:@echo") == 5);
+    CHECK(sun.sun_path[0] == '\0' && memcmp(sun.sun_path + 1, "echo", 4) == 0);
+    CHECK(len == base + 5);
 
-    port[port_i] = '\0';
-    return port_i;
+    CHECK(tcpsunix(NULL, NULL, "unix:relative/path") == 13);
+    CHECK(tcpsunix(NULL, NULL, "localhost:8080") == 0);
+    CHECK(tcpsunix(NULL, NULL, "unix") == 0);
+    CHECK(tcpsunix(NULL, NULL, NULL) == 0);
+    CHECK(tcpsunix(NULL, NULL, "unix:") == -1);
+    CHECK(tcpsunix(NULL, NULL, "unix:@") == -1);
+
+    /* the path and its null byte must fit in sun_path */
+    char addr[TCP_UNIXLN + 16] = TCP_UNIXPFX;
+    int pfx = strlen(addr);
+    memset(addr + pfx, 'a', TCP_UNIXLN);
+    addr[pfx + TCP_UNIXLN] = '\0';
+    CHECK(tcpsunix(&sun, &len, addr) == -1);
+    addr[pfx + TCP_UNIXLN - 1] = '\0';
+    CHECK(tcpsunix(&sun, &len, addr) == TCP_UNIXLN - 1);
+    CHECK(len == base + TCP_UNIXLN);
+    CHECK((size_t)len <= sizeof sun);
+
+    /* to tcpsplit it is the host "unix" with an invalid port */
+    invalid("unix:/tmp/echo.sock", TCP_INVP);
 }
 
-/* tcpsaddr: splits host and port from address addr[] and write to *host
- * and *port.
- *
- * This function combine tcpsh() and tcpsp() functions. The size of *host 
- * and *port should equal to or greater than TCP_HOSTLN and TCP_PORTLN.
- *
- * It returns 0 if successfully split host and port. 
- * It returns TCP_INVH if the host is invalid.
- * It returns TCP_INVP if the port is invalid.
- */
-int tcpsaddr(char *host, char *port, char addr[])
+int main()
 {
-    int colon_i = tcpsh(host, addr);
-    if(colon_i == -1) return TCP_INVH;
-    int res = tcpsp(port, colon_i, addr);
-    if(res == -1) return TCP_INVP;
+    testhost();
+    testport();
+    testv6();
+    testsplit();
+    testbatch();
+    testunix();
+    printf("splithostport: %d checks passed\n", nchecks);
     return 0;
 }
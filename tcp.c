@@ -29,17 +29,92 @@
  */
 
 /* This macro causes system header files to expose definitions corresponding 
- * to the POSIX.1-2008 base specification (excluding the XSI extension). */
-#define _POSIX_C_SOURCE 200809L
+ * to the POSIX.1-2008 base specification and the Linux extensions, such as
+ * accept4(2), SOCK_NONBLOCK and MSG_CMSG_CLOEXEC, used by this module. */
+#define _GNU_SOURCE
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include "tcp.h"
+#include "tcpacl.h"
+#include "tcpresolv.h"
+#include "tcpsaddr.h"
+#include "tcpstat.h"
+
+static int tcpdialunix(int *conn, struct sockaddr_un *sun, socklen_t len,
+        struct timespec *deadline, struct tcpopts *opts);
+static int tcplistenunix(int *ln, struct sockaddr_un *sun, socklen_t len,
+        int flags, struct tcpopts *opts);
+static int tcpdialaddrs(int *conn, char host[], char port[],
+        struct timespec *deadline, struct tcpopts *opts);
+static int tcpdialrace(int *conn, struct tcpaddr *addrs[], int naddrs,
+        int proto, struct timespec *deadline, struct tcpopts *opts);
+
+/* tcpgaierr maps a getaddrinfo(3) error code to errno and returns it. */
+int tcpgaierr(int gaierr)
+{
+    switch(gaierr) {
+        case EAI_AGAIN:
+            errno = ENETUNREACH;
+            break;
+        case EAI_FAIL:
+            errno = ENETDOWN;
+            break;
+        case EAI_MEMORY:
+            errno = ENOMEM;
+            break;
+        case EAI_NONAME:
+        case EAI_SERVICE:
+            errno = EINVAL;
+            break;
+        case EAI_SYSTEM:
+            /* errno is already set by getaddrinfo */
+            break;
+        default:
+            errno = EINVAL;
+            break;
+    }
+    return errno;
+}
+
+static void tcpmsadd(struct timespec *ts, int ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if(ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* tcpmsuntil returns the number of milliseconds from now until ts, rounded
+ * up, or 0 if ts has passed. */
+static int tcpmsuntil(struct timespec *ts, struct timespec *now)
+{
+    long long ms = (long long)(ts->tv_sec - now->tv_sec) * 1000 +
+        (ts->tv_nsec - now->tv_nsec + 999999) / 1000000;
+    if(ms <= 0) return 0;
+    if(ms > 0x7fffffff) return 0x7fffffff;
+    return (int)ms;
+}
 
 /* tcpdial connects to a TCP server. It supports IPV4 and IPV6.
  * 
@@ -47,6 +122,11 @@
  * connection is write into. The second and the third one is the host and port
  * of TCP server to connect to.
  *
+ * If host is a Unix domain socket address as recognized by tcpsunix, e.g.
+ * "unix:/run/echo.sock" or "unix:@echo", an AF_UNIX stream socket is
+ * connected instead and port is ignored. On the same host it skips the
+ * TCP/IP stack and has a lower latency than a loopback connection.
+ *
  * If the function succeeds it returns 0 and the enpoint of connection can be
  * used by send(2) and recv(2).
  * If the function fails, it returns and set errno to one of the following 
@@ -69,10 +149,18 @@
  * The name server is down.
  *
  * EINVAL
- * The host or port is invalid.
+ * The host or port is invalid, or the path of a Unix address is empty or
+ * longer than TCP_UNIXLN - 1 bytes.
+ *
+ * ENOENT
+ * The path of a Unix address does not exist.
  *
  * ENOTCONN
- * The socket is not connected.
+ * The host has no address to connect to.
+ *
+ * ECONNREFUSED, ETIMEDOUT, ...
+ * No address could be connected; the error of the last attempt is returned.
+ * See tcpdialdl for how the addresses are tried.
  *
  * Other system error may returned, check errno for the details.
  *
@@ -85,63 +173,981 @@
  */
 int tcpdial(int *conn, char host[], char port[])
 {
-    /* get the TCP protocol number from the host; 
-     * conforming to POSIX.1-2001 */
+    return tcpdialdl(conn, host, port, NULL);
+}
+
+/* tcpdialdl connects to a TCP server like tcpdial, but gives up when the
+ * absolute CLOCK_MONOTONIC time *deadline has passed. If deadline is NULL,
+ * it waits for as long as the kernel connect timeout.
+ *
+ * Every resolved address is tried with its own non-blocking socket. The
+ * attempts are raced as described by RFC 8305 "Happy Eyeballs": the address
+ * families are interleaved, a new attempt is started every TCP_DIALDELAY
+ * milliseconds, or as soon as the previous one fails, while the earlier
+ * attempts keep running. The first connection to complete wins and the
+ * others are closed. A dead address therefore costs TCP_DIALDELAY instead
+ * of a full connect timeout.
+ *
+ * The time and the outcome of every dial are counted by tcpstatdial.
+ *
+ * With the environment variable TCP_HOSTCACHE set to a file, the addresses
+ * resolved by a previous run are dialed at once on a cold start and
+ * refreshed in the background, and they keep being used while the name
+ * servers are unreachable; see tcpresolvsnap.
+ *
+ * On success the connection is returned in blocking mode, as by tcpdial.
+ * Besides the errors of tcpdial, it returns:
+ *
+ * ETIMEDOUT
+ * The deadline expired before any attempt succeeded.
+ *
+ * Example
+ *     int conn;
+ *     struct timespec dl;
+ *     tcpdeadline(&dl, 2000);
+ *     int errdial = tcpdialdl(&conn, "localhost", "9090", &dl);
+ */
+int tcpdialdl(int *conn, char host[], char port[], struct timespec *deadline)
+{
+    return tcpdialopt(conn, host, port, deadline, NULL);
+}
+
+/* tcpdialopt connects like tcpdialdl and sets the socket options opts,
+ * which may be NULL, on every attempt before its connect(2), so that the
+ * buffer sizes are in place for the window scale of the handshake.
+ * Options the kernel or the privileges of the process do not allow, e.g.
+ * a SO_BUSY_POLL above net.core.busy_read without CAP_NET_ADMIN, are
+ * skipped.
+ *
+ * With opts->fastopen and a Fast Open cookie cached for the server, the
+ * connect completes at once and the SYN goes out with the first write, so
+ * the first address wins without a race. The client side of Fast Open
+ * must be enabled in net.ipv4.tcp_fastopen, as it is by default.
+ *
+ * Example
+ *     struct tcpopts o;
+ *     tcpoptspreset(&o, "low-latency");
+ *     int conn;
+ *     int errdial = tcpdialopt(&conn, "localhost", "9090", NULL, &o);
+ */
+int tcpdialopt(int *conn, char host[], char port[], struct timespec *deadline,
+        struct tcpopts *opts)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = tcpdialaddrs(conn, host, port, deadline, opts);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tcpstatdial((int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+            (end.tv_nsec - start.tv_nsec), err);
+    errno = err;
+    return errno;
+}
+
+/* tcpdialaddrs resolves host:port and dials the addresses for tcpdialdl. */
+static int tcpdialaddrs(int *conn, char host[], char port[],
+        struct timespec *deadline, struct tcpopts *opts)
+{
+    struct sockaddr_un sun;
+    socklen_t sunlen;
+    int unixlen = tcpsunix(&sun, &sunlen, host);
+    if(unixlen != 0) {
+        if(unixlen == -1) {
+            errno = EINVAL;
+            return errno;
+        }
+        errno = tcpdialunix(conn, &sun, sunlen, deadline, opts);
+        return errno;
+    }
+
     struct protoent *tcpproto = getprotobyname("tcp");
     if(tcpproto == NULL) {
         errno = ENOPROTOOPT;
         return errno;
     }
 
-    /* create a socket; conforming to POSIX.1-2001 */
-    *conn = socket(AF_INET, SOCK_STREAM, tcpproto->p_proto);
-    if(*conn == -1) {
+    /* resolve through the caching resolver, so a slow name server can
+     * only hold the caller until the deadline */
+    struct tcpaddrs tcpaddrs;
+    int errresolv = tcpresolve(tcpresolvdefault(), &tcpaddrs, host, port,
+            deadline);
+    if(errresolv != 0) {
+        errno = errresolv;
+        return errno;
+    }
+
+    /* interleave the address families, starting with the family of the
+     * first address that getaddrinfo(3) prefers */
+    struct tcpaddr *addrs[TCP_RESOLVMAX];
+    int naddrs = 0;
+    int first = tcpaddrs.addr[0].u.sa.sa_family;
+    int fi = 0, oi = 0;
+    while(naddrs < tcpaddrs.n) {
+        while(fi < tcpaddrs.n && tcpaddrs.addr[fi].u.sa.sa_family != first) {
+            fi++;
+        }
+        while(oi < tcpaddrs.n && tcpaddrs.addr[oi].u.sa.sa_family == first) {
+            oi++;
+        }
+        if(fi < tcpaddrs.n) addrs[naddrs++] = &tcpaddrs.addr[fi++];
+        if(oi < tcpaddrs.n) addrs[naddrs++] = &tcpaddrs.addr[oi++];
+    }
+
+    errno = tcpdialrace(conn, addrs, naddrs, tcpproto->p_proto, deadline,
+            opts);
+    return errno;
+}
+
+/* tcpdialrace races non-blocking connects to addrs[0..naddrs-1] in order,
+ * starting a new attempt every TCP_DIALDELAY milliseconds or as soon as the
+ * previous attempt fails. */
+static int tcpdialrace(int *conn, struct tcpaddr *addrs[], int naddrs,
+        int proto, struct timespec *deadline, struct tcpopts *opts)
+{
+    struct pollfd pfds[TCP_RESOLVMAX];
+    int npfds = 0;
+    int next = 0;
+    int errdial = ENOTCONN;
+    int winner = -1;
+    struct timespec nextstart, now;
+    clock_gettime(CLOCK_MONOTONIC, &nextstart);
+
+    while(winner == -1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(deadline != NULL && tcpmsuntil(deadline, &now) == 0) {
+            errdial = ETIMEDOUT;
+            break;
+        }
+
+        /* start the next attempt when the previous one failed or when the
+         * attempt delay is over */
+        if(next < naddrs &&
+                (npfds == 0 || tcpmsuntil(&nextstart, &now) == 0)) {
+            struct tcpaddr *ai = addrs[next++];
+            int fd = socket(ai->u.sa.sa_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, proto);
+            if(fd == -1) {
+                errdial = errno;
+                continue;
+            }
+            if(opts != NULL) tcpoptsapply(fd, opts, 0);
+            if(connect(fd, &ai->u.sa, ai->len) == 0) {
+                winner = fd;
+                break;
+            }
+            if(errno != EINPROGRESS) {
+                errdial = errno;
+                close(fd);
+                continue;
+            }
+            pfds[npfds].fd = fd;
+            pfds[npfds].events = POLLOUT;
+            npfds++;
+            nextstart = now;
+            tcpmsadd(&nextstart, TCP_DIALDELAY);
+        }
+        if(npfds == 0) {
+            if(next < naddrs) continue;
+            break;
+        }
+
+        int timeout = -1;
+        if(next < naddrs) timeout = tcpmsuntil(&nextstart, &now);
+        if(deadline != NULL) {
+            int dlms = tcpmsuntil(deadline, &now);
+            if(timeout == -1 || dlms < timeout) timeout = dlms;
+        }
+
+        int nready = poll(pfds, npfds, timeout);
+        if(nready == -1 && errno != EINTR) {
+            errdial = errno;
+            break;
+        }
+        for(int i = 0; nready > 0 && i < npfds; i++) {
+            if(pfds[i].revents == 0) continue;
+            int err = 0;
+            socklen_t errlen = sizeof err;
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+            if(err == 0) {
+                winner = pfds[i].fd;
+                pfds[i] = pfds[--npfds];
+                break;
+            }
+            /* the attempt failed, drop it and start the next one right
+             * away */
+            errdial = err;
+            close(pfds[i].fd);
+            pfds[i--] = pfds[--npfds];
+            clock_gettime(CLOCK_MONOTONIC, &nextstart);
+        }
+    }
+
+    for(int i = 0; i < npfds; i++) {
+        close(pfds[i].fd);
+    }
+    if(winner == -1) return errdial;
+
+    /* hand out a blocking connection like tcpdial always did */
+    int fl = fcntl(winner, F_GETFL);
+    if(fl != -1) fcntl(winner, F_SETFL, fl & ~O_NONBLOCK);
+    /* the kernel leaves quick ack mode on its own, ask again now that the
+     * data can flow */
+    if(opts != NULL && opts->quickack) {
+        int on = 1;
+        setsockopt(winner, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof on);
+    }
+    *conn = winner;
+    return 0;
+}
+
+/* tcpdialunix connects an AF_UNIX stream socket to sun for tcpdialdl.
+ * Unlike TCP, a Unix connect(2) either completes at once or waits for room
+ * in the backlog of the listener, and a non-blocking one fails with EAGAIN
+ * that cannot be polled for, so the deadline is enforced by SO_SNDTIMEO,
+ * which bounds that wait. */
+static int tcpdialunix(int *conn, struct sockaddr_un *sun, socklen_t len,
+        struct timespec *deadline, struct tcpopts *opts)
+{
+    *conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(*conn == -1) return errno;
+    if(opts != NULL) tcpoptsapply(*conn, opts, 0);
+
+    struct timeval tv = { 0, 0 };
+    if(deadline != NULL) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int ms = tcpmsuntil(deadline, &now);
+        if(ms <= 0) {
+            close(*conn);
+            *conn = -1;
+            errno = ETIMEDOUT;
+            return errno;
+        }
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = ms % 1000 * 1000;
+        setsockopt(*conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    }
+
+    int err = 0;
+    if(connect(*conn, (struct sockaddr *)sun, len) == -1) {
+        err = errno == EAGAIN || errno == EINPROGRESS ? ETIMEDOUT : errno;
+        close(*conn);
+        *conn = -1;
+        errno = err;
+        return errno;
+    }
+    if(deadline != NULL) {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        setsockopt(*conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    }
+    return 0;
+}
+
+/* tcpdeadline write into *dl the absolute CLOCK_MONOTONIC time that is ms
+ * milliseconds from now, for use as the deadline of tcpdialdl. */
+void tcpdeadline(struct timespec *dl, int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, dl);
+    tcpmsadd(dl, ms);
+}
+
+/* tcplisten creates a TCP socket that listens for incoming connections.
+ *
+ * The first parameter is the pointer of integer where the listening socket
+ * is write into. The second and the third one is the host and port to bind
+ * to. If host is NULL or an empty string, the socket is bound to the
+ * wildcard address of every available address family.
+ *
+ * The flags parameter is zero or the bitwise OR of:
+ *
+ * TCP_NONBLOCK
+ * Put the listening socket into non-blocking mode, so it can be driven by
+ * an event loop. tcpaccept(2) returns EAGAIN when no connection is pending.
+ *
+ * TCP_REUSEPORT
+ * Set SO_REUSEPORT, so several sockets can listen on the same address and
+ * the kernel spreads incoming connections between them.
+ *
+ * If host is a Unix domain socket address as recognized by tcpsunix, an
+ * AF_UNIX stream socket is bound to its path and port is ignored. A stale
+ * socket file left by a server that exited is removed first; a path that
+ * another server listens on, or that is not a socket, is left alone and
+ * EADDRINUSE is returned. Linux has no SO_REUSEPORT group for AF_UNIX, so
+ * TCP_REUSEPORT is ignored: share the one listener, e.g. with dup(2) or
+ * tcpsendfd, instead. The socket file is not removed by close(2); the
+ * caller should unlink(2) it when the server stops.
+ *
+ * If the function succeeds it returns 0 and the listening socket can be
+ * passed to tcpaccept. If the function fails, it returns and set errno to
+ * the same values as tcpdial, or:
+ *
+ * EADDRINUSE
+ * Another socket is already listening on the same address.
+ *
+ * Example
+ *     int ln;
+ *     int errlisten = tcplisten(&ln, NULL, "9090", TCP_NONBLOCK);
+ *     if(errlisten != 0) {
+ *         fprintf(stderr, "E: tcplisten %s\n", strerror(errlisten));
+ *     }
+ */
+int tcplisten(int *ln, char host[], char port[], int flags)
+{
+    return tcplistenopt(ln, host, port, flags, NULL);
+}
+
+/* tcplistenopt listens like tcplisten and sets the socket options opts,
+ * which may be NULL, on the listening socket before listen(2). Accepted
+ * connections inherit them from the listener, so a server does not set
+ * them one connection at a time; only the transient TCP_QUICKACK has to
+ * be set again with tcpoptsapply. Options that are not allowed are
+ * skipped as by tcpdialopt.
+ *
+ * Fast Open is only accepted when the server side is enabled in
+ * net.ipv4.tcp_fastopen, e.g. by setting it to 3.
+ *
+ * Example
+ *     struct tcpopts o;
+ *     tcpoptspreset(&o, "bulk-throughput");
+ *     int ln;
+ *     int errlisten = tcplistenopt(&ln, NULL, "9090", 0, &o);
+ */
+int tcplistenopt(int *ln, char host[], char port[], int flags,
+        struct tcpopts *opts)
+{
+    struct sockaddr_un sun;
+    socklen_t sunlen;
+    int unixlen = tcpsunix(&sun, &sunlen, host);
+    if(unixlen != 0) {
+        if(unixlen == -1) {
+            errno = EINVAL;
+            return errno;
+        }
+        errno = tcplistenunix(ln, &sun, sunlen, flags, opts);
+        return errno;
+    }
+
+    struct protoent *tcpproto = getprotobyname("tcp");
+    if(tcpproto == NULL) {
+        errno = ENOPROTOOPT;
         return errno;
     }
 
-    /* create a socket address; conforming to POSIX.1-2001 */
     struct addrinfo tcphints, *tcpsockaddr;
     memset(&tcphints, 0, sizeof tcphints);
     tcphints.ai_family = AF_UNSPEC;
     tcphints.ai_socktype = SOCK_STREAM;
     tcphints.ai_protocol = tcpproto->p_proto;
-    errno = getaddrinfo(host, port, &tcphints, &tcpsockaddr);
-    if(errno != 0) {
-        switch(errno) {
-            case EAI_AGAIN:
-                errno = ENETUNREACH;
-                break;
-            case EAI_FAIL:
-                errno = ENETDOWN;
-                break;
-            case EAI_MEMORY:
-                errno = ENOMEM;
-                break;
-            case EAI_NONAME:
-            case EAI_SERVICE:
-                errno = EINVAL;
-                break;
-            default:
+    tcphints.ai_flags = AI_PASSIVE;
+    if(host != NULL && host[0] == '\0') host = NULL;
+    int gaierr = getaddrinfo(host, port, &tcphints, &tcpsockaddr);
+    if(gaierr != 0) {
+        return tcpgaierr(gaierr);
+    }
+
+    /* prefer the IPv6 wildcard address since it also accepts IPv4
+     * connections as v4-mapped addresses */
+    struct addrinfo *addri = tcpsockaddr;
+    if(host == NULL) {
+        for(struct addrinfo *a = tcpsockaddr; a != NULL; a = a->ai_next) {
+            if(a->ai_family == AF_INET6) {
+                addri = a;
                 break;
+            }
         }
-        return errno;
     }
 
-    /* iterate over returned address & test the connection for each address */
-    struct addrinfo *addri;
-    for(addri = tcpsockaddr; addri != NULL; addri = addri->ai_next) {
-        /* try connect to a socket address; conforming to POSIX.1-2001 */
-        int retcon = connect(*conn, addri->ai_addr, addri->ai_addrlen);
-        if(retcon != 0) {
-            /* continue until we can connect to the address */
+    int type = SOCK_STREAM | SOCK_CLOEXEC;
+    if(flags & TCP_NONBLOCK) type |= SOCK_NONBLOCK;
+
+    int errlisten = ENOTCONN;
+    for(; addri != NULL; addri = addri->ai_next) {
+        *ln = socket(addri->ai_family, type, tcpproto->p_proto);
+        if(*ln == -1) {
+            errlisten = errno;
             continue;
         }
-        break;
+
+        /* allow the server to restart while old connections are still in
+         * TIME_WAIT state */
+        int on = 1;
+        setsockopt(*ln, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+        if((flags & TCP_REUSEPORT) &&
+                setsockopt(*ln, SOL_SOCKET, SO_REUSEPORT, &on,
+                    sizeof on) == -1) {
+            errlisten = errno;
+            close(*ln);
+            *ln = -1;
+            continue;
+        }
+        if(addri->ai_family == AF_INET6 && host == NULL) {
+            int off = 0;
+            setsockopt(*ln, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof off);
+        }
+        if(opts != NULL) tcpoptsapply(*ln, opts, 1);
+
+        if(bind(*ln, addri->ai_addr, addri->ai_addrlen) == 0 &&
+                listen(*ln, SOMAXCONN) == 0) {
+            errlisten = 0;
+            break;
+        }
+        errlisten = errno;
+        close(*ln);
+        *ln = -1;
+    }
+    freeaddrinfo(tcpsockaddr);
+
+    errno = errlisten;
+    return errno;
+}
+
+/* tcpunixstale reports whether the path of sun is a socket file that no
+ * process listens on. */
+static int tcpunixstale(struct sockaddr_un *sun, socklen_t len)
+{
+    struct stat st;
+    if(sun->sun_path[0] == '\0' || lstat(sun->sun_path, &st) == -1 ||
+            !S_ISSOCK(st.st_mode)) {
+        return 0;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(probe == -1) return 0;
+    int stale = connect(probe, (struct sockaddr *)sun, len) == -1 &&
+        errno == ECONNREFUSED;
+    close(probe);
+    return stale;
+}
+
+/* tcplistenunix binds and listens on the AF_UNIX address sun for
+ * tcplisten. */
+static int tcplistenunix(int *ln, struct sockaddr_un *sun, socklen_t len,
+        int flags, struct tcpopts *opts)
+{
+    int type = SOCK_STREAM | SOCK_CLOEXEC;
+    if(flags & TCP_NONBLOCK) type |= SOCK_NONBLOCK;
+    *ln = socket(AF_UNIX, type, 0);
+    if(*ln == -1) return errno;
+    if(opts != NULL) tcpoptsapply(*ln, opts, 1);
+
+    int err = 0;
+    if(bind(*ln, (struct sockaddr *)sun, len) == -1) {
+        err = errno;
+        if(err == EADDRINUSE && tcpunixstale(sun, len) &&
+                unlink(sun->sun_path) == 0) {
+            err = bind(*ln, (struct sockaddr *)sun, len) == -1 ? errno : 0;
+        }
+    }
+    if(err == 0 && listen(*ln, SOMAXCONN) == -1) err = errno;
+    if(err != 0) {
+        close(*ln);
+        *ln = -1;
+    }
+    errno = err;
+    return errno;
+}
+
+/* tcpoptsinit sets every option of *o to the kernel default. */
+void tcpoptsinit(struct tcpopts *o)
+{
+    memset(o, 0, sizeof *o);
+    o->incomingcpu = -1;
+}
+
+/* tcpoptspreset fills *o with the named set of options:
+ *
+ * "default"
+ * The kernel defaults, as set by tcpoptsinit.
+ *
+ * "low-latency"
+ * For request and response traffic of small messages: TCP_NODELAY,
+ * TCP_QUICKACK, Fast Open, a TCP_NOTSENT_LOWAT of 16 KB so a writer
+ * polling for room does not queue more than the peer needs right now,
+ * and 50 microseconds of SO_BUSY_POLL, which only pays off on a NIC
+ * with a busy poll capable driver and needs CAP_NET_ADMIN above the
+ * net.core.busy_read default.
+ *
+ * "bulk-throughput"
+ * For long transfers: Nagle's algorithm stays on to fill the segments,
+ * the buffers are left to the autotuning of the kernel, which grows them
+ * up to net.ipv4.tcp_wmem and tcp_rmem where fixed sizes are capped by
+ * net.core.wmem_max, a TCP_NOTSENT_LOWAT of 128 KB keeps the queue of
+ * unsent data, not the data in flight, short so the writer refills it
+ * while its buffer is still in cache, and keepalive probes after 60
+ * seconds of silence detect a dead peer.
+ *
+ * It returns 0 on success, or EINVAL for an unknown name.
+ *
+ * Example
+ *     struct tcpopts o;
+ *     if(tcpoptspreset(&o, "low-latency") != 0) tcpoptsinit(&o);
+ */
+int tcpoptspreset(struct tcpopts *o, const char *name)
+{
+    tcpoptsinit(o);
+    if(strcmp(name, "default") == 0) return 0;
+    if(strcmp(name, "low-latency") == 0) {
+        o->nodelay = 1;
+        o->quickack = 1;
+        o->fastopen = 1;
+        o->notsentlowat = 16384;
+        o->busypoll = 50;
+        return 0;
+    }
+    if(strcmp(name, "bulk-throughput") == 0) {
+        o->notsentlowat = 131072;
+        o->keepidle = 60;
+        o->keepintvl = 10;
+        o->keepcnt = 6;
+        return 0;
+    }
+    errno = EINVAL;
+    return errno;
+}
+
+/* tcpoptsapply sets the options of *o on the socket fd. listener tells
+ * whether fd will be a listening socket, which takes the TCP_FASTOPEN
+ * queue length instead of TCP_FASTOPEN_CONNECT. Every option is tried;
+ * TCP level options fail on a Unix domain socket.
+ *
+ * It returns 0 if every option was set, or the error of the first one
+ * that was not.
+ */
+int tcpoptsapply(int fd, struct tcpopts *o, int listener)
+{
+    struct {
+        int set;
+        int level;
+        int name;
+        int val;
+    } opt[] = {
+        { o->nodelay, IPPROTO_TCP, TCP_NODELAY, 1 },
+        { o->quickack, IPPROTO_TCP, TCP_QUICKACK, 1 },
+        { o->sndbuf, SOL_SOCKET, SO_SNDBUF, o->sndbuf },
+        { o->rcvbuf, SOL_SOCKET, SO_RCVBUF, o->rcvbuf },
+        { o->busypoll, SOL_SOCKET, SO_BUSY_POLL, o->busypoll },
+        { o->fastopen && !listener, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1 },
+        { o->fastopen && listener, IPPROTO_TCP, TCP_FASTOPEN, o->fastopen },
+        { o->notsentlowat, IPPROTO_TCP, TCP_NOTSENT_LOWAT, o->notsentlowat },
+        { o->incomingcpu != -1 && listener, SOL_SOCKET, SO_INCOMING_CPU,
+            o->incomingcpu },
+        { o->keepidle, SOL_SOCKET, SO_KEEPALIVE, 1 },
+        { o->keepidle, IPPROTO_TCP, TCP_KEEPIDLE, o->keepidle },
+        { o->keepidle && o->keepintvl, IPPROTO_TCP, TCP_KEEPINTVL,
+            o->keepintvl },
+        { o->keepidle && o->keepcnt, IPPROTO_TCP, TCP_KEEPCNT, o->keepcnt }
+    };
+
+    int err = 0;
+    for(size_t i = 0; i < sizeof opt / sizeof opt[0]; i++) {
+        if(!opt[i].set) continue;
+        if(setsockopt(fd, opt[i].level, opt[i].name, &opt[i].val,
+                    sizeof opt[i].val) == -1 && err == 0) {
+            err = errno;
+        }
+    }
+    errno = err;
+    return errno;
+}
+
+/* tcpaccept accepts a pending connection on the listening socket ln created
+ * by tcplisten and write the endpoint of the connection into *conn.
+ *
+ * The flags parameter is zero or TCP_NONBLOCK; the latter puts the accepted
+ * connection into non-blocking mode without an extra fcntl(2) call.
+ *
+ * If the function succeeds it returns 0. If the listening socket is
+ * non-blocking and there is no pending connection, it returns EAGAIN.
+ * Otherwise it returns and set errno to the error reported by accept(2);
+ * ECONNABORTED and EINTR are transient and the caller should try again.
+ */
+int tcpaccept(int *conn, int ln, int flags)
+{
+    return tcpacceptacl(conn, ln, flags, NULL);
+}
+
+/* tcpacceptacl accepts like tcpaccept and checks the peer address against
+ * acl, which may be NULL, before the connection is handed out. A denied
+ * connection is reset, so the client fails at once rather than on its
+ * first read, and closed; the check costs a lookup in acl and no system
+ * call, so a server under a flood of denied clients stays responsive.
+ * Unix domain peers have no address and are not checked.
+ *
+ * If the function succeeds it returns 0. If the peer is denied, it returns
+ * and set errno to EACCES; the caller should accept the next connection.
+ * Otherwise it returns the errors of tcpaccept.
+ *
+ * Example
+ *     int conn;
+ *     int erraccept = tcpacceptacl(&conn, ln, TCP_NONBLOCK, acl);
+ *     if(erraccept == EACCES) continue;
+ */
+int tcpacceptacl(int *conn, int ln, int flags, struct tcpacl *acl)
+{
+    int aflags = SOCK_CLOEXEC;
+    if(flags & TCP_NONBLOCK) aflags |= SOCK_NONBLOCK;
+
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof peer;
+    *conn = accept4(ln, acl != NULL ? (struct sockaddr *)&peer : NULL,
+            acl != NULL ? &peerlen : NULL, aflags);
+    if(*conn == -1) {
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return errno;
+    }
+    if(acl != NULL &&
+            tcpaclcheck(acl, (struct sockaddr *)&peer) == TCP_ACLDENY) {
+        struct linger lg = { 1, 0 };
+        setsockopt(*conn, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+        close(*conn);
+        *conn = -1;
+        errno = EACCES;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpsendfd passes the descriptor fd to the process at the other end of
+ * the AF_UNIX socket sock with an SCM_RIGHTS message, e.g. from a front
+ * process that accepts connections to the worker process that serves
+ * them. The receiver gets its own descriptor for the same open file, so
+ * the caller still owns fd and usually closes it after the call.
+ *
+ * A byte of data carries the message, since a stream socket does not
+ * deliver ancillary data alone.
+ *
+ * If the function succeeds it returns 0. Otherwise it returns and set
+ * errno to the error reported by sendmsg(2); EAGAIN if sock is
+ * non-blocking and its buffer is full, EPIPE if the receiver is gone.
+ *
+ * Example
+ *     int conn;
+ *     if(tcpaccept(&conn, ln, 0) == 0) {
+ *         tcpsendfd(worker, conn);
+ *         close(conn);
+ *     }
+ */
+int tcpsendfd(int sock, int fd)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        size_t align;
+    } u;
+    memset(&u, 0, sizeof u);
+    char tag = 0;
+    struct iovec iov = { &tag, 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof u.buf;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while(n == -1 && errno == EINTR);
+    if(n == -1) {
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcprecvfd receives a descriptor sent by tcpsendfd over the AF_UNIX
+ * socket sock and write it into *fd. The descriptor has FD_CLOEXEC set
+ * and is owned by the caller.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to one of the following non-zero values:
+ *
+ * ECONNRESET
+ * The sender closed its end of the socket; no more descriptors follow.
+ *
+ * EBADMSG
+ * The message did not carry exactly one descriptor, e.g. because the
+ * process is out of descriptors; anything received was closed.
+ *
+ * EAGAIN
+ * sock is non-blocking and no message is pending.
+ *
+ * Other errors of recvmsg(2) may be returned.
+ *
+ * Example
+ *     int conn;
+ *     while(tcprecvfd(front, &conn) == 0) {
+ *         serve(conn);
+ *     }
+ */
+int tcprecvfd(int sock, int *fd)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        size_t align;
+    } u;
+    char tag;
+    struct iovec iov = { &tag, 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof u.buf;
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while(n == -1 && errno == EINTR);
+    if(n == -1) {
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return errno;
     }
-    if(addri == NULL) {
-        errno = ENOTCONN;
+    if(n == 0) {
+        errno = ECONNRESET;
         return errno;
     }
 
+    *fd = -1;
+    int nfds = 0;
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(int i = 0; i < len; i++) {
+            int got;
+            memcpy(&got, CMSG_DATA(cmsg) + i * sizeof(int), sizeof got);
+            if(nfds++ == 0) *fd = got;
+            else close(got);
+        }
+    }
+    if(nfds != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+        if(*fd != -1) close(*fd);
+        *fd = -1;
+        errno = EBADMSG;
+        return errno;
+    }
     return 0;
 }
+
+/* tcpenvfd parses the descriptor number at *s and moves *s past it. It
+ * returns the descriptor or -1. */
+static int tcpenvfd(const char **s)
+{
+    char *end;
+    long fd = strtol(*s, &end, 10);
+    if(end == *s || fd < 0 || fd > 0x7fffffff) return -1;
+    *s = end;
+    return (int)fd;
+}
+
+/* tcpinherit takes over the listening sockets a previous process passed
+ * with tcphandoff. It writes up to max descriptors, in the order they
+ * were passed, into fds[] and their number into *n, which is 0 when the
+ * process was started normally. The descriptors get FD_CLOEXEC back and
+ * TCP_ENVLISTEN is removed from the environment, so they are not passed
+ * on by accident.
+ *
+ * A server calls it before tcplisten and listens only when *n is 0. The
+ * inherited sockets are the very sockets of the previous process, with
+ * their accept queues and their SO_REUSEPORT group, so no connection is
+ * refused or reset while the processes change over.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to one of the following non-zero values:
+ *
+ * EINVAL
+ * TCP_ENVLISTEN is malformed or lists more than max descriptors.
+ *
+ * EBADF
+ * A listed descriptor is not a listening socket.
+ *
+ * Example
+ *     int fds[16], n;
+ *     if(tcpinherit(fds, 16, &n) == 0 && n == 0) {
+ *         tcplisten(&fds[n++], NULL, "9090", 0);
+ *     }
+ */
+int tcpinherit(int fds[], int max, int *n)
+{
+    *n = 0;
+    const char *s = getenv(TCP_ENVLISTEN);
+    if(s == NULL) return 0;
+
+    int err = 0;
+    while(*s != '\0') {
+        int fd = tcpenvfd(&s);
+        if(fd == -1 || *n == max || (*s != ',' && *s != '\0')) {
+            err = EINVAL;
+            break;
+        }
+        if(*s == ',') s++;
+        int on = 0;
+        socklen_t len = sizeof on;
+        if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &on, &len) == -1 ||
+                !on) {
+            err = EBADF;
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fds[(*n)++] = fd;
+    }
+    unsetenv(TCP_ENVLISTEN);
+    if(err != 0) *n = 0;
+    errno = err;
+    return errno;
+}
+
+/* tcphandoff restarts the server: it starts the program argv[0] with the
+ * arguments argv and passes it the n listening sockets fds[], which it
+ * takes over with tcpinherit. argv[0] must be the path of the program,
+ * so a binary installed over the old one is the one that is started.
+ * The pid of the new process is written into *pid.
+ *
+ * It then waits up to timeoutms milliseconds for the new process to call
+ * tcpready. Until then the caller keeps accepting, so a new process that
+ * fails to start costs nothing. Once it returns 0, the caller should stop
+ * accepting, keep its copies of fds[] open, finish its connections, which
+ * the new process knows nothing about, and exit.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to one of the following non-zero values:
+ *
+ * ECHILD
+ * The new process exited, or could not be executed, before it was ready.
+ *
+ * ETIMEDOUT
+ * The new process was not ready in time; it has been killed.
+ *
+ * ENOMEM
+ * Insufficient memory is available.
+ *
+ * Other errors of pipe2(2) and fork(2) may be returned.
+ *
+ * Example
+ *     pid_t pid;
+ *     if(tcphandoff(&pid, argv, &ln, 1, 10000) == 0) {
+ *         close(ln);
+ *         // finish the connections and exit
+ *     }
+ */
+int tcphandoff(pid_t *pid, char *argv[], int fds[], int n, int timeoutms)
+{
+    /* everything the child needs is prepared before fork(2), since a
+     * multithreaded process may only make async-signal-safe calls between
+     * fork(2) and execve(2) */
+    int ready[2];
+    if(pipe2(ready, O_CLOEXEC) == -1) return errno;
+
+    int nenv = 0;
+    while(environ[nenv] != NULL) nenv++;
+    size_t listenln = sizeof TCP_ENVLISTEN + 12 * (n + 1);
+    char **envp = malloc((nenv + 3) * sizeof *envp);
+    char *listen = malloc(listenln);
+    char readyenv[sizeof TCP_ENVREADY + 12];
+    if(envp == NULL || listen == NULL) {
+        free(envp);
+        free(listen);
+        close(ready[0]);
+        close(ready[1]);
+        errno = ENOMEM;
+        return errno;
+    }
+    int off = snprintf(listen, listenln, "%s=", TCP_ENVLISTEN);
+    for(int i = 0; i < n; i++) {
+        off += snprintf(listen + off, listenln - off, i ? ",%d" : "%d",
+                fds[i]);
+    }
+    snprintf(readyenv, sizeof readyenv, "%s=%d", TCP_ENVREADY, ready[1]);
+    int ne = 0;
+    for(int i = 0; i < nenv; i++) {
+        /* drop what is left of a handoff to this process */
+        if(strncmp(environ[i], TCP_ENVLISTEN "=",
+                    sizeof TCP_ENVLISTEN) == 0 ||
+                strncmp(environ[i], TCP_ENVREADY "=",
+                    sizeof TCP_ENVREADY) == 0) {
+            continue;
+        }
+        envp[ne++] = environ[i];
+    }
+    envp[ne++] = listen;
+    envp[ne++] = readyenv;
+    envp[ne] = NULL;
+    sigset_t none;
+    sigemptyset(&none);
+
+    *pid = fork();
+    if(*pid == 0) {
+        /* the signal mask survives execve(2) */
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        for(int i = 0; i < n; i++) fcntl(fds[i], F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        execve(argv[0], argv, envp);
+        _exit(127);
+    }
+    int err = *pid == -1 ? errno : 0;
+    free(envp);
+    free(listen);
+    close(ready[1]);
+    if(err != 0) {
+        close(ready[0]);
+        errno = err;
+        return errno;
+    }
+
+    /* a byte means ready, end of file means the new process is gone */
+    struct timespec dl, now;
+    tcpdeadline(&dl, timeoutms);
+    struct pollfd pfd = { ready[0], POLLIN, 0 };
+    err = ETIMEDOUT;
+    for(;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int ms = tcpmsuntil(&dl, &now);
+        if(ms <= 0) break;
+        int np = poll(&pfd, 1, ms);
+        if(np == -1 && errno == EINTR) continue;
+        if(np != 1) break;
+        char b;
+        ssize_t nr = read(ready[0], &b, 1);
+        if(nr == -1 && errno == EINTR) continue;
+        err = nr == 1 ? 0 : ECHILD;
+        break;
+    }
+    close(ready[0]);
+    if(err == ETIMEDOUT) kill(*pid, SIGKILL);
+    if(err != 0) waitpid(*pid, NULL, 0);
+    errno = err;
+    return errno;
+}
+
+/* tcpready tells the process that started this one with tcphandoff that
+ * this one accepts on the inherited sockets now, so the old one can stop.
+ * A server calls it once it is ready to serve; when the process was not
+ * started by tcphandoff it does nothing.
+ *
+ * It returns 0 on success, or the error of write(2).
+ */
+int tcpready(void)
+{
+    const char *s = getenv(TCP_ENVREADY);
+    if(s == NULL) return 0;
+    int fd = tcpenvfd(&s);
+    unsetenv(TCP_ENVREADY);
+    if(fd == -1) return 0;
+
+    int err = 0;
+    char b = 1;
+    while(write(fd, &b, 1) == -1) {
+        if(errno == EINTR) continue;
+        err = errno;
+        break;
+    }
+    close(fd);
+    errno = err;
+    return errno;
+}
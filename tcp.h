@@ -31,6 +31,75 @@
 #ifndef TCP_H
 #define TCP_H
 
+#include <sys/types.h>
+
+struct timespec;
+struct tcpacl;
+
+/* the delay in milliseconds between two connection attempts of tcpdialdl,
+ * the "Connection Attempt Delay" recommended by RFC 8305 */
+#define TCP_DIALDELAY 250
+
+/* the environment variables of a restart by tcphandoff: the inherited
+ * listening sockets as a comma separated list of descriptors, and the
+ * pipe the new process reports readiness on */
+#define TCP_ENVLISTEN "TCP_LISTENFDS"
+#define TCP_ENVREADY "TCP_READYFD"
+
+/* flags for tcplisten and tcpaccept */
+enum {
+    TCP_NONBLOCK = 1,
+    TCP_REUSEPORT = 2
+};
+
+/* tcpopts are the socket options of tcpdialopt and tcplistenopt. Fill it
+ * with tcpoptsinit or tcpoptspreset, then change what is needed; a field
+ * that is 0 leaves the kernel default. */
+struct tcpopts {
+    /* TCP_NODELAY: send small writes at once instead of coalescing them */
+    int nodelay;
+    /* TCP_QUICKACK: do not delay the first acknowledgements */
+    int quickack;
+    /* SO_SNDBUF and SO_RCVBUF in bytes; setting one turns the buffer
+     * autotuning of the kernel off for it */
+    int sndbuf;
+    int rcvbuf;
+    /* SO_BUSY_POLL: microseconds a blocking read polls the device queue */
+    int busypoll;
+    /* TCP_FASTOPEN_CONNECT when dialing, the length of the TCP_FASTOPEN
+     * queue when listening */
+    int fastopen;
+    /* TCP_NOTSENT_LOWAT: bytes of unsent data above which the socket does
+     * not poll writable */
+    int notsentlowat;
+    /* SO_INCOMING_CPU of a listener: the CPU whose connections it gets
+     * first in its SO_REUSEPORT group, or -1 */
+    int incomingcpu;
+    /* SO_KEEPALIVE with TCP_KEEPIDLE and TCP_KEEPINTVL in seconds and
+     * TCP_KEEPCNT probes, if keepidle is not 0 */
+    int keepidle;
+    int keepintvl;
+    int keepcnt;
+};
+
 int tcpdial(int *conn, char host[], char port[]);
+int tcpdialdl(int *conn, char host[], char port[], struct timespec *deadline);
+int tcpdialopt(int *conn, char host[], char port[], struct timespec *deadline,
+        struct tcpopts *opts);
+void tcpdeadline(struct timespec *dl, int ms);
+int tcplisten(int *ln, char host[], char port[], int flags);
+int tcplistenopt(int *ln, char host[], char port[], int flags,
+        struct tcpopts *opts);
+int tcpaccept(int *conn, int ln, int flags);
+int tcpacceptacl(int *conn, int ln, int flags, struct tcpacl *acl);
+int tcpgaierr(int gaierr);
+void tcpoptsinit(struct tcpopts *o);
+int tcpoptspreset(struct tcpopts *o, const char *name);
+int tcpoptsapply(int fd, struct tcpopts *o, int listener);
+int tcpsendfd(int sock, int fd);
+int tcprecvfd(int sock, int *fd);
+int tcpinherit(int fds[], int max, int *n);
+int tcphandoff(pid_t *pid, char *argv[], int fds[], int n, int timeoutms);
+int tcpready(void);
 
 #endif
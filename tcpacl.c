@@ -0,0 +1,722 @@
+/* tcpacl - Longest prefix match allow and deny lists of IPv4 and IPv6
+ * networks, checked on the accept path of the tcp module.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces used here: syscall(2) for membarrier(2). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tcpmem.h"
+#include "tcpacl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TCP_ACLX86
+#endif
+
+/* a direct entry with this bit set holds a result, otherwise the index of
+ * a node */
+#define TCP_ACLLEAF 0x80000000u
+
+/* tcpaclpfx is a prefix of the list. Both families are kept as 128 bit
+ * numbers aligned to the left, so one walk serves both. */
+struct tcpaclpfx {
+    uint64_t hi;
+    uint64_t lo;
+    /* the line of the prefix; a later line wins over an equal prefix */
+    uint32_t seq;
+    uint8_t len;
+    uint8_t action;
+};
+
+/* tcpaclnode covers 2^TCP_ACLSTRIDE slots. A slot either leads to a child
+ * node or holds a result; the children of a node are contiguous, and so
+ * are its results, with a run of equal results stored once. The position
+ * of a slot in either array is the number of bits set up to it. */
+struct tcpaclnode {
+    /* the slots that lead to a child */
+    uint64_t vector;
+    /* the slots where a run of equal results starts */
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+};
+
+struct tcpacltrie {
+    /* indexed by the first TCP_ACLDIRECT bits; NULL when the family has no
+     * prefix */
+    uint32_t *direct;
+    struct tcpaclnode *nodes;
+    uint8_t *leaves;
+    uint32_t nnodes;
+    uint32_t capnodes;
+    uint32_t nleaves;
+    uint32_t capleaves;
+};
+
+/* tcpacltab is a compiled list. It is never modified once built, so any
+ * number of threads may look it up without synchronization. */
+struct tcpacltab {
+    struct tcpacltrie v4;
+    struct tcpacltrie v6;
+    size_t nprefixes;
+};
+
+struct tcpacl {
+    struct tcpacltab *tab;
+    /* serializes the loads, and the lookups of threads without a reader
+     * slot */
+    pthread_mutex_t mu;
+};
+
+/* A table replaced by tcpaclload is released once no lookup can still be
+ * walking it. Every thread that looks up has a reader slot in which it
+ * publishes, for the duration of a lookup, the generation it started in.
+ * The writer bumps the generation after the swap and waits for the slots
+ * that still show an older one. The reader only stores to its own slot;
+ * the writer makes those stores visible with membarrier(2), which runs a
+ * full barrier on every thread of the process, and readers fall back to a
+ * fence of their own where the kernel lacks it. */
+struct tcpaclreader {
+    uint64_t gen;
+    struct tcpaclreader *next;
+    int used;
+    char pad[TCP_CACHELN - sizeof(uint64_t) - sizeof(void *) - sizeof(int)];
+};
+
+static struct tcpaclreader *tcpaclreaders;
+static __thread struct tcpaclreader *tcpaclmine;
+static pthread_key_t tcpaclkey;
+static pthread_once_t tcpaclonce = PTHREAD_ONCE_INIT;
+static uint64_t tcpaclgen = 1;
+static int tcpaclmb;
+static int tcpaclpopcnt;
+
+static void tcpaclrelease(void *arg)
+{
+    struct tcpaclreader *r = arg;
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static void tcpaclinit(void)
+{
+    pthread_key_create(&tcpaclkey, tcpaclrelease);
+    tcpaclmb = syscall(SYS_membarrier,
+            MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#ifdef TCP_ACLX86
+    tcpaclpopcnt = __builtin_cpu_supports("popcnt");
+#endif
+}
+
+/* tcpaclreader returns the reader slot of the calling thread, or NULL if
+ * none could be allocated. */
+static struct tcpaclreader *tcpaclreader(void)
+{
+    if(tcpaclmine != NULL) return tcpaclmine;
+
+    struct tcpaclreader *r;
+    for(r = __atomic_load_n(&tcpaclreaders, __ATOMIC_ACQUIRE); r != NULL;
+            r = r->next) {
+        int unused = 0;
+        if(__atomic_compare_exchange_n(&r->used, &unused, 1, 0,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if(r == NULL) {
+        void *p;
+        if(posix_memalign(&p, TCP_CACHELN, sizeof *r) != 0) return NULL;
+        r = p;
+        memset(r, 0, sizeof *r);
+        r->used = 1;
+        r->next = __atomic_load_n(&tcpaclreaders, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&tcpaclreaders, &r->next, r, 1,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        }
+    }
+    /* a writer that did not see the slot yet swapped before this point */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    pthread_setspecific(tcpaclkey, r);
+    tcpaclmine = r;
+    return r;
+}
+
+/* tcpaclsync waits until no lookup started before the call is running. */
+static void tcpaclsync(void)
+{
+    uint64_t gen = __atomic_add_fetch(&tcpaclgen, 1, __ATOMIC_SEQ_CST);
+    if(!tcpaclmb || syscall(SYS_membarrier,
+                MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) != 0) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    for(struct tcpaclreader *r = __atomic_load_n(&tcpaclreaders,
+                __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        for(;;) {
+            uint64_t g = __atomic_load_n(&r->gen, __ATOMIC_ACQUIRE);
+            if(g == 0 || g >= gen) break;
+            sched_yield();
+        }
+    }
+}
+
+/* tcpaclbits returns the n bits of hi:lo that start off bits from the
+ * left, 0 past the end. */
+__attribute__((always_inline))
+static inline unsigned tcpaclbits(uint64_t hi, uint64_t lo, unsigned off,
+        unsigned n)
+{
+    uint64_t w;
+    if(off == 0) {
+        w = hi;
+    } else if(off < 64) {
+        w = hi << off | lo >> (64 - off);
+    } else if(off < 128) {
+        w = lo << (off - 64);
+    } else {
+        w = 0;
+    }
+    return w >> (64 - n);
+}
+
+__attribute__((always_inline))
+static inline int tcpaclwalk(const struct tcpacltrie *t, uint64_t hi,
+        uint64_t lo)
+{
+    if(t->direct == NULL) return TCP_ACLNONE;
+    uint32_t e = t->direct[hi >> (64 - TCP_ACLDIRECT)];
+    if(e & TCP_ACLLEAF) return e & ~TCP_ACLLEAF;
+
+    const struct tcpaclnode *n = &t->nodes[e];
+    unsigned off = TCP_ACLDIRECT;
+    for(;;) {
+        uint64_t bit = (uint64_t)1 << tcpaclbits(hi, lo, off, TCP_ACLSTRIDE);
+        uint64_t upto = bit | (bit - 1);
+        if(!(n->vector & bit)) {
+            return t->leaves[n->base0 +
+                __builtin_popcountll(n->leafvec & upto) - 1];
+        }
+        n = &t->nodes[n->base1 + __builtin_popcountll(n->vector & upto) - 1];
+        off += TCP_ACLSTRIDE;
+    }
+}
+
+/* The walk is compiled twice: the popcount builtin is one instruction
+ * where the CPU has POPCNT and a library call otherwise. */
+#ifdef TCP_ACLX86
+__attribute__((target("popcnt")))
+static int tcpaclfindpopcnt(const struct tcpacltrie *t, uint64_t hi,
+        uint64_t lo)
+{
+    return tcpaclwalk(t, hi, lo);
+}
+#endif
+
+static int tcpaclfindscalar(const struct tcpacltrie *t, uint64_t hi,
+        uint64_t lo)
+{
+    return tcpaclwalk(t, hi, lo);
+}
+
+static int tcpacltabfind(const struct tcpacltab *tab,
+        const struct sockaddr *sa)
+{
+    const struct tcpacltrie *t;
+    uint64_t hi = 0, lo = 0;
+    if(sa->sa_family == AF_INET) {
+        struct sockaddr_in in;
+        memcpy(&in, sa, sizeof in);
+        hi = (uint64_t)ntohl(in.sin_addr.s_addr) << 32;
+        t = &tab->v4;
+    } else if(sa->sa_family == AF_INET6) {
+        struct sockaddr_in6 in6;
+        memcpy(&in6, sa, sizeof in6);
+        for(int i = 0; i < 8; i++) {
+            hi = hi << 8 | in6.sin6_addr.s6_addr[i];
+            lo = lo << 8 | in6.sin6_addr.s6_addr[i + 8];
+        }
+        t = &tab->v6;
+        /* an IPv4 client of a dual-stack listener */
+        if(hi == 0 && lo >> 32 == 0xffff) {
+            hi = lo << 32;
+            lo = 0;
+            t = &tab->v4;
+        }
+    } else {
+        return TCP_ACLNONE;
+    }
+#ifdef TCP_ACLX86
+    if(tcpaclpopcnt) return tcpaclfindpopcnt(t, hi, lo);
+#endif
+    return tcpaclfindscalar(t, hi, lo);
+}
+
+static int64_t tcpaclnodes(struct tcpacltrie *t, uint32_t n)
+{
+    if(t->nnodes + (uint64_t)n >= TCP_ACLLEAF) return -1;
+    if(t->nnodes + n > t->capnodes) {
+        uint32_t cap = t->capnodes > 0 ? t->capnodes : 1024;
+        while(cap < t->nnodes + n) cap *= 2;
+        struct tcpaclnode *nodes = realloc(t->nodes, cap * sizeof *nodes);
+        if(nodes == NULL) return -1;
+        t->nodes = nodes;
+        t->capnodes = cap;
+    }
+    t->nnodes += n;
+    return t->nnodes - n;
+}
+
+static int64_t tcpaclleaves(struct tcpacltrie *t, uint32_t n)
+{
+    if(t->nleaves + (uint64_t)n >= TCP_ACLLEAF) return -1;
+    if(t->nleaves + n > t->capleaves) {
+        uint32_t cap = t->capleaves > 0 ? t->capleaves : 4096;
+        while(cap < t->nleaves + n) cap *= 2;
+        uint8_t *leaves = realloc(t->leaves, cap);
+        if(leaves == NULL) return -1;
+        t->leaves = leaves;
+        t->capleaves = cap;
+    }
+    t->nleaves += n;
+    return t->nleaves - n;
+}
+
+/* tcpaclbuild fills node ni from the prefixes p[0..n-1], which all lead
+ * to the node, the first off bits of the address, and are longer than
+ * off. def is the result of the longest prefix that covers the node.
+ *
+ * The prefixes are sorted by address and then by length, so a prefix
+ * always comes after the prefixes that contain it, and applying them in
+ * order leaves every slot with its longest match. */
+static int tcpaclbuild(struct tcpacltrie *t, uint32_t ni,
+        struct tcpaclpfx **p, size_t n, unsigned off, uint8_t def)
+{
+    uint8_t leaf[1 << TCP_ACLSTRIDE];
+    unsigned end = off + TCP_ACLSTRIDE;
+    memset(leaf, def, sizeof leaf);
+
+    /* apply the prefixes that end in this node and keep the others, in
+     * order, at the front of p */
+    size_t w = 0;
+    uint64_t vector = 0;
+    for(size_t i = 0; i < n; i++) {
+        unsigned s = tcpaclbits(p[i]->hi, p[i]->lo, off, TCP_ACLSTRIDE);
+        if(p[i]->len > end) {
+            vector |= (uint64_t)1 << s;
+            p[w++] = p[i];
+            continue;
+        }
+        memset(leaf + s, p[i]->action, (size_t)1 << (end - p[i]->len));
+    }
+
+    uint8_t runs[1 << TCP_ACLSTRIDE];
+    uint64_t leafvec = 0;
+    uint32_t nruns = 0;
+    int prev = -1;
+    for(unsigned s = 0; s < sizeof leaf; s++) {
+        if(vector >> s & 1) continue;
+        if(leaf[s] != prev) {
+            leafvec |= (uint64_t)1 << s;
+            runs[nruns++] = leaf[s];
+            prev = leaf[s];
+        }
+    }
+    int64_t base0 = tcpaclleaves(t, nruns);
+    int64_t base1 = tcpaclnodes(t, __builtin_popcountll(vector));
+    if(base0 == -1 || base1 == -1) return ENOMEM;
+    memcpy(t->leaves + base0, runs, nruns);
+    t->nodes[ni].vector = vector;
+    t->nodes[ni].leafvec = leafvec;
+    t->nodes[ni].base0 = base0;
+    t->nodes[ni].base1 = base1;
+
+    uint32_t child = base1;
+    for(size_t i = 0; i < w; ) {
+        unsigned s = tcpaclbits(p[i]->hi, p[i]->lo, off, TCP_ACLSTRIDE);
+        size_t j = i + 1;
+        while(j < w && tcpaclbits(p[j]->hi, p[j]->lo, off,
+                    TCP_ACLSTRIDE) == s) {
+            j++;
+        }
+        int err = tcpaclbuild(t, child++, p + i, j - i, end, leaf[s]);
+        if(err != 0) return err;
+        i = j;
+    }
+    return 0;
+}
+
+/* tcpacltrie builds the trie of one family from its sorted prefixes. */
+static int tcpacltrie(struct tcpacltrie *t, struct tcpaclpfx **p, size_t n)
+{
+    memset(t, 0, sizeof *t);
+    if(n == 0) return 0;
+    size_t ndirect = (size_t)1 << TCP_ACLDIRECT;
+    t->direct = malloc(ndirect * sizeof *t->direct);
+    if(t->direct == NULL) return ENOMEM;
+    for(size_t i = 0; i < ndirect; i++) {
+        t->direct[i] = TCP_ACLLEAF | TCP_ACLNONE;
+    }
+
+    size_t w = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(p[i]->len > TCP_ACLDIRECT) {
+            p[w++] = p[i];
+            continue;
+        }
+        size_t s = p[i]->hi >> (64 - TCP_ACLDIRECT);
+        size_t count = (size_t)1 << (TCP_ACLDIRECT - p[i]->len);
+        for(size_t k = s; k < s + count; k++) {
+            t->direct[k] = TCP_ACLLEAF | p[i]->action;
+        }
+    }
+    for(size_t i = 0; i < w; ) {
+        size_t s = p[i]->hi >> (64 - TCP_ACLDIRECT);
+        size_t j = i + 1;
+        while(j < w && p[j]->hi >> (64 - TCP_ACLDIRECT) == s) j++;
+        int64_t ni = tcpaclnodes(t, 1);
+        if(ni == -1) return ENOMEM;
+        uint8_t def = t->direct[s] & ~TCP_ACLLEAF;
+        t->direct[s] = ni;
+        int err = tcpaclbuild(t, ni, p + i, j - i, TCP_ACLDIRECT, def);
+        if(err != 0) return err;
+        i = j;
+    }
+    return 0;
+}
+
+static int tcpaclcmp(const void *a, const void *b)
+{
+    const struct tcpaclpfx *x = *(struct tcpaclpfx *const *)a;
+    const struct tcpaclpfx *y = *(struct tcpaclpfx *const *)b;
+    if(x->hi != y->hi) return x->hi < y->hi ? -1 : 1;
+    if(x->lo != y->lo) return x->lo < y->lo ? -1 : 1;
+    if(x->len != y->len) return x->len < y->len ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* tcpaclparse parses a line of the list into *p and sets *v6 for an IPv6
+ * prefix. It returns 1 for a prefix, 0 for an empty line or -1 if the
+ * line is invalid. */
+static int tcpaclparse(char *s, struct tcpaclpfx *p, int *v6)
+{
+    char *hash = strchr(s, '#');
+    if(hash != NULL) *hash = '\0';
+    char *save;
+    char *tok = strtok_r(s, " \t\r\n", &save);
+    if(tok == NULL) return 0;
+    p->action = TCP_ACLDENY;
+    if(strcmp(tok, "allow") == 0 || strcmp(tok, "deny") == 0) {
+        p->action = tok[0] == 'a' ? TCP_ACLALLOW : TCP_ACLDENY;
+        tok = strtok_r(NULL, " \t\r\n", &save);
+        if(tok == NULL) return -1;
+    }
+    if(strtok_r(NULL, " \t\r\n", &save) != NULL) return -1;
+
+    char *slash = strchr(tok, '/');
+    if(slash != NULL) *slash = '\0';
+    unsigned char a[16];
+    unsigned max;
+    if(inet_pton(AF_INET, tok, a) == 1) {
+        p->hi = (uint64_t)a[0] << 56 | (uint64_t)a[1] << 48 |
+            (uint64_t)a[2] << 40 | (uint64_t)a[3] << 32;
+        p->lo = 0;
+        max = 32;
+        *v6 = 0;
+    } else if(inet_pton(AF_INET6, tok, a) == 1) {
+        p->hi = 0;
+        p->lo = 0;
+        for(int i = 0; i < 8; i++) {
+            p->hi = p->hi << 8 | a[i];
+            p->lo = p->lo << 8 | a[i + 8];
+        }
+        max = 128;
+        *v6 = 1;
+    } else {
+        return -1;
+    }
+
+    unsigned len = max;
+    if(slash != NULL) {
+        char *end;
+        unsigned long l = strtoul(slash + 1, &end, 10);
+        if(slash[1] < '0' || slash[1] > '9' || *end != '\0' || l > max) {
+            return -1;
+        }
+        len = l;
+    }
+    /* an IPv4-mapped prefix matches the IPv4 addresses it maps */
+    if(*v6 && len >= 96 && p->hi == 0 && p->lo >> 32 == 0xffff) {
+        p->hi = p->lo << 32;
+        p->lo = 0;
+        len -= 96;
+        *v6 = 0;
+    }
+    /* clear the host bits, the build relies on them being 0 */
+    if(len < 64) {
+        p->hi &= len > 0 ? ~(uint64_t)0 << (64 - len) : 0;
+        p->lo = 0;
+    } else if(len < 128) {
+        p->lo &= len > 64 ? ~(uint64_t)0 << (128 - len) : 0;
+    }
+    p->len = len;
+    return 1;
+}
+
+static void tcpacltabfree(struct tcpacltab *tab)
+{
+    struct tcpacltrie *tries[] = { &tab->v4, &tab->v6 };
+    for(int i = 0; i < 2; i++) {
+        free(tries[i]->direct);
+        free(tries[i]->nodes);
+        free(tries[i]->leaves);
+    }
+    free(tab);
+}
+
+/* tcpacltabload compiles the list in the file path into *tab. */
+static int tcpacltabload(struct tcpacltab **tab, const char *path,
+        size_t *line)
+{
+    FILE *f = fopen(path, "r");
+    if(f == NULL) return errno;
+
+    struct tcpaclpfx *pfx = NULL;
+    size_t n = 0, cap = 0;
+    char *buf = NULL;
+    size_t buflen = 0;
+    size_t lineno = 0;
+    int err = 0;
+    while(getline(&buf, &buflen, f) != -1) {
+        lineno++;
+        if(n == cap) {
+            size_t c = cap > 0 ? 2 * cap : 1024;
+            struct tcpaclpfx *p = realloc(pfx, c * sizeof *p);
+            if(p == NULL) {
+                err = ENOMEM;
+                break;
+            }
+            pfx = p;
+            cap = c;
+        }
+        int v6;
+        int ok = tcpaclparse(buf, &pfx[n], &v6);
+        if(ok == -1) {
+            if(line != NULL) *line = lineno;
+            err = EINVAL;
+            break;
+        }
+        if(ok == 0) continue;
+        /* the family is kept in the top bit of seq until the split */
+        pfx[n].seq = lineno | (uint32_t)v6 << 31;
+        n++;
+    }
+    if(err == 0 && ferror(f)) err = EIO;
+    free(buf);
+    fclose(f);
+
+    struct tcpaclpfx **p = NULL;
+    struct tcpacltab *t = NULL;
+    if(err == 0) {
+        p = malloc((n > 0 ? n : 1) * sizeof *p);
+        t = calloc(1, sizeof *t);
+        if(p == NULL || t == NULL) err = ENOMEM;
+    }
+    if(err == 0) {
+        /* the IPv4 prefixes first, each family sorted on its own */
+        size_t n4 = 0;
+        for(size_t i = 0; i < n; i++) {
+            if(!(pfx[i].seq >> 31)) p[n4++] = &pfx[i];
+        }
+        size_t k = n4;
+        for(size_t i = 0; i < n; i++) {
+            if(pfx[i].seq >> 31) {
+                pfx[i].seq &= ~((uint32_t)1 << 31);
+                p[k++] = &pfx[i];
+            }
+        }
+        qsort(p, n4, sizeof *p, tcpaclcmp);
+        qsort(p + n4, n - n4, sizeof *p, tcpaclcmp);
+        err = tcpacltrie(&t->v4, p, n4);
+        if(err == 0) err = tcpacltrie(&t->v6, p + n4, n - n4);
+        t->nprefixes = n;
+    }
+    free(p);
+    free(pfx);
+    if(err != 0) {
+        if(t != NULL) tcpacltabfree(t);
+        return err;
+    }
+    *tab = t;
+    return 0;
+}
+
+/* tcpaclnew creates an empty list, which matches no address, and write it
+ * into *acl.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM.
+ *
+ * Example:
+ *
+ *     struct tcpacl *acl;
+ *     size_t line = 0;
+ *     if(tcpaclnew(&acl) != 0 ||
+ *             tcpaclload(acl, "/etc/echoserver.acl", &line) != 0) {
+ *         fprintf(stderr, "E: acl line %zu: %s\n", line, strerror(errno));
+ *     }
+ */
+int tcpaclnew(struct tcpacl **acl)
+{
+    pthread_once(&tcpaclonce, tcpaclinit);
+    struct tcpacl *a = malloc(sizeof *a);
+    if(a == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    a->tab = calloc(1, sizeof *a->tab);
+    if(a->tab == NULL) {
+        free(a);
+        errno = ENOMEM;
+        return errno;
+    }
+    pthread_mutex_init(&a->mu, NULL);
+    *acl = a;
+    return 0;
+}
+
+/* tcpaclfree releases acl. No thread may be checking against it. */
+void tcpaclfree(struct tcpacl *acl)
+{
+    tcpacltabfree(acl->tab);
+    pthread_mutex_destroy(&acl->mu);
+    free(acl);
+}
+
+/* tcpaclload replaces the list of acl with the one in the file path. Every
+ * line holds a prefix, an IPv4 or IPv6 address with an optional /length,
+ * optionally preceded by allow or deny, which is the default. A # starts a
+ * comment. An address takes the result of its longest matching prefix, so
+ * an allow list is a deny of 0.0.0.0/0 and ::/0 plus the allowed prefixes,
+ * and a narrower allow pierces a wider deny.
+ *
+ * The new list is compiled in the calling thread, which is meant to be a
+ * background thread, then swapped in with a single atomic store: checks
+ * never wait for a load, they see either the old or the new list. The
+ * call returns once the old list, which no check can be using any more, is
+ * released.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL, and *line to the number of the invalid line if
+ * line is not NULL, to ENOMEM, or to an error of fopen(3) or getline(3).
+ * The old list stays in place on failure.
+ */
+int tcpaclload(struct tcpacl *acl, const char *path, size_t *line)
+{
+    struct tcpacltab *tab = NULL;
+    int err = tcpacltabload(&tab, path, line);
+    if(err != 0) {
+        errno = err;
+        return errno;
+    }
+    pthread_mutex_lock(&acl->mu);
+    struct tcpacltab *old = __atomic_exchange_n(&acl->tab, tab,
+            __ATOMIC_SEQ_CST);
+    tcpaclsync();
+    pthread_mutex_unlock(&acl->mu);
+    tcpacltabfree(old);
+    return 0;
+}
+
+/* tcpaclcheck returns the result of the longest prefix of acl that matches
+ * the address sa: TCP_ACLALLOW, TCP_ACLDENY, or TCP_ACLNONE if none does
+ * or sa is neither an IPv4 nor an IPv6 address. IPv4-mapped IPv6 addresses
+ * are matched against the IPv4 prefixes. It takes no lock and is safe to
+ * call from any number of threads, also while tcpaclload runs.
+ *
+ * Example:
+ *
+ *     if(tcpaclcheck(acl, (struct sockaddr *)&peer) == TCP_ACLDENY) {
+ *         close(conn);
+ *     }
+ */
+int tcpaclcheck(struct tcpacl *acl, const struct sockaddr *sa)
+{
+    struct tcpaclreader *r = tcpaclreader();
+    if(r == NULL) {
+        pthread_mutex_lock(&acl->mu);
+        int res = tcpacltabfind(acl->tab, sa);
+        pthread_mutex_unlock(&acl->mu);
+        return res;
+    }
+    __atomic_store_n(&r->gen, __atomic_load_n(&tcpaclgen, __ATOMIC_ACQUIRE),
+            __ATOMIC_RELAXED);
+    if(tcpaclmb) {
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } else {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    int res = tcpacltabfind(__atomic_load_n(&acl->tab, __ATOMIC_ACQUIRE),
+            sa);
+    __atomic_store_n(&r->gen, 0, __ATOMIC_RELEASE);
+    return res;
+}
+
+/* tcpaclinfo writes the number of prefixes of acl and the bytes its tables
+ * take into *nprefixes and *bytes. */
+void tcpaclinfo(struct tcpacl *acl, size_t *nprefixes, size_t *bytes)
+{
+    pthread_mutex_lock(&acl->mu);
+    struct tcpacltab *tab = acl->tab;
+    struct tcpacltrie *tries[] = { &tab->v4, &tab->v6 };
+    *nprefixes = tab->nprefixes;
+    *bytes = sizeof *tab;
+    for(int i = 0; i < 2; i++) {
+        struct tcpacltrie *t = tries[i];
+        if(t->direct != NULL) {
+            *bytes += ((size_t)1 << TCP_ACLDIRECT) * sizeof *t->direct;
+        }
+        *bytes += (size_t)t->capnodes * sizeof *t->nodes + t->capleaves;
+    }
+    pthread_mutex_unlock(&acl->mu);
+}
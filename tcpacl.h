@@ -0,0 +1,60 @@
+/* tcpacl - Longest prefix match allow and deny lists of IPv4 and IPv6
+ * networks, checked on the accept path of the tcp module.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPACL_H
+#define TCPACL_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* the results of tcpaclcheck */
+enum {
+    TCP_ACLNONE,
+    TCP_ACLALLOW,
+    TCP_ACLDENY
+};
+
+/* the tables are Poptries: the first TCP_ACLDIRECT bits of an address
+ * index an array directly, the next bits are consumed TCP_ACLSTRIDE at a
+ * time by nodes of 64 bit bitmaps */
+#define TCP_ACLDIRECT 16
+#define TCP_ACLSTRIDE 6
+
+struct tcpacl;
+
+int tcpaclnew(struct tcpacl **acl);
+void tcpaclfree(struct tcpacl *acl);
+int tcpaclload(struct tcpacl *acl, const char *path, size_t *line);
+int tcpaclcheck(struct tcpacl *acl, const struct sockaddr *sa);
+void tcpaclinfo(struct tcpacl *acl, size_t *nprefixes, size_t *bytes);
+
+#endif
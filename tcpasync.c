@@ -0,0 +1,734 @@
+/* tcpasync - Non-blocking dial, read and write for the tcp module, driven
+ * by a tcploop.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces used here, such as eventfd(2). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tcp.h"
+#include "tcploop.h"
+#include "tcpresolv.h"
+#include "tcpsaddr.h"
+#include "tcptimer.h"
+#include "tcpasync.h"
+
+/* the state of a descriptor */
+enum {
+    /* registered to the loop */
+    TCP_AFDADDED = 1,
+    TCP_AFDCLOSING = 2,
+    /* the pending write is a connect(2) in progress */
+    TCP_AFDCONNECT = 4
+};
+
+struct tcpafd;
+
+/* tcpaop is the pending read or write of a descriptor. */
+struct tcpaop {
+    /* the timeout, first so the timer callback can cast it back */
+    struct tcptimer timer;
+    struct tcpafd *c;
+    /* NULL when no operation is pending */
+    tcpasyncfn *fn;
+    void *arg;
+    char *buf;
+    size_t len;
+    size_t off;
+};
+
+struct tcpafd {
+    /* the event source, first so the loop callback can cast it back */
+    struct tcpev ev;
+    struct tcpasync *as;
+    int flags;
+    struct tcpaop rd;
+    struct tcpaop wr;
+    /* the nesting depth of the callbacks running for the descriptor; the
+     * state is only released when it drops to zero */
+    int busy;
+    /* the next closed descriptor waiting to be released */
+    struct tcpafd *next;
+};
+
+/* tcpadial is a tcpdialasync in progress. Like tcpdialdl, it races
+ * connects to the resolved addresses, starting a new attempt every
+ * TCP_DIALDELAY milliseconds or as soon as the previous attempt fails. */
+struct tcpadial {
+    struct tcpasync *as;
+    tcpasyncfn *fn;
+    void *arg;
+    struct tcptimer delay;
+    struct tcptimer deadline;
+    int proto;
+    struct tcpaddrs addrs;
+    struct tcpaddr *order[TCP_RESOLVMAX];
+    int naddrs;
+    int next;
+    /* the connects in progress */
+    int fds[TCP_RESOLVMAX];
+    int nfds;
+    int err;
+    /* the result of a lookup made by a resolver worker */
+    int resolverr;
+    /* set while the resolver owns the dial, and once the caller was told
+     * the dial timed out */
+    int resolving;
+    int dead;
+    struct tcpadial *nextresolved;
+};
+
+struct tcpasync {
+    struct tcploop *loop;
+    pthread_t owner;
+    /* the descriptor state, indexed by descriptor */
+    struct tcpafd **fds;
+    int nfds;
+    /* closed descriptors, released between two batches of events since
+     * the current batch may still hold events for them */
+    struct tcpafd *closed;
+    struct tcptimer reap;
+    /* the dials whose lookup completed on a resolver worker, handed to the
+     * loop thread through the eventfd wake */
+    struct tcpev wake;
+    pthread_mutex_t mu;
+    struct tcpadial *resolved;
+};
+
+static void tcpafdev(struct tcploop *loop, struct tcpev *ev, int events);
+static void tcpadialnext(struct tcpadial *d);
+
+static struct tcpafd *tcpafdget(struct tcpasync *as, int fd)
+{
+    if(fd < 0) {
+        errno = EBADF;
+        return NULL;
+    }
+    if(fd >= as->nfds) {
+        int n = as->nfds > 0 ? as->nfds : 64;
+        while(n <= fd) n *= 2;
+        struct tcpafd **fds = realloc(as->fds, n * sizeof *fds);
+        if(fds == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(fds + as->nfds, 0, (n - as->nfds) * sizeof *fds);
+        as->fds = fds;
+        as->nfds = n;
+    }
+    if(as->fds[fd] == NULL) {
+        struct tcpafd *c = calloc(1, sizeof *c);
+        if(c == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        c->ev.fd = fd;
+        c->ev.fn = tcpafdev;
+        c->as = as;
+        c->rd.c = c;
+        c->wr.c = c;
+        as->fds[fd] = c;
+    }
+    return as->fds[fd];
+}
+
+/* tcpafdwatch registers c to the loop, for both directions at once, so a
+ * descriptor costs a single epoll_ctl(2) for its whole life. */
+static int tcpafdwatch(struct tcpasync *as, struct tcpafd *c)
+{
+    if(c->flags & TCP_AFDADDED) return 0;
+    int err = tcploopadd(as->loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+    if(err == 0) c->flags |= TCP_AFDADDED;
+    return err;
+}
+
+/* tcpaopdone ends the operation op with res and calls its callback. */
+static void tcpaopdone(struct tcpaop *op, ssize_t res)
+{
+    struct tcpafd *c = op->c;
+    tcpasyncfn *fn = op->fn;
+    op->fn = NULL;
+    tcptimercancel(tcploopwheel(c->as->loop), &op->timer);
+    fn(c->as, c->ev.fd, res, op->arg);
+}
+
+/* tcpafdput releases the state of a closing descriptor once no callback
+ * references it. The memory itself is released by tcpasyncreap. */
+static void tcpafdput(struct tcpasync *as, struct tcpafd *c)
+{
+    if(!(c->flags & TCP_AFDCLOSING) || c->busy > 0 || c->ev.fd == -1) {
+        return;
+    }
+    if(c->flags & TCP_AFDADDED) tcploopdel(as->loop, &c->ev);
+    close(c->ev.fd);
+    as->fds[c->ev.fd] = NULL;
+    c->ev.fd = -1;
+    c->next = as->closed;
+    as->closed = c;
+    tcptimerarm(tcploopwheel(as->loop), &as->reap, 0);
+}
+
+static void tcpasyncreap(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct tcpasync *as = (struct tcpasync *)
+        ((char *)t - offsetof(struct tcpasync, reap));
+    (void)w;
+    while(as->closed != NULL) {
+        struct tcpafd *c = as->closed;
+        as->closed = c->next;
+        free(c);
+    }
+}
+
+static void tcpafdread(struct tcpafd *c)
+{
+    while(c->rd.fn != NULL && !(c->flags & TCP_AFDCLOSING)) {
+        ssize_t n = recv(c->ev.fd, c->rd.buf, c->rd.len, 0);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            n = -errno;
+        }
+        tcpaopdone(&c->rd, n);
+    }
+}
+
+static void tcpafdwrite(struct tcpafd *c, int events)
+{
+    if(c->flags & TCP_AFDCONNECT) {
+        /* the socket reports the outcome once it is writable */
+        if(!(events & (TCP_EVOUT | TCP_EVERR))) return;
+        int err = 0;
+        socklen_t errlen = sizeof err;
+        getsockopt(c->ev.fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+        c->flags &= ~TCP_AFDCONNECT;
+        tcpaopdone(&c->wr, -err);
+        return;
+    }
+    while(c->wr.fn != NULL && !(c->flags & TCP_AFDCLOSING)) {
+        ssize_t n = send(c->ev.fd, c->wr.buf + c->wr.off,
+                c->wr.len - c->wr.off, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            tcpaopdone(&c->wr, -errno);
+            return;
+        }
+        c->wr.off += n;
+        if(c->wr.off == c->wr.len) tcpaopdone(&c->wr, c->wr.len);
+    }
+}
+
+static void tcpafdev(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct tcpafd *c = (struct tcpafd *)ev;
+    (void)loop;
+    if(c->flags & TCP_AFDCLOSING) return;
+
+    c->busy++;
+    if(c->rd.fn != NULL) tcpafdread(c);
+    if(c->wr.fn != NULL) tcpafdwrite(c, events);
+    c->busy--;
+    tcpafdput(c->as, c);
+}
+
+static void tcpaoptimeout(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct tcpaop *op = (struct tcpaop *)t;
+    struct tcpafd *c = op->c;
+    (void)w;
+    if(op->fn == NULL) return;
+    c->busy++;
+    if(op == &c->wr) c->flags &= ~TCP_AFDCONNECT;
+    tcpaopdone(op, -ETIMEDOUT);
+    c->busy--;
+    tcpafdput(c->as, c);
+}
+
+/* tcpaopstart makes op the pending operation of c. */
+static int tcpaopstart(struct tcpasync *as, struct tcpafd *c,
+        struct tcpaop *op, char *buf, size_t len, int timeoutms,
+        tcpasyncfn *fn, void *arg)
+{
+    if(c->flags & TCP_AFDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    if(op->fn != NULL) {
+        errno = EBUSY;
+        return errno;
+    }
+    int err = tcpafdwatch(as, c);
+    if(err != 0) {
+        errno = err;
+        return errno;
+    }
+    op->fn = fn;
+    op->arg = arg;
+    op->buf = buf;
+    op->len = len;
+    op->off = 0;
+    tcptimerinit(&op->timer, tcpaoptimeout);
+    if(timeoutms > 0) {
+        tcptimerarm(tcploopwheel(as->loop), &op->timer, timeoutms);
+    }
+    return 0;
+}
+
+/* tcpasyncwake hands the dials resolved by the resolver workers to the
+ * loop thread. */
+static void tcpasyncwake(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct tcpasync *as = (struct tcpasync *)
+        ((char *)ev - offsetof(struct tcpasync, wake));
+    (void)loop;
+    (void)events;
+
+    uint64_t n;
+    while(read(ev->fd, &n, sizeof n) == sizeof n);
+    pthread_mutex_lock(&as->mu);
+    struct tcpadial *d = as->resolved;
+    as->resolved = NULL;
+    pthread_mutex_unlock(&as->mu);
+
+    while(d != NULL) {
+        struct tcpadial *next = d->nextresolved;
+        d->resolving = 0;
+        if(d->dead) {
+            free(d);
+        } else {
+            if(d->resolverr != 0) d->err = d->resolverr;
+            tcpadialnext(d);
+        }
+        d = next;
+    }
+}
+
+/* tcpadialend reports the outcome of d to the caller and releases it. */
+static void tcpadialend(struct tcpadial *d, int fd, int err)
+{
+    struct tcpwheel *w = tcploopwheel(d->as->loop);
+    tcptimercancel(w, &d->delay);
+    tcptimercancel(w, &d->deadline);
+    for(int i = 0; i < d->nfds; i++) {
+        /* drop the losing connects without their callback */
+        struct tcpafd *c = d->as->fds[d->fds[i]];
+        c->wr.fn = NULL;
+        tcptimercancel(w, &c->wr.timer);
+        tcpcloseasync(d->as, d->fds[i]);
+    }
+    d->nfds = 0;
+    d->fn(d->as, fd, fd == -1 ? -err : 0, d->arg);
+    if(d->resolving) {
+        /* released by tcpasyncwake once the resolver is done with it */
+        d->dead = 1;
+    } else {
+        free(d);
+    }
+}
+
+static void tcpadialconn(struct tcpasync *as, int fd, ssize_t res,
+        void *arg)
+{
+    struct tcpadial *d = arg;
+    for(int i = 0; i < d->nfds; i++) {
+        if(d->fds[i] == fd) {
+            d->fds[i] = d->fds[--d->nfds];
+            break;
+        }
+    }
+    if(res == 0) {
+        tcpadialend(d, fd, 0);
+        return;
+    }
+    tcpcloseasync(as, fd);
+    d->err = -res;
+    /* start the next attempt right away */
+    tcptimercancel(tcploopwheel(as->loop), &d->delay);
+    tcpadialnext(d);
+}
+
+/* tcpadialnext starts the next attempt of d, or ends d when none is left
+ * and none is in progress. */
+static void tcpadialnext(struct tcpadial *d)
+{
+    struct tcpasync *as = d->as;
+    while(d->next < d->naddrs) {
+        struct tcpaddr *ai = d->order[d->next++];
+        int fd = socket(ai->u.sa.sa_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, d->proto);
+        if(fd == -1) {
+            d->err = errno;
+            continue;
+        }
+        if(connect(fd, &ai->u.sa, ai->len) == 0) {
+            struct tcpafd *c = tcpafdget(as, fd);
+            if(c == NULL) {
+                d->err = errno;
+                close(fd);
+                continue;
+            }
+            tcpadialend(d, fd, 0);
+            return;
+        }
+        if(errno != EINPROGRESS) {
+            d->err = errno;
+            close(fd);
+            continue;
+        }
+        struct tcpafd *c = tcpafdget(as, fd);
+        int err = c != NULL ? 0 : errno;
+        if(err == 0) {
+            err = tcpaopstart(as, c, &c->wr, NULL, 0, 0, tcpadialconn, d);
+        }
+        if(err != 0) {
+            d->err = err;
+            if(c != NULL) {
+                tcpcloseasync(as, fd);
+            } else {
+                close(fd);
+            }
+            continue;
+        }
+        c->flags |= TCP_AFDCONNECT;
+        d->fds[d->nfds++] = fd;
+        if(d->next < d->naddrs) {
+            tcptimerarm(tcploopwheel(as->loop), &d->delay, TCP_DIALDELAY);
+        }
+        return;
+    }
+    if(d->nfds == 0) tcpadialend(d, -1, d->err);
+}
+
+static void tcpadialdelay(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct tcpadial *d = (struct tcpadial *)
+        ((char *)t - offsetof(struct tcpadial, delay));
+    (void)w;
+    tcpadialnext(d);
+}
+
+static void tcpadialtimeout(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct tcpadial *d = (struct tcpadial *)
+        ((char *)t - offsetof(struct tcpadial, deadline));
+    (void)w;
+    tcpadialend(d, -1, ETIMEDOUT);
+}
+
+/* tcpadialorder interleaves the address families of the lookup result like
+ * tcpdialdl, starting with the family getaddrinfo(3) prefers. */
+static void tcpadialorder(struct tcpadial *d)
+{
+    struct tcpaddrs *a = &d->addrs;
+    int first = a->addr[0].u.sa.sa_family;
+    int fi = 0, oi = 0;
+    d->naddrs = 0;
+    while(d->naddrs < a->n) {
+        while(fi < a->n && a->addr[fi].u.sa.sa_family != first) fi++;
+        while(oi < a->n && a->addr[oi].u.sa.sa_family == first) oi++;
+        if(fi < a->n) d->order[d->naddrs++] = &a->addr[fi++];
+        if(oi < a->n) d->order[d->naddrs++] = &a->addr[oi++];
+    }
+}
+
+/* tcpadialresolved receives the lookup of a dial. A cached result arrives
+ * in the loop thread, during tcpdialasync, and the dial goes on at once;
+ * a resolver worker queues the dial to the loop thread instead. */
+static void tcpadialresolved(struct tcpaddrs *addrs, int err, void *arg)
+{
+    struct tcpadial *d = arg;
+    struct tcpasync *as = d->as;
+    if(err == 0) {
+        d->addrs = *addrs;
+        tcpadialorder(d);
+    }
+    if(pthread_equal(pthread_self(), as->owner)) {
+        d->resolving = 0;
+        if(err != 0) d->err = err;
+        tcpadialnext(d);
+        return;
+    }
+    d->resolverr = err;
+    pthread_mutex_lock(&as->mu);
+    d->nextresolved = as->resolved;
+    as->resolved = d;
+    pthread_mutex_unlock(&as->mu);
+    uint64_t one = 1;
+    if(write(as->wake.fd, &one, sizeof one) == -1) {
+        /* the counter is already non-zero, the loop will wake up anyway */
+    }
+}
+
+/* tcpasyncnew creates the asynchronous operations state of loop and write
+ * it into *as. The state, like the loop, must only be used from the thread
+ * that runs the loop, which must be the thread calling tcpasyncnew.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM or the error of eventfd(2) or tcploopadd.
+ *
+ * Example:
+ *
+ *     struct tcploop *loop;
+ *     struct tcpasync *as;
+ *     tcploopnew(&loop);
+ *     if(tcpasyncnew(&as, loop) != 0) {
+ *         perror("tcpasyncnew");
+ *     }
+ *     tcpdialasync(as, "localhost", "9090", 1000, ondial, NULL);
+ *     tcplooprun(loop);
+ */
+int tcpasyncnew(struct tcpasync **as, struct tcploop *loop)
+{
+    struct tcpasync *a = calloc(1, sizeof *a);
+    if(a == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    a->loop = loop;
+    a->owner = pthread_self();
+    tcptimerinit(&a->reap, tcpasyncreap);
+    a->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(a->wake.fd == -1) {
+        int err = errno;
+        free(a);
+        errno = err;
+        return errno;
+    }
+    a->wake.fn = tcpasyncwake;
+    int err = tcploopadd(loop, &a->wake, TCP_EVIN);
+    if(err != 0) {
+        close(a->wake.fd);
+        free(a);
+        errno = err;
+        return errno;
+    }
+    pthread_mutex_init(&a->mu, NULL);
+    *as = a;
+    return 0;
+}
+
+/* tcpasyncfree closes every descriptor known to as, without calling the
+ * callbacks of their pending operations, and releases as. No dial may be
+ * in progress. */
+void tcpasyncfree(struct tcpasync *as)
+{
+    struct tcpwheel *w = tcploopwheel(as->loop);
+    for(int fd = 0; fd < as->nfds; fd++) {
+        struct tcpafd *c = as->fds[fd];
+        if(c == NULL) continue;
+        tcptimercancel(w, &c->rd.timer);
+        tcptimercancel(w, &c->wr.timer);
+        if(c->flags & TCP_AFDADDED) tcploopdel(as->loop, &c->ev);
+        close(fd);
+        free(c);
+    }
+    tcptimercancel(w, &as->reap);
+    tcpasyncreap(w, &as->reap);
+    tcploopdel(as->loop, &as->wake);
+    close(as->wake.fd);
+    pthread_mutex_destroy(&as->mu);
+    free(as->fds);
+    free(as);
+}
+
+/* tcpasyncloop returns the loop as runs on. */
+struct tcploop *tcpasyncloop(struct tcpasync *as)
+{
+    return as->loop;
+}
+
+/* tcpdialasync connects to host:port like tcpdialdl without blocking the
+ * loop thread. The lookup goes through the caching resolver of tcpdial and
+ * the resolved addresses are raced the same way. fn is called with the new
+ * connection, or with ETIMEDOUT if timeoutms, when positive, elapses first.
+ * A host of the form unix:path dials a Unix domain socket.
+ *
+ * fn may be called before tcpdialasync returns, when the address was
+ * cached and the connect completed at once.
+ *
+ * It returns 0 when fn was or will be called, or ENOMEM.
+ *
+ * Example:
+ *
+ *     static void ondial(struct tcpasync *as, int fd, ssize_t res,
+ *             void *arg)
+ *     {
+ *         if(res < 0) {
+ *             fprintf(stderr, "E: dial %s\n", strerror(-res));
+ *             return;
+ *         }
+ *         tcpwriteasync(as, fd, "hello\n", 6, 1000, onwrite, arg);
+ *     }
+ */
+int tcpdialasync(struct tcpasync *as, char host[], char port[],
+        int timeoutms, tcpasyncfn *fn, void *arg)
+{
+    struct sockaddr_un sun;
+    socklen_t sunlen;
+    int unixlen = tcpsunix(&sun, &sunlen, host);
+    if(unixlen != 0) {
+        /* a Unix connect(2) completes at once or fails, with EAGAIN when
+         * the backlog of the listener is full */
+        int err = unixlen == -1 ? EINVAL : 0;
+        int fd = -1;
+        if(err == 0) {
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+            if(fd == -1) err = errno;
+        }
+        if(err == 0 && connect(fd, (struct sockaddr *)&sun, sunlen) == -1) {
+            err = errno;
+        }
+        if(err == 0 && tcpafdget(as, fd) == NULL) err = errno;
+        if(err != 0 && fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+        fn(as, fd, -err, arg);
+        return 0;
+    }
+
+    struct protoent *tcpproto = getprotobyname("tcp");
+    struct tcpadial *d = calloc(1, sizeof *d);
+    if(d == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    d->as = as;
+    d->fn = fn;
+    d->arg = arg;
+    d->proto = tcpproto != NULL ? tcpproto->p_proto : 0;
+    d->err = ENOTCONN;
+    tcptimerinit(&d->delay, tcpadialdelay);
+    tcptimerinit(&d->deadline, tcpadialtimeout);
+    if(timeoutms > 0) {
+        tcptimerarm(tcploopwheel(as->loop), &d->deadline, timeoutms);
+    }
+    d->resolving = 1;
+    int err = tcpresolveasync(tcpresolvdefault(), host, port,
+            tcpadialresolved, d);
+    if(err != 0) {
+        tcptimercancel(tcploopwheel(as->loop), &d->deadline);
+        free(d);
+        errno = err;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpreadasync reads up to len bytes from fd into buf. fn is called once
+ * data, EOF or an error arrived, or with ETIMEDOUT if timeoutms, when
+ * positive, elapses first. buf must stay valid until then. A descriptor
+ * has at most one pending read and one pending write.
+ *
+ * fd must be non-blocking; from then on it is owned by as and must be
+ * closed with tcpcloseasync. fn may be called before tcpreadasync returns,
+ * when data is already waiting.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EBADF, EBUSY, ENOMEM or the error of epoll_ctl(2).
+ */
+int tcpreadasync(struct tcpasync *as, int fd, void *buf, size_t len,
+        int timeoutms, tcpasyncfn *fn, void *arg)
+{
+    struct tcpafd *c = tcpafdget(as, fd);
+    if(c == NULL) return errno;
+    int err = tcpaopstart(as, c, &c->rd, buf, len, timeoutms, fn, arg);
+    if(err != 0) return err;
+    c->busy++;
+    tcpafdread(c);
+    c->busy--;
+    tcpafdput(as, c);
+    return 0;
+}
+
+/* tcpwriteasync writes the len bytes of buf to fd. fn is called once all
+ * of them were written or the write failed, or with ETIMEDOUT if
+ * timeoutms, when positive, elapses first. buf must stay valid until
+ * then. Otherwise it works like tcpreadasync.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EBADF, EBUSY, ENOMEM or the error of epoll_ctl(2).
+ */
+int tcpwriteasync(struct tcpasync *as, int fd, const void *buf, size_t len,
+        int timeoutms, tcpasyncfn *fn, void *arg)
+{
+    struct tcpafd *c = tcpafdget(as, fd);
+    if(c == NULL) return errno;
+    int err = tcpaopstart(as, c, &c->wr, (char *)buf, len, timeoutms, fn,
+            arg);
+    if(err != 0) return err;
+    c->busy++;
+    tcpafdwrite(c, TCP_EVOUT);
+    c->busy--;
+    tcpafdput(as, c);
+    return 0;
+}
+
+/* tcpcloseasync closes fd. Its pending operations fail with ECANCELED.
+ *
+ * It returns 0, or EBADF if fd is already closing.
+ */
+int tcpcloseasync(struct tcpasync *as, int fd)
+{
+    struct tcpafd *c = fd >= 0 && fd < as->nfds ? as->fds[fd] : NULL;
+    if(c == NULL) {
+        /* never handed to as */
+        close(fd);
+        return 0;
+    }
+    if(c->flags & TCP_AFDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    c->flags |= TCP_AFDCLOSING;
+    c->flags &= ~TCP_AFDCONNECT;
+    c->busy++;
+    if(c->rd.fn != NULL) tcpaopdone(&c->rd, -ECANCELED);
+    if(c->wr.fn != NULL) tcpaopdone(&c->wr, -ECANCELED);
+    c->busy--;
+    tcpafdput(as, c);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* tcpasync - Non-blocking dial, read and write for the tcp module, driven
+ * by a tcploop.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPASYNC_H
+#define TCPASYNC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "tcploop.h"
+
+struct tcpasync;
+
+/* tcpasyncfn receives the result of an operation on fd.
+ *
+ * For tcpdialasync, res is 0 and fd is the new connection, which is
+ * non-blocking and may be used with tcpreadasync and tcpwriteasync, or res
+ * is a negative errno value and fd is -1.
+ * For tcpreadasync, res is the number of bytes read, 0 on EOF or a negative
+ * errno value.
+ * For tcpwriteasync, res is the length of the buffer once all of it was
+ * written, or a negative errno value.
+ *
+ * ETIMEDOUT means the timeout of the operation expired and ECANCELED that
+ * fd was closed with tcpcloseasync while the operation was pending.
+ */
+typedef void tcpasyncfn(struct tcpasync *as, int fd, ssize_t res, void *arg);
+
+int tcpasyncnew(struct tcpasync **as, struct tcploop *loop);
+void tcpasyncfree(struct tcpasync *as);
+struct tcploop *tcpasyncloop(struct tcpasync *as);
+int tcpdialasync(struct tcpasync *as, char host[], char port[],
+        int timeoutms, tcpasyncfn *fn, void *arg);
+int tcpreadasync(struct tcpasync *as, int fd, void *buf, size_t len,
+        int timeoutms, tcpasyncfn *fn, void *arg);
+int tcpwriteasync(struct tcpasync *as, int fd, const void *buf, size_t len,
+        int timeoutms, tcpasyncfn *fn, void *arg);
+int tcpcloseasync(struct tcpasync *as, int fd);
+
+#endif
@@ -0,0 +1,458 @@
+/* tcpbench.c - A load generator for echo servers. It opens N connections
+ * over M threads, keeps a number of messages in flight on every connection
+ * and reports the throughput and the latency distribution.
+ *
+ * In closed-loop mode (the default) every connection sends a new message as
+ * soon as a reply comes back, with -p messages in flight. In open-loop mode
+ * (-r) messages are sent at a fixed total rate whether or not the server
+ * keeps up; latency is then measured from the time a message was due, so a
+ * stalled server shows up in the tail instead of slowing the benchmark down.
+ *
+ * Build:
+ * % make tcpbench
+ *
+ * Usage:
+ * % ./echoserver 8080 &
+ * % ./tcpbench 8080
+ * % ./tcpbench -c 100 -t 4 -s 64 -p 8 -d 10 localhost 8080
+ * % ./tcpbench -c 50 -r 20000 8080
+ *
+ * Options:
+ * -c conns    number of connections (default: 10)
+ * -t threads  number of threads (default: 1)
+ * -s size     message size in bytes (default: 64)
+ * -p depth    messages in flight per connection (default: 1)
+ * -r rate     open loop: total messages per second (default: closed loop)
+ * -d seconds  duration of the run (default: 10)
+ * -o preset   socket options of the connections, a tcpoptspreset name
+ *             (default: low-latency)
+ *
+ * The exit status is non-zero if a connection failed or no message
+ * completed, so the benchmark can gate a CI job.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose the Linux specific interfaces
+ * the benchmark uses, timerfd_create(2). */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+
+#include "tcp.h"
+#include "tcploop.h"
+#include "tcphist.h"
+
+/* the size of the receive buffer of a thread */
+#define BENCH_RDLN 65536
+/* the bounds of the open-loop timer period, in nanoseconds; within them
+ * the timer fires once per message, so latency is not skewed by messages
+ * waiting for the next tick */
+#define BENCH_TICKMIN 10000
+#define BENCH_TICKMAX 1000000
+/* the number of due messages a thread queues while all of its connections
+ * are busy */
+#define BENCH_BACKLOG 65536
+
+struct benchthread;
+
+struct benchconn {
+    struct tcpev ev;
+    struct benchthread *t;
+    /* the send times of the messages in flight, a ring of depth entries */
+    uint64_t *sent;
+    int head;
+    int n;
+    /* the bytes queued for writing, and of the current reply */
+    size_t wrlen;
+    size_t rdoff;
+    int dead;
+};
+
+struct benchthread {
+    pthread_t thread;
+    struct tcploop *loop;
+    struct benchconn *conns;
+    int nconns;
+    /* open loop */
+    struct tcpev timer;
+    double rate;
+    uint64_t start;
+    uint64_t issued;
+    uint64_t backlog[BENCH_BACKLOG];
+    int bhead;
+    int bn;
+    uint64_t dropped;
+    int next;
+
+    uint64_t done;
+    uint64_t errors;
+    struct tcphist hist;
+    char rdbuf[BENCH_RDLN];
+};
+
+static size_t size = 64;
+static int depth = 1;
+static struct tcpopts opts;
+static char *payload;
+static size_t paylen;
+
+static uint64_t benchnow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void benchkill(struct benchconn *c, int err)
+{
+    if(c->dead) return;
+    fprintf(stderr, "error: connection: %s\n", strerror(err));
+    c->dead = 1;
+    c->t->errors++;
+    tcploopdel(c->t->loop, &c->ev);
+    close(c->ev.fd);
+}
+
+/* benchqueue puts a message that was due at time ts in flight. */
+static void benchqueue(struct benchconn *c, uint64_t ts)
+{
+    c->sent[(c->head + c->n) % depth] = ts;
+    c->n++;
+    c->wrlen += size;
+}
+
+/* benchflush writes the queued messages; the payload holds depth messages,
+ * so a whole pipeline goes out with one send(2). */
+static void benchflush(struct benchconn *c)
+{
+    while(c->wrlen > 0) {
+        size_t len = c->wrlen < paylen ? c->wrlen : paylen;
+        ssize_t n = send(c->ev.fd, payload, len, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            benchkill(c, errno);
+            return;
+        }
+        c->wrlen -= n;
+    }
+}
+
+/* benchnext gives the connection its next message: in closed loop right
+ * away, in open loop only if one is overdue. */
+static void benchnext(struct benchconn *c, uint64_t now)
+{
+    struct benchthread *t = c->t;
+    if(t->rate == 0) {
+        benchqueue(c, now);
+    } else if(t->bn > 0) {
+        benchqueue(c, t->backlog[t->bhead]);
+        t->bhead = (t->bhead + 1) % BENCH_BACKLOG;
+        t->bn--;
+    }
+}
+
+static void benchconn(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct benchconn *c = (struct benchconn *)ev;
+    struct benchthread *t = c->t;
+
+    for(;;) {
+        ssize_t n = recv(c->ev.fd, t->rdbuf, BENCH_RDLN, 0);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            benchkill(c, errno);
+            return;
+        }
+        if(n == 0) {
+            benchkill(c, ECONNRESET);
+            return;
+        }
+
+        uint64_t now = benchnow();
+        c->rdoff += n;
+        while(c->rdoff >= size && c->n > 0) {
+            c->rdoff -= size;
+            tcphistadd(&t->hist, now - c->sent[c->head]);
+            c->head = (c->head + 1) % depth;
+            c->n--;
+            t->done++;
+            benchnext(c, now);
+        }
+    }
+    benchflush(c);
+}
+
+/* benchtick issues the messages that became due since the last tick,
+ * spreading them over the connections round-robin. Messages for which no
+ * connection has room wait in the backlog with their due time. */
+static void benchtick(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct benchthread *t = (struct benchthread *)((char *)ev -
+            offsetof(struct benchthread, timer));
+    uint64_t expirations;
+    while(read(ev->fd, &expirations, sizeof expirations) > 0);
+
+    uint64_t now = benchnow();
+    uint64_t due = (uint64_t)((now - t->start) / 1e9 * t->rate);
+    for(; t->issued < due; t->issued++) {
+        uint64_t ts = t->start + (uint64_t)(t->issued / t->rate * 1e9);
+        int placed = 0;
+        for(int i = 0; i < t->nconns && !placed; i++) {
+            struct benchconn *c = &t->conns[t->next];
+            t->next = (t->next + 1) % t->nconns;
+            if(!c->dead && c->n < depth) {
+                benchqueue(c, ts);
+                placed = 1;
+            }
+        }
+        if(placed) continue;
+        if(t->bn == BENCH_BACKLOG) {
+            t->dropped++;
+            continue;
+        }
+        t->backlog[(t->bhead + t->bn) % BENCH_BACKLOG] = ts;
+        t->bn++;
+    }
+    for(int i = 0; i < t->nconns; i++) {
+        if(!t->conns[i].dead) benchflush(&t->conns[i]);
+    }
+}
+
+static void *benchrun(void *arg)
+{
+    struct benchthread *t = arg;
+    uint64_t now = benchnow();
+    t->start = now;
+    for(int i = 0; i < t->nconns; i++) {
+        struct benchconn *c = &t->conns[i];
+        if(c->dead) continue;
+        if(t->rate == 0) {
+            for(int j = 0; j < depth; j++) benchqueue(c, now);
+        }
+        benchflush(c);
+    }
+    int err = tcplooprun(t->loop);
+    if(err != 0) fprintf(stderr, "error: loop: %s\n", strerror(err));
+    return NULL;
+}
+
+/* benchsetup dials the connections of a thread and registers them to its
+ * loop. */
+static int benchsetup(struct benchthread *t, char host[], char port[])
+{
+    int err = tcploopnew(&t->loop);
+    if(err != 0) return err;
+    tcphistinit(&t->hist);
+
+    for(int i = 0; i < t->nconns; i++) {
+        struct benchconn *c = &t->conns[i];
+        c->t = t;
+        c->sent = calloc(depth, sizeof *c->sent);
+        if(c->sent == NULL) return ENOMEM;
+        err = tcpdialopt(&c->ev.fd, host, port, NULL, &opts);
+        if(err != 0) return err;
+        fcntl(c->ev.fd, F_SETFL, fcntl(c->ev.fd, F_GETFL) | O_NONBLOCK);
+        c->ev.fn = benchconn;
+        err = tcploopadd(t->loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+        if(err != 0) return err;
+    }
+
+    if(t->rate > 0) {
+        t->timer.fd = timerfd_create(CLOCK_MONOTONIC,
+                TFD_NONBLOCK | TFD_CLOEXEC);
+        if(t->timer.fd == -1) return errno;
+        long tick = 1e9 / t->rate;
+        if(tick < BENCH_TICKMIN) tick = BENCH_TICKMIN;
+        if(tick > BENCH_TICKMAX) tick = BENCH_TICKMAX;
+        struct itimerspec its;
+        memset(&its, 0, sizeof its);
+        its.it_value.tv_nsec = tick;
+        its.it_interval.tv_nsec = tick;
+        timerfd_settime(t->timer.fd, 0, &its, NULL);
+        t->timer.fn = benchtick;
+        err = tcploopadd(t->loop, &t->timer, TCP_EVIN);
+        if(err != 0) return err;
+    }
+    return 0;
+}
+
+static void benchusage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c conns] [-t threads] [-s size] [-p depth] "
+            "[-r rate] [-d seconds] [-o preset] [host] port\n", prog);
+}
+
+static void benchprintns(char *name, uint64_t ns)
+{
+    if(ns < 10000) {
+        printf(" %s %lluns", name, (unsigned long long)ns);
+    } else if(ns < 10000000) {
+        printf(" %s %.1fus", name, ns / 1e3);
+    } else {
+        printf(" %s %.1fms", name, ns / 1e6);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int nconns = 10;
+    int nthreads = 1;
+    double rate = 0;
+    int secs = 10;
+
+    tcpoptspreset(&opts, "low-latency");
+    int opt;
+    while((opt = getopt(argc, argv, "c:t:s:p:r:d:o:")) != -1) {
+        switch(opt) {
+            case 'c':
+                nconns = atoi(optarg);
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                depth = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'd':
+                secs = atoi(optarg);
+                break;
+            case 'o':
+                if(tcpoptspreset(&opts, optarg) != 0) {
+                    fprintf(stderr, "error: unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                benchusage(argv[0]);
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if((argc != 2 && argc != 3) || nconns <= 0 || nthreads <= 0 ||
+            size == 0 || depth <= 0 || rate < 0 || secs <= 0) {
+        benchusage(argv[0]);
+        return 1;
+    }
+    char *host = argc == 3 ? argv[1] : "localhost";
+    char *port = argv[argc-1];
+    if(nthreads > nconns) nthreads = nconns;
+
+    paylen = size * depth;
+    payload = malloc(paylen);
+    struct benchthread *threads = calloc(nthreads, sizeof *threads);
+    struct benchconn *conns = calloc(nconns, sizeof *conns);
+    if(payload == NULL || threads == NULL || conns == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    memset(payload, 'x', paylen);
+
+    for(int i = 0, off = 0; i < nthreads; i++) {
+        struct benchthread *t = &threads[i];
+        t->conns = conns + off;
+        t->nconns = nconns / nthreads + (i < nconns % nthreads);
+        t->rate = rate / nthreads;
+        off += t->nconns;
+        int err = benchsetup(t, host, port);
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            return 1;
+        }
+    }
+
+    printf("tcpbench: %d connections, %d threads, %zu byte messages, "
+            "depth %d, ", nconns, nthreads, size, depth);
+    if(rate > 0) {
+        printf("open loop at %.0f msg/s", rate);
+    } else {
+        printf("closed loop");
+    }
+    printf(", %d s\n", secs);
+    fflush(stdout);
+
+    uint64_t start = benchnow();
+    for(int i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i].thread, NULL, benchrun, &threads[i]);
+    }
+    sleep(secs);
+    for(int i = 0; i < nthreads; i++) tcploopstop(threads[i].loop);
+    for(int i = 0; i < nthreads; i++) pthread_join(threads[i].thread, NULL);
+    double elapsed = (benchnow() - start) / 1e9;
+
+    struct tcphist hist;
+    tcphistinit(&hist);
+    uint64_t done = 0, errors = 0, dropped = 0, late = 0;
+    for(int i = 0; i < nthreads; i++) {
+        tcphistmerge(&hist, &threads[i].hist);
+        done += threads[i].done;
+        errors += threads[i].errors;
+        dropped += threads[i].dropped;
+        late += threads[i].bn;
+    }
+
+    printf("messages   %llu (%.1f/s)\n", (unsigned long long)done,
+            done / elapsed);
+    printf("throughput %.2f MB/s each way\n", done * size / elapsed / 1e6);
+    printf("latency   ");
+    benchprintns("p50", tcphistpct(&hist, 50.0));
+    benchprintns("p99", tcphistpct(&hist, 99.0));
+    benchprintns("p99.9", tcphistpct(&hist, 99.9));
+    benchprintns("max", tcphistpct(&hist, 100.0));
+    printf("\n");
+    if(rate > 0) {
+        printf("backlog    %llu due messages not sent, %llu dropped\n",
+                (unsigned long long)late, (unsigned long long)dropped);
+    }
+    printf("errors     %llu\n", (unsigned long long)errors);
+    return errors > 0 || done == 0;
+}
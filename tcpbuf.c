@@ -0,0 +1,488 @@
+/* tcpbuf - Buffered, message oriented reads and writes for the tcp module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose definitions corresponding
+ * to the POSIX.1-2008 base specification and MSG_NOSIGNAL. */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tcpbuf.h"
+#include "tcpstat.h"
+
+/* the maximum number of iovec passed to a single sendmsg(2) */
+#define TCP_IOVMAX 64
+/* the minimum free space offered to a single read */
+#define TCP_READMIN 1024
+
+static size_t tcpbufpow2(size_t n)
+{
+    size_t cap = 64;
+    while(cap < n) cap <<= 1;
+    return cap;
+}
+
+static int tcpbufinit(struct tcpbuf *b, size_t size)
+{
+    b->cap = tcpbufpow2(size > 0 ? size : TCP_BUFLN);
+    b->head = 0;
+    b->len = 0;
+    b->data = malloc(b->cap);
+    if(b->data == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpbufdata write the buffered data, at most two segments, into iov and
+ * returns the number of segments. */
+static int tcpbufdata(struct tcpbuf *b, struct iovec iov[2])
+{
+    if(b->len == 0) return 0;
+    size_t first = b->cap - b->head;
+    if(first > b->len) first = b->len;
+    iov[0].iov_base = b->data + b->head;
+    iov[0].iov_len = first;
+    if(first == b->len) return 1;
+    iov[1].iov_base = b->data;
+    iov[1].iov_len = b->len - first;
+    return 2;
+}
+
+/* tcpbufspace write the free space, at most two segments, into iov and
+ * returns the number of segments. */
+static int tcpbufspace(struct tcpbuf *b, struct iovec iov[2])
+{
+    size_t space = b->cap - b->len;
+    if(space == 0) return 0;
+    size_t tail = (b->head + b->len) & (b->cap - 1);
+    size_t first = b->cap - tail;
+    if(first > space) first = space;
+    iov[0].iov_base = b->data + tail;
+    iov[0].iov_len = first;
+    if(first == space) return 1;
+    iov[1].iov_base = b->data;
+    iov[1].iov_len = space - first;
+    return 2;
+}
+
+static void tcpbufconsume(struct tcpbuf *b, size_t n)
+{
+    b->head = (b->head + n) & (b->cap - 1);
+    b->len -= n;
+    /* restart at the beginning, so the next data is contiguous */
+    if(b->len == 0) b->head = 0;
+}
+
+/* tcpbufrealloc moves the data to the start of a new buffer of cap
+ * bytes. */
+static int tcpbufrealloc(struct tcpbuf *b, size_t cap)
+{
+    char *data = malloc(cap);
+    if(data == NULL) return ENOMEM;
+    struct iovec iov[2];
+    int cnt = tcpbufdata(b, iov);
+    size_t off = 0;
+    for(int i = 0; i < cnt; i++) {
+        memcpy(data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    free(b->data);
+    b->data = data;
+    b->cap = cap;
+    b->head = 0;
+    return 0;
+}
+
+/* tcpbufreserve makes room for at least n more bytes. */
+static int tcpbufreserve(struct tcpbuf *b, size_t n)
+{
+    if(b->cap - b->len >= n) return 0;
+    return tcpbufrealloc(b, tcpbufpow2(b->len + n));
+}
+
+/* tcpbuflinear makes the buffered data contiguous. */
+static int tcpbuflinear(struct tcpbuf *b)
+{
+    if(b->head + b->len <= b->cap) return 0;
+    return tcpbufrealloc(b, b->cap);
+}
+
+static int tcpbufappend(struct tcpbuf *b, const char *src, size_t n)
+{
+    if(tcpbufreserve(b, n) != 0) return ENOMEM;
+    struct iovec iov[2];
+    int cnt = tcpbufspace(b, iov);
+    for(int i = 0; i < cnt && n > 0; i++) {
+        size_t m = iov[i].iov_len < n ? iov[i].iov_len : n;
+        memcpy(iov[i].iov_base, src, m);
+        src += m;
+        n -= m;
+        b->len += m;
+    }
+    return 0;
+}
+
+/* tcpbufpeek copies the first n buffered bytes into dst. */
+static void tcpbufpeek(struct tcpbuf *b, void *dst, size_t n)
+{
+    struct iovec iov[2];
+    int cnt = tcpbufdata(b, iov);
+    char *d = dst;
+    for(int i = 0; i < cnt && n > 0; i++) {
+        size_t m = iov[i].iov_len < n ? iov[i].iov_len : n;
+        memcpy(d, iov[i].iov_base, m);
+        d += m;
+        n -= m;
+    }
+}
+
+/* tcprdfill reads once from the connection into the free space of the
+ * buffer. It returns 0, TCP_EOF or an errno value. */
+static int tcprdfill(struct tcprd *rd)
+{
+    if(tcpbufreserve(&rd->buf, TCP_READMIN) != 0) return ENOMEM;
+
+    struct iovec iov[2];
+    int cnt = tcpbufspace(&rd->buf, iov);
+    for(;;) {
+        ssize_t n = readv(rd->fd, iov, cnt);
+        if(n == -1 && errno == EINTR) continue;
+        tcpstatio(TCP_STATREAD, n, errno);
+        if(n == -1) {
+            if(errno == EWOULDBLOCK) return EAGAIN;
+            return errno;
+        }
+        if(n == 0) return TCP_EOF;
+        rd->buf.len += n;
+        return 0;
+    }
+}
+
+/* tcprdfilln reads until at least n bytes are buffered. */
+static int tcprdfilln(struct tcprd *rd, size_t n)
+{
+    if(rd->buf.len >= n) return 0;
+    if(tcpbufreserve(&rd->buf, n - rd->buf.len) != 0) return ENOMEM;
+    while(rd->buf.len < n) {
+        int err = tcprdfill(rd);
+        if(err == TCP_EOF && rd->buf.len > 0) return ECONNRESET;
+        if(err != 0) return err;
+    }
+    return 0;
+}
+
+/* tcprdinit initializes a buffered reader of the connection fd. size is
+ * the initial size of the buffer and max is the maximum size of a line or
+ * a frame; 0 selects TCP_BUFLN and TCP_MSGMAX.
+ *
+ * It returns 0 on success or ENOMEM.
+ */
+int tcprdinit(struct tcprd *rd, int fd, size_t size, size_t max)
+{
+    rd->fd = fd;
+    rd->max = max > 0 ? max : TCP_MSGMAX;
+    return tcpbufinit(&rd->buf, size);
+}
+
+/* tcprdfree releases the buffer of the reader, the connection is not
+ * closed. */
+void tcprdfree(struct tcprd *rd)
+{
+    free(rd->buf.data);
+    rd->buf.data = NULL;
+}
+
+/* tcpreadline reads a line terminated by '\n'. On success *line points to
+ * the line, including the '\n', and *n is its length. The line stays valid
+ * until the next call on the reader; it is not NUL-terminated.
+ *
+ * Every read function returns 0 on success or one of:
+ *
+ * TCP_EOF
+ * The peer closed the connection before the first byte of the message.
+ *
+ * ECONNRESET
+ * The peer closed the connection in the middle of a message.
+ *
+ * EAGAIN
+ * The connection is non-blocking and the message is not complete yet. The
+ * partial message is kept in the buffer; call again when readable.
+ *
+ * EMSGSIZE
+ * The message is longer than the maximum size of the reader.
+ *
+ * Other errors of readv(2) and ENOMEM may be returned.
+ *
+ * Example
+ *     struct tcprd rd;
+ *     tcprdinit(&rd, conn, 0, 0);
+ *     char *line;
+ *     size_t n;
+ *     while(tcpreadline(&rd, &line, &n) == 0) {
+ *         printf("%.*s", (int)n, line);
+ *     }
+ */
+int tcpreadline(struct tcprd *rd, char **line, size_t *n)
+{
+    size_t scanned = 0;
+    for(;;) {
+        struct iovec iov[2];
+        int cnt = tcpbufdata(&rd->buf, iov);
+        size_t base = 0;
+        for(int i = 0; i < cnt; i++) {
+            if(scanned < base + iov[i].iov_len) {
+                size_t off = scanned > base ? scanned - base : 0;
+                char *nl = memchr((char *)iov[i].iov_base + off, '\n',
+                        iov[i].iov_len - off);
+                if(nl != NULL) {
+                    size_t len = base + (nl - (char *)iov[i].iov_base) + 1;
+                    if(tcpbuflinear(&rd->buf) != 0) return ENOMEM;
+                    *line = rd->buf.data + rd->buf.head;
+                    *n = len;
+                    tcpbufconsume(&rd->buf, len);
+                    return 0;
+                }
+            }
+            base += iov[i].iov_len;
+        }
+
+        scanned = rd->buf.len;
+        if(scanned >= rd->max) return EMSGSIZE;
+        int err = tcprdfill(rd);
+        if(err == TCP_EOF && rd->buf.len > 0) return ECONNRESET;
+        if(err != 0) return err;
+    }
+}
+
+/* tcpreadn reads exactly n bytes into dst. The bytes are only taken from
+ * the buffer once all of them arrived, so EAGAIN never loses data. */
+int tcpreadn(struct tcprd *rd, void *dst, size_t n)
+{
+    if(n == 0) return 0;
+    if(n > rd->max) return EMSGSIZE;
+    int err = tcprdfilln(rd, n);
+    if(err != 0) return err;
+    tcpbufpeek(&rd->buf, dst, n);
+    tcpbufconsume(&rd->buf, n);
+    return 0;
+}
+
+/* tcpreadframe reads a frame prefixed by its length as a 32-bit big-endian
+ * integer, as written by tcpwriteframe. On success *frame points to the
+ * payload and *n is its length; the payload stays valid until the next
+ * call on the reader. */
+int tcpreadframe(struct tcprd *rd, char **frame, size_t *n)
+{
+    int err = tcprdfilln(rd, 4);
+    if(err != 0) return err;
+
+    unsigned char hdr[4];
+    tcpbufpeek(&rd->buf, hdr, 4);
+    size_t len = (size_t)hdr[0] << 24 | (size_t)hdr[1] << 16 |
+        (size_t)hdr[2] << 8 | hdr[3];
+    if(len > rd->max) return EMSGSIZE;
+
+    err = tcprdfilln(rd, 4 + len);
+    if(err == TCP_EOF) return ECONNRESET;
+    if(err != 0) return err;
+    if(tcpbuflinear(&rd->buf) != 0) return ENOMEM;
+    *frame = rd->buf.data + rd->buf.head + 4;
+    *n = len;
+    tcpbufconsume(&rd->buf, 4 + len);
+    return 0;
+}
+
+/* tcpwrinit initializes a buffered writer of the connection fd. size is
+ * the size of the buffer, writes that fit in it are coalesced until
+ * tcpflush; 0 selects TCP_BUFLN.
+ *
+ * It returns 0 on success or ENOMEM.
+ */
+int tcpwrinit(struct tcpwr *wr, int fd, size_t size)
+{
+    wr->fd = fd;
+    return tcpbufinit(&wr->buf, size);
+}
+
+/* tcpwrfree releases the buffer of the writer. Unflushed data is
+ * dropped. */
+void tcpwrfree(struct tcpwr *wr)
+{
+    free(wr->buf.data);
+    wr->buf.data = NULL;
+}
+
+/* tcpwritev writes the gather array iov. Small writes are only copied to
+ * the buffer. When the data does not fit, the buffered data and iov are
+ * sent together by a single sendmsg(2) without copying iov.
+ *
+ * The write functions return 0 on success or one of:
+ *
+ * EAGAIN
+ * The connection is non-blocking and not everything could be sent. The
+ * rest is kept in the buffer; call tcpflush when writable.
+ *
+ * Other errors of sendmsg(2), such as EPIPE, and ENOMEM.
+ */
+int tcpwritev(struct tcpwr *wr, const struct iovec *iov, int iovcnt)
+{
+    if(iovcnt > TCP_IOVMAX - 2) {
+        int err = tcpwritev(wr, iov, TCP_IOVMAX - 2);
+        if(err != 0 && err != EAGAIN) return err;
+        int errrest = tcpwritev(wr, iov + TCP_IOVMAX - 2,
+                iovcnt - (TCP_IOVMAX - 2));
+        return errrest != 0 ? errrest : err;
+    }
+
+    size_t total = 0;
+    for(int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    /* coalesce small writes */
+    if(wr->buf.len + total <= wr->buf.cap) {
+        for(int i = 0; i < iovcnt; i++) {
+            tcpbufappend(&wr->buf, iov[i].iov_base, iov[i].iov_len);
+        }
+        return 0;
+    }
+
+    struct iovec vec[TCP_IOVMAX];
+    int nbuf = tcpbufdata(&wr->buf, vec);
+    memcpy(vec + nbuf, iov, iovcnt * sizeof *iov);
+    int cnt = nbuf + iovcnt;
+    struct iovec *v = vec;
+
+    while(cnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = v;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(wr->fd, &msg, MSG_NOSIGNAL);
+        if(n == -1 && errno == EINTR) continue;
+        tcpstatio(TCP_STATWRITE, n, errno);
+        if(n == -1) {
+            int err = errno == EWOULDBLOCK ? EAGAIN : errno;
+            if(err != EAGAIN) return err;
+            break;
+        }
+
+        /* account for the sent bytes, buffered data first */
+        size_t sent = n;
+        size_t fromb = sent < wr->buf.len ? sent : wr->buf.len;
+        tcpbufconsume(&wr->buf, fromb);
+        while(cnt > 0 && sent >= v->iov_len) {
+            sent -= v->iov_len;
+            v++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            v->iov_base = (char *)v->iov_base + sent;
+            v->iov_len -= sent;
+        }
+    }
+    if(cnt == 0) return 0;
+
+    /* keep the part of iov that was not sent; the buffered data that was
+     * not sent is still in the buffer */
+    int first = 0;
+    size_t skip = wr->buf.len;
+    while(first < cnt && skip > 0) {
+        size_t m = v[first].iov_len < skip ? v[first].iov_len : skip;
+        skip -= m;
+        if(m == v[first].iov_len) {
+            first++;
+        } else {
+            v[first].iov_base = (char *)v[first].iov_base + m;
+            v[first].iov_len -= m;
+        }
+    }
+    for(int i = first; i < cnt; i++) {
+        if(tcpbufappend(&wr->buf, v[i].iov_base, v[i].iov_len) != 0) {
+            return ENOMEM;
+        }
+    }
+    return EAGAIN;
+}
+
+/* tcpwrite writes n bytes of src, see tcpwritev. */
+int tcpwrite(struct tcpwr *wr, const void *src, size_t n)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)src;
+    iov.iov_len = n;
+    return tcpwritev(wr, &iov, 1);
+}
+
+/* tcpwriteframe writes src prefixed by its length as a 32-bit big-endian
+ * integer, see tcpwritev. */
+int tcpwriteframe(struct tcpwr *wr, const void *src, size_t n)
+{
+    if(n > 0xffffffffu) return EMSGSIZE;
+    unsigned char hdr[4];
+    hdr[0] = n >> 24;
+    hdr[1] = n >> 16;
+    hdr[2] = n >> 8;
+    hdr[3] = n;
+
+    struct iovec iov[2];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 4;
+    iov[1].iov_base = (void *)src;
+    iov[1].iov_len = n;
+    return tcpwritev(wr, iov, 2);
+}
+
+/* tcpflush sends the buffered data. It returns 0 when the buffer is empty,
+ * or an error of tcpwritev. */
+int tcpflush(struct tcpwr *wr)
+{
+    while(wr->buf.len > 0) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = tcpbufdata(&wr->buf, iov);
+        ssize_t n = sendmsg(wr->fd, &msg, MSG_NOSIGNAL);
+        if(n == -1 && errno == EINTR) continue;
+        tcpstatio(TCP_STATWRITE, n, errno);
+        if(n == -1) {
+            if(errno == EWOULDBLOCK) return EAGAIN;
+            return errno;
+        }
+        tcpbufconsume(&wr->buf, n);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* tcpbuf - Buffered, message oriented reads and writes for the tcp module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPBUF_H
+#define TCPBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* returned by the read functions when the peer closed the connection
+ * cleanly, at a message boundary */
+#define TCP_EOF (-1)
+/* the default initial size of the buffers */
+#define TCP_BUFLN 4096
+/* the default maximum size of a line or a frame */
+#define TCP_MSGMAX (1 << 20)
+
+/* tcpbuf is a growable ring buffer. Its capacity is always a power of two
+ * and the data starts at head, wrapping around at the end. */
+struct tcpbuf {
+    char *data;
+    size_t cap;
+    size_t head;
+    size_t len;
+};
+
+struct tcprd {
+    int fd;
+    size_t max;
+    struct tcpbuf buf;
+};
+
+struct tcpwr {
+    int fd;
+    struct tcpbuf buf;
+};
+
+int tcprdinit(struct tcprd *rd, int fd, size_t size, size_t max);
+void tcprdfree(struct tcprd *rd);
+int tcpreadline(struct tcprd *rd, char **line, size_t *n);
+int tcpreadn(struct tcprd *rd, void *dst, size_t n);
+int tcpreadframe(struct tcprd *rd, char **frame, size_t *n);
+
+int tcpwrinit(struct tcpwr *wr, int fd, size_t size);
+void tcpwrfree(struct tcpwr *wr);
+int tcpwrite(struct tcpwr *wr, const void *src, size_t n);
+int tcpwritev(struct tcpwr *wr, const struct iovec *iov, int iovcnt);
+int tcpwriteframe(struct tcpwr *wr, const void *src, size_t n);
+int tcpflush(struct tcpwr *wr);
+
+#endif
@@ -0,0 +1,382 @@
+/* tcpfiber - Stackful fibers on top of tcpasync, so a connection can be
+ * served by sequential code while one thread multiplexes many of them.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the interfaces used
+ * here that POSIX.1-2008 dropped or never had: the ucontext(3) functions
+ * and MAP_ANONYMOUS. */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__x86_64__) && !defined(TCP_FIBERUCONTEXT)
+#define TCP_FIBERASM
+#else
+#include <ucontext.h>
+#endif
+
+#include "tcpasync.h"
+#include "tcptimer.h"
+#include "tcpfiber.h"
+
+struct tcpfiber {
+#ifdef TCP_FIBERASM
+    /* the saved stack pointers of the fiber and of whoever resumed it */
+    void *sp;
+    void *back;
+#else
+    ucontext_t uc;
+    ucontext_t backuc;
+#endif
+    char *map;
+    size_t maplen;
+    tcpfiberfn *fn;
+    void *arg;
+    struct tcpasync *as;
+    struct tcptimer sleep;
+    int done;
+    /* an operation is pending, and the fiber is suspended waiting for it */
+    int pending;
+    int suspended;
+    int fd;
+    ssize_t res;
+};
+
+/* the fiber running on this thread, NULL outside of fibers */
+static __thread struct tcpfiber *tcpfibercur;
+
+#ifdef TCP_FIBERASM
+/* tcpfiberswitch saves the callee-saved registers of the System V ABI on
+ * the current stack, stores the stack pointer in *save, and restores the
+ * registers saved on the stack at to. Unlike swapcontext(3), it leaves the
+ * signal mask alone and so never enters the kernel. The floating point
+ * control words are shared by all the fibers of the thread. */
+void tcpfiberswitch(void **save, void *to);
+
+__asm__(
+    ".text\n"
+    ".globl tcpfiberswitch\n"
+    ".hidden tcpfiberswitch\n"
+    ".type tcpfiberswitch, @function\n"
+    "tcpfiberswitch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size tcpfiberswitch, .-tcpfiberswitch\n"
+);
+#endif
+
+static void tcpfiberrelease(struct tcpfiber *f)
+{
+    munmap(f->map, f->maplen);
+    free(f);
+}
+
+/* tcpfiberboot is the first function of every fiber. It never returns:
+ * the finished fiber switches back for good and is released by
+ * tcpfiberresume, which runs on another stack. */
+static void tcpfiberboot(void)
+{
+    struct tcpfiber *f = tcpfibercur;
+    f->fn(f->arg);
+    f->done = 1;
+    tcpfibersuspend();
+}
+
+/* tcpfiberstart creates a fiber with a stack of stacklen bytes, or
+ * TCP_FIBERSTACK if stacklen is 0, that runs fn(arg), and runs it until
+ * it first waits. The fiber is released once fn returns. Fibers run on the
+ * loop thread of as and wait for I/O with tcpfiberdial, tcpfiberread and
+ * tcpfiberwrite, which suspend the fiber until tcpasync completes the
+ * operation, while the loop runs the other fibers.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM or the error of mmap(2).
+ *
+ * Example:
+ *
+ *     static void client(void *arg)
+ *     {
+ *         int conn;
+ *         size_t n;
+ *         char buf[64];
+ *         if(tcpfiberdial(&conn, "localhost", "9090", 1000) != 0) return;
+ *         if(tcpfiberwrite(conn, "hello\n", 6, 1000) == 0) {
+ *             tcpfiberread(conn, buf, sizeof buf, &n, 1000);
+ *         }
+ *         tcpfiberclose(conn);
+ *     }
+ *
+ *     for(int i = 0; i < 1000; i++) {
+ *         tcpfiberstart(as, client, NULL, 0);
+ *     }
+ *     tcplooprun(loop);
+ */
+int tcpfiberstart(struct tcpasync *as, tcpfiberfn *fn, void *arg,
+        size_t stacklen)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if(stacklen == 0) stacklen = TCP_FIBERSTACK;
+    stacklen = (stacklen + page - 1) / page * page;
+
+    struct tcpfiber *f = calloc(1, sizeof *f);
+    if(f == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    f->maplen = stacklen + page;
+    f->map = mmap(NULL, f->maplen, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(f->map == MAP_FAILED) {
+        int err = errno;
+        free(f);
+        errno = err;
+        return errno;
+    }
+    /* an overflow faults instead of corrupting the neighbouring memory */
+    mprotect(f->map, page, PROT_NONE);
+    f->fn = fn;
+    f->arg = arg;
+    f->as = as;
+
+#ifdef TCP_FIBERASM
+    /* the first switch pops six zero registers and returns to
+     * tcpfiberboot as if it had been called, with the stack aligned as the
+     * ABI requires on function entry */
+    uintptr_t *sp = (uintptr_t *)((uintptr_t)(f->map + f->maplen) & ~15);
+    *--sp = 0;
+    *--sp = (uintptr_t)tcpfiberboot;
+    for(int i = 0; i < 6; i++) *--sp = 0;
+    f->sp = sp;
+#else
+    getcontext(&f->uc);
+    f->uc.uc_stack.ss_sp = f->map + page;
+    f->uc.uc_stack.ss_size = stacklen;
+    f->uc.uc_link = NULL;
+    makecontext(&f->uc, tcpfiberboot, 0);
+#endif
+
+    tcpfiberresume(f);
+    return 0;
+}
+
+/* tcpfiberself returns the running fiber, or NULL outside of fibers. */
+struct tcpfiber *tcpfiberself(void)
+{
+    return tcpfibercur;
+}
+
+/* tcpfibersuspend suspends the running fiber and returns to whoever
+ * resumed it, until tcpfiberresume resumes it again. It is the building
+ * block of waits the fiber does not do through tcpasync, e.g. for a job of
+ * tcpwork whose done callback resumes the fiber. */
+void tcpfibersuspend(void)
+{
+    struct tcpfiber *f = tcpfibercur;
+#ifdef TCP_FIBERASM
+    tcpfiberswitch(&f->sp, f->back);
+#else
+    swapcontext(&f->uc, &f->backuc);
+#endif
+}
+
+/* tcpfiberresume runs the suspended fiber f until it waits again or
+ * finishes. It may be called from the loop thread, in or out of a fiber. */
+void tcpfiberresume(struct tcpfiber *f)
+{
+    struct tcpfiber *prev = tcpfibercur;
+    tcpfibercur = f;
+#ifdef TCP_FIBERASM
+    tcpfiberswitch(&f->back, f->sp);
+#else
+    swapcontext(&f->backuc, &f->uc);
+#endif
+    tcpfibercur = prev;
+    if(f->done) tcpfiberrelease(f);
+}
+
+static void tcpfiberwake(struct tcpasync *as, int fd, ssize_t res,
+        void *arg)
+{
+    struct tcpfiber *f = arg;
+    (void)as;
+    f->fd = fd;
+    f->res = res;
+    f->pending = 0;
+    /* not suspended yet when the operation completed at once */
+    if(f->suspended) tcpfiberresume(f);
+}
+
+/* tcpfiberwait suspends f until its pending operation completes. It
+ * returns the result of the operation. */
+static ssize_t tcpfiberwait(struct tcpfiber *f, int err)
+{
+    if(err != 0) {
+        f->pending = 0;
+        return -err;
+    }
+    if(f->pending) {
+        f->suspended = 1;
+        tcpfibersuspend();
+        f->suspended = 0;
+    }
+    return f->res;
+}
+
+/* tcpfiberdial connects to host:port like tcpdialasync and writes the
+ * connection into *conn. It must be called from a fiber.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL outside of a fiber, ETIMEDOUT, or an error of
+ * tcpdialasync.
+ */
+int tcpfiberdial(int *conn, char host[], char port[], int timeoutms)
+{
+    struct tcpfiber *f = tcpfibercur;
+    if(f == NULL) {
+        errno = EINVAL;
+        return errno;
+    }
+    f->pending = 1;
+    ssize_t res = tcpfiberwait(f, tcpdialasync(f->as, host, port,
+                timeoutms, tcpfiberwake, f));
+    if(res < 0) {
+        errno = -res;
+        return errno;
+    }
+    *conn = f->fd;
+    return 0;
+}
+
+/* tcpfiberread reads up to len bytes from fd into buf like tcpreadasync
+ * and writes the number of bytes read, 0 on EOF, into *n. It must be
+ * called from a fiber.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL outside of a fiber, ETIMEDOUT, ECANCELED, or an
+ * error of tcpreadasync or recv(2).
+ */
+int tcpfiberread(int fd, void *buf, size_t len, size_t *n, int timeoutms)
+{
+    struct tcpfiber *f = tcpfibercur;
+    if(f == NULL) {
+        errno = EINVAL;
+        return errno;
+    }
+    f->pending = 1;
+    ssize_t res = tcpfiberwait(f, tcpreadasync(f->as, fd, buf, len,
+                timeoutms, tcpfiberwake, f));
+    if(res < 0) {
+        errno = -res;
+        return errno;
+    }
+    *n = res;
+    return 0;
+}
+
+/* tcpfiberwrite writes the len bytes of buf to fd like tcpwriteasync. It
+ * must be called from a fiber.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL outside of a fiber, ETIMEDOUT, ECANCELED, or an
+ * error of tcpwriteasync or send(2).
+ */
+int tcpfiberwrite(int fd, const void *buf, size_t len, int timeoutms)
+{
+    struct tcpfiber *f = tcpfibercur;
+    if(f == NULL) {
+        errno = EINVAL;
+        return errno;
+    }
+    f->pending = 1;
+    ssize_t res = tcpfiberwait(f, tcpwriteasync(f->as, fd, buf, len,
+                timeoutms, tcpfiberwake, f));
+    if(res < 0) {
+        errno = -res;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpfiberclose closes fd with tcpcloseasync. */
+int tcpfiberclose(int fd)
+{
+    struct tcpfiber *f = tcpfibercur;
+    if(f == NULL) {
+        errno = EINVAL;
+        return errno;
+    }
+    return tcpcloseasync(f->as, fd);
+}
+
+static void tcpfiberalarm(struct tcpwheel *w, struct tcptimer *t)
+{
+    struct tcpfiber *f = (struct tcpfiber *)
+        ((char *)t - offsetof(struct tcpfiber, sleep));
+    (void)w;
+    tcpfiberresume(f);
+}
+
+/* tcpfibersleep suspends the running fiber for ms milliseconds, on the
+ * timer wheel of the loop.
+ *
+ * It returns 0, or EINVAL outside of a fiber.
+ */
+int tcpfibersleep(int ms)
+{
+    struct tcpfiber *f = tcpfibercur;
+    if(f == NULL) {
+        errno = EINVAL;
+        return errno;
+    }
+    tcptimerinit(&f->sleep, tcpfiberalarm);
+    tcptimerarm(tcploopwheel(tcpasyncloop(f->as)), &f->sleep, ms);
+    tcpfibersuspend();
+    return 0;
+}
@@ -0,0 +1,59 @@
+/* tcpfiber - Stackful fibers on top of tcpasync, so a connection can be
+ * served by sequential code while one thread multiplexes many of them.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPFIBER_H
+#define TCPFIBER_H
+
+#include <stddef.h>
+
+#include "tcpasync.h"
+
+/* the default stack size of a fiber; the lowest page of the stack is a
+ * guard page */
+#define TCP_FIBERSTACK (64 * 1024)
+
+struct tcpfiber;
+
+typedef void tcpfiberfn(void *arg);
+
+int tcpfiberstart(struct tcpasync *as, tcpfiberfn *fn, void *arg,
+        size_t stacklen);
+struct tcpfiber *tcpfiberself(void);
+void tcpfibersuspend(void);
+void tcpfiberresume(struct tcpfiber *f);
+int tcpfiberdial(int *conn, char host[], char port[], int timeoutms);
+int tcpfiberread(int fd, void *buf, size_t len, size_t *n, int timeoutms);
+int tcpfiberwrite(int fd, const void *buf, size_t len, int timeoutms);
+int tcpfiberclose(int fd);
+int tcpfibersleep(int ms);
+
+#endif
@@ -0,0 +1,110 @@
+/* tcphist - A log-linear latency histogram.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "tcphist.h"
+
+/* the value 2 * TCP_HISTSUB, below it every value has its own bucket */
+#define TCP_HISTLIN (2 * TCP_HISTSUB)
+/* log2(TCP_HISTSUB) */
+#define TCP_HISTSHIFT 6
+
+/* tcphistidx maps v to its bucket. Values below TCP_HISTLIN map to
+ * themselves; above, every power of two is split into TCP_HISTSUB
+ * buckets. */
+static int tcphistidx(uint64_t v)
+{
+    if(v < TCP_HISTLIN) return v;
+    int msb = 63 - __builtin_clzll(v);
+    int b = msb - TCP_HISTSHIFT;
+    return b * TCP_HISTSUB + (int)(v >> b);
+}
+
+/* tcphistval returns the highest value that maps to bucket idx. */
+static uint64_t tcphistval(int idx)
+{
+    if(idx < TCP_HISTLIN) return idx;
+    int b = idx / TCP_HISTSUB - 1;
+    return (((uint64_t)(idx - b * TCP_HISTSUB) + 1) << b) - 1;
+}
+
+void tcphistinit(struct tcphist *h)
+{
+    memset(h, 0, sizeof *h);
+    h->min = UINT64_MAX;
+}
+
+/* tcphistadd counts the value v. Values beyond the range of the histogram
+ * are counted in the last bucket but still update the maximum. */
+void tcphistadd(struct tcphist *h, uint64_t v)
+{
+    int idx = tcphistidx(v);
+    if(idx >= TCP_HISTLN) idx = TCP_HISTLN - 1;
+    h->counts[idx]++;
+    h->n++;
+    if(v < h->min) h->min = v;
+    if(v > h->max) h->max = v;
+}
+
+/* tcphistmerge adds the counts of src to dst. */
+void tcphistmerge(struct tcphist *dst, struct tcphist *src)
+{
+    for(int i = 0; i < TCP_HISTLN; i++) dst->counts[i] += src->counts[i];
+    dst->n += src->n;
+    if(src->min < dst->min) dst->min = src->min;
+    if(src->max > dst->max) dst->max = src->max;
+}
+
+/* tcphistpct returns the value below which pct percent of the values fall,
+ * rounded up to the bucket boundary. It returns 0 for an empty histogram
+ * and the exact maximum for pct 100.
+ *
+ * Example:
+ *
+ *     printf("p99 %llu ns\n", (unsigned long long)tcphistpct(&h, 99.0));
+ */
+uint64_t tcphistpct(struct tcphist *h, double pct)
+{
+    if(h->n == 0) return 0;
+    if(pct >= 100.0) return h->max;
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * h->n + 0.5);
+    if(rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < TCP_HISTLN; i++) {
+        seen += h->counts[i];
+        if(seen >= rank) {
+            uint64_t v = tcphistval(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
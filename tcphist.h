@@ -0,0 +1,57 @@
+/* tcphist - A log-linear latency histogram in the style of HdrHistogram.
+ * Values are counted in buckets whose width grows with the value, which
+ * keeps the relative error below 1/TCP_HISTSUB at any magnitude in a fixed
+ * amount of memory.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPHIST_H
+#define TCPHIST_H
+
+#include <stdint.h>
+
+/* sub-buckets per power of two; the precision is 1/TCP_HISTSUB */
+#define TCP_HISTSUB 64
+/* values up to 2^TCP_HISTBITS, in nanoseconds that is about 18 minutes */
+#define TCP_HISTBITS 40
+#define TCP_HISTLN ((TCP_HISTBITS - 5) * TCP_HISTSUB)
+
+struct tcphist {
+    uint64_t n;
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[TCP_HISTLN];
+};
+
+void tcphistinit(struct tcphist *h);
+void tcphistadd(struct tcphist *h, uint64_t v);
+void tcphistmerge(struct tcphist *dst, struct tcphist *src);
+uint64_t tcphistpct(struct tcphist *h, double pct);
+
+#endif
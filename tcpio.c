@@ -0,0 +1,1184 @@
+/* tcpio - A completion based I/O engine for the tcp module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces the engines are built on: the io_uring(7) system calls,
+ * eventfd(2) and accept4(2). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "tcp.h"
+#include "tcploop.h"
+#include "tcpio.h"
+
+/* the operation of a submission, kept in the low byte of its user_data; the
+ * descriptor is kept in the remaining bits */
+enum {
+    TCP_OPACCEPT = 1,
+    TCP_OPRECV,
+    TCP_OPSEND,
+    TCP_OPWAKE,
+    TCP_OPCANCEL,
+    /* waits for a connection after an accept ran out of descriptors */
+    TCP_OPPOLL
+};
+
+/* the state of a descriptor */
+enum {
+    /* the caller wants connections or data */
+    TCP_FDACCEPT = 1,
+    TCP_FDRECV = 2,
+    /* io_uring: the accept, or the poll that replaces it while out of
+     * descriptors, or the receive is armed in the kernel */
+    TCP_FDACCEPTQ = 4,
+    TCP_FDRECVQ = 8,
+    /* epoll: registered to the loop */
+    TCP_FDADDED = 16,
+    TCP_FDCLOSING = 32,
+    /* io_uring: the cancel of a closing descriptor waits for room in the
+     * submission queue */
+    TCP_FDCANCELQ = 64
+};
+
+struct tcpiosend {
+    struct tcpiosend *next;
+    const char *buf;
+    size_t len;
+    size_t off;
+    tcpiofn *fn;
+    void *arg;
+};
+
+struct tcpiofd {
+    /* the event source of the epoll engine, first so the loop callback can
+     * cast it back */
+    struct tcpev ev;
+    struct tcpio *io;
+    int flags;
+    tcpiofn *acceptfn;
+    void *acceptarg;
+    tcpiofn *recvfn;
+    void *recvarg;
+    /* the queued sends in order; the ones that completed are always at the
+     * head */
+    struct tcpiosend *head;
+    struct tcpiosend *tail;
+    /* io_uring: the send the next send completion belongs to, and the
+     * number of sends in flight */
+    struct tcpiosend *cqe;
+    int nsend;
+    /* the first send error, the following sends fail with it */
+    int senderr;
+    /* io_uring: the number of operations the kernel still owns */
+    int ninflight;
+    /* the nesting depth of the callbacks running for the descriptor; the
+     * state is only released when it drops to zero */
+    int busy;
+    /* io_uring: the next descriptor whose cancel waits */
+    struct tcpiofd *cancelnext;
+};
+
+struct tcpuring {
+    int fd;
+    unsigned *sqhead;
+    unsigned *sqtail;
+    unsigned *sqmask;
+    unsigned *sqarray;
+    unsigned *cqhead;
+    unsigned *cqtail;
+    unsigned *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqentries;
+    /* the tail of the submission queue not yet published to the kernel, and
+     * the number of entries the kernel has not consumed */
+    unsigned sqlocal;
+    unsigned pending;
+    void *map;
+    size_t maplen;
+    void *sqemap;
+    size_t sqemaplen;
+    /* the provided buffer ring the kernel picks receive buffers from */
+    struct io_uring_buf_ring *br;
+    size_t brlen;
+    unsigned short brtail;
+    char *bufs;
+    /* cleared when the kernel rejects multishot accept or receive */
+    int multishot;
+    int wakefd;
+};
+
+struct tcpio {
+    int engine;
+    int stop;
+    /* a descriptor kept open to be released when accept fails with EMFILE
+     * or ENFILE, so the pending connections can be taken and closed */
+    int spare;
+    /* the descriptor state, indexed by descriptor */
+    struct tcpiofd **fds;
+    int nfds;
+    /* the epoll engine */
+    struct tcploop *loop;
+    char *buf;
+    /* the io_uring engine */
+    struct tcpuring ring;
+    /* the closing descriptors whose cancel did not fit in the submission
+     * queue yet */
+    struct tcpiofd *cancels;
+};
+
+/* tcpaccepterr reports whether an accept error is worth retrying. After
+ * any other error, ENOMEM for one, the engine stops accepting until the
+ * caller calls tcpioaccept again, instead of spinning on the error. */
+static int tcpaccepterr(int err)
+{
+    return err == ECONNABORTED || err == EINTR || err == EAGAIN;
+}
+
+static uint64_t tcpud(int fd, int op)
+{
+    return (uint64_t)fd << 8 | op;
+}
+
+static struct tcpiofd *tcpiofdget(struct tcpio *io, int fd)
+{
+    if(fd < 0) {
+        errno = EBADF;
+        return NULL;
+    }
+    if(fd >= io->nfds) {
+        int n = io->nfds > 0 ? io->nfds : 64;
+        while(n <= fd) n *= 2;
+        struct tcpiofd **fds = realloc(io->fds, n * sizeof *fds);
+        if(fds == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(fds + io->nfds, 0, (n - io->nfds) * sizeof *fds);
+        io->fds = fds;
+        io->nfds = n;
+    }
+    if(io->fds[fd] == NULL) {
+        struct tcpiofd *c = calloc(1, sizeof *c);
+        if(c == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        c->ev.fd = fd;
+        c->io = io;
+        io->fds[fd] = c;
+    }
+    return io->fds[fd];
+}
+
+/* tcpiodrain takes the pending connections off ln and closes them while
+ * the process or the system is out of descriptors, releasing the spare
+ * descriptor for each accept. Otherwise the queue never empties: the
+ * accepts keep failing and the peers wait for connections that are not
+ * served.
+ *
+ * It returns 0 once the queue is empty, or EMFILE or ENFILE if there is no
+ * spare descriptor to release.
+ */
+static int tcpiodrain(struct tcpio *io, int ln)
+{
+    for(;;) {
+        if(io->spare == -1) {
+            io->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if(io->spare == -1) return errno;
+        }
+        /* accept fails with EMFILE even when the queue is empty, and would
+         * block on a blocking listener, so look first */
+        struct pollfd p = { ln, POLLIN, 0 };
+        if(poll(&p, 1, 0) != 1 || !(p.revents & POLLIN)) return 0;
+        close(io->spare);
+        int conn = accept(ln, NULL, NULL);
+        if(conn != -1) close(conn);
+        io->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+/* tcpiofail fails every queued send with err. */
+static void tcpiofail(struct tcpio *io, struct tcpiofd *c, int err)
+{
+    c->busy++;
+    while(c->head != NULL) {
+        struct tcpiosend *s = c->head;
+        c->head = s->next;
+        s->fn(io, c->ev.fd, -err, (char *)s->buf, s->arg);
+        free(s);
+    }
+    c->tail = NULL;
+    c->busy--;
+}
+
+/* tcpioput releases the state of a closing descriptor once neither the
+ * kernel nor a callback references it. */
+static void tcpioput(struct tcpio *io, struct tcpiofd *c)
+{
+    if(!(c->flags & TCP_FDCLOSING) || c->ninflight > 0 || c->busy > 0 ||
+            (c->flags & TCP_FDCANCELQ)) {
+        return;
+    }
+    tcpiofail(io, c, ECANCELED);
+    if(c->flags & TCP_FDADDED) tcploopdel(io->loop, &c->ev);
+    close(c->ev.fd);
+    io->fds[c->ev.fd] = NULL;
+    free(c);
+}
+
+/* The io_uring engine. The rings are set up with the raw system calls, so
+ * no library is needed. */
+
+static int tcpuringsetup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int tcpuringenter(int fd, unsigned submit, unsigned wait,
+        unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int tcpuringregister(int fd, unsigned op, void *arg, unsigned n)
+{
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+/* tcpuringsubmit publishes the queued submissions and, if wait is non-zero,
+ * waits for at least one completion. */
+static int tcpuringsubmit(struct tcpuring *r, int wait)
+{
+    __atomic_store_n(r->sqtail, r->sqlocal, __ATOMIC_RELEASE);
+    if(r->pending == 0 && !wait) return 0;
+
+    int n = tcpuringenter(r->fd, r->pending, wait ? 1 : 0,
+            wait ? IORING_ENTER_GETEVENTS : 0);
+    if(n == -1) return errno;
+    r->pending -= (unsigned)n < r->pending ? (unsigned)n : r->pending;
+    return 0;
+}
+
+static unsigned tcpsqspace(struct tcpuring *r)
+{
+    unsigned head = __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+    return r->sqentries - (r->sqlocal - head);
+}
+
+/* tcpsqe returns the next free submission queue entry, or NULL if the
+ * kernel cannot take more submissions right now. */
+static struct io_uring_sqe *tcpsqe(struct tcpuring *r)
+{
+    if(tcpsqspace(r) == 0) {
+        tcpuringsubmit(r, 0);
+        if(tcpsqspace(r) == 0) return NULL;
+    }
+    unsigned idx = r->sqlocal & *r->sqmask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof *sqe);
+    r->sqarray[idx] = idx;
+    r->sqlocal++;
+    r->pending++;
+    return sqe;
+}
+
+/* tcpuringbuf hands the receive buffer bid back to the kernel. */
+static void tcpuringbuf(struct tcpuring *r, unsigned bid)
+{
+    struct io_uring_buf *b = &r->br->bufs[r->brtail & (TCP_IOBUFS - 1)];
+    b->addr = (uintptr_t)(r->bufs + (size_t)bid * TCP_IOBUFLN);
+    b->len = TCP_IOBUFLN;
+    b->bid = bid;
+    r->brtail++;
+    __atomic_store_n(&r->br->tail, r->brtail, __ATOMIC_RELEASE);
+}
+
+static int tcparmwake(struct tcpuring *r)
+{
+    struct io_uring_sqe *sqe = tcpsqe(r);
+    if(sqe == NULL) return EBUSY;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = r->wakefd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tcpud(0, TCP_OPWAKE);
+    return 0;
+}
+
+static void tcpuringfree(struct tcpuring *r)
+{
+    if(r->wakefd != -1) close(r->wakefd);
+    if(r->br != NULL) munmap(r->br, r->brlen);
+    free(r->bufs);
+    if(r->sqemap != NULL) munmap(r->sqemap, r->sqemaplen);
+    if(r->map != NULL) munmap(r->map, r->maplen);
+    close(r->fd);
+}
+
+/* tcpuringinit sets up the ring and registers the receive buffers. It fails
+ * on kernels without io_uring, where it is disabled, and on kernels older
+ * than 5.19 which have no provided buffer rings. */
+static int tcpuringinit(struct tcpuring *r)
+{
+    memset(r, 0, sizeof *r);
+    r->wakefd = -1;
+
+    /* a single thread submits and reaps, which lets the kernel defer the
+     * completion work until we ask for completions */
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+        IORING_SETUP_DEFER_TASKRUN;
+    r->fd = tcpuringsetup(TCP_IOENTRIES, &p);
+    if(r->fd == -1 && errno == EINVAL) {
+        memset(&p, 0, sizeof p);
+        r->fd = tcpuringsetup(TCP_IOENTRIES, &p);
+    }
+    if(r->fd == -1) return errno;
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(r->fd);
+        return EOPNOTSUPP;
+    }
+
+    int err = 0;
+    r->maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(cqlen > r->maplen) r->maplen = cqlen;
+    r->map = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->map == MAP_FAILED) {
+        err = errno;
+        r->map = NULL;
+        goto fail;
+    }
+    r->sqemaplen = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqemap = mmap(NULL, r->sqemaplen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sqemap == MAP_FAILED) {
+        err = errno;
+        r->sqemap = NULL;
+        goto fail;
+    }
+
+    char *m = r->map;
+    r->sqhead = (unsigned *)(m + p.sq_off.head);
+    r->sqtail = (unsigned *)(m + p.sq_off.tail);
+    r->sqmask = (unsigned *)(m + p.sq_off.ring_mask);
+    r->sqarray = (unsigned *)(m + p.sq_off.array);
+    r->cqhead = (unsigned *)(m + p.cq_off.head);
+    r->cqtail = (unsigned *)(m + p.cq_off.tail);
+    r->cqmask = (unsigned *)(m + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(m + p.cq_off.cqes);
+    r->sqes = r->sqemap;
+    r->sqentries = p.sq_entries;
+    r->sqlocal = *r->sqtail;
+
+    r->brlen = TCP_IOBUFS * sizeof(struct io_uring_buf);
+    r->br = mmap(NULL, r->brlen, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(r->br == MAP_FAILED) {
+        err = errno;
+        r->br = NULL;
+        goto fail;
+    }
+    r->bufs = malloc((size_t)TCP_IOBUFS * TCP_IOBUFLN);
+    if(r->bufs == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr = (uintptr_t)r->br;
+    reg.ring_entries = TCP_IOBUFS;
+    reg.bgid = 0;
+    if(tcpuringregister(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        err = errno;
+        goto fail;
+    }
+    for(unsigned i = 0; i < TCP_IOBUFS; i++) tcpuringbuf(r, i);
+
+    r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(r->wakefd == -1) {
+        err = errno;
+        goto fail;
+    }
+    err = tcparmwake(r);
+    if(err != 0) goto fail;
+    r->multishot = 1;
+    return 0;
+
+fail:
+    tcpuringfree(r);
+    return err;
+}
+
+static int tcpurarmaccept(struct tcpio *io, struct tcpiofd *c)
+{
+    struct io_uring_sqe *sqe = tcpsqe(&io->ring);
+    if(sqe == NULL) return EBUSY;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->ev.fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if(io->ring.multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = tcpud(c->ev.fd, TCP_OPACCEPT);
+    c->flags |= TCP_FDACCEPTQ;
+    c->ninflight++;
+    return 0;
+}
+
+/* tcpurarmrecv arms a receive that lets the kernel pick a buffer from the
+ * buffer ring once data arrives, so idle connections hold no buffer. */
+static int tcpurarmrecv(struct tcpio *io, struct tcpiofd *c)
+{
+    struct io_uring_sqe *sqe = tcpsqe(&io->ring);
+    if(sqe == NULL) return EBUSY;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->ev.fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    if(io->ring.multishot) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else {
+        sqe->len = TCP_IOBUFLN;
+    }
+    sqe->user_data = tcpud(c->ev.fd, TCP_OPRECV);
+    c->flags |= TCP_FDRECVQ;
+    c->ninflight++;
+    return 0;
+}
+
+/* tcpursend submits the queued sends of c as one linked chain, so the
+ * kernel runs them in order without waiting for us in between. A chain is
+ * never split across two io_uring_enter(2) calls, which would break the
+ * ordering. */
+static void tcpursend(struct tcpio *io, struct tcpiofd *c)
+{
+    struct tcpuring *r = &io->ring;
+    if(c->nsend > 0 || c->head == NULL || (c->flags & TCP_FDCLOSING)) {
+        return;
+    }
+    unsigned space = tcpsqspace(r);
+    if(space == 0) {
+        tcpuringsubmit(r, 0);
+        space = tcpsqspace(r);
+    }
+
+    struct io_uring_sqe *prev = NULL;
+    c->cqe = c->head;
+    for(struct tcpiosend *s = c->head; s != NULL && c->nsend < TCP_IOLINKMAX
+            && (unsigned)c->nsend < space; s = s->next) {
+        struct io_uring_sqe *sqe = tcpsqe(r);
+        if(prev != NULL) prev->flags |= IOSQE_IO_LINK;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c->ev.fd;
+        sqe->addr = (uintptr_t)(s->buf + s->off);
+        sqe->len = s->len - s->off;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = tcpud(c->ev.fd, TCP_OPSEND);
+        c->nsend++;
+        c->ninflight++;
+        prev = sqe;
+    }
+}
+
+/* tcpurarmcancel cancels every operation the kernel still runs on c. */
+static int tcpurarmcancel(struct tcpio *io, struct tcpiofd *c)
+{
+    struct io_uring_sqe *sqe = tcpsqe(&io->ring);
+    if(sqe == NULL) return EBUSY;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = c->ev.fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = tcpud(c->ev.fd, TCP_OPCANCEL);
+    return 0;
+}
+
+/* tcpurcancels submits the cancels tcpioclose could not fit in the
+ * submission queue. A descriptor whose operations ended meanwhile needs
+ * none and is released. */
+static void tcpurcancels(struct tcpio *io)
+{
+    while(io->cancels != NULL) {
+        struct tcpiofd *c = io->cancels;
+        if(c->ninflight > 0 && tcpurarmcancel(io, c) != 0) return;
+        io->cancels = c->cancelnext;
+        c->flags &= ~TCP_FDCANCELQ;
+        tcpioput(io, c);
+    }
+}
+
+/* tcpurarmpoll waits for the next connection on c without accepting it.
+ * An accept armed while out of descriptors would fail at once, queue or
+ * no queue. */
+static int tcpurarmpoll(struct tcpio *io, struct tcpiofd *c)
+{
+    struct io_uring_sqe *sqe = tcpsqe(&io->ring);
+    if(sqe == NULL) return EBUSY;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->ev.fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tcpud(c->ev.fd, TCP_OPPOLL);
+    c->flags |= TCP_FDACCEPTQ;
+    c->ninflight++;
+    return 0;
+}
+
+/* tcpurrearm arms the accept again once the previous one ended, unless the
+ * caller stopped accepting. */
+static void tcpurrearm(struct tcpio *io, struct tcpiofd *c)
+{
+    if((c->flags & (TCP_FDCLOSING | TCP_FDACCEPTQ)) ||
+            !(c->flags & TCP_FDACCEPT)) {
+        return;
+    }
+    int err = tcpurarmaccept(io, c);
+    if(err != 0) {
+        c->flags &= ~TCP_FDACCEPT;
+        c->busy++;
+        c->acceptfn(io, c->ev.fd, -err, NULL, c->acceptarg);
+        c->busy--;
+    }
+}
+
+static void tcpuraccept(struct tcpio *io, struct tcpiofd *c, int res,
+        unsigned flags)
+{
+    if(!(flags & IORING_CQE_F_MORE)) {
+        c->flags &= ~TCP_FDACCEPTQ;
+        c->ninflight--;
+    }
+    if(res == -EINVAL && io->ring.multishot) {
+        /* the kernel predates multishot accept, fall back to one accept
+         * per submission */
+        io->ring.multishot = 0;
+    } else if((res == -EMFILE || res == -ENFILE) &&
+            !(c->flags & TCP_FDCLOSING) && tcpiodrain(io, c->ev.fd) == 0) {
+        if(!(c->flags & TCP_FDACCEPTQ)) tcpurarmpoll(io, c);
+    } else if(!(c->flags & TCP_FDCLOSING)) {
+        if(res < 0 && !tcpaccepterr(-res)) c->flags &= ~TCP_FDACCEPT;
+        c->busy++;
+        c->acceptfn(io, c->ev.fd, res, NULL, c->acceptarg);
+        c->busy--;
+    }
+    tcpurrearm(io, c);
+    tcpioput(io, c);
+}
+
+/* tcpurpolled accepts again once a connection arrived on a listener that
+ * ran out of descriptors. */
+static void tcpurpolled(struct tcpio *io, struct tcpiofd *c)
+{
+    c->flags &= ~TCP_FDACCEPTQ;
+    c->ninflight--;
+    tcpurrearm(io, c);
+    tcpioput(io, c);
+}
+
+static void tcpurrecv(struct tcpio *io, struct tcpiofd *c, int res,
+        unsigned flags)
+{
+    struct tcpuring *r = &io->ring;
+    if(!(flags & IORING_CQE_F_MORE)) {
+        c->flags &= ~TCP_FDRECVQ;
+        c->ninflight--;
+    }
+
+    if(res == -EINVAL && r->multishot) {
+        /* the kernel predates multishot receive */
+        r->multishot = 0;
+    } else if(res == -ENOBUFS) {
+        /* every buffer was in use, they are back by now */
+    } else if(!(c->flags & TCP_FDCLOSING)) {
+        char *buf = NULL;
+        if(flags & IORING_CQE_F_BUFFER) {
+            buf = r->bufs +
+                (size_t)(flags >> IORING_CQE_BUFFER_SHIFT) * TCP_IOBUFLN;
+        }
+        if(res <= 0) c->flags &= ~TCP_FDRECV;
+        c->busy++;
+        c->recvfn(io, c->ev.fd, res, buf, c->recvarg);
+        c->busy--;
+    }
+    if(flags & IORING_CQE_F_BUFFER) {
+        tcpuringbuf(r, flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    if(!(c->flags & (TCP_FDCLOSING | TCP_FDRECVQ)) &&
+            (c->flags & TCP_FDRECV)) {
+        int err = tcpurarmrecv(io, c);
+        if(err != 0) {
+            c->flags &= ~TCP_FDRECV;
+            c->busy++;
+            c->recvfn(io, c->ev.fd, -err, NULL, c->recvarg);
+            c->busy--;
+        }
+    }
+    tcpioput(io, c);
+}
+
+static void tcpursent(struct tcpio *io, struct tcpiofd *c, int res)
+{
+    struct tcpiosend *s = c->cqe;
+    c->cqe = s->next;
+    c->nsend--;
+    c->ninflight--;
+
+    if(res >= 0) {
+        s->off += res;
+    } else if(res != -ECANCELED && c->senderr == 0) {
+        c->senderr = -res;
+    }
+    /* a short send breaks the chain, the rest of it completes with
+     * ECANCELED and is submitted again */
+    if(s == c->head && s->off == s->len) {
+        c->head = s->next;
+        if(c->head == NULL) c->tail = NULL;
+        c->busy++;
+        s->fn(io, c->ev.fd, s->len, (char *)s->buf, s->arg);
+        c->busy--;
+        free(s);
+    }
+
+    if(c->nsend == 0) {
+        if(c->senderr != 0) {
+            tcpiofail(io, c, c->senderr);
+        } else {
+            tcpursend(io, c);
+        }
+    }
+    tcpioput(io, c);
+}
+
+static void tcpurcqe(struct tcpio *io, uint64_t ud, int res, unsigned flags)
+{
+    struct tcpuring *r = &io->ring;
+    int op = ud & 0xff;
+    int fd = ud >> 8;
+
+    if(op == TCP_OPCANCEL) return;
+    if(op == TCP_OPWAKE) {
+        uint64_t n;
+        while(read(r->wakefd, &n, sizeof n) == sizeof n);
+        tcparmwake(r);
+        return;
+    }
+
+    struct tcpiofd *c = fd < io->nfds ? io->fds[fd] : NULL;
+    if(c == NULL) {
+        if(flags & IORING_CQE_F_BUFFER) {
+            tcpuringbuf(r, flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        return;
+    }
+    switch(op) {
+        case TCP_OPACCEPT:
+            tcpuraccept(io, c, res, flags);
+            break;
+        case TCP_OPPOLL:
+            tcpurpolled(io, c);
+            break;
+        case TCP_OPRECV:
+            tcpurrecv(io, c, res, flags);
+            break;
+        case TCP_OPSEND:
+            tcpursent(io, c, res);
+            break;
+    }
+}
+
+/* tcpurrun submits everything the callbacks queued, waits for completions
+ * and dispatches them, one io_uring_enter(2) per batch. */
+static int tcpurrun(struct tcpio *io)
+{
+    struct tcpuring *r = &io->ring;
+    while(!__atomic_load_n(&io->stop, __ATOMIC_ACQUIRE)) {
+        tcpurcancels(io);
+        int err = tcpuringsubmit(r, 1);
+        if(err != 0 && err != EINTR && err != EAGAIN && err != EBUSY) {
+            return err;
+        }
+
+        unsigned head = *r->cqhead;
+        unsigned tail = __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+            uint64_t ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            __atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+            tcpurcqe(io, ud, res, flags);
+        }
+    }
+    return 0;
+}
+
+/* The epoll engine, built on tcploop. Operations are attempted as soon as
+ * the loop reports the descriptor ready and their callbacks run in line. */
+
+/* tcpepflush writes the queued sends with one sendmsg(2) per batch of
+ * TCP_IOLINKMAX buffers until the socket would block. */
+static void tcpepflush(struct tcpio *io, struct tcpiofd *c)
+{
+    while(c->head != NULL && !(c->flags & TCP_FDCLOSING)) {
+        struct iovec iov[TCP_IOLINKMAX];
+        int n = 0;
+        for(struct tcpiosend *s = c->head; s != NULL && n < TCP_IOLINKMAX;
+                s = s->next, n++) {
+            iov[n].iov_base = (char *)s->buf + s->off;
+            iov[n].iov_len = s->len - s->off;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        ssize_t m = sendmsg(c->ev.fd, &msg, MSG_NOSIGNAL);
+        if(m == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            c->senderr = errno;
+            tcpiofail(io, c, c->senderr);
+            return;
+        }
+
+        /* detach the completed sends before running their callbacks, which
+         * may queue more */
+        struct tcpiosend *done = c->head, **last = &done;
+        while(*last != NULL && (size_t)m >= (*last)->len - (*last)->off) {
+            m -= (*last)->len - (*last)->off;
+            last = &(*last)->next;
+        }
+        c->head = *last;
+        if(c->head == NULL) {
+            c->tail = NULL;
+        } else {
+            c->head->off += m;
+        }
+        *last = NULL;
+
+        c->busy++;
+        while(done != NULL) {
+            struct tcpiosend *s = done;
+            done = s->next;
+            s->fn(io, c->ev.fd, s->len, (char *)s->buf, s->arg);
+            free(s);
+        }
+        c->busy--;
+    }
+}
+
+static void tcpepaccept(struct tcpio *io, struct tcpiofd *c)
+{
+    while((c->flags & TCP_FDACCEPT) && !(c->flags & TCP_FDCLOSING)) {
+        int conn;
+        int err = tcpaccept(&conn, c->ev.fd, TCP_NONBLOCK);
+        if(err == EAGAIN) return;
+        if(tcpaccepterr(err)) continue;
+        /* once drained, the next connection raises another edge */
+        if((err == EMFILE || err == ENFILE) &&
+                tcpiodrain(io, c->ev.fd) == 0) {
+            return;
+        }
+        if(err != 0) c->flags &= ~TCP_FDACCEPT;
+        c->acceptfn(io, c->ev.fd, err != 0 ? -err : conn, NULL, c->acceptarg);
+    }
+}
+
+static void tcpeprecv(struct tcpio *io, struct tcpiofd *c)
+{
+    while((c->flags & TCP_FDRECV) && !(c->flags & TCP_FDCLOSING)) {
+        ssize_t n = recv(c->ev.fd, io->buf, TCP_IOBUFLN, 0);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            n = -errno;
+        }
+        if(n <= 0) c->flags &= ~TCP_FDRECV;
+        c->recvfn(io, c->ev.fd, n, io->buf, c->recvarg);
+    }
+}
+
+static void tcpepev(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct tcpiofd *c = (struct tcpiofd *)ev;
+    struct tcpio *io = c->io;
+
+    c->busy++;
+    tcpepaccept(io, c);
+    tcpeprecv(io, c);
+    tcpepflush(io, c);
+    c->busy--;
+    tcpioput(io, c);
+}
+
+/* tcpepwatch registers c to the loop or, if it is registered already,
+ * makes the loop report it again in case it was ready before the caller
+ * became interested. */
+static int tcpepwatch(struct tcpio *io, struct tcpiofd *c)
+{
+    c->ev.fn = tcpepev;
+    if(c->flags & TCP_FDADDED) {
+        return tcploopmod(io->loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+    }
+    int err = tcploopadd(io->loop, &c->ev, TCP_EVIN | TCP_EVOUT);
+    if(err == 0) c->flags |= TCP_FDADDED;
+    return err;
+}
+
+/* tcpionew creates a new I/O engine and write it into *io.
+ *
+ * The engine parameter is one of:
+ *
+ * TCP_IOAUTO
+ * Use io_uring if the kernel supports it and epoll otherwise.
+ *
+ * TCP_IOURING
+ * Use io_uring, fail if the kernel does not support it. io_uring needs
+ * Linux 5.19 or newer and is not available where it is disabled with the
+ * kernel.io_uring_disabled sysctl or by a seccomp policy.
+ *
+ * TCP_IOEPOLL
+ * Use epoll(7) through tcploop.
+ *
+ * An engine is not thread-safe; it must be used by the thread that created
+ * it, except for tcpiostop.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM, EINVAL, or to the error of open(2),
+ * io_uring_setup(2) or tcploopnew.
+ *
+ * Example:
+ *
+ *     struct tcpio *io;
+ *     int errio = tcpionew(&io, TCP_IOAUTO);
+ *     if(errio != 0) {
+ *         fprintf(stderr, "E: tcpionew %s\n", strerror(errio));
+ *         exit(1);
+ *     }
+ *     tcpioaccept(io, ln, onaccept, NULL);
+ *     tcpiorun(io);
+ */
+int tcpionew(struct tcpio **io, int engine)
+{
+    if(engine != TCP_IOAUTO && engine != TCP_IOURING &&
+            engine != TCP_IOEPOLL) {
+        errno = EINVAL;
+        return errno;
+    }
+    struct tcpio *o = calloc(1, sizeof *o);
+    if(o == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+
+    int err = 0;
+    o->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(o->spare == -1) {
+        err = errno;
+        goto fail;
+    }
+    if(engine != TCP_IOEPOLL) {
+        err = tcpuringinit(&o->ring);
+        if(err == 0) {
+            o->engine = TCP_IOURING;
+            *io = o;
+            return 0;
+        }
+        if(engine == TCP_IOURING) goto fail;
+    }
+
+    o->buf = malloc(TCP_IOBUFLN);
+    if(o->buf == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    err = tcploopnew(&o->loop);
+    if(err != 0) goto fail;
+    o->engine = TCP_IOEPOLL;
+    *io = o;
+    return 0;
+
+fail:
+    if(o->spare != -1) close(o->spare);
+    free(o->buf);
+    free(o);
+    errno = err;
+    return errno;
+}
+
+/* tcpiofree releases the engine. Descriptors that are not closed yet are
+ * left open and no more callbacks are called; the buffers of their pending
+ * sends belong to the caller again once the engine is released. */
+void tcpiofree(struct tcpio *io)
+{
+    for(int fd = 0; fd < io->nfds; fd++) {
+        struct tcpiofd *c = io->fds[fd];
+        if(c == NULL) continue;
+        if(c->flags & TCP_FDCLOSING) close(fd);
+        while(c->head != NULL) {
+            struct tcpiosend *s = c->head;
+            c->head = s->next;
+            free(s);
+        }
+        free(c);
+    }
+    free(io->fds);
+    if(io->spare != -1) close(io->spare);
+    if(io->engine == TCP_IOURING) {
+        /* closing the ring cancels the operations still in flight */
+        tcpuringfree(&io->ring);
+    } else {
+        tcploopfree(io->loop);
+        free(io->buf);
+    }
+    free(io);
+}
+
+/* tcpioengine returns the engine in use, TCP_IOURING or TCP_IOEPOLL. */
+int tcpioengine(struct tcpio *io)
+{
+    return io->engine;
+}
+
+/* tcpioaccept accepts connections on the listening socket ln until ln is
+ * closed with tcpioclose. fn is called with every new connection, which is
+ * non-blocking and close-on-exec. On io_uring a single multishot accept
+ * serves any number of connections. After an error other than ECONNABORTED
+ * fn is called with the error and accepting stops until tcpioaccept is
+ * called again.
+ *
+ * When the process or the system runs out of descriptors, the engine
+ * closes the pending connections with a spare descriptor it keeps for
+ * this and accepts again once a new connection arrives. fn is only called
+ * with EMFILE or ENFILE if the spare could not be reopened.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EBADF, ENOMEM, EBUSY or the error of epoll_ctl(2).
+ */
+int tcpioaccept(struct tcpio *io, int ln, tcpiofn *fn, void *arg)
+{
+    struct tcpiofd *c = tcpiofdget(io, ln);
+    if(c == NULL) return errno;
+    if(c->flags & TCP_FDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    c->acceptfn = fn;
+    c->acceptarg = arg;
+    c->flags |= TCP_FDACCEPT;
+
+    int err = 0;
+    if(io->engine == TCP_IOURING) {
+        if(!(c->flags & TCP_FDACCEPTQ)) err = tcpurarmaccept(io, c);
+    } else {
+        err = tcpepwatch(io, c);
+    }
+    if(err != 0) {
+        c->flags &= ~TCP_FDACCEPT;
+        errno = err;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpiorecv receives data from fd until EOF, an error or tcpioclose. fn is
+ * called with every chunk of data; the buffer is only lent for the duration
+ * of the call. On io_uring the kernel picks the buffer from a shared buffer
+ * ring when the data arrives, so idle connections hold no memory.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EBADF, ENOMEM, EBUSY or the error of epoll_ctl(2).
+ */
+int tcpiorecv(struct tcpio *io, int fd, tcpiofn *fn, void *arg)
+{
+    struct tcpiofd *c = tcpiofdget(io, fd);
+    if(c == NULL) return errno;
+    if(c->flags & TCP_FDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    c->recvfn = fn;
+    c->recvarg = arg;
+    c->flags |= TCP_FDRECV;
+
+    int err = 0;
+    if(io->engine == TCP_IOURING) {
+        if(!(c->flags & TCP_FDRECVQ)) err = tcpurarmrecv(io, c);
+    } else {
+        err = tcpepwatch(io, c);
+    }
+    if(err != 0) {
+        c->flags &= ~TCP_FDRECV;
+        errno = err;
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpiosend sends the len bytes of buf to fd. Sends to the same descriptor
+ * are written in the order they were queued. fn is called once the whole
+ * buffer has been sent or the send failed; buf must stay valid until then.
+ * On io_uring consecutive sends are submitted as one linked chain; on epoll
+ * they are written with one sendmsg(2) and fn may be called before
+ * tcpiosend returns.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EBADF, ENOMEM, or the error a previous send on fd failed
+ * with, such as EPIPE or ECONNRESET.
+ */
+int tcpiosend(struct tcpio *io, int fd, const void *buf, size_t len,
+        tcpiofn *fn, void *arg)
+{
+    struct tcpiofd *c = tcpiofdget(io, fd);
+    if(c == NULL) return errno;
+    if(c->flags & TCP_FDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    if(c->senderr != 0) {
+        errno = c->senderr;
+        return errno;
+    }
+
+    struct tcpiosend *s = malloc(sizeof *s);
+    if(s == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    s->next = NULL;
+    s->buf = buf;
+    s->len = len;
+    s->off = 0;
+    s->fn = fn;
+    s->arg = arg;
+    if(c->tail != NULL) {
+        c->tail->next = s;
+    } else {
+        c->head = s;
+    }
+    c->tail = s;
+
+    if(io->engine == TCP_IOURING) {
+        tcpursend(io, c);
+        return 0;
+    }
+    if(!(c->flags & TCP_FDADDED)) {
+        int err = tcpepwatch(io, c);
+        if(err != 0) {
+            /* fail only this send, the queue was empty before */
+            c->head = c->tail = NULL;
+            free(s);
+            errno = err;
+            return errno;
+        }
+    }
+    c->busy++;
+    tcpepflush(io, c);
+    c->busy--;
+    tcpioput(io, c);
+    return 0;
+}
+
+/* tcpioclose stops the operations on fd and closes it. No receive or accept
+ * callback is called for fd afterwards. Sends that did not complete fail
+ * with ECANCELED. On io_uring the descriptor is closed once the kernel has
+ * released the operations, which also keeps its number from being reused
+ * while they are in flight. If the submission queue has no room for the
+ * cancel, it is submitted with the next batch.
+ *
+ * It returns 0, or EBADF if fd is already closing.
+ */
+int tcpioclose(struct tcpio *io, int fd)
+{
+    struct tcpiofd *c = fd >= 0 && fd < io->nfds ? io->fds[fd] : NULL;
+    if(c == NULL) {
+        /* never handed to the engine */
+        close(fd);
+        return 0;
+    }
+    if(c->flags & TCP_FDCLOSING) {
+        errno = EBADF;
+        return errno;
+    }
+    c->flags |= TCP_FDCLOSING;
+
+    if(io->engine == TCP_IOURING && c->ninflight > 0 &&
+            tcpurarmcancel(io, c) != 0) {
+        /* the submission queue is full even after a flush; the cancel goes
+         * out with the next submission */
+        c->flags |= TCP_FDCANCELQ;
+        c->cancelnext = io->cancels;
+        io->cancels = c;
+    }
+    tcpioput(io, c);
+    return 0;
+}
+
+/* tcpiorun dispatches completions to the callbacks until tcpiostop is
+ * called.
+ *
+ * It returns 0 when the engine is stopped or the errno of
+ * io_uring_enter(2) or epoll_wait(2).
+ */
+int tcpiorun(struct tcpio *io)
+{
+    if(io->engine == TCP_IOURING) return tcpurrun(io);
+    return tcplooprun(io->loop);
+}
+
+/* tcpiostop makes tcpiorun return after the current batch of completions.
+ * It is safe to call from another thread or from a signal handler. */
+void tcpiostop(struct tcpio *io)
+{
+    if(io->engine == TCP_IOEPOLL) {
+        tcploopstop(io->loop);
+        return;
+    }
+    uint64_t one = 1;
+    __atomic_store_n(&io->stop, 1, __ATOMIC_RELEASE);
+    if(write(io->ring.wakefd, &one, sizeof one) == -1) {
+        /* the counter is already non-zero, the engine wakes up anyway */
+    }
+}
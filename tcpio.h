@@ -0,0 +1,79 @@
+/* tcpio - A completion based I/O engine for the tcp module. It runs on
+ * io_uring(7) where the kernel supports it and falls back to the epoll loop
+ * of tcploop otherwise; both engines deliver the same callbacks.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPIO_H
+#define TCPIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* engines for tcpionew */
+enum {
+    TCP_IOAUTO,
+    TCP_IOEPOLL,
+    TCP_IOURING
+};
+
+/* the number of submission queue entries of the ring */
+#define TCP_IOENTRIES 256
+/* the number and the size of the receive buffers, TCP_IOBUFS is a power
+ * of two */
+#define TCP_IOBUFS 256
+#define TCP_IOBUFLN 4096
+/* the maximum number of sends submitted as a single linked chain */
+#define TCP_IOLINKMAX 16
+
+struct tcpio;
+
+/* tcpiofn receives the completions of an operation on fd.
+ *
+ * For tcpioaccept, res is the new connection or a negative errno value.
+ * For tcpiorecv, res is the number of bytes in buf, 0 on EOF or a negative
+ * errno value; buf belongs to the engine and is only valid during the call.
+ * For tcpiosend, res is the number of bytes sent or a negative errno value;
+ * buf is the buffer given to tcpiosend.
+ */
+typedef void tcpiofn(struct tcpio *io, int fd, ssize_t res, char *buf,
+        void *arg);
+
+int tcpionew(struct tcpio **io, int engine);
+void tcpiofree(struct tcpio *io);
+int tcpioengine(struct tcpio *io);
+int tcpioaccept(struct tcpio *io, int ln, tcpiofn *fn, void *arg);
+int tcpiorecv(struct tcpio *io, int fd, tcpiofn *fn, void *arg);
+int tcpiosend(struct tcpio *io, int fd, const void *buf, size_t len,
+        tcpiofn *fn, void *arg);
+int tcpioclose(struct tcpio *io, int fd);
+int tcpiorun(struct tcpio *io);
+void tcpiostop(struct tcpio *io);
+
+#endif
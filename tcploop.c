@@ -0,0 +1,236 @@
+/* tcploop - An edge-triggered event loop for the tcp module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces, epoll(7) and eventfd(2), that the loop is built on. */
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tcploop.h"
+#include "tcptimer.h"
+
+/* the maximum number of events returned by a single epoll_wait(2) */
+#define TCP_EVBATCH 256
+
+struct tcploop {
+    int epfd;
+    int stop;
+    /* eventfd used to interrupt epoll_wait from other threads or from a
+     * signal handler */
+    struct tcpev wake;
+    /* the deadlines of the connections served by the loop */
+    struct tcpwheel wheel;
+    struct epoll_event evs[TCP_EVBATCH];
+};
+
+/* tcploopwake drains the wake up counter. The stop flag itself is checked by
+ * tcplooprun after every batch. */
+static void tcploopwake(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    uint64_t n;
+    while(read(ev->fd, &n, sizeof n) == sizeof n);
+}
+
+static uint32_t tcpepevents(int events)
+{
+    uint32_t epev = EPOLLET | EPOLLRDHUP;
+    if(events & TCP_EVIN) epev |= EPOLLIN;
+    if(events & TCP_EVOUT) epev |= EPOLLOUT;
+    return epev;
+}
+
+/* tcploopnew creates a new event loop and write it into *loop.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM, EMFILE or ENFILE.
+ */
+int tcploopnew(struct tcploop **loop)
+{
+    struct tcploop *l = malloc(sizeof *l);
+    if(l == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+
+    l->stop = 0;
+    tcpwheelinit(&l->wheel, tcpwheelms());
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(l->epfd == -1) {
+        int err = errno;
+        free(l);
+        errno = err;
+        return errno;
+    }
+
+    l->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    l->wake.fn = tcploopwake;
+    if(l->wake.fd == -1 || tcploopadd(l, &l->wake, TCP_EVIN) != 0) {
+        int err = errno;
+        if(l->wake.fd != -1) close(l->wake.fd);
+        close(l->epfd);
+        free(l);
+        errno = err;
+        return errno;
+    }
+
+    *loop = l;
+    return 0;
+}
+
+/* tcploopfree releases the loop. Event sources that are still registered
+ * are not closed; they belong to the caller. */
+void tcploopfree(struct tcploop *loop)
+{
+    close(loop->wake.fd);
+    close(loop->epfd);
+    free(loop);
+}
+
+/* tcploopadd registers the event source ev to the loop. The events
+ * parameter is the bitwise OR of TCP_EVIN and TCP_EVOUT.
+ *
+ * The loop is edge-triggered: the callback is invoked once when the socket
+ * becomes readable or writable, so the callback must read or write until
+ * the operation fails with EAGAIN before returning.
+ *
+ * ev must stay valid until it is removed with tcploopdel or its descriptor
+ * is closed. It returns 0 on success or the errno of epoll_ctl(2).
+ */
+int tcploopadd(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct epoll_event epev;
+    epev.events = tcpepevents(events);
+    epev.data.ptr = ev;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev->fd, &epev) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+/* tcploopmod changes the events the source ev is interested in. */
+int tcploopmod(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct epoll_event epev;
+    epev.events = tcpepevents(events);
+    epev.data.ptr = ev;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_MOD, ev->fd, &epev) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+/* tcploopdel removes the event source ev from the loop. Closing the
+ * descriptor removes it implicitly, so the call is only needed when the
+ * descriptor outlives its registration.
+ *
+ * A callback may free its own event source, but it must not free another
+ * source that may still have a pending event in the current batch. */
+int tcploopdel(struct tcploop *loop, struct tcpev *ev)
+{
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, NULL) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+/* tcploopwait returns the epoll_wait(2) timeout that wakes the loop up when
+ * its wheel has work to do. */
+static int tcploopwait(struct tcploop *loop)
+{
+    int64_t next = tcpwheelnext(&loop->wheel);
+    if(next == -1) return -1;
+    uint64_t now = tcpwheelms();
+    if((uint64_t)next <= now) return 0;
+    return next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
+
+/* tcplooprun waits for events and dispatches them to the callbacks until
+ * tcploopstop is called. The timers of the loop wheel expire after every
+ * batch of events, once no callback can still refer to a connection a
+ * timer frees.
+ *
+ * It returns 0 when the loop is stopped or the errno of epoll_wait(2).
+ */
+int tcplooprun(struct tcploop *loop)
+{
+    while(!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(loop->epfd, loop->evs, TCP_EVBATCH,
+                tcploopwait(loop));
+        tcpwheelsync(&loop->wheel, tcpwheelms());
+        if(n == -1) {
+            if(errno != EINTR) return errno;
+            n = 0;
+        }
+
+        for(int i = 0; i < n; i++) {
+            struct tcpev *ev = loop->evs[i].data.ptr;
+            uint32_t epev = loop->evs[i].events;
+            int events = 0;
+            if(epev & (EPOLLIN | EPOLLRDHUP)) events |= TCP_EVIN;
+            if(epev & EPOLLOUT) events |= TCP_EVOUT;
+            if(epev & (EPOLLERR | EPOLLHUP)) events |= TCP_EVERR;
+            ev->fn(loop, ev, events);
+        }
+        tcpwheeladvance(&loop->wheel, tcpwheelnow(&loop->wheel));
+    }
+    return 0;
+}
+
+/* tcploopwheel returns the timer wheel of the loop. Timers armed on it
+ * expire in the loop thread, between two batches of events, and the wheel
+ * must only be used from that thread.
+ *
+ * Example:
+ *
+ *     tcptimerinit(&c->idle, idleexpired);
+ *     tcptimerarm(tcploopwheel(loop), &c->idle, 30000);
+ */
+struct tcpwheel *tcploopwheel(struct tcploop *loop)
+{
+    return &loop->wheel;
+}
+
+/* tcploopstop makes tcplooprun return after the current batch of events.
+ * It is safe to call from another thread or from a signal handler. */
+void tcploopstop(struct tcploop *loop)
+{
+    uint64_t one = 1;
+    __atomic_store_n(&loop->stop, 1, __ATOMIC_RELEASE);
+    if(write(loop->wake.fd, &one, sizeof one) == -1) {
+        /* the counter is already non-zero, the loop will wake up anyway */
+    }
+}
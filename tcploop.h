@@ -0,0 +1,64 @@
+/* tcploop - An edge-triggered event loop for the tcp module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPLOOP_H
+#define TCPLOOP_H
+
+/* event flags for tcploopadd and the event callback */
+enum {
+    TCP_EVIN = 1,
+    TCP_EVOUT = 2,
+    TCP_EVERR = 4
+};
+
+struct tcploop;
+struct tcpev;
+struct tcpwheel;
+
+typedef void tcpevfn(struct tcploop *loop, struct tcpev *ev, int events);
+
+/* tcpev is an event source registered to the loop. It is meant to be the
+ * first member of the caller's connection object, so the callback can cast
+ * the tcpev pointer back to the enclosing object without a lookup. */
+struct tcpev {
+    int fd;
+    tcpevfn *fn;
+};
+
+int tcploopnew(struct tcploop **loop);
+void tcploopfree(struct tcploop *loop);
+int tcploopadd(struct tcploop *loop, struct tcpev *ev, int events);
+int tcploopmod(struct tcploop *loop, struct tcpev *ev, int events);
+int tcploopdel(struct tcploop *loop, struct tcpev *ev);
+int tcplooprun(struct tcploop *loop);
+struct tcpwheel *tcploopwheel(struct tcploop *loop);
+void tcploopstop(struct tcploop *loop);
+
+#endif
@@ -0,0 +1,210 @@
+/* tcpmem - Slab allocators for connection state and pools of I/O buffers
+ * for servers with many mostly idle connections.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "tcpmem.h"
+
+/* the alignment of slab objects and the size of the page header */
+#define TCP_SLABALIGN 16
+
+static size_t tcpmemround(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+/* tcpslabinit prepares s to allocate objects of size bytes, aligned to 16
+ * bytes. No memory is allocated until the first tcpslaballoc.
+ *
+ * It returns 0, or EINVAL if size is 0 or does not fit a TCP_SLABPAGE.
+ *
+ * Example:
+ *
+ *     struct tcpslab slab;
+ *     tcpslabinit(&slab, sizeof(struct conn));
+ *     struct conn *c = tcpslaballoc(&slab);
+ *     ...
+ *     tcpslabfree(&slab, c);
+ */
+int tcpslabinit(struct tcpslab *s, size_t size)
+{
+    if(size == 0 || size > TCP_SLABPAGE - TCP_SLABALIGN) {
+        errno = EINVAL;
+        return errno;
+    }
+    if(size < sizeof(void *)) size = sizeof(void *);
+    s->size = tcpmemround(size, TCP_SLABALIGN);
+    s->perpage = (TCP_SLABPAGE - TCP_SLABALIGN) / s->size;
+    s->free = NULL;
+    s->pages = NULL;
+    s->nused = 0;
+    s->npages = 0;
+    return 0;
+}
+
+/* tcpslabgrow carves a new page into free objects. */
+static int tcpslabgrow(struct tcpslab *s)
+{
+    char *page = malloc(TCP_SLABPAGE);
+    if(page == NULL) return ENOMEM;
+    *(void **)page = s->pages;
+    s->pages = page;
+    s->npages++;
+
+    /* link the objects so that they are handed out in address order */
+    char *obj = page + TCP_SLABALIGN + (s->perpage - 1) * s->size;
+    for(size_t i = 0; i < s->perpage; i++, obj -= s->size) {
+        *(void **)obj = s->free;
+        s->free = obj;
+    }
+    return 0;
+}
+
+/* tcpslaballoc returns an uninitialized object, or NULL with errno set to
+ * ENOMEM. */
+void *tcpslaballoc(struct tcpslab *s)
+{
+    if(s->free == NULL && tcpslabgrow(s) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *obj = s->free;
+    s->free = *(void **)obj;
+    s->nused++;
+    return obj;
+}
+
+/* tcpslabfree returns obj, which tcpslaballoc of the same slab returned,
+ * to the slab. Pages are kept until tcpslabdestroy, so a slab is as large
+ * as its peak use. */
+void tcpslabfree(struct tcpslab *s, void *obj)
+{
+    *(void **)obj = s->free;
+    s->free = obj;
+    s->nused--;
+}
+
+/* tcpslabdestroy releases all pages of s, including the objects that are
+ * still allocated. */
+void tcpslabdestroy(struct tcpslab *s)
+{
+    while(s->pages != NULL) {
+        void *next = *(void **)s->pages;
+        free(s->pages);
+        s->pages = next;
+    }
+    s->free = NULL;
+    s->nused = 0;
+    s->npages = 0;
+}
+
+/* tcpbpoolinit prepares bp to lend buffers of size bytes, rounded up to a
+ * multiple of TCP_CACHELN, and to cache up to keep of the returned ones.
+ *
+ * A server should hold a buffer only while it has data in it: take one
+ * when the connection is readable and give it back as soon as everything
+ * read was written. An idle connection then costs no buffer memory, and
+ * the memory of the pool follows the number of busy connections.
+ *
+ * It returns 0, or EINVAL if size is 0.
+ *
+ * Example:
+ *
+ *     struct tcpbpool bp;
+ *     tcpbpoolinit(&bp, 4096, 64);
+ *     char *buf = tcpbpoolget(&bp);
+ *     ssize_t n = recv(conn, buf, bp.size, 0);
+ *     ...
+ *     tcpbpoolput(&bp, buf);
+ */
+int tcpbpoolinit(struct tcpbpool *bp, size_t size, size_t keep)
+{
+    if(size == 0) {
+        errno = EINVAL;
+        return errno;
+    }
+    bp->size = tcpmemround(size, TCP_CACHELN);
+    bp->keep = keep;
+    bp->free = NULL;
+    bp->nfree = 0;
+    bp->nused = 0;
+    return 0;
+}
+
+/* tcpbpoolget lends a buffer of bp->size bytes, or returns NULL with errno
+ * set to ENOMEM. */
+void *tcpbpoolget(struct tcpbpool *bp)
+{
+    void *buf = bp->free;
+    if(buf != NULL) {
+        bp->free = *(void **)buf;
+        bp->nfree--;
+    } else {
+        int err = posix_memalign(&buf, TCP_CACHELN, bp->size);
+        if(err != 0) {
+            errno = err;
+            return NULL;
+        }
+    }
+    bp->nused++;
+    return buf;
+}
+
+/* tcpbpoolput returns a buffer lent by tcpbpoolget. */
+void tcpbpoolput(struct tcpbpool *bp, void *buf)
+{
+    bp->nused--;
+    if(bp->nfree >= bp->keep) {
+        free(buf);
+        return;
+    }
+    *(void **)buf = bp->free;
+    bp->free = buf;
+    bp->nfree++;
+}
+
+/* tcpbpooldestroy releases the cached buffers. Buffers still lent out must
+ * be returned with free(3). */
+void tcpbpooldestroy(struct tcpbpool *bp)
+{
+    while(bp->free != NULL) {
+        void *next = *(void **)bp->free;
+        free(bp->free);
+        bp->free = next;
+    }
+    bp->nfree = 0;
+}
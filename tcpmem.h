@@ -0,0 +1,79 @@
+/* tcpmem - Slab allocators for connection state and pools of I/O buffers
+ * for servers with many mostly idle connections.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPMEM_H
+#define TCPMEM_H
+
+#include <stddef.h>
+
+/* the size of a cache line; the I/O buffers start and end on one */
+#define TCP_CACHELN 64
+/* the size of the pages a slab carves its objects from */
+#define TCP_SLABPAGE (64 * 1024)
+
+/* tcpslab hands out objects of one size. It is not thread-safe: give every
+ * worker thread its own slab, as tcpsrv gives it its own shard. */
+struct tcpslab {
+    size_t size;
+    size_t perpage;
+    /* the free objects, linked through their first bytes */
+    void *free;
+    /* the pages, linked through their first bytes */
+    void *pages;
+    size_t nused;
+    size_t npages;
+};
+
+/* tcpbpool lends fixed-size, cache-line aligned buffers. Up to keep
+ * returned buffers are cached for reuse, the others are released. Like
+ * tcpslab it belongs to one thread. */
+struct tcpbpool {
+    size_t size;
+    size_t keep;
+    /* the cached buffers, linked through their first bytes */
+    void *free;
+    size_t nfree;
+    /* the number of buffers lent out */
+    size_t nused;
+};
+
+int tcpslabinit(struct tcpslab *s, size_t size);
+void *tcpslaballoc(struct tcpslab *s);
+void tcpslabfree(struct tcpslab *s, void *obj);
+void tcpslabdestroy(struct tcpslab *s);
+
+int tcpbpoolinit(struct tcpbpool *bp, size_t size, size_t keep);
+void *tcpbpoolget(struct tcpbpool *bp);
+void tcpbpoolput(struct tcpbpool *bp, void *buf);
+void tcpbpooldestroy(struct tcpbpool *bp);
+
+#endif
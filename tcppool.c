@@ -0,0 +1,350 @@
+/* tcppool - A pool of idle, already connected TCP connections keyed by
+ * host:port.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the definitions used by
+ * the pool, such as MSG_DONTWAIT and pthread_condattr_setclock(3). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tcp.h"
+#include "tcppool.h"
+
+/* the number of hash buckets of the backend table */
+#define TCP_POOLBUCKETS 256
+
+struct tcpidle {
+    int fd;
+    struct timespec since;
+};
+
+/* tcpbackend is the set of connections to a single host:port. */
+struct tcpbackend {
+    struct tcpbackend *next;
+    char *host;
+    char *port;
+    /* connections handed out plus idle connections */
+    int nconns;
+    /* the idle connections, used as a stack so the most recently used and
+     * therefore warmest connection is handed out first */
+    int nidle;
+    struct tcpidle *idle;
+    pthread_cond_t cond;
+};
+
+struct tcppool {
+    pthread_mutex_t mu;
+    int maxconns;
+    int idlems;
+    struct tcpbackend *buckets[TCP_POOLBUCKETS];
+    /* the backend of every connection handed out, indexed by descriptor */
+    struct tcpbackend **owner;
+    int nowner;
+};
+
+static uint32_t tcppoolhash(char host[], char port[])
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for(char *c = host; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    }
+    h = (h ^ ':') * 16777619u;
+    for(char *c = port; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    }
+    return h;
+}
+
+static long long tcppoolms(struct timespec *a, struct timespec *b)
+{
+    return (long long)(a->tv_sec - b->tv_sec) * 1000 +
+        (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+/* tcppoolbackend returns the backend of host:port, creating it if needed.
+ * The pool must be locked. */
+static struct tcpbackend *tcppoolbackend(struct tcppool *pool, char host[],
+        char port[])
+{
+    uint32_t i = tcppoolhash(host, port) % TCP_POOLBUCKETS;
+    struct tcpbackend *b;
+    for(b = pool->buckets[i]; b != NULL; b = b->next) {
+        if(strcmp(b->host, host) == 0 && strcmp(b->port, port) == 0) {
+            return b;
+        }
+    }
+
+    b = calloc(1, sizeof *b);
+    if(b == NULL) return NULL;
+    b->idle = malloc(pool->maxconns * sizeof *b->idle);
+    b->host = strdup(host);
+    b->port = strdup(port);
+    if(b->idle == NULL || b->host == NULL || b->port == NULL) {
+        free(b->idle);
+        free(b->host);
+        free(b->port);
+        free(b);
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    b->next = pool->buckets[i];
+    pool->buckets[i] = b;
+    return b;
+}
+
+/* tcppoolsetowner records the backend of conn. The pool must be locked. */
+static int tcppoolsetowner(struct tcppool *pool, int conn,
+        struct tcpbackend *b)
+{
+    if(conn >= pool->nowner) {
+        int n = pool->nowner > 0 ? pool->nowner : 64;
+        while(n <= conn) n *= 2;
+        struct tcpbackend **owner = realloc(pool->owner, n * sizeof *owner);
+        if(owner == NULL) return ENOMEM;
+        memset(owner + pool->nowner, 0, (n - pool->nowner) * sizeof *owner);
+        pool->owner = owner;
+        pool->nowner = n;
+    }
+    pool->owner[conn] = b;
+    return 0;
+}
+
+/* tcppoolprobe checks whether an idle connection is still usable without
+ * blocking. The peer must not have closed it, and there must be no unread
+ * data, which would be a stale reply to an earlier request. */
+static int tcppoolprobe(int conn)
+{
+    char c;
+    ssize_t n = recv(conn, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* tcppoolnew creates a connection pool and write it into *pool.
+ *
+ * maxconns is the maximum number of connections, idle or in use, to a
+ * single host:port. Idle connections older than idlems milliseconds are
+ * closed instead of reused; 0 means they never expire.
+ *
+ * It returns 0 on success, or ENOMEM or EINVAL.
+ */
+int tcppoolnew(struct tcppool **pool, int maxconns, int idlems)
+{
+    if(maxconns <= 0 || idlems < 0) {
+        errno = EINVAL;
+        return errno;
+    }
+
+    struct tcppool *p = calloc(1, sizeof *p);
+    if(p == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    pthread_mutex_init(&p->mu, NULL);
+    p->maxconns = maxconns;
+    p->idlems = idlems;
+    *pool = p;
+    return 0;
+}
+
+/* tcppoolfree closes the idle connections and releases the pool. The
+ * connections that are still in use are not closed. */
+void tcppoolfree(struct tcppool *pool)
+{
+    for(int i = 0; i < TCP_POOLBUCKETS; i++) {
+        struct tcpbackend *b = pool->buckets[i];
+        while(b != NULL) {
+            struct tcpbackend *next = b->next;
+            for(int j = 0; j < b->nidle; j++) close(b->idle[j].fd);
+            pthread_cond_destroy(&b->cond);
+            free(b->idle);
+            free(b->host);
+            free(b->port);
+            free(b);
+            b = next;
+        }
+    }
+    pthread_mutex_destroy(&pool->mu);
+    free(pool->owner);
+    free(pool);
+}
+
+/* tcppoolget write into *conn a connection to host:port.
+ *
+ * An idle connection is reused when there is one that passed the liveness
+ * probe; otherwise a new one is dialed with tcpdialdl. When the backend
+ * already has maxconns connections, it waits until one is returned with
+ * tcppoolput or until the absolute CLOCK_MONOTONIC time *deadline, if
+ * deadline is not NULL.
+ *
+ * The connection must be given back with tcppoolput. It returns 0 on
+ * success, ETIMEDOUT when the deadline expired, ENOMEM, or one of the
+ * errors of tcpdialdl.
+ *
+ * Example
+ *     int conn;
+ *     int errget = tcppoolget(pool, &conn, "localhost", "9090", NULL);
+ *     if(errget != 0) {
+ *         fprintf(stderr, "E: tcppoolget %s\n", strerror(errget));
+ *     }
+ *     ...
+ *     tcppoolput(pool, conn, 0);
+ */
+int tcppoolget(struct tcppool *pool, int *conn, char host[], char port[],
+        struct timespec *deadline)
+{
+    pthread_mutex_lock(&pool->mu);
+    struct tcpbackend *b = tcppoolbackend(pool, host, port);
+    if(b == NULL) {
+        pthread_mutex_unlock(&pool->mu);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    for(;;) {
+        while(b->nidle > 0) {
+            struct tcpidle idle = b->idle[--b->nidle];
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            int expired = pool->idlems > 0 &&
+                tcppoolms(&now, &idle.since) >= pool->idlems;
+            if(!expired && tcppoolprobe(idle.fd) &&
+                    tcppoolsetowner(pool, idle.fd, b) == 0) {
+                pthread_mutex_unlock(&pool->mu);
+                *conn = idle.fd;
+                return 0;
+            }
+            close(idle.fd);
+            b->nconns--;
+        }
+
+        if(b->nconns < pool->maxconns) break;
+
+        int errwait;
+        if(deadline == NULL) {
+            errwait = pthread_cond_wait(&b->cond, &pool->mu);
+        } else {
+            errwait = pthread_cond_timedwait(&b->cond, &pool->mu, deadline);
+        }
+        if(errwait == ETIMEDOUT) {
+            pthread_mutex_unlock(&pool->mu);
+            errno = ETIMEDOUT;
+            return errno;
+        }
+    }
+
+    /* reserve the slot and dial without holding the lock */
+    b->nconns++;
+    pthread_mutex_unlock(&pool->mu);
+
+    int errdial = tcpdialdl(conn, host, port, deadline);
+
+    pthread_mutex_lock(&pool->mu);
+    if(errdial == 0) errdial = tcppoolsetowner(pool, *conn, b);
+    if(errdial != 0) {
+        b->nconns--;
+        pthread_cond_signal(&b->cond);
+    }
+    pthread_mutex_unlock(&pool->mu);
+
+    errno = errdial;
+    return errno;
+}
+
+/* tcppoolput gives back a connection obtained from tcppoolget. If broken is
+ * non-zero, e.g. after an I/O error or an unfinished request, the
+ * connection is closed instead of kept for reuse. */
+void tcppoolput(struct tcppool *pool, int conn, int broken)
+{
+    pthread_mutex_lock(&pool->mu);
+    if(conn < 0 || conn >= pool->nowner || pool->owner[conn] == NULL) {
+        pthread_mutex_unlock(&pool->mu);
+        return;
+    }
+    struct tcpbackend *b = pool->owner[conn];
+    pool->owner[conn] = NULL;
+
+    if(broken) {
+        close(conn);
+        b->nconns--;
+    } else {
+        struct tcpidle *idle = &b->idle[b->nidle++];
+        idle->fd = conn;
+        clock_gettime(CLOCK_MONOTONIC, &idle->since);
+    }
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&pool->mu);
+}
+
+/* tcppoolreap closes the idle connections that expired or failed the
+ * liveness probe. It is meant to be called periodically, so dead
+ * connections do not hold descriptors until the next tcppoolget. */
+void tcppoolreap(struct tcppool *pool)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&pool->mu);
+    for(int i = 0; i < TCP_POOLBUCKETS; i++) {
+        for(struct tcpbackend *b = pool->buckets[i]; b != NULL; b = b->next) {
+            int kept = 0;
+            for(int j = 0; j < b->nidle; j++) {
+                struct tcpidle *idle = &b->idle[j];
+                int expired = pool->idlems > 0 &&
+                    tcppoolms(&now, &idle->since) >= pool->idlems;
+                if(expired || !tcppoolprobe(idle->fd)) {
+                    close(idle->fd);
+                    b->nconns--;
+                    pthread_cond_signal(&b->cond);
+                    continue;
+                }
+                b->idle[kept++] = *idle;
+            }
+            b->nidle = kept;
+        }
+    }
+    pthread_mutex_unlock(&pool->mu);
+}
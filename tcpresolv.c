@@ -0,0 +1,1052 @@
+/* tcpresolv - A caching, asynchronous host name resolver for the tcp
+ * module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose definitions corresponding
+ * to the POSIX.1-2008 base specification, pthread_condattr_setclock(3) and
+ * mkostemp(3). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcp.h"
+#include "tcpresolv.h"
+
+/* the number of workers of the default resolver */
+#define TCP_RESOLVWORKERS 4
+/* above this number of entries, expired results are evicted even while
+ * they could still be used past their expiry, and if that is not enough,
+ * results that did not expire yet */
+#define TCP_RESOLVCAP 16384
+/* the most entries a snapshot holds: those of the cache first, then those
+ * of the previous snapshot */
+#define TCP_RESOLVSNAPMAX 65536
+
+/* the levels of tcpresolvsweep */
+enum {
+    TCP_RSWEEPDEAD,
+    TCP_RSWEEPEXPIRED,
+    TCP_RSWEEPALL
+};
+
+/* The snapshot is a file the cache is written to, and that a later process
+ * maps and uses in place instead of waiting for the name servers: a header,
+ * the entries sorted by the hash of their key, their addresses, then their
+ * keys. The addresses are stored as struct tcpaddr, so the header records
+ * the layout and a file of another build is ignored. */
+#define TCP_SNAPMAGIC "TCPHOSTS"
+#define TCP_SNAPVERSION 1
+#define TCP_SNAPORDER 0x01020304u
+
+struct tcpsnaphdr {
+    char magic[8];
+    uint32_t version;
+    /* sizeof(struct tcpaddr) and TCP_SNAPORDER in host byte order */
+    uint32_t addrlen;
+    uint32_t order;
+    uint32_t nentries;
+    uint64_t size;
+    /* FNV-1a of the bytes that follow the header */
+    uint64_t sum;
+};
+
+struct tcpsnapent {
+    uint64_t hash;
+    /* the expiry and the end of the stale period, in CLOCK_REALTIME
+     * nanoseconds, which unlike CLOCK_MONOTONIC survive a reboot */
+    int64_t expires;
+    int64_t stale;
+    /* the offsets in the file of the key, "host\0port\0", and of the
+     * addresses */
+    uint32_t key;
+    uint32_t keylen;
+    uint32_t addrs;
+    uint32_t naddrs;
+};
+
+/* tcpsnapw writes the entries of a snapshot. With p NULL it only counts
+ * them, with p set it copies them and addrs and keys are the offsets of the
+ * next addresses and key. */
+struct tcpsnapw {
+    unsigned char *p;
+    size_t n;
+    size_t addrs;
+    size_t keys;
+};
+
+enum {
+    TCP_RIDLE,
+    TCP_RPENDING,
+    TCP_RREADY
+};
+
+/* tcprwait is a tcpresolveasync call waiting for a lookup in progress. */
+struct tcprwait {
+    struct tcprwait *next;
+    tcpresolvfn *fn;
+    void *arg;
+};
+
+/* tcprent is the cache entry of a single host:port. An expired entry is
+ * looked up again in place; it is evicted by tcpresolvsweep once nobody
+ * waits for it. */
+struct tcprent {
+    /* the key, "host\0port\0" */
+    char *host;
+    char *port;
+    int state;
+    int err;
+    /* counts the completed lookups, so a waiter knows its lookup is done
+     * even when the result expired on arrival */
+    uint64_t gen;
+    int64_t expires;
+    /* until when the addresses are used past expires, see TCP_RESOLVSTALE */
+    int64_t stale;
+    /* set while the addresses are those of the snapshot */
+    int snap;
+    int naddrs;
+    struct tcpaddr *addrs;
+    struct tcprwait *waiters;
+    /* the number of tcpresolve calls waiting on the entry */
+    int nwait;
+    struct tcprent *qnext;
+};
+
+/* tcprslot is a slot of the open addressing table. The hash is kept in
+ * the slot so a probe only dereferences the entry on a likely match. */
+struct tcprslot {
+    uint64_t hash;
+    struct tcprent *e;
+};
+
+struct tcpresolv {
+    pthread_mutex_t mu;
+    /* broadcast whenever a lookup completes */
+    pthread_cond_t done;
+    /* signaled when a lookup is queued */
+    pthread_cond_t work;
+    int ttlms;
+    int negttlms;
+    struct tcprslot *slots;
+    size_t cap;
+    size_t len;
+    /* the queue of entries to look up */
+    struct tcprent *qhead;
+    struct tcprent *qtail;
+    int stop;
+    int nworkers;
+    pthread_t *workers;
+    /* the snapshot file, and the snapshot it held at tcpresolvsnap */
+    char *snappath;
+    unsigned char *snap;
+    size_t snaplen;
+    /* set when the cache changed since the last write of the snapshot */
+    int dirty;
+    /* signaled when dirty is set */
+    pthread_cond_t save;
+    /* serializes the writes, so an older image never replaces a newer */
+    pthread_mutex_t savemu;
+    int hassaver;
+    pthread_t saver;
+};
+
+static pthread_once_t tcpresolvonce = PTHREAD_ONCE_INIT;
+static struct tcpresolv *tcpresolvdef;
+
+static int64_t tcpresolvnow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int64_t tcpresolvreal(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t tcpresolvsum(const unsigned char *p, size_t n)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t tcpresolvhash(char host[], char port[])
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ull;
+    for(char *c = host; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    h *= 1099511628211ull;
+    for(char *c = port; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    return h;
+}
+
+/* tcpresolvgrow doubles the table. The resolver must be locked. */
+static int tcpresolvgrow(struct tcpresolv *r)
+{
+    size_t cap = r->cap * 2;
+    struct tcprslot *slots = calloc(cap, sizeof *slots);
+    if(slots == NULL) return ENOMEM;
+    for(size_t i = 0; i < r->cap; i++) {
+        if(r->slots[i].e == NULL) continue;
+        size_t j = r->slots[i].hash & (cap - 1);
+        while(slots[j].e != NULL) j = (j + 1) & (cap - 1);
+        slots[j] = r->slots[i];
+    }
+    free(r->slots);
+    r->slots = slots;
+    r->cap = cap;
+    return 0;
+}
+
+/* tcpresolvsweep evicts the entries that no lookup or caller is waiting
+ * for and rehashes the others. TCP_RSWEEPDEAD evicts the results that can
+ * no longer be used, TCP_RSWEEPEXPIRED also those only usable past their
+ * expiry, and TCP_RSWEEPALL every result. The resolver must be locked. */
+static void tcpresolvsweep(struct tcpresolv *r, int level)
+{
+    struct tcprslot *slots = calloc(r->cap, sizeof *slots);
+    if(slots == NULL) return;
+    int64_t now = tcpresolvnow();
+    size_t len = 0;
+    for(size_t i = 0; i < r->cap; i++) {
+        struct tcprent *e = r->slots[i].e;
+        if(e == NULL) continue;
+        int dead = e->expires <= now && (e->naddrs == 0 || e->stale <= now);
+        if(e->state != TCP_RPENDING && e->nwait == 0 &&
+                (dead || level == TCP_RSWEEPALL ||
+                 (level == TCP_RSWEEPEXPIRED && e->expires <= now))) {
+            free(e->addrs);
+            free(e->host);
+            free(e);
+            continue;
+        }
+        size_t j = r->slots[i].hash & (r->cap - 1);
+        while(slots[j].e != NULL) j = (j + 1) & (r->cap - 1);
+        slots[j] = r->slots[i];
+        len++;
+    }
+    free(r->slots);
+    r->slots = slots;
+    r->len = len;
+}
+
+/* tcpresolvslot returns the slot of host:port, whose hash is h, or the
+ * free slot it would take. The resolver must be locked. */
+static size_t tcpresolvslot(struct tcpresolv *r, uint64_t h,
+        const char host[], const char port[])
+{
+    size_t i = h & (r->cap - 1);
+    for(; r->slots[i].e != NULL; i = (i + 1) & (r->cap - 1)) {
+        struct tcprent *e = r->slots[i].e;
+        if(r->slots[i].hash == h && strcmp(e->host, host) == 0 &&
+                strcmp(e->port, port) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* tcpsnapvalid reports whether the n bytes at p are a snapshot this build
+ * can use in place. */
+static int tcpsnapvalid(const unsigned char *p, size_t n)
+{
+    const struct tcpsnaphdr *hdr = (const struct tcpsnaphdr *)p;
+    if(n < sizeof *hdr || memcmp(hdr->magic, TCP_SNAPMAGIC, 8) != 0 ||
+            hdr->version != TCP_SNAPVERSION ||
+            hdr->addrlen != sizeof(struct tcpaddr) ||
+            hdr->order != TCP_SNAPORDER || hdr->size != n ||
+            hdr->nentries > (n - sizeof *hdr) / sizeof(struct tcpsnapent) ||
+            hdr->sum != tcpresolvsum(p + sizeof *hdr, n - sizeof *hdr)) {
+        return 0;
+    }
+    const struct tcpsnapent *se = (const struct tcpsnapent *)(hdr + 1);
+    for(uint32_t i = 0; i < hdr->nentries; i++, se++) {
+        if(se->keylen < 2 || se->key > n || se->keylen > n - se->key ||
+                p[se->key + se->keylen - 1] != '\0' ||
+                memchr(p + se->key, '\0', se->keylen - 1) == NULL ||
+                se->naddrs == 0 || se->naddrs > TCP_RESOLVMAX ||
+                se->addrs % sizeof(uint64_t) != 0 || se->addrs > n ||
+                se->naddrs * sizeof(struct tcpaddr) > n - se->addrs ||
+                (i > 0 && se[-1].hash > se->hash)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* tcpresolvseed gives the new entry e of host:port the addresses the
+ * snapshot holds for it, unless they are too old. The resolver must be
+ * locked. */
+static void tcpresolvseed(struct tcpresolv *r, struct tcprent *e,
+        uint64_t h, size_t keylen)
+{
+    if(r->snap == NULL) return;
+    const struct tcpsnaphdr *hdr = (const struct tcpsnaphdr *)r->snap;
+    const struct tcpsnapent *ents = (const struct tcpsnapent *)(hdr + 1);
+    size_t lo = 0, hi = hdr->nentries;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(ents[mid].hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for(; lo < hdr->nentries && ents[lo].hash == h; lo++) {
+        const struct tcpsnapent *se = &ents[lo];
+        if(se->keylen != keylen ||
+                memcmp(r->snap + se->key, e->host, keylen) != 0) {
+            continue;
+        }
+        int64_t real = tcpresolvreal();
+        if(se->stale <= real) return;
+        struct tcpaddr *copy = malloc(se->naddrs * sizeof *copy);
+        if(copy == NULL) return;
+        memcpy(copy, r->snap + se->addrs, se->naddrs * sizeof *copy);
+        int64_t now = tcpresolvnow();
+        e->addrs = copy;
+        e->naddrs = se->naddrs;
+        e->err = 0;
+        e->state = TCP_RREADY;
+        e->expires = now + (se->expires - real);
+        e->stale = now + (se->stale - real);
+        e->snap = 1;
+        return;
+    }
+}
+
+/* tcpresolventry returns the entry of host:port, creating an idle one, or
+ * one with the addresses of the snapshot, if needed. The resolver must be
+ * locked. */
+static struct tcprent *tcpresolventry(struct tcpresolv *r, char host[],
+        char port[])
+{
+    uint64_t h = tcpresolvhash(host, port);
+    size_t i = tcpresolvslot(r, h, host, port);
+    if(r->slots[i].e != NULL) return r->slots[i].e;
+
+    if((r->len + 1) * 2 > r->cap) {
+        /* evict before growing; grow anyway unless a quarter of the table
+         * was freed, so the sweeps stay amortized */
+        tcpresolvsweep(r, TCP_RSWEEPDEAD);
+        if(r->len >= TCP_RESOLVCAP) tcpresolvsweep(r, TCP_RSWEEPEXPIRED);
+        if(r->len >= TCP_RESOLVCAP) tcpresolvsweep(r, TCP_RSWEEPALL);
+        if(r->len * 8 > r->cap * 3 && tcpresolvgrow(r) != 0) return NULL;
+        return tcpresolventry(r, host, port);
+    }
+
+    size_t hostln = strlen(host), portln = strlen(port);
+    struct tcprent *e = calloc(1, sizeof *e);
+    char *key = malloc(hostln + portln + 2);
+    if(e == NULL || key == NULL) {
+        free(e);
+        free(key);
+        return NULL;
+    }
+    memcpy(key, host, hostln + 1);
+    memcpy(key + hostln + 1, port, portln + 1);
+    e->host = key;
+    e->port = key + hostln + 1;
+    e->state = TCP_RIDLE;
+    tcpresolvseed(r, e, h, hostln + portln + 2);
+
+    r->slots[i].hash = h;
+    r->slots[i].e = e;
+    r->len++;
+    return e;
+}
+
+/* tcpresolvcopy copies the result of the entry e into *addrs and returns
+ * its error. */
+static int tcpresolvcopy(struct tcprent *e, struct tcpaddrs *addrs)
+{
+    addrs->n = e->naddrs;
+    memcpy(addrs->addr, e->addrs, e->naddrs * sizeof *e->addrs);
+    return e->err;
+}
+
+/* tcpresolvqueue queues a lookup of e unless one is already in progress.
+ * The resolver must be locked. */
+static void tcpresolvqueue(struct tcpresolv *r, struct tcprent *e)
+{
+    if(e->state == TCP_RPENDING) return;
+    e->state = TCP_RPENDING;
+    e->qnext = NULL;
+    if(r->qtail != NULL) {
+        r->qtail->qnext = e;
+    } else {
+        r->qhead = e;
+    }
+    r->qtail = e;
+    pthread_cond_signal(&r->work);
+}
+
+/* tcpresolvusable reports whether the result of e can be returned now. The
+ * addresses of the snapshot are returned even once expired, while a lookup
+ * refreshes them in the background. The resolver must be locked. */
+static int tcpresolvusable(struct tcpresolv *r, struct tcprent *e)
+{
+    int64_t now = tcpresolvnow();
+    if(e->state == TCP_RREADY && e->expires > now) return 1;
+    if(!e->snap || e->naddrs == 0 || e->stale <= now) return 0;
+    if(e->expires <= now) tcpresolvqueue(r, e);
+    return 1;
+}
+
+/* tcpresolvlookup runs getaddrinfo(3) for host:port and write the result
+ * into *addrs. It returns 0 or an errno value. */
+static int tcpresolvlookup(char host[], char port[], struct tcpaddrs *addrs)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    int gaierr = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints,
+            &res);
+    if(gaierr != 0) {
+        addrs->n = 0;
+        return tcpgaierr(gaierr);
+    }
+
+    addrs->n = 0;
+    for(struct addrinfo *ai = res; ai != NULL && addrs->n < TCP_RESOLVMAX;
+            ai = ai->ai_next) {
+        if(ai->ai_addrlen > sizeof addrs->addr[0].u) continue;
+        struct tcpaddr *a = &addrs->addr[addrs->n++];
+        a->len = ai->ai_addrlen;
+        memcpy(&a->u, ai->ai_addr, ai->ai_addrlen);
+    }
+    freeaddrinfo(res);
+    return addrs->n > 0 ? 0 : ENOTCONN;
+}
+
+static void *tcpresolvworker(void *arg)
+{
+    struct tcpresolv *r = arg;
+    struct tcpaddrs addrs;
+
+    pthread_mutex_lock(&r->mu);
+    for(;;) {
+        while(r->qhead == NULL && !r->stop) {
+            pthread_cond_wait(&r->work, &r->mu);
+        }
+        if(r->stop) break;
+
+        struct tcprent *e = r->qhead;
+        r->qhead = e->qnext;
+        if(r->qhead == NULL) r->qtail = NULL;
+        pthread_mutex_unlock(&r->mu);
+
+        /* the key of an entry never changes, it is safe to read it
+         * without the lock */
+        int err = tcpresolvlookup(e->host, e->port, &addrs);
+        struct tcpaddr *copy = NULL;
+        if(addrs.n > 0) {
+            copy = malloc(addrs.n * sizeof *copy);
+            if(copy == NULL) {
+                err = ENOMEM;
+                addrs.n = 0;
+            } else {
+                memcpy(copy, addrs.addr, addrs.n * sizeof *copy);
+            }
+        }
+
+        pthread_mutex_lock(&r->mu);
+        int64_t now = tcpresolvnow();
+        if(err != 0 && err != EINVAL && e->naddrs > 0 && e->stale > now) {
+            /* the name servers are unreachable, not denying the host: keep
+             * the last addresses and try again later */
+            free(copy);
+            err = tcpresolvcopy(e, &addrs);
+            e->expires = now + (int64_t)r->negttlms * 1000000;
+        } else {
+            free(e->addrs);
+            e->addrs = copy;
+            e->naddrs = addrs.n;
+            e->err = err;
+            e->expires = now +
+                (int64_t)(err == 0 ? r->ttlms : r->negttlms) * 1000000;
+            e->stale = e->expires + (int64_t)TCP_RESOLVSTALE * 1000000;
+            e->snap = 0;
+            r->dirty = 1;
+            pthread_cond_signal(&r->save);
+        }
+        e->state = TCP_RREADY;
+        e->gen++;
+        struct tcprwait *w = e->waiters;
+        e->waiters = NULL;
+        pthread_cond_broadcast(&r->done);
+
+        if(w != NULL) {
+            pthread_mutex_unlock(&r->mu);
+            while(w != NULL) {
+                struct tcprwait *next = w->next;
+                w->fn(&addrs, err, w->arg);
+                free(w);
+                w = next;
+            }
+            pthread_mutex_lock(&r->mu);
+        }
+    }
+    pthread_mutex_unlock(&r->mu);
+    return NULL;
+}
+
+/* tcpresolvnew creates a resolver with nworkers lookup threads and write it
+ * into *r. Successful lookups are cached for ttlms milliseconds, failed ones
+ * for negttlms milliseconds.
+ *
+ * It returns 0 on success, EINVAL, ENOMEM or the error of
+ * pthread_create(3).
+ */
+int tcpresolvnew(struct tcpresolv **r, int nworkers, int ttlms, int negttlms)
+{
+    if(nworkers <= 0 || ttlms < 0 || negttlms < 0) {
+        errno = EINVAL;
+        return errno;
+    }
+
+    struct tcpresolv *res = calloc(1, sizeof *res);
+    if(res == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    res->cap = 64;
+    res->slots = calloc(res->cap, sizeof *res->slots);
+    res->workers = calloc(nworkers, sizeof *res->workers);
+    if(res->slots == NULL || res->workers == NULL) {
+        free(res->slots);
+        free(res->workers);
+        free(res);
+        errno = ENOMEM;
+        return errno;
+    }
+    res->ttlms = ttlms;
+    res->negttlms = negttlms;
+
+    pthread_mutex_init(&res->mu, NULL);
+    pthread_mutex_init(&res->savemu, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&res->done, &attr);
+    pthread_cond_init(&res->save, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&res->work, NULL);
+
+    for(; res->nworkers < nworkers; res->nworkers++) {
+        int err = pthread_create(&res->workers[res->nworkers], NULL,
+                tcpresolvworker, res);
+        if(err != 0) {
+            tcpresolvfree(res);
+            errno = err;
+            return errno;
+        }
+    }
+
+    *r = res;
+    return 0;
+}
+
+/* tcpresolvfree stops the workers and releases the resolver. Pending
+ * tcpresolveasync callbacks are dropped without being called. A snapshot
+ * attached with tcpresolvsnap is brought up to date first. */
+void tcpresolvfree(struct tcpresolv *r)
+{
+    pthread_mutex_lock(&r->mu);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->work);
+    pthread_cond_signal(&r->save);
+    pthread_mutex_unlock(&r->mu);
+    for(int i = 0; i < r->nworkers; i++) pthread_join(r->workers[i], NULL);
+    if(r->hassaver) pthread_join(r->saver, NULL);
+    if(r->snappath != NULL && r->dirty) tcpresolvsave(r);
+
+    for(size_t i = 0; i < r->cap; i++) {
+        struct tcprent *e = r->slots[i].e;
+        if(e == NULL) continue;
+        while(e->waiters != NULL) {
+            struct tcprwait *next = e->waiters->next;
+            free(e->waiters);
+            e->waiters = next;
+        }
+        free(e->addrs);
+        free(e->host);
+        free(e);
+    }
+    pthread_cond_destroy(&r->done);
+    pthread_cond_destroy(&r->work);
+    pthread_cond_destroy(&r->save);
+    pthread_mutex_destroy(&r->mu);
+    pthread_mutex_destroy(&r->savemu);
+    if(r->snap != NULL) munmap(r->snap, r->snaplen);
+    free(r->snappath);
+    free(r->slots);
+    free(r->workers);
+    free(r);
+}
+
+static void tcpresolvinit(void)
+{
+    if(tcpresolvnew(&tcpresolvdef, TCP_RESOLVWORKERS, TCP_RESOLVTTL,
+                TCP_RESOLVNEGTTL) != 0) {
+        tcpresolvdef = NULL;
+        return;
+    }
+    /* without a usable snapshot the resolver just starts empty */
+    const char *path = getenv(TCP_ENVHOSTS);
+    if(path != NULL && path[0] != '\0') tcpresolvsnap(tcpresolvdef, path);
+}
+
+/* tcpresolvdefault returns the process-wide resolver used by tcpdial. It is
+ * created on first use and lives until the process exits. It returns NULL
+ * if the resolver could not be created; tcpresolve then falls back to a
+ * direct getaddrinfo(3) call.
+ *
+ * If the environment variable TCP_ENVHOSTS names a file, the resolver keeps
+ * a snapshot of its cache in it, see tcpresolvsnap. A restarted process
+ * then dials its backends at once, before any name server answers. */
+struct tcpresolv *tcpresolvdefault(void)
+{
+    pthread_once(&tcpresolvonce, tcpresolvinit);
+    return tcpresolvdef;
+}
+
+/* tcpresolve resolves host:port and write up to TCP_RESOLVMAX addresses, in
+ * the order preferred by getaddrinfo(3), into *addrs.
+ *
+ * A cached result is returned without a system call. Otherwise the lookup
+ * runs on a worker of the resolver; concurrent calls for the same host:port
+ * share a single lookup. The calling thread waits until the lookup is done
+ * or until the absolute CLOCK_MONOTONIC time *deadline, if deadline is not
+ * NULL. The lookup is not abandoned on timeout, its result still fills the
+ * cache for the next call.
+ *
+ * If r is NULL, getaddrinfo(3) is called directly and nothing is cached.
+ *
+ * It returns 0 on success, ETIMEDOUT when the deadline expired, or one of
+ * the errors of tcpdial: ENETUNREACH, ENETDOWN, ENOMEM or EINVAL.
+ */
+int tcpresolve(struct tcpresolv *r, struct tcpaddrs *addrs, char host[],
+        char port[], struct timespec *deadline)
+{
+    if(host == NULL) host = "";
+    if(port == NULL) port = "";
+    if(r == NULL) {
+        errno = tcpresolvlookup(host, port, addrs);
+        return errno;
+    }
+
+    pthread_mutex_lock(&r->mu);
+    struct tcprent *e = tcpresolventry(r, host, port);
+    if(e == NULL) {
+        pthread_mutex_unlock(&r->mu);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    /* the result of a lookup that completed while waiting is returned
+     * even if it expired already, as with a TTL of 0 */
+    uint64_t gen = e->gen;
+    for(;;) {
+        if(e->gen != gen || tcpresolvusable(r, e)) {
+            int err = tcpresolvcopy(e, addrs);
+            pthread_mutex_unlock(&r->mu);
+            errno = err;
+            return errno;
+        }
+        tcpresolvqueue(r, e);
+
+        int errwait;
+        e->nwait++;
+        if(deadline == NULL) {
+            errwait = pthread_cond_wait(&r->done, &r->mu);
+        } else {
+            errwait = pthread_cond_timedwait(&r->done, &r->mu, deadline);
+        }
+        e->nwait--;
+        if(errwait == ETIMEDOUT) {
+            pthread_mutex_unlock(&r->mu);
+            errno = ETIMEDOUT;
+            return errno;
+        }
+    }
+}
+
+/* tcpresolveasync resolves host:port without blocking the caller. fn is
+ * called with the result, from the calling thread when the result is
+ * cached, or from a resolver worker otherwise. fn must not block for long,
+ * since it delays the other lookups of that worker.
+ *
+ * It returns 0 when fn was or will be called, or ENOMEM.
+ */
+int tcpresolveasync(struct tcpresolv *r, char host[], char port[],
+        tcpresolvfn *fn, void *arg)
+{
+    if(host == NULL) host = "";
+    if(port == NULL) port = "";
+
+    pthread_mutex_lock(&r->mu);
+    struct tcprent *e = tcpresolventry(r, host, port);
+    if(e == NULL) {
+        pthread_mutex_unlock(&r->mu);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    if(tcpresolvusable(r, e)) {
+        struct tcpaddrs addrs;
+        int err = tcpresolvcopy(e, &addrs);
+        pthread_mutex_unlock(&r->mu);
+        fn(&addrs, err, arg);
+        return 0;
+    }
+
+    struct tcprwait *w = malloc(sizeof *w);
+    if(w == NULL) {
+        pthread_mutex_unlock(&r->mu);
+        errno = ENOMEM;
+        return errno;
+    }
+    w->fn = fn;
+    w->arg = arg;
+    w->next = e->waiters;
+    e->waiters = w;
+    tcpresolvqueue(r, e);
+    pthread_mutex_unlock(&r->mu);
+    return 0;
+}
+
+/* tcpsnapput adds an entry to the snapshot written by w, unless it holds
+ * TCP_RESOLVSNAPMAX entries already. */
+static void tcpsnapput(struct tcpsnapw *w, uint64_t h, const char *key,
+        size_t keylen, const struct tcpaddr *addrs, int naddrs,
+        int64_t expires, int64_t stale)
+{
+    if(w->n >= TCP_RESOLVSNAPMAX) return;
+    if(w->p != NULL) {
+        struct tcpsnapent *se = (struct tcpsnapent *)
+            (w->p + sizeof(struct tcpsnaphdr)) + w->n;
+        se->hash = h;
+        se->expires = expires;
+        se->stale = stale;
+        se->key = w->keys;
+        se->keylen = keylen;
+        se->addrs = w->addrs;
+        se->naddrs = naddrs;
+        memcpy(w->p + w->addrs, addrs, naddrs * sizeof *addrs);
+        memcpy(w->p + w->keys, key, keylen);
+    }
+    w->n++;
+    w->addrs += naddrs * sizeof *addrs;
+    w->keys += keylen;
+}
+
+/* tcpsnapputall adds the entries of the cache that have addresses still
+ * in use, and those of the previous snapshot that are not in the cache and
+ * not too old, to the snapshot written by w. A process that looked up only
+ * a few names so keeps the others for the next one, while an entry the
+ * cache evicted is kept until it is too old. The resolver must be
+ * locked. */
+static void tcpsnapputall(struct tcpresolv *r, struct tcpsnapw *w,
+        int64_t now, int64_t real)
+{
+    for(size_t i = 0; i < r->cap; i++) {
+        struct tcprent *e = r->slots[i].e;
+        if(e == NULL || e->naddrs == 0 || e->stale <= now) continue;
+        size_t keylen = (e->port - e->host) + strlen(e->port) + 1;
+        tcpsnapput(w, r->slots[i].hash, e->host, keylen, e->addrs,
+                e->naddrs, real + (e->expires - now),
+                real + (e->stale - now));
+    }
+
+    if(r->snap == NULL) return;
+    const struct tcpsnaphdr *hdr = (const struct tcpsnaphdr *)r->snap;
+    const struct tcpsnapent *se = (const struct tcpsnapent *)(hdr + 1);
+    for(uint32_t i = 0; i < hdr->nentries; i++, se++) {
+        const char *host = (const char *)r->snap + se->key;
+        const char *port = host + strlen(host) + 1;
+        if(se->stale <= real ||
+                r->slots[tcpresolvslot(r, se->hash, host, port)].e != NULL) {
+            continue;
+        }
+        tcpsnapput(w, se->hash, host, se->keylen,
+                (const struct tcpaddr *)(r->snap + se->addrs), se->naddrs,
+                se->expires, se->stale);
+    }
+}
+
+static int tcpsnapcmp(const void *a, const void *b)
+{
+    const struct tcpsnapent *x = a, *y = b;
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+/* tcpsnapimage builds the snapshot of the cache in memory and write it
+ * into *img and its size into *len. The resolver must be locked. */
+static int tcpsnapimage(struct tcpresolv *r, unsigned char **img,
+        size_t *len)
+{
+    int64_t now = tcpresolvnow(), real = tcpresolvreal();
+    struct tcpsnapw w = { NULL, 0, 0, 0 };
+    tcpsnapputall(r, &w, now, real);
+
+    size_t addroff = sizeof(struct tcpsnaphdr) +
+        w.n * sizeof(struct tcpsnapent);
+    size_t keyoff = addroff + w.addrs;
+    size_t size = keyoff + w.keys;
+    if(size > UINT32_MAX) return EFBIG;
+    unsigned char *p = calloc(1, size);
+    if(p == NULL) return ENOMEM;
+    w.p = p;
+    w.n = 0;
+    w.addrs = addroff;
+    w.keys = keyoff;
+    tcpsnapputall(r, &w, now, real);
+
+    struct tcpsnaphdr *hdr = (struct tcpsnaphdr *)p;
+    qsort(hdr + 1, w.n, sizeof(struct tcpsnapent), tcpsnapcmp);
+    memcpy(hdr->magic, TCP_SNAPMAGIC, 8);
+    hdr->version = TCP_SNAPVERSION;
+    hdr->addrlen = sizeof(struct tcpaddr);
+    hdr->order = TCP_SNAPORDER;
+    hdr->nentries = w.n;
+    hdr->size = size;
+    hdr->sum = tcpresolvsum(p + sizeof *hdr, size - sizeof *hdr);
+    *img = p;
+    *len = size;
+    return 0;
+}
+
+/* tcpsnapwrite replaces the file path with the len bytes of img. The file
+ * is written under a temporary name and renamed over path, so a reader
+ * sees either the old or the new snapshot, never a part of one. */
+static int tcpsnapwrite(const char *path, const unsigned char *img,
+        size_t len)
+{
+    size_t pathln = strlen(path);
+    char *tmp = malloc(pathln + sizeof ".XXXXXX");
+    if(tmp == NULL) return ENOMEM;
+    memcpy(tmp, path, pathln);
+    memcpy(tmp + pathln, ".XXXXXX", sizeof ".XXXXXX");
+
+    int err = 0;
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if(fd == -1) {
+        err = errno;
+        free(tmp);
+        return err;
+    }
+    for(size_t off = 0; off < len; ) {
+        ssize_t n = write(fd, img + off, len - off);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) {
+            err = errno;
+            break;
+        }
+        off += n;
+    }
+    if(err == 0 && fsync(fd) != 0) err = errno;
+    if(close(fd) != 0 && err == 0) err = errno;
+    if(err == 0 && rename(tmp, path) != 0) err = errno;
+    if(err != 0) unlink(tmp);
+    free(tmp);
+    return err;
+}
+
+static void *tcpresolvsaver(void *arg)
+{
+    struct tcpresolv *r = arg;
+    pthread_mutex_lock(&r->mu);
+    while(!r->stop) {
+        if(!r->dirty) {
+            pthread_cond_wait(&r->save, &r->mu);
+            continue;
+        }
+        /* the lookups that complete in the meantime go into the same
+         * write */
+        struct timespec dl;
+        tcpdeadline(&dl, TCP_RESOLVSAVEMS);
+        while(!r->stop &&
+                pthread_cond_timedwait(&r->save, &r->mu, &dl) != ETIMEDOUT) {
+        }
+        if(r->stop) break;
+        pthread_mutex_unlock(&r->mu);
+        tcpresolvsave(r);
+        pthread_mutex_lock(&r->mu);
+    }
+    pthread_mutex_unlock(&r->mu);
+    return NULL;
+}
+
+/* tcpresolvsnap attaches the snapshot file path to r. The addresses it
+ * holds are used at once, without a lookup, even when they have expired,
+ * for up to TCP_RESOLVSTALE milliseconds; an expired result is refreshed
+ * in the background by the first call that uses it. The file is mapped,
+ * not parsed, so a large snapshot costs nothing until it is used.
+ *
+ * From then on a thread of r writes the cache back to path, at most every
+ * TCP_RESOLVSAVEMS milliseconds while lookups complete, and tcpresolvfree
+ * writes it a last time. The file is replaced atomically. Results of the
+ * snapshot that were not used are kept until they are too old, after the
+ * entries of the cache and up to TCP_RESOLVSNAPMAX entries in all.
+ *
+ * A missing file is not an error, it is created. If the function succeeds
+ * it returns 0. Otherwise it returns and set errno to EINVAL if the file is
+ * not a snapshot of this build, which is then ignored and overwritten,
+ * EBUSY if r has a snapshot already, ENOMEM, or the error of open(2),
+ * mmap(2) or pthread_create(3). But for EBUSY and ENOMEM, path is attached
+ * to r in any case.
+ *
+ * Example
+ *     struct tcpresolv *r;
+ *     if(tcpresolvnew(&r, 4, TCP_RESOLVTTL, TCP_RESOLVNEGTTL) == 0) {
+ *         tcpresolvsnap(r, "/var/cache/myservice/hosts");
+ *     }
+ */
+int tcpresolvsnap(struct tcpresolv *r, const char *path)
+{
+    char *p = strdup(path);
+    if(p == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+
+    unsigned char *snap = NULL;
+    size_t snaplen = 0;
+    int err = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        if(errno != ENOENT) err = errno;
+    } else {
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            err = errno;
+        } else if(st.st_size > 0) {
+            snaplen = st.st_size;
+            snap = mmap(NULL, snaplen, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(snap == MAP_FAILED) {
+                err = errno;
+                snap = NULL;
+            }
+        }
+        close(fd);
+        if(err == 0 && (snap == NULL || !tcpsnapvalid(snap, snaplen))) {
+            err = EINVAL;
+        }
+        if(err != 0 && snap != NULL) {
+            munmap(snap, snaplen);
+            snap = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&r->mu);
+    if(r->snappath != NULL) {
+        pthread_mutex_unlock(&r->mu);
+        if(snap != NULL) munmap(snap, snaplen);
+        free(p);
+        errno = EBUSY;
+        return errno;
+    }
+    r->snappath = p;
+    r->snap = snap;
+    r->snaplen = snaplen;
+    int errthread = pthread_create(&r->saver, NULL, tcpresolvsaver, r);
+    if(errthread == 0) {
+        r->hassaver = 1;
+    } else if(err == 0) {
+        err = errthread;
+    }
+    pthread_mutex_unlock(&r->mu);
+    errno = err;
+    return errno;
+}
+
+/* tcpresolvsave writes the cache of r to its snapshot file now. It is
+ * only needed before a process exits without tcpresolvfree, e.g. the one
+ * of tcpresolvdefault.
+ *
+ * If the function succeeds it returns 0. Otherwise it returns and set
+ * errno to EINVAL if r has no snapshot, EFBIG if the snapshot would exceed
+ * 4 GiB, ENOMEM, or the error of writing the file.
+ */
+int tcpresolvsave(struct tcpresolv *r)
+{
+    pthread_mutex_lock(&r->savemu);
+    pthread_mutex_lock(&r->mu);
+    if(r->snappath == NULL) {
+        pthread_mutex_unlock(&r->mu);
+        pthread_mutex_unlock(&r->savemu);
+        errno = EINVAL;
+        return errno;
+    }
+    unsigned char *img;
+    size_t len;
+    int err = tcpsnapimage(r, &img, &len);
+    if(err == 0) r->dirty = 0;
+    pthread_mutex_unlock(&r->mu);
+
+    if(err == 0) {
+        err = tcpsnapwrite(r->snappath, img, len);
+        free(img);
+        if(err != 0) {
+            /* try again with the next write */
+            pthread_mutex_lock(&r->mu);
+            r->dirty = 1;
+            pthread_mutex_unlock(&r->mu);
+        }
+    }
+    pthread_mutex_unlock(&r->savemu);
+    errno = err;
+    return errno;
+}
@@ -0,0 +1,88 @@
+/* tcpresolv - A caching, asynchronous host name resolver for the tcp
+ * module.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPRESOLV_H
+#define TCPRESOLV_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* the maximum number of addresses kept for a single host:port */
+#define TCP_RESOLVMAX 16
+/* the default time to live of a successful and of a failed lookup, in
+ * milliseconds; getaddrinfo(3) does not report the DNS record TTL */
+#define TCP_RESOLVTTL 30000
+#define TCP_RESOLVNEGTTL 5000
+/* how long past its expiry a result is still used, in milliseconds: while
+ * the resolver fails, or when it was loaded from a snapshot and is being
+ * refreshed */
+#define TCP_RESOLVSTALE 86400000
+/* the shortest interval between two writes of the snapshot, in
+ * milliseconds */
+#define TCP_RESOLVSAVEMS 1000
+
+/* the environment variable that names the snapshot file of the default
+ * resolver */
+#define TCP_ENVHOSTS "TCP_HOSTCACHE"
+
+struct timespec;
+struct tcpresolv;
+
+struct tcpaddr {
+    socklen_t len;
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } u;
+};
+
+struct tcpaddrs {
+    int n;
+    struct tcpaddr addr[TCP_RESOLVMAX];
+};
+
+/* tcpresolvfn receives the result of tcpresolveasync. err is 0 or an errno
+ * value; addrs is only valid during the call. */
+typedef void tcpresolvfn(struct tcpaddrs *addrs, int err, void *arg);
+
+int tcpresolvnew(struct tcpresolv **r, int nworkers, int ttlms, int negttlms);
+void tcpresolvfree(struct tcpresolv *r);
+struct tcpresolv *tcpresolvdefault(void);
+int tcpresolve(struct tcpresolv *r, struct tcpaddrs *addrs, char host[],
+        char port[], struct timespec *deadline);
+int tcpresolveasync(struct tcpresolv *r, char host[], char port[],
+        tcpresolvfn *fn, void *arg);
+int tcpresolvsnap(struct tcpresolv *r, const char *path);
+int tcpresolvsave(struct tcpresolv *r);
+
+#endif
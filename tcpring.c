@@ -0,0 +1,157 @@
+/* tcpring - Bounded lock-free ring queues of pointers for handing work
+ * between threads.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "tcpring.h"
+
+/* tcpringinit creates a ring of at least n cells, rounded up to a power of
+ * two, in *r.
+ *
+ * It returns 0 on success, EINVAL if n is 0 or too large, or ENOMEM.
+ *
+ * Example:
+ *
+ *     struct tcpring r;
+ *     if(tcpringinit(&r, 1024) != 0) {
+ *         perror("tcpringinit");
+ *     }
+ */
+int tcpringinit(struct tcpring *r, uint64_t n)
+{
+    if(n == 0 || n > ((uint64_t)1 << 32)) {
+        errno = EINVAL;
+        return errno;
+    }
+    uint64_t size = 1;
+    while(size < n) size <<= 1;
+
+    void *cells;
+    if(posix_memalign(&cells, TCP_CACHELN, size * sizeof *r->cells) != 0) {
+        errno = ENOMEM;
+        return errno;
+    }
+    r->cells = cells;
+    r->mask = size - 1;
+    for(uint64_t i = 0; i < size; i++) {
+        r->cells[i].seq = i;
+        r->cells[i].data = NULL;
+    }
+    r->head = 0;
+    r->tail = 0;
+    return 0;
+}
+
+/* tcpringdestroy releases the cells of r. Pointers still queued are not
+ * touched. */
+void tcpringdestroy(struct tcpring *r)
+{
+    free(r->cells);
+    r->cells = NULL;
+}
+
+/* tcpringpush appends data to r. It is safe to call from any number of
+ * threads at once. It returns 0, or EAGAIN if the ring is full. */
+int tcpringpush(struct tcpring *r, void *data)
+{
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    struct tcpringcell *c;
+    for(;;) {
+        c = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        int64_t dif = (int64_t)(seq - pos);
+        if(dif == 0) {
+            /* the cell is free for this lap, claim the position */
+            if(__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(dif < 0) {
+            /* the cell still holds the item of the previous lap */
+            return EAGAIN;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    c->data = data;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* tcpringpop removes the oldest pointer of r and writes it into *data. It
+ * is safe to call from any number of threads at once. It returns 0, or
+ * EAGAIN if the ring is empty. */
+int tcpringpop(struct tcpring *r, void **data)
+{
+    uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    struct tcpringcell *c;
+    for(;;) {
+        c = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        int64_t dif = (int64_t)(seq - (pos + 1));
+        if(dif == 0) {
+            if(__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(dif < 0) {
+            return EAGAIN;
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    *data = c->data;
+    /* free the cell for the next lap */
+    __atomic_store_n(&c->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* tcpringpopsc is tcpringpop for a ring with a single consumer, e.g. the
+ * completions of many workers for one I/O thread. Only that thread may pop
+ * the ring, but producers may still push concurrently. */
+int tcpringpopsc(struct tcpring *r, void **data)
+{
+    uint64_t pos = r->tail;
+    struct tcpringcell *c = &r->cells[pos & r->mask];
+    uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    if(seq != pos + 1) return EAGAIN;
+    *data = c->data;
+    r->tail = pos + 1;
+    __atomic_store_n(&c->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* tcpring - Bounded lock-free ring queues of pointers for handing work
+ * between threads.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPRING_H
+#define TCPRING_H
+
+#include <stdint.h>
+
+#include "tcpmem.h"
+
+struct tcpringcell {
+    /* the lap of the cell: which position may use it next */
+    uint64_t seq;
+    void *data;
+};
+
+/* tcpring is the bounded queue of D. Vyukov: every cell carries a sequence
+ * number that tells producers and consumers whether it is free or full for
+ * their position, so each side claims a position with one compare and swap
+ * and never waits for the other. Any number of threads may push and pop;
+ * a queue with a single consumer can pop with tcpringpopsc, which needs no
+ * atomic read-modify-write at all. The two positions live on cache lines
+ * of their own, so producers and consumers do not share one. */
+struct tcpring {
+    struct tcpringcell *cells;
+    uint64_t mask;
+    char pad0[TCP_CACHELN - sizeof(void *) - sizeof(uint64_t)];
+    uint64_t head;
+    char pad1[TCP_CACHELN - sizeof(uint64_t)];
+    uint64_t tail;
+    char pad2[TCP_CACHELN - sizeof(uint64_t)];
+};
+
+int tcpringinit(struct tcpring *r, uint64_t n);
+void tcpringdestroy(struct tcpring *r);
+int tcpringpush(struct tcpring *r, void *data);
+int tcpringpop(struct tcpring *r, void **data);
+int tcpringpopsc(struct tcpring *r, void **data);
+
+#endif
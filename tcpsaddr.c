@@ -0,0 +1,343 @@
+/* tcpsaddr - Split host:port and [IPv6]:port addresses, one at a time or
+ * in bulk.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tcpsaddr.h"
+
+/* the longest string that can still be a valid address: a bracketed host,
+ * the colon and the port; tcpsplit never reads further */
+#define TCP_ADDRLN (TCP_HOSTLN + 2 + TCP_PORTLN)
+
+/* character classes of tcpsclass */
+enum {
+    TCP_CHOST = 1,
+    TCP_CDIGIT = 2
+};
+
+/* tcpsclass maps every byte to its classes. Unlike isalnum(3) and
+ * isdigit(3) it does not depend on the locale. */
+static const unsigned char tcpsclass[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#ifdef __SSE2__
+/* tcpshostmask returns a bit for every byte of v that is a valid hostname
+ * character: a letter, a digit, '.' or '-'. */
+static unsigned tcpshostmask(__m128i v)
+{
+    /* letters, folded to lower case */
+    __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+            _mm_set1_epi8('a'));
+    __m128i isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(25)), l);
+    /* '-', '.', '/' and the digits are contiguous; drop the '/' */
+    __m128i r = _mm_sub_epi8(v, _mm_set1_epi8('-'));
+    __m128i isr = _mm_cmpeq_epi8(_mm_min_epu8(r, _mm_set1_epi8(12)), r);
+    isr = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), isr);
+    return _mm_movemask_epi8(_mm_or_si128(isl, isr));
+}
+#endif
+
+/* tcpshost returns the index of the first byte of the n bytes of s that is
+ * not a hostname character, or n. */
+static int tcpshost(const char *s, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned stop = ~tcpshostmask(v) & 0xffff;
+        if(stop != 0) return i + __builtin_ctz(stop);
+    }
+#endif
+    while(i < n && tcpsclass[(unsigned char)s[i]] & TCP_CHOST) i++;
+    return i;
+}
+
+/* tcpsv6 validates the bracketed IPv6 address, with an optional %zone, at
+ * the start of the n bytes of s. It returns the index of the ':' that
+ * follows the closing bracket, or -1. */
+static int tcpsv6(const char *s, int n)
+{
+    const char *end = memchr(s, ']', n);
+    if(end == NULL) return -1;
+    int len = end - s - 1;
+    if(len < 2 || len >= TCP_HOSTLN || end[1] != ':') return -1;
+
+    char buf[TCP_HOSTLN];
+    memcpy(buf, s + 1, len);
+    buf[len] = '\0';
+    char *zone = memchr(buf, '%', len);
+    if(zone != NULL) {
+        int zlen = buf + len - zone - 1;
+        if(zlen == 0 || tcpshost(zone + 1, zlen) != zlen) return -1;
+        *zone = '\0';
+    }
+    struct in6_addr in6;
+    if(inet_pton(AF_INET6, buf, &in6) != 1) return -1;
+    return end + 1 - s;
+}
+
+/* tcpsport parses the port in the n bytes of s. It returns the port
+ * number, or -1 if s is empty, has a non-digit or is above 65535. */
+static int tcpsport(const char *s, int n)
+{
+    if(n < 1 || n > TCP_PORTLN - 1) return -1;
+    int port = 0;
+    for(int i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        if(!(tcpsclass[c] & TCP_CDIGIT)) return -1;
+        port = port * 10 + c - '0';
+    }
+    if(port > 65535) return -1;
+    return port;
+}
+
+/* tcpsplit: finds the host and the port of address addr[] and describes
+ * them in *sp without copying them. addr[] is either host:port, where the
+ * host has 1 to 253 of the characters a-zA-Z0-9 and {'.','-'} as
+ * specified by RFC 952, or [IPv6]:port, where IPv6 is any address
+ * inet_pton(3) accepts for AF_INET6 optionally followed by %zone. The
+ * port is a decimal number from 0 to 65535 of at most 5 digits.
+ *
+ * The host is classified 16 bytes at a time with SSE2 where available;
+ * the rest uses a lookup table.
+ *
+ * It returns 0 and sets sp->err to the same value if successfully split
+ * host and port.
+ * It returns TCP_INVH if the host is invalid.
+ * It returns TCP_INVP if the port is invalid.
+ *
+ * Example:
+ *
+ *     const char *addr = "[::1]:8080";
+ *     struct tcpsplit sp;
+ *     if(tcpsplit(&sp, addr) == 0) {
+ *         printf("%.*s %d\n", sp.hostlen, addr + sp.hostoff, sp.port);
+ *     }
+ */
+int tcpsplit(struct tcpsplit *sp, const char addr[])
+{
+    int n = strnlen(addr, TCP_ADDRLN);
+    int colon;
+    sp->port = -1;
+    if(addr[0] == '[') {
+        colon = tcpsv6(addr, n);
+        sp->hostoff = 1;
+        sp->hostlen = colon - 2;
+    } else {
+        colon = tcpshost(addr, n < TCP_HOSTLN ? n : TCP_HOSTLN);
+        if(colon == 0 || colon == TCP_HOSTLN || addr[colon] != ':') {
+            colon = -1;
+        }
+        sp->hostoff = 0;
+        sp->hostlen = colon;
+    }
+    if(colon == -1) {
+        sp->hostlen = 0;
+        return sp->err = TCP_INVH;
+    }
+
+    sp->port = tcpsport(addr + colon + 1, n - colon - 1);
+    if(sp->port == -1) return sp->err = TCP_INVP;
+    return sp->err = 0;
+}
+
+/* tcpsaddrv: splits the n addresses of addrs[] like tcpsplit and writes
+ * the results into sp[0] to sp[n-1]. Use it to validate large lists of
+ * endpoints; it does not copy anything.
+ *
+ * It returns the number of invalid addresses.
+ *
+ * Example:
+ *
+ *     char *addrs[] = { "localhost:8080", "[::1]:80", "bad" };
+ *     struct tcpsplit sp[3];
+ *     int nbad = tcpsaddrv(sp, addrs, 3);
+ *     // nbad == 1, sp[2].err == TCP_INVH
+ */
+int tcpsaddrv(struct tcpsplit sp[], char *addrs[], int n)
+{
+    int nbad = 0;
+    for(int i = 0; i < n; i++) {
+        /* the strings are usually scattered over the heap */
+        if(i + 8 < n) __builtin_prefetch(addrs[i+8]);
+        if(tcpsplit(&sp[i], addrs[i]) != 0) nbad++;
+    }
+    return nbad;
+}
+
+/* tcpsh: splits TCP hostname from the host:port address format and write to
+ * *host. The brackets of an [IPv6]:port address are not written.
+ * Valid ASCII character for hostname are a-zA-Z0-9 and {'.','-'} as specified
+ * by RFC 952. The maximum length of hostname are 253 ASCII characters.
+ *
+ * This function do not write more than TCP_HOSTLN bytes (including the
+ * terminating null byte ('\0')) to *host. The size of *host should equal
+ * to or greater than TCP_HOSTLN bytes.
+ *
+ * Upon successful return, this function return the index of the ':' that
+ * separates the host from the port, which is the number of bytes written
+ * to *host for a hostname. If the host is invalid or ':' character is not
+ * found in hostport[], -1 will be returned. */
+int tcpsh(char *host, char hostport[])
+{
+    struct tcpsplit sp;
+    if(tcpsplit(&sp, hostport) == TCP_INVH) {
+        host[0] = '\0';
+        return -1;
+    }
+    memcpy(host, hostport + sp.hostoff, sp.hostlen);
+    host[sp.hostlen] = '\0';
+    return sp.hostoff ? sp.hostlen + 2 : sp.hostlen;
+}
+
+/* tcpsp: splits port from the host:port format address and write to *port.
+ * This function will start reading the hostport[] from colon_i index until
+ * the null character.
+ * Since port is stored in 16-bit interger, valid port are only a 5 digit
+ * ASCII characters long, up to 65535.
+ * This function do not write more than TCP_PORTLN bytes (including the
+ * terminating null byte ('\0')) to *port. The length of *port should
+ * equal to or greater than TCP_PORTLN bytes.
+ * Upon successful return, this function returns the number of bytes that
+ * succesfully written to *port. If the port is invalid, -1 is returned */
+int tcpsp(char *port, int colon_i, char hostport[])
+{
+    port[0] = '\0';
+    /* handle invalid "host:" format */
+    if(hostport[colon_i] != ':') return -1;
+
+    char *p = hostport + colon_i + 1;
+    int n = strnlen(p, TCP_PORTLN);
+    if(tcpsport(p, n) == -1) return -1;
+    memcpy(port, p, n);
+    port[n] = '\0';
+    return n;
+}
+
+/* tcpsaddr: splits host and port from address addr[] and write to *host
+ * and *port.
+ *
+ * This function combine tcpsh() and tcpsp() functions. The size of *host
+ * and *port should equal to or greater than TCP_HOSTLN and TCP_PORTLN.
+ *
+ * It returns 0 if successfully split host and port.
+ * It returns TCP_INVH if the host is invalid.
+ * It returns TCP_INVP if the port is invalid.
+ */
+int tcpsaddr(char *host, char *port, char addr[])
+{
+    struct tcpsplit sp;
+    int err = tcpsplit(&sp, addr);
+    host[0] = '\0';
+    port[0] = '\0';
+    if(err != 0) return err;
+
+    memcpy(host, addr + sp.hostoff, sp.hostlen);
+    host[sp.hostlen] = '\0';
+    int colon = sp.hostoff ? sp.hostlen + 2 : sp.hostlen;
+    return tcpsp(port, colon, addr) == -1 ? TCP_INVP : 0;
+}
+
+/* tcpsunix: recognizes the Unix domain socket address addr[], which is
+ * TCP_UNIXPFX followed by a path, e.g. "unix:/run/echo.sock", or by '@'
+ * and a name in the Linux abstract namespace, e.g. "unix:@echo". The path
+ * or the name must have 1 to TCP_UNIXLN - 1 bytes.
+ *
+ * If sun is not NULL, the address is written into *sun and its length,
+ * for bind(2) and connect(2), into *len. An abstract name is not null
+ * terminated: its length is part of the address.
+ *
+ * It returns the length of the path or of the '@' and the name if addr[]
+ * is a valid Unix address, 0 if addr[] does not start with TCP_UNIXPFX,
+ * in which case it is a host for tcpsplit, and -1 if the path is empty or
+ * too long.
+ *
+ * Example:
+ *
+ *     struct sockaddr_un sun;
+ *     socklen_t len;
+ *     if(tcpsunix(&sun, &len, "unix:/tmp/echo.sock") > 0) {
+ *         connect(fd, (struct sockaddr *)&sun, len);
+ *     }
+ */
+int tcpsunix(struct sockaddr_un *sun, socklen_t *len, const char addr[])
+{
+    int pfxlen = sizeof TCP_UNIXPFX - 1;
+    if(addr == NULL || strncmp(addr, TCP_UNIXPFX, pfxlen) != 0) return 0;
+
+    const char *path = addr + pfxlen;
+    int n = strnlen(path, TCP_UNIXLN);
+    if(n == 0 || n == TCP_UNIXLN || (path[0] == '@' && n == 1)) return -1;
+    if(sun == NULL) return n;
+
+    memset(sun, 0, sizeof *sun);
+    sun->sun_family = AF_UNIX;
+    memcpy(sun->sun_path, path, n);
+    if(path[0] == '@') {
+        sun->sun_path[0] = '\0';
+        *len = offsetof(struct sockaddr_un, sun_path) + n;
+    } else {
+        *len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+    }
+    return n;
+}
@@ -0,0 +1,75 @@
+/* tcpsaddr - Split host:port and [IPv6]:port addresses, one at a time or
+ * in bulk.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPSADDR_H
+#define TCPSADDR_H
+
+#include <sys/socket.h>
+
+struct sockaddr_un;
+
+/* The maximum length of TCP hostname are 253 ASCII character; specified
+ * by RFC 952. */
+#define TCP_HOSTLN 254
+/* TCP port is stored in 16-bit integer, the maximum value is 65535; 5
+ * digit characters long. */
+#define TCP_PORTLN 6
+/* A Unix domain socket address is "unix:" followed by a file system path,
+ * or by '@' and a name in the Linux abstract namespace. The path must fit
+ * in sun_path of struct sockaddr_un with its terminating null byte. */
+#define TCP_UNIXPFX "unix:"
+#define TCP_UNIXLN 108
+
+/* results of tcpsaddr and tcpsplit */
+enum {
+    TCP_INVH = 1,
+    TCP_INVP
+};
+
+/* tcpsplit describes where the host and the port are in an address. The
+ * host is the hostlen bytes at hostoff; hostoff is 1 for a bracketed IPv6
+ * address. */
+struct tcpsplit {
+    int err;
+    int hostoff;
+    int hostlen;
+    int port;
+};
+
+int tcpsh(char *host, char hostport[]);
+int tcpsp(char *port, int colon_i, char hostport[]);
+int tcpsaddr(char *host, char *port, char addr[]);
+int tcpsplit(struct tcpsplit *sp, const char addr[]);
+int tcpsaddrv(struct tcpsplit sp[], char *addrs[], int n);
+int tcpsunix(struct sockaddr_un *sun, socklen_t *len, const char addr[]);
+
+#endif
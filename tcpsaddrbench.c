@@ -0,0 +1,207 @@
+/* tcpsaddrbench.c - Measure how fast the tcpsaddr module splits a large
+ * list of endpoints. It generates a mix of hostnames, IPv4 and bracketed
+ * IPv6 addresses and times the original character at a time splitter,
+ * tcpsaddr, which copies host and port out, and the tcpsaddrv batch call.
+ *
+ * Build:
+ * % make tcpsaddrbench
+ *
+ * Usage:
+ * % ./tcpsaddrbench
+ * % ./tcpsaddrbench -n 4000000 -r 5 -6 0
+ *
+ * Options:
+ * -n count  number of addresses (default: 1000000)
+ * -r runs   number of timed runs; the fastest is reported (default: 3)
+ * -6 pct    percentage of IPv6 addresses (default: 10); the original
+ *           splitter rejects them, which it does quickly
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcpsaddr.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* oldsaddr is the splitter tcpsaddr replaced, kept as the baseline. */
+static int oldsaddr(char *host, char *port, char addr[])
+{
+    int h = 0;
+    for(; addr[h] != '\0' && addr[h] != ':'; h++) {
+        char c = addr[h];
+        if(!(isalnum(c) || c == '-' || c == '.') || h >= TCP_HOSTLN - 1) {
+            host[0] = '\0';
+            return TCP_INVH;
+        }
+        host[h] = c;
+    }
+    if(h == 0 || addr[h] != ':') {
+        host[0] = '\0';
+        return TCP_INVH;
+    }
+    host[h] = '\0';
+
+    int p = 0;
+    for(int i = h + 1; addr[i] != '\0'; i++) {
+        if(!isdigit(addr[i]) || p >= TCP_PORTLN - 1) {
+            port[0] = '\0';
+            return TCP_INVP;
+        }
+        port[p++] = addr[i];
+    }
+    port[p] = '\0';
+    return p == 0 ? TCP_INVP : 0;
+}
+
+static char *genaddr(int v6pct)
+{
+    static const char *tld[] = { "com", "net", "internal", "svc.cluster" };
+    char buf[TCP_HOSTLN + 16];
+    int r = rand() % 100;
+    if(r < v6pct) {
+        sprintf(buf, "[2001:db8:%x:%x::%x]:%d", rand() & 0xffff,
+                rand() & 0xffff, rand() & 0xffff, rand() % 65536);
+    } else if(r < v6pct + (100 - v6pct) / 3) {
+        sprintf(buf, "10.%d.%d.%d:%d", rand() % 256, rand() % 256,
+                rand() % 256, rand() % 65536);
+    } else {
+        int n = sprintf(buf, "svc-%d", rand() % 100000);
+        for(int labels = rand() % 4; labels > 0; labels--) {
+            n += sprintf(buf + n, ".zone%d", rand() % 100);
+        }
+        sprintf(buf + n, ".%s:%d", tld[rand() % 4], rand() % 65536);
+    }
+    return strdup(buf);
+}
+
+static void report(const char *name, long count, double best, int nbad)
+{
+    printf("  %-10s %8.2f Maddr/s %8.1f ns/addr %8d invalid\n", name,
+            count / best / 1e6, best * 1e9 / count, nbad);
+}
+
+int main(int argc, char *argv[])
+{
+    long count = 1000000;
+    int runs = 3;
+    int v6pct = 10;
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:6:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case '6':
+                v6pct = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-r runs] [-6 pct]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(count <= 0 || runs <= 0 || v6pct < 0 || v6pct > 100) {
+        fprintf(stderr, "Invalid count, runs or pct\n");
+        return 1;
+    }
+
+    char **addrs = malloc(count * sizeof *addrs);
+    struct tcpsplit *sp = malloc(count * sizeof *sp);
+    if(addrs == NULL || sp == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1);
+    for(long i = 0; i < count; i++) {
+        if((addrs[i] = genaddr(v6pct)) == NULL) {
+            perror("strdup");
+            return 1;
+        }
+    }
+    printf("%ld addresses, %d%% IPv6\n", count, v6pct);
+
+    char host[TCP_HOSTLN];
+    char port[TCP_PORTLN];
+    double best = 0;
+    int nbad = 0;
+    for(int r = 0; r < runs; r++) {
+        double t0 = now();
+        nbad = 0;
+        for(long i = 0; i < count; i++) {
+            if(oldsaddr(host, port, addrs[i]) != 0) nbad++;
+        }
+        double d = now() - t0;
+        if(r == 0 || d < best) best = d;
+    }
+    report("original", count, best, nbad);
+
+    for(int r = 0; r < runs; r++) {
+        double t0 = now();
+        nbad = 0;
+        for(long i = 0; i < count; i++) {
+            if(tcpsaddr(host, port, addrs[i]) != 0) nbad++;
+        }
+        double d = now() - t0;
+        if(r == 0 || d < best) best = d;
+    }
+    report("tcpsaddr", count, best, nbad);
+
+    for(int r = 0; r < runs; r++) {
+        double t0 = now();
+        nbad = tcpsaddrv(sp, addrs, count);
+        double d = now() - t0;
+        if(r == 0 || d < best) best = d;
+    }
+    report("tcpsaddrv", count, best, nbad);
+
+    for(long i = 0; i < count; i++) free(addrs[i]);
+    free(addrs);
+    free(sp);
+    return 0;
+}
@@ -0,0 +1,263 @@
+/* tcpsaddrfuzz.c - Differential fuzzer for the tcpsaddr module. It feeds
+ * random and mutated addresses to tcpsplit, tcpsaddr and tcpsaddrv and
+ * compares every result with a plain, byte at a time reference parser.
+ * It stops at the first difference and prints the input.
+ *
+ * Build:
+ * % make tcpsaddrfuzz
+ *
+ * Usage:
+ * % ./tcpsaddrfuzz
+ * % ./tcpsaddrfuzz -n 100000000 -s 42
+ *
+ * Options:
+ * -n count  number of inputs (default: 10000000)
+ * -s seed   seed of the random generator (default: the current time)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tcpsaddr.h"
+
+/* the longest generated input; longer than any valid address */
+#define FUZZLN 300
+
+static uint64_t rng;
+
+static unsigned rnd(unsigned n)
+{
+    /* xorshift64* */
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (rng * 0x2545f4914f6cdd1dull >> 32) % n;
+}
+
+static int ishost(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '.' || c == '-';
+}
+
+/* refsplit is the reference: the grammar of tcpsplit written out one
+ * character at a time. */
+static int refsplit(struct tcpsplit *sp, const char *s)
+{
+    int colon;
+    sp->port = -1;
+    if(s[0] == '[') {
+        const char *end = strchr(s, ']');
+        int len = end == NULL ? 0 : end - s - 1;
+        char buf[FUZZLN + 1];
+        struct in6_addr in6;
+        colon = -1;
+        if(end != NULL && len >= 2 && len < TCP_HOSTLN && end[1] == ':') {
+            memcpy(buf, s + 1, len);
+            buf[len] = '\0';
+            char *zone = strchr(buf, '%');
+            int ok = 1;
+            if(zone != NULL) {
+                ok = zone[1] != '\0';
+                for(char *z = zone + 1; *z != '\0'; z++) ok &= ishost(*z);
+                *zone = '\0';
+            }
+            if(ok && inet_pton(AF_INET6, buf, &in6) == 1) colon = len + 2;
+        }
+        sp->hostoff = 1;
+        sp->hostlen = colon - 2;
+    } else {
+        int i = 0;
+        while(ishost(s[i])) i++;
+        colon = i > 0 && i < TCP_HOSTLN && s[i] == ':' ? i : -1;
+        sp->hostoff = 0;
+        sp->hostlen = colon;
+    }
+    if(colon == -1) {
+        sp->hostlen = 0;
+        return sp->err = TCP_INVH;
+    }
+
+    const char *p = s + colon + 1;
+    int n = strlen(p);
+    int port = 0;
+    int ok = n >= 1 && n <= 5;
+    for(int i = 0; ok && i < n; i++) {
+        ok = p[i] >= '0' && p[i] <= '9';
+        port = port * 10 + p[i] - '0';
+    }
+    if(!ok || port > 65535) return sp->err = TCP_INVP;
+    sp->port = port;
+    return sp->err = 0;
+}
+
+/* gen writes a random input into s: mostly almost-valid addresses, so
+ * that the fuzzer spends its time near the edges of the grammar. */
+static void gen(char *s)
+{
+    static const char alpha[] = "abcXYZ0189.-:[]%/ _@\x80\xff";
+    int n = 0;
+    switch(rnd(4)) {
+    case 0:
+        /* random bytes from the interesting alphabet */
+        n = rnd(40);
+        for(int i = 0; i < n; i++) s[i] = alpha[rnd(sizeof alpha - 1)];
+        break;
+    case 1: {
+        /* a hostname of any length around the limit */
+        int hl = rnd(4) == 0 ? 240 + rnd(20) : 1 + rnd(40);
+        for(; n < hl; n++) s[n] = "ab-.9"[rnd(5)];
+        n += sprintf(s + n, ":%u", rnd(4) == 0 ? rnd(200000) : rnd(65536));
+        break;
+    }
+    default: {
+        /* a bracketed IPv6 address */
+        unsigned char a[16];
+        for(int i = 0; i < 16; i++) a[i] = rnd(3) == 0 ? rnd(256) : 0;
+        s[n++] = '[';
+        inet_ntop(AF_INET6, a, s + n, INET6_ADDRSTRLEN);
+        n += strlen(s + n);
+        if(rnd(4) == 0) n += sprintf(s + n, "%%eth%u", rnd(10));
+        n += sprintf(s + n, "]:%u", rnd(70000));
+        break;
+    }
+    }
+    s[n] = '\0';
+
+    /* flip, drop or insert a few bytes */
+    for(int m = rnd(3); m > 0 && n > 0; m--) {
+        int at = rnd(n);
+        switch(rnd(3)) {
+        case 0:
+            s[at] = alpha[rnd(sizeof alpha - 1)];
+            break;
+        case 1:
+            memmove(s + at, s + at + 1, n - at);
+            n--;
+            break;
+        default:
+            if(n + 1 >= FUZZLN) break;
+            memmove(s + at + 1, s + at, n - at + 1);
+            s[at] = alpha[rnd(sizeof alpha - 1)];
+            n++;
+            break;
+        }
+    }
+}
+
+static void fail(const char *what, const char *s)
+{
+    fprintf(stderr, "%s differs for \"", what);
+    for(; *s != '\0'; s++) {
+        if(*s >= ' ' && *s < 127) fputc(*s, stderr);
+        else fprintf(stderr, "\\x%02x", (unsigned char)*s);
+    }
+    fprintf(stderr, "\"\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    long count = 10000000;
+    unsigned long seed = time(NULL);
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-s seed]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    rng = seed * 0x9e3779b97f4a7c15ull + 1;
+    printf("seed %lu\n", seed);
+
+    char *s = NULL;
+    long nvalid = 0;
+    for(long i = 0; i < count; i++) {
+        /* every input gets a buffer of its exact size so that any read
+         * past the null byte shows under a sanitizer */
+        char tmp[FUZZLN + 1];
+        gen(tmp);
+        size_t n = strlen(tmp);
+        free(s);
+        if((s = malloc(n + 1)) == NULL) {
+            perror("malloc");
+            return 1;
+        }
+        memcpy(s, tmp, n + 1);
+        char *batch[1] = { s };
+
+        struct tcpsplit want, got, gotv;
+        int err = refsplit(&want, s);
+        if(tcpsplit(&got, s) != err ||
+                memcmp(&got, &want, sizeof got) != 0) {
+            fail("tcpsplit", s);
+        }
+        if(tcpsaddrv(&gotv, batch, 1) != (err != 0) ||
+                memcmp(&gotv, &want, sizeof got) != 0) {
+            fail("tcpsaddrv", s);
+        }
+
+        char host[TCP_HOSTLN];
+        char port[TCP_PORTLN];
+        if(tcpsaddr(host, port, s) != err) fail("tcpsaddr", s);
+        if(err == 0) {
+            nvalid++;
+            if((int)strlen(host) != want.hostlen ||
+                    memcmp(host, s + want.hostoff, want.hostlen) != 0 ||
+                    atoi(port) != want.port) {
+                fail("tcpsaddr output", s);
+            }
+        }
+    }
+    free(s);
+    printf("%ld inputs, %ld valid, no differences\n", count, nvalid);
+    return 0;
+}
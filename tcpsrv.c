@@ -0,0 +1,338 @@
+/* tcpsrv - A sharded TCP server for the tcp module. Every worker thread is
+ * pinned to a CPU and owns its listener, event loop and connection state.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces used to pin the workers, such as pthread_setaffinity_np(3). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "tcp.h"
+#include "tcpsaddr.h"
+#include "tcpsrv.h"
+
+/* tcpsrvaccept accepts every pending connection on the worker listener and
+ * hands them to the accept callback of the server.
+ *
+ * The listener is edge-triggered, so it must drain the accept queue even
+ * when the process or the system is out of file descriptors. It then
+ * closes the spare descriptor of the worker, accepts and closes the
+ * pending connection and reopens the spare, so the peer sees the close
+ * instead of waiting for a connection that is not served.
+ */
+static void tcpsrvaccept(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct tcpshard *sh = (struct tcpshard *)
+        ((char *)ev - offsetof(struct tcpshard, ln));
+
+    if(sh->spare == -1) sh->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    for(;;) {
+        int conn;
+        int erraccept = tcpacceptacl(&conn, ev->fd, TCP_NONBLOCK,
+                sh->srv->cfg.acl);
+        if(erraccept == EINTR || erraccept == ECONNABORTED ||
+                erraccept == EACCES) {
+            continue;
+        }
+        if((erraccept == EMFILE || erraccept == ENFILE) && sh->spare != -1) {
+            /* accept fails with EMFILE even when the queue is empty, so
+             * the queue is drained once this accept finds nothing */
+            close(sh->spare);
+            conn = accept(ev->fd, NULL, NULL);
+            if(conn != -1) close(conn);
+            sh->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if(conn == -1) return;
+            continue;
+        }
+        if(erraccept != 0) return;
+        sh->srv->cfg.accept(sh, conn);
+    }
+}
+
+/* tcpsrvsteer attaches a classic BPF program to the SO_REUSEPORT group that
+ * selects the listener by the CPU that received the connection. The
+ * connection is then accepted and served by the worker pinned to that CPU,
+ * so the softirq and the application run on the same core. */
+static void tcpsrvsteer(int ln, int nshards)
+{
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, nshards },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog = { sizeof code / sizeof code[0], code };
+
+    /* the steering is an optimization, the kernel hash is used if it
+     * cannot be attached */
+    setsockopt(ln, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+}
+
+static void *tcpsrvworker(void *arg)
+{
+    struct tcpshard *sh = arg;
+    struct tcpsrv *srv = sh->srv;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(sh->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+
+    if(srv->cfg.init != NULL) srv->cfg.init(sh);
+
+    intptr_t err = tcploopadd(sh->loop, &sh->ln, TCP_EVIN);
+    /* a handoff may have raced with the registration */
+    if(__atomic_load_n(&srv->handedoff, __ATOMIC_SEQ_CST)) {
+        tcploopdel(sh->loop, &sh->ln);
+    }
+    if(err == 0) err = tcplooprun(sh->loop);
+
+    if(srv->cfg.fini != NULL) srv->cfg.fini(sh);
+    return (void *)err;
+}
+
+/* tcpsrvnew creates a sharded server described by cfg and write it into
+ * *srv. One SO_REUSEPORT listener and one event loop are created for every
+ * worker; the workers are started by tcpsrvrun.
+ *
+ * Worker i is pinned to the i-th CPU the process may run on, wrapping
+ * around when there are more workers than CPUs.
+ *
+ * If cfg->host is a Unix domain socket address, which cannot be bound more
+ * than once, a single listener is created and every worker polls its own
+ * duplicate of it; whichever worker wakes first accepts.
+ *
+ * If the process was started by tcpsrvhandoff, the listeners of the old
+ * process are taken over with tcpinherit instead of bound, and there is
+ * one worker for each of them whatever cfg->nshards says.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to ENOMEM, EINVAL or one of the errors of open(2) or
+ * tcplisten.
+ */
+int tcpsrvnew(struct tcpsrv **srv, struct tcpsrvcfg *cfg)
+{
+    if(cfg->accept == NULL || cfg->nshards < 0) {
+        errno = EINVAL;
+        return errno;
+    }
+
+    int inherited[CPU_SETSIZE];
+    int ninherited;
+    int err = tcpinherit(inherited, CPU_SETSIZE, &ninherited);
+    if(err != 0) return err;
+
+    /* list the CPUs the process is allowed to run on */
+    cpu_set_t set;
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    if(sched_getaffinity(0, sizeof set, &set) == 0) {
+        for(int c = 0; c < CPU_SETSIZE; c++) {
+            if(CPU_ISSET(c, &set)) cpus[ncpus++] = c;
+        }
+    }
+    if(ncpus == 0) cpus[ncpus++] = 0;
+
+    struct tcpsrv *s = malloc(sizeof *s);
+    if(s == NULL) {
+        for(int i = 0; i < ninherited; i++) close(inherited[i]);
+        errno = ENOMEM;
+        return errno;
+    }
+    s->cfg = *cfg;
+    s->nshards = cfg->nshards > 0 ? cfg->nshards : ncpus;
+    if(ninherited > 0) s->nshards = ninherited;
+    s->handedoff = 0;
+    s->shards = calloc(s->nshards, sizeof *s->shards);
+    if(s->shards == NULL) {
+        for(int i = 0; i < ninherited; i++) close(inherited[i]);
+        free(s);
+        errno = ENOMEM;
+        return errno;
+    }
+    for(int i = 0; i < s->nshards; i++) {
+        s->shards[i].ln.fd = i < ninherited ? inherited[i] : -1;
+        s->shards[i].spare = -1;
+    }
+
+    int unixln = tcpsunix(NULL, NULL, cfg->host) != 0;
+    /* inherited listeners keep the program of their group */
+    int steer = s->nshards == ncpus && !unixln && ninherited == 0;
+    for(int i = 0; i < s->nshards; i++) {
+        struct tcpshard *sh = &s->shards[i];
+        sh->id = i;
+        sh->cpu = cpus[i % ncpus];
+        sh->srv = s;
+        sh->data = cfg->data;
+        sh->ln.fn = tcpsrvaccept;
+        if(sh->cpu != i) steer = 0;
+
+        sh->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if(sh->spare == -1) {
+            err = errno;
+            break;
+        }
+        err = tcploopnew(&sh->loop);
+        if(err != 0) break;
+        if(sh->ln.fd != -1) {
+            int fl = fcntl(sh->ln.fd, F_GETFL);
+            if(fl == -1 || fcntl(sh->ln.fd, F_SETFL, fl | O_NONBLOCK) == -1) {
+                err = errno;
+                break;
+            }
+            continue;
+        }
+        if(unixln && i > 0) {
+            sh->ln.fd = fcntl(s->shards[0].ln.fd, F_DUPFD_CLOEXEC, 0);
+            if(sh->ln.fd == -1) {
+                err = errno;
+                break;
+            }
+            continue;
+        }
+        err = tcplisten(&sh->ln.fd, cfg->host, cfg->port,
+                TCP_NONBLOCK | TCP_REUSEPORT);
+        if(err != 0) break;
+    }
+    if(err != 0) {
+        tcpsrvfree(s);
+        errno = err;
+        return errno;
+    }
+
+    /* listeners are indexed in the group in the order they were bound, so
+     * CPU c maps to listener c only when worker i runs on CPU i */
+    if(steer && s->nshards > 1) tcpsrvsteer(s->shards[0].ln.fd, s->nshards);
+
+    *srv = s;
+    return 0;
+}
+
+/* tcpsrvrun starts the workers and waits until all of them stop. Once
+ * they are started, it reports with tcpready to the process that handed
+ * its listeners over, if any, that this one accepts now.
+ *
+ * It returns 0 when the server was stopped by tcpsrvstop, or the first
+ * error reported by a worker event loop or by pthread_create(3).
+ */
+int tcpsrvrun(struct tcpsrv *srv)
+{
+    int err = 0;
+    int started = 0;
+    for(; started < srv->nshards; started++) {
+        struct tcpshard *sh = &srv->shards[started];
+        err = pthread_create(&sh->thread, NULL, tcpsrvworker, sh);
+        if(err != 0) {
+            tcpsrvstop(srv);
+            break;
+        }
+    }
+    if(err == 0) tcpready();
+
+    for(int i = 0; i < started; i++) {
+        void *ret;
+        pthread_join(srv->shards[i].thread, &ret);
+        if(err == 0 && ret != NULL) err = (int)(intptr_t)ret;
+    }
+
+    errno = err;
+    return err;
+}
+
+/* tcpsrvstop stops every worker. It is safe to call from a signal
+ * handler. */
+void tcpsrvstop(struct tcpsrv *srv)
+{
+    for(int i = 0; i < srv->nshards; i++) {
+        if(srv->shards[i].loop != NULL) tcploopstop(srv->shards[i].loop);
+    }
+}
+
+/* tcpsrvhandoff restarts the server without refusing a connection: it
+ * starts the program argv[0] with the arguments argv, which must create
+ * its server with tcpsrvnew, and hands it the listeners with tcphandoff.
+ * Once the new process runs, the workers of this one stop accepting, the
+ * connections queued on the listeners are left to the new one, and the
+ * caller should finish its own connections, e.g. within a deadline, then
+ * call tcpsrvstop. The listeners stay open until tcpsrvfree.
+ *
+ * It may be called from any thread while tcpsrv runs. If the function
+ * succeeds it returns 0. Otherwise it returns and set errno to one of the
+ * errors of tcphandoff, and the server keeps accepting.
+ */
+int tcpsrvhandoff(struct tcpsrv *srv, char *argv[], int timeoutms)
+{
+    int *fds = malloc(srv->nshards * sizeof *fds);
+    if(fds == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    for(int i = 0; i < srv->nshards; i++) fds[i] = srv->shards[i].ln.fd;
+    pid_t pid;
+    int err = tcphandoff(&pid, argv, fds, srv->nshards, timeoutms);
+    free(fds);
+    if(err != 0) {
+        errno = err;
+        return errno;
+    }
+
+    /* epoll_ctl(2) may be called while another thread waits on the same
+     * epoll instance */
+    __atomic_store_n(&srv->handedoff, 1, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < srv->nshards; i++) {
+        tcploopdel(srv->shards[i].loop, &srv->shards[i].ln);
+    }
+    return 0;
+}
+
+/* tcpsrvfree closes the listeners and the spare descriptors and releases
+ * the server. The workers must have been stopped. */
+void tcpsrvfree(struct tcpsrv *srv)
+{
+    for(int i = 0; i < srv->nshards; i++) {
+        struct tcpshard *sh = &srv->shards[i];
+        if(sh->ln.fd != -1) close(sh->ln.fd);
+        if(sh->spare != -1) close(sh->spare);
+        if(sh->loop != NULL) tcploopfree(sh->loop);
+    }
+    free(srv->shards);
+    free(srv);
+}
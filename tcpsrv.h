@@ -0,0 +1,94 @@
+/* tcpsrv - A sharded TCP server for the tcp module. Every worker thread is
+ * pinned to a CPU and owns its listener, event loop and connection state.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPSRV_H
+#define TCPSRV_H
+
+#include <pthread.h>
+
+#include "tcploop.h"
+
+struct tcpsrv;
+struct tcpshard;
+struct tcpacl;
+
+typedef void tcpshardfn(struct tcpshard *sh);
+typedef void tcpacceptfn(struct tcpshard *sh, int conn);
+
+/* tcpshard is the state owned by a single worker thread. Nothing in it is
+ * shared with the other workers. */
+struct tcpshard {
+    int id;
+    int cpu;
+    struct tcpsrv *srv;
+    struct tcploop *loop;
+    /* the SO_REUSEPORT listener of this worker, or a duplicate of the
+     * shared listener of a Unix domain socket address */
+    struct tcpev ln;
+    /* a descriptor kept open to be released when accept fails with EMFILE
+     * or ENFILE, so the pending connection can still be taken and closed */
+    int spare;
+    /* the caller's per-worker state, e.g. the connection table */
+    void *data;
+    pthread_t thread;
+};
+
+/* tcpsrvcfg describes the server. init and fini are optional and run in the
+ * worker thread before and after its event loop. */
+struct tcpsrvcfg {
+    char *host;
+    char *port;
+    /* the number of workers, 0 means one per available CPU */
+    int nshards;
+    tcpacceptfn *accept;
+    tcpshardfn *init;
+    tcpshardfn *fini;
+    void *data;
+    /* if not NULL, connections from peers it denies are reset before
+     * accept runs; it may be reloaded while the server runs */
+    struct tcpacl *acl;
+};
+
+struct tcpsrv {
+    struct tcpsrvcfg cfg;
+    int nshards;
+    struct tcpshard *shards;
+    /* set once the listeners were handed to a new process */
+    int handedoff;
+};
+
+int tcpsrvnew(struct tcpsrv **srv, struct tcpsrvcfg *cfg);
+int tcpsrvrun(struct tcpsrv *srv);
+void tcpsrvstop(struct tcpsrv *srv);
+int tcpsrvhandoff(struct tcpsrv *srv, char *argv[], int timeoutms);
+void tcpsrvfree(struct tcpsrv *srv);
+
+#endif
@@ -0,0 +1,502 @@
+/* tcpstat - Counters of the tcp module and TCP_INFO samples of single
+ * connections, exported as Prometheus text or JSON.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the POSIX.1-2008
+ * interfaces and strerrorname_np(3). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcpstat.h"
+
+/* Every thread counts into its own slot, so the hot paths never share a
+ * cache line or take a lock. The slots form a list that only grows; the
+ * slot of a thread that exits is handed to the next new thread, which
+ * keeps adding to its totals. */
+struct tcpstatslot {
+    struct tcpstats s;
+    struct tcpstatslot *next;
+    int used;
+};
+
+static const char *tcpstatops[TCP_STATOPS] = { "dial", "read", "write" };
+
+static struct tcpstatslot *tcpstatslots;
+static __thread struct tcpstatslot *tcpstatmine;
+static pthread_key_t tcpstatkey;
+static pthread_once_t tcpstatonce = PTHREAD_ONCE_INIT;
+
+/* the state of the periodic dump of tcpstatstart */
+static pthread_mutex_t tcpstatmu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcpstatcond = PTHREAD_COND_INITIALIZER;
+static pthread_t tcpstatthread;
+static int tcpstatrunning;
+static int tcpstatstopping;
+
+static void tcpstatrelease(void *arg)
+{
+    struct tcpstatslot *slot = arg;
+    __atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+}
+
+static void tcpstatinit(void)
+{
+    pthread_key_create(&tcpstatkey, tcpstatrelease);
+}
+
+/* tcpstatslot returns the slot of the calling thread, or NULL if none
+ * could be allocated. It leaves errno alone, since the callers record
+ * errors before they look at errno themselves. */
+static struct tcpstatslot *tcpstatslot(void)
+{
+    if(tcpstatmine != NULL) return tcpstatmine;
+    int saved = errno;
+    pthread_once(&tcpstatonce, tcpstatinit);
+
+    struct tcpstatslot *slot;
+    for(slot = __atomic_load_n(&tcpstatslots, __ATOMIC_ACQUIRE);
+            slot != NULL; slot = slot->next) {
+        int unused = 0;
+        if(__atomic_compare_exchange_n(&slot->used, &unused, 1, 0,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if(slot == NULL) {
+        slot = calloc(1, sizeof *slot);
+        if(slot == NULL) {
+            errno = saved;
+            return NULL;
+        }
+        slot->used = 1;
+        slot->next = __atomic_load_n(&tcpstatslots, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&tcpstatslots, &slot->next, slot,
+                    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(tcpstatkey, slot);
+    tcpstatmine = slot;
+    errno = saved;
+    return slot;
+}
+
+/* tcpstatadd adds n to a counter of the calling thread's slot. Only the
+ * owner writes a slot, so a plain load and store suffice; they are atomic
+ * so that tcpstatsnap never reads a torn value. */
+static void tcpstatadd(uint64_t *c, uint64_t n)
+{
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n,
+            __ATOMIC_RELAXED);
+}
+
+static void tcpstaterr(struct tcpstats *s, int op, int err)
+{
+    if(err < 0 || err >= TCP_STATERRNO) err = 0;
+    tcpstatadd(&s->errs[op][err], 1);
+}
+
+/* tcpstatdial records a dial that took ns nanoseconds and ended with the
+ * errno value err, or 0. tcpdial and tcpdialdl call it. */
+void tcpstatdial(int64_t ns, int err)
+{
+    struct tcpstatslot *slot = tcpstatslot();
+    if(slot == NULL) return;
+    if(err != 0) {
+        tcpstaterr(&slot->s, TCP_STATDIAL, err);
+        return;
+    }
+
+    uint64_t us = ns / 1000;
+    int b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if(b >= TCP_STATBUCKETS) b = TCP_STATBUCKETS - 1;
+    tcpstatadd(&slot->s.dials, 1);
+    tcpstatadd(&slot->s.dialns, ns);
+    tcpstatadd(&slot->s.dialhist[b], 1);
+}
+
+/* tcpstatio records a read or a write, op TCP_STATREAD or TCP_STATWRITE,
+ * that moved n bytes, or failed with the errno value err if n is -1. The
+ * buffered readers and writers of tcpbuf call it. */
+void tcpstatio(int op, ssize_t n, int err)
+{
+    struct tcpstatslot *slot = tcpstatslot();
+    if(slot == NULL) return;
+    if(n >= 0) {
+        tcpstatadd(op == TCP_STATREAD ? &slot->s.bytesin :
+                &slot->s.bytesout, n);
+    } else if(err == EAGAIN || err == EWOULDBLOCK) {
+        tcpstatadd(&slot->s.eagain[op], 1);
+    } else {
+        tcpstaterr(&slot->s, op, err);
+    }
+}
+
+/* tcpstatsnap writes into *s the sum of the counters of all threads. The
+ * counters are read without stopping the threads, so the sum is not an
+ * atomic snapshot, but no counter ever goes backwards. */
+void tcpstatsnap(struct tcpstats *s)
+{
+    memset(s, 0, sizeof *s);
+    uint64_t *dst = (uint64_t *)s;
+    size_t n = sizeof *s / sizeof *dst;
+    for(struct tcpstatslot *slot = __atomic_load_n(&tcpstatslots,
+                __ATOMIC_ACQUIRE); slot != NULL; slot = slot->next) {
+        uint64_t *src = (uint64_t *)&slot->s;
+        for(size_t i = 0; i < n; i++) {
+            dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* tcpstatconn samples getsockopt(2) TCP_INFO of the connection conn and
+ * write it into *cs.
+ *
+ * It returns 0 or an errno value of getsockopt(2), such as ENOTSOCK or
+ * EOPNOTSUPP for a socket that is not TCP.
+ *
+ * Example:
+ *
+ *     struct tcpconnstat cs;
+ *     if(tcpstatconn(conn, &cs) == 0) {
+ *         printf("rtt %u us, cwnd %u\n", cs.rttus, cs.cwnd);
+ *     }
+ */
+int tcpstatconn(int conn, struct tcpconnstat *cs)
+{
+    /* older kernels fill only a prefix of the structure */
+    struct tcp_info ti;
+    socklen_t len = sizeof ti;
+    memset(&ti, 0, sizeof ti);
+    if(getsockopt(conn, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return errno;
+    }
+
+    cs->state = ti.tcpi_state;
+    cs->rttus = ti.tcpi_rtt;
+    cs->rttvarus = ti.tcpi_rttvar;
+    cs->minrttus = ti.tcpi_min_rtt;
+    cs->cwnd = ti.tcpi_snd_cwnd;
+    cs->mss = ti.tcpi_snd_mss;
+    cs->retransmits = ti.tcpi_retransmits;
+    cs->totalretrans = ti.tcpi_total_retrans;
+    cs->lost = ti.tcpi_lost;
+    cs->deliveryrate = ti.tcpi_delivery_rate;
+    cs->bytesacked = ti.tcpi_bytes_acked;
+    cs->bytesreceived = ti.tcpi_bytes_received;
+    return 0;
+}
+
+static const char *tcpstaterrname(int err, char buf[16])
+{
+    const char *name = err == 0 ? "other" : strerrorname_np(err);
+    if(name == NULL) {
+        snprintf(buf, 16, "%d", err);
+        name = buf;
+    }
+    return name;
+}
+
+static void tcpstatprom(FILE *f, struct tcpstats *s)
+{
+    fprintf(f, "# HELP tcp_dial_seconds Time to establish outgoing "
+            "connections.\n# TYPE tcp_dial_seconds histogram\n");
+    uint64_t cum = 0;
+    for(int b = 0; b < TCP_STATBUCKETS - 1; b++) {
+        cum += s->dialhist[b];
+        fprintf(f, "tcp_dial_seconds_bucket{le=\"%.9g\"} %llu\n",
+                (double)(1ull << b) / 1e6, (unsigned long long)cum);
+    }
+    fprintf(f, "tcp_dial_seconds_bucket{le=\"+Inf\"} %llu\n",
+            (unsigned long long)s->dials);
+    fprintf(f, "tcp_dial_seconds_sum %.9f\n", s->dialns / 1e9);
+    fprintf(f, "tcp_dial_seconds_count %llu\n",
+            (unsigned long long)s->dials);
+
+    fprintf(f, "# HELP tcp_bytes_total Bytes moved by the buffered "
+            "readers and writers.\n# TYPE tcp_bytes_total counter\n");
+    fprintf(f, "tcp_bytes_total{dir=\"in\"} %llu\n",
+            (unsigned long long)s->bytesin);
+    fprintf(f, "tcp_bytes_total{dir=\"out\"} %llu\n",
+            (unsigned long long)s->bytesout);
+
+    fprintf(f, "# HELP tcp_eagain_total Operations that would have "
+            "blocked.\n# TYPE tcp_eagain_total counter\n");
+    for(int op = TCP_STATREAD; op < TCP_STATOPS; op++) {
+        fprintf(f, "tcp_eagain_total{op=\"%s\"} %llu\n", tcpstatops[op],
+                (unsigned long long)s->eagain[op]);
+    }
+
+    fprintf(f, "# HELP tcp_errors_total Failed operations by errno.\n"
+            "# TYPE tcp_errors_total counter\n");
+    for(int op = 0; op < TCP_STATOPS; op++) {
+        for(int err = 0; err < TCP_STATERRNO; err++) {
+            if(s->errs[op][err] == 0) continue;
+            char buf[16];
+            fprintf(f, "tcp_errors_total{op=\"%s\",errno=\"%s\"} %llu\n",
+                    tcpstatops[op], tcpstaterrname(err, buf),
+                    (unsigned long long)s->errs[op][err]);
+        }
+    }
+}
+
+static void tcpstatjson(FILE *f, struct tcpstats *s)
+{
+    fprintf(f, "{\"dial\":{\"count\":%llu,\"sum_seconds\":%.9f,"
+            "\"buckets_us\":[", (unsigned long long)s->dials,
+            s->dialns / 1e9);
+    for(int b = 0; b < TCP_STATBUCKETS; b++) {
+        fprintf(f, "%s%llu", b > 0 ? "," : "",
+                (unsigned long long)s->dialhist[b]);
+    }
+    fprintf(f, "]},\"bytes_in\":%llu,\"bytes_out\":%llu,\"eagain\":{",
+            (unsigned long long)s->bytesin, (unsigned long long)s->bytesout);
+    for(int op = TCP_STATREAD; op < TCP_STATOPS; op++) {
+        fprintf(f, "%s\"%s\":%llu", op > TCP_STATREAD ? "," : "",
+                tcpstatops[op], (unsigned long long)s->eagain[op]);
+    }
+    fprintf(f, "},\"errors\":{");
+    for(int op = 0; op < TCP_STATOPS; op++) {
+        fprintf(f, "%s\"%s\":{", op > 0 ? "," : "", tcpstatops[op]);
+        int first = 1;
+        for(int err = 0; err < TCP_STATERRNO; err++) {
+            if(s->errs[op][err] == 0) continue;
+            char buf[16];
+            fprintf(f, "%s\"%s\":%llu", first ? "" : ",",
+                    tcpstaterrname(err, buf),
+                    (unsigned long long)s->errs[op][err]);
+            first = 0;
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "}}\n");
+}
+
+/* tcpstatwrite writes the n bytes of buf to fd. */
+static int tcpstatwrite(int fd, const char *buf, size_t n)
+{
+    while(n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if(w == -1) {
+            if(errno == EINTR) continue;
+            return errno;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* tcpstatdump writes the counters of all threads to fd, as Prometheus text
+ * exposition if fmt is TCP_STATPROM or as one line of JSON if fmt is
+ * TCP_STATJSON. The whole dump is formatted first and written at once.
+ *
+ * It returns 0, ENOMEM or an errno value of write(2).
+ *
+ * Example:
+ *
+ *     tcpstatdump(STDERR_FILENO, TCP_STATPROM);
+ */
+int tcpstatdump(int fd, int fmt)
+{
+    struct tcpstats *s = malloc(sizeof *s);
+    char *buf = NULL;
+    size_t n = 0;
+    FILE *f = s != NULL ? open_memstream(&buf, &n) : NULL;
+    if(f == NULL) {
+        free(s);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    tcpstatsnap(s);
+    if(fmt == TCP_STATJSON) {
+        tcpstatjson(f, s);
+    } else {
+        tcpstatprom(f, s);
+    }
+    free(s);
+    if(fclose(f) != 0) {
+        free(buf);
+        errno = ENOMEM;
+        return errno;
+    }
+    errno = tcpstatwrite(fd, buf, n);
+    free(buf);
+    return errno;
+}
+
+/* tcpstatdumpconn writes the sample *cs of the connection called name to
+ * fd in the format fmt, like tcpstatdump. In Prometheus text every value
+ * is a gauge labelled with conn="name"; name must not need escaping.
+ *
+ * It returns 0, ENOMEM or an errno value of write(2).
+ */
+int tcpstatdumpconn(int fd, int fmt, const char *name,
+        struct tcpconnstat *cs)
+{
+    static const char *const names[] = {
+        "state", "rtt_us", "rttvar_us", "min_rtt_us", "cwnd", "mss",
+        "retransmits", "total_retrans", "lost", "delivery_rate_bytes",
+        "bytes_acked", "bytes_received"
+    };
+    unsigned long long v[] = {
+        cs->state, cs->rttus, cs->rttvarus, cs->minrttus, cs->cwnd,
+        cs->mss, cs->retransmits, cs->totalretrans, cs->lost,
+        cs->deliveryrate, cs->bytesacked, cs->bytesreceived
+    };
+    int nv = sizeof v / sizeof v[0];
+
+    char *buf = NULL;
+    size_t n = 0;
+    FILE *f = open_memstream(&buf, &n);
+    if(f == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    if(fmt == TCP_STATJSON) {
+        fprintf(f, "{\"conn\":\"%s\"", name);
+        for(int i = 0; i < nv; i++) fprintf(f, ",\"%s\":%llu", names[i], v[i]);
+        fprintf(f, "}\n");
+    } else {
+        for(int i = 0; i < nv; i++) {
+            fprintf(f, "tcp_conn_%s{conn=\"%s\"} %llu\n", names[i], name,
+                    v[i]);
+        }
+    }
+    if(fclose(f) != 0) {
+        free(buf);
+        errno = ENOMEM;
+        return errno;
+    }
+    errno = tcpstatwrite(fd, buf, n);
+    free(buf);
+    return errno;
+}
+
+struct tcpstattimer {
+    int fd;
+    int fmt;
+    int ms;
+};
+
+static void *tcpstatloop(void *arg)
+{
+    struct tcpstattimer t = *(struct tcpstattimer *)arg;
+    free(arg);
+
+    pthread_mutex_lock(&tcpstatmu);
+    struct timespec next;
+    clock_gettime(CLOCK_REALTIME, &next);
+    while(!tcpstatstopping) {
+        next.tv_sec += t.ms / 1000;
+        next.tv_nsec += (long)(t.ms % 1000) * 1000000;
+        if(next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        while(!tcpstatstopping && pthread_cond_timedwait(&tcpstatcond,
+                    &tcpstatmu, &next) != ETIMEDOUT) {
+        }
+        if(tcpstatstopping) break;
+        pthread_mutex_unlock(&tcpstatmu);
+        tcpstatdump(t.fd, t.fmt);
+        pthread_mutex_lock(&tcpstatmu);
+    }
+    pthread_mutex_unlock(&tcpstatmu);
+    return NULL;
+}
+
+/* tcpstatstart starts a thread that calls tcpstatdump(fd, fmt) every ms
+ * milliseconds until tcpstatstop. Only one such thread runs at a time.
+ *
+ * It returns 0, EBUSY if the thread already runs, EINVAL if ms is not
+ * positive, or an errno value of pthread_create(3).
+ *
+ * Example:
+ *
+ *     tcpstatstart(STDERR_FILENO, TCP_STATJSON, 10000);
+ */
+int tcpstatstart(int fd, int fmt, int ms)
+{
+    if(ms <= 0) {
+        errno = EINVAL;
+        return errno;
+    }
+    struct tcpstattimer *t = malloc(sizeof *t);
+    if(t == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    t->fd = fd;
+    t->fmt = fmt;
+    t->ms = ms;
+
+    pthread_mutex_lock(&tcpstatmu);
+    int err = EBUSY;
+    if(!tcpstatrunning) {
+        tcpstatstopping = 0;
+        err = pthread_create(&tcpstatthread, NULL, tcpstatloop, t);
+        if(err == 0) tcpstatrunning = 1;
+    }
+    pthread_mutex_unlock(&tcpstatmu);
+    if(err != 0) free(t);
+    errno = err;
+    return errno;
+}
+
+/* tcpstatstop stops the thread of tcpstatstart and waits for it. */
+void tcpstatstop(void)
+{
+    pthread_mutex_lock(&tcpstatmu);
+    if(!tcpstatrunning) {
+        pthread_mutex_unlock(&tcpstatmu);
+        return;
+    }
+    tcpstatstopping = 1;
+    pthread_cond_signal(&tcpstatcond);
+    pthread_mutex_unlock(&tcpstatmu);
+    pthread_join(tcpstatthread, NULL);
+
+    pthread_mutex_lock(&tcpstatmu);
+    tcpstatrunning = 0;
+    pthread_mutex_unlock(&tcpstatmu);
+}
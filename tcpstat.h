@@ -0,0 +1,97 @@
+/* tcpstat - Counters of the tcp module and TCP_INFO samples of single
+ * connections, exported as Prometheus text or JSON.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPSTAT_H
+#define TCPSTAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* the operations counted by tcpstat */
+enum {
+    TCP_STATDIAL,
+    TCP_STATREAD,
+    TCP_STATWRITE,
+    TCP_STATOPS
+};
+
+/* dump formats */
+enum {
+    TCP_STATPROM,
+    TCP_STATJSON
+};
+
+/* the number of buckets of the dial latency histogram; bucket i counts the
+ * dials that took less than 2^i microseconds, the last one all others */
+#define TCP_STATBUCKETS 24
+/* errno values at or above TCP_STATERRNO are counted in bucket 0 */
+#define TCP_STATERRNO 136
+
+struct tcpstats {
+    uint64_t dials;
+    uint64_t dialns;
+    uint64_t dialhist[TCP_STATBUCKETS];
+    uint64_t bytesin;
+    uint64_t bytesout;
+    uint64_t eagain[TCP_STATOPS];
+    uint64_t errs[TCP_STATOPS][TCP_STATERRNO];
+};
+
+/* tcpconnstat is a TCP_INFO sample of one connection. Times are in
+ * microseconds, the delivery rate in bytes per second. Fields the kernel
+ * does not report are 0. */
+struct tcpconnstat {
+    uint32_t state;
+    uint32_t rttus;
+    uint32_t rttvarus;
+    uint32_t minrttus;
+    uint32_t cwnd;
+    uint32_t mss;
+    uint32_t retransmits;
+    uint32_t totalretrans;
+    uint32_t lost;
+    uint64_t deliveryrate;
+    uint64_t bytesacked;
+    uint64_t bytesreceived;
+};
+
+void tcpstatdial(int64_t ns, int err);
+void tcpstatio(int op, ssize_t n, int err);
+void tcpstatsnap(struct tcpstats *s);
+int tcpstatconn(int conn, struct tcpconnstat *cs);
+int tcpstatdump(int fd, int fmt);
+int tcpstatdumpconn(int fd, int fmt, const char *name,
+        struct tcpconnstat *cs);
+int tcpstatstart(int fd, int fmt, int ms);
+void tcpstatstop(void);
+
+#endif
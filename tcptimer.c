@@ -0,0 +1,259 @@
+/* tcptimer - A hierarchical timing wheel for connection deadlines and idle
+ * timeouts.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcptimer.h"
+
+#define TCP_WHEELMASK (TCP_WHEELSLOTS - 1)
+/* the longest delay the wheel can hold; later timers are parked in the
+ * last level and placed again when they get there */
+#define TCP_WHEELMAX ((UINT64_C(1) << TCP_WHEELBITS * TCP_WHEELLEVELS) - 1)
+
+static void tcpwheellink(struct tcpwheel *w, struct tcptimer *t, int level,
+        int slot)
+{
+    struct tcptimer **head = &w->slots[level][slot];
+    t->next = *head;
+    if(t->next != NULL) t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    w->bitmap[level] |= UINT64_C(1) << slot;
+}
+
+static void tcpwheelunlink(struct tcptimer *t)
+{
+    *t->pprev = t->next;
+    if(t->next != NULL) t->next->pprev = t->pprev;
+    t->pprev = NULL;
+}
+
+/* tcpwheeladd places t in the level whose slots are just fine enough for
+ * its distance to w->now. */
+static void tcpwheeladd(struct tcpwheel *w, struct tcptimer *t)
+{
+    uint64_t e = t->expires > w->now ? t->expires : w->now;
+    if(e - w->now > TCP_WHEELMAX) e = w->now + TCP_WHEELMAX;
+
+    int level = 0;
+    uint64_t delta = e - w->now;
+    while(delta >> (TCP_WHEELBITS * (level + 1)) != 0) level++;
+    tcpwheellink(w, t, level, (e >> (TCP_WHEELBITS * level)) &
+            TCP_WHEELMASK);
+}
+
+/* tcpwheeltake moves the timers of a slot to the list *head, so that a
+ * timer callback may cancel any of them while the list is walked. */
+static void tcpwheeltake(struct tcpwheel *w, struct tcptimer **head,
+        int level, int slot)
+{
+    *head = w->slots[level][slot];
+    if(*head != NULL) (*head)->pprev = head;
+    w->slots[level][slot] = NULL;
+    w->bitmap[level] &= ~(UINT64_C(1) << slot);
+}
+
+/* tcpwheelms returns the CLOCK_MONOTONIC time in milliseconds, the clock
+ * the event loop drives its wheel with. */
+uint64_t tcpwheelms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* tcpwheelinit prepares an empty wheel whose clock starts at now
+ * milliseconds. */
+void tcpwheelinit(struct tcpwheel *w, uint64_t now)
+{
+    w->now = now;
+    w->clock = now;
+    w->n = 0;
+    for(int l = 0; l < TCP_WHEELLEVELS; l++) {
+        w->bitmap[l] = 0;
+        for(int i = 0; i < TCP_WHEELSLOTS; i++) w->slots[l][i] = NULL;
+    }
+}
+
+/* tcpwheelsync sets the current time of the wheel without expiring any
+ * timer. Timers are armed relative to it, so the event loop calls it as
+ * soon as it wakes up, before it runs the event callbacks. */
+void tcpwheelsync(struct tcpwheel *w, uint64_t now)
+{
+    if(now > w->clock) w->clock = now;
+}
+
+/* tcpwheelnow returns the current time of the wheel. It is the cheap clock
+ * for the callbacks of an event loop: it does not change while a batch of
+ * events is dispatched. */
+uint64_t tcpwheelnow(struct tcpwheel *w)
+{
+    return w->clock;
+}
+
+/* tcptimerinit prepares the timer t, which calls fn when it expires. */
+void tcptimerinit(struct tcptimer *t, tcptimerfn *fn)
+{
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+}
+
+/* tcptimerarm makes t expire ms milliseconds after the current time of the
+ * wheel, at the earliest on the next tick. A timer that is already armed
+ * is moved. Both arming and cancelling take constant time and never
+ * allocate.
+ *
+ * The callback runs once, from tcpwheeladvance, with the timer disarmed;
+ * it may arm it again or free the object it is embedded in.
+ *
+ * Example:
+ *
+ *     struct conn {
+ *         struct tcpev ev;
+ *         struct tcptimer idle;
+ *     };
+ *
+ *     static void idle(struct tcpwheel *w, struct tcptimer *t)
+ *     {
+ *         struct conn *c = (struct conn *)
+ *             ((char *)t - offsetof(struct conn, idle));
+ *         close(c->ev.fd);
+ *         free(c);
+ *     }
+ *
+ *     tcptimerinit(&c->idle, idle);
+ *     tcptimerarm(tcploopwheel(loop), &c->idle, 30000);
+ */
+void tcptimerarm(struct tcpwheel *w, struct tcptimer *t, uint64_t ms)
+{
+    if(t->pprev != NULL) tcptimercancel(w, t);
+    t->expires = w->clock + (ms > 0 ? ms : 1);
+    tcpwheeladd(w, t);
+    w->n++;
+}
+
+/* tcptimercancel disarms t. It does nothing if t is not armed. */
+void tcptimercancel(struct tcpwheel *w, struct tcptimer *t)
+{
+    if(t->pprev == NULL) return;
+    /* the slot bit is cleared lazily by the next tcpwheelnext */
+    tcpwheelunlink(t);
+    w->n--;
+}
+
+/* tcptimerarmed returns non-zero if t is armed. */
+int tcptimerarmed(struct tcptimer *t)
+{
+    return t->pprev != NULL;
+}
+
+/* tcpwheelnext returns the time at which the wheel next has work to do, or
+ * -1 if no timer is armed. This is the wait timeout of an event loop: at
+ * that time a timer expires or the timers of a coarser slot are spread to
+ * the finer levels. */
+int64_t tcpwheelnext(struct tcpwheel *w)
+{
+    if(w->n == 0) return -1;
+
+    int64_t next = -1;
+    for(int l = 0; l < TCP_WHEELLEVELS; l++) {
+        int shift = TCP_WHEELBITS * l;
+        int first = ((w->now >> shift) + 1) & TCP_WHEELMASK;
+        while(w->bitmap[l] != 0) {
+            /* rotate so that bit 0 is the slot after the current one */
+            uint64_t bits = w->bitmap[l];
+            if(first != 0) {
+                bits = bits >> first | bits << (TCP_WHEELSLOTS - first);
+            }
+            int i = __builtin_ctzll(bits);
+            int slot = (first + i) & TCP_WHEELMASK;
+            if(w->slots[l][slot] == NULL) {
+                w->bitmap[l] &= ~(UINT64_C(1) << slot);
+                continue;
+            }
+            uint64_t at = ((w->now >> shift) + i + 1) << shift;
+            if(next == -1 || at < (uint64_t)next) next = at;
+            break;
+        }
+    }
+    return next;
+}
+
+/* tcpwheeladvance expires every timer due at or before now and sets the
+ * current time of the wheel to now. It costs one step per slot that holds
+ * timers, not one per millisecond that passed. */
+void tcpwheeladvance(struct tcpwheel *w, uint64_t now)
+{
+    tcpwheelsync(w, now);
+
+    for(;;) {
+        int64_t at = tcpwheelnext(w);
+        if(at == -1 || (uint64_t)at > now) break;
+        w->now = at;
+
+        /* spread the coarser slots that start now, the coarsest first,
+         * as it may refill the finer ones */
+        for(int l = TCP_WHEELLEVELS - 1; l > 0; l--) {
+            int shift = TCP_WHEELBITS * l;
+            if((w->now & ((UINT64_C(1) << shift) - 1)) != 0) continue;
+            struct tcptimer *head;
+            tcpwheeltake(w, &head, l, (w->now >> shift) & TCP_WHEELMASK);
+            while(head != NULL) {
+                struct tcptimer *t = head;
+                tcpwheelunlink(t);
+                tcpwheeladd(w, t);
+            }
+        }
+
+        struct tcptimer *head;
+        tcpwheeltake(w, &head, 0, w->now & TCP_WHEELMASK);
+        while(head != NULL) {
+            struct tcptimer *t = head;
+            tcpwheelunlink(t);
+            if(t->expires > w->now) {
+                /* parked beyond the reach of the wheel */
+                tcpwheeladd(w, t);
+                continue;
+            }
+            w->n--;
+            t->fn(w, t);
+        }
+    }
+    if(now > w->now) w->now = now;
+}
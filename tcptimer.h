@@ -0,0 +1,85 @@
+/* tcptimer - A hierarchical timing wheel for connection deadlines and idle
+ * timeouts.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPTIMER_H
+#define TCPTIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the wheel has TCP_WHEELLEVELS levels of 2^TCP_WHEELBITS slots; a slot of
+ * level 0 is one millisecond, a slot of level n spans all of level n-1 */
+#define TCP_WHEELBITS 6
+#define TCP_WHEELSLOTS (1 << TCP_WHEELBITS)
+#define TCP_WHEELLEVELS 4
+
+struct tcpwheel;
+struct tcptimer;
+
+typedef void tcptimerfn(struct tcpwheel *w, struct tcptimer *t);
+
+/* tcptimer is a deadline armed on a wheel. It is meant to be embedded in the
+ * caller's connection object, so arming and cancelling never allocate; the
+ * callback finds the enclosing object with offsetof. */
+struct tcptimer {
+    struct tcptimer *next;
+    /* the next pointer that points to this timer, NULL when not armed */
+    struct tcptimer **pprev;
+    /* the expiry time in milliseconds on the clock of the wheel */
+    uint64_t expires;
+    tcptimerfn *fn;
+};
+
+/* tcpwheel holds the armed timers. It is not thread-safe: every event loop
+ * has its own wheel. */
+struct tcpwheel {
+    /* the time up to which the timers were expired and the current time
+     * as last seen by tcpwheelsync, in milliseconds */
+    uint64_t now;
+    uint64_t clock;
+    size_t n;
+    /* bit i of level l is set when slots[l][i] may hold timers */
+    uint64_t bitmap[TCP_WHEELLEVELS];
+    struct tcptimer *slots[TCP_WHEELLEVELS][TCP_WHEELSLOTS];
+};
+
+void tcpwheelinit(struct tcpwheel *w, uint64_t now);
+uint64_t tcpwheelms(void);
+void tcpwheelsync(struct tcpwheel *w, uint64_t now);
+uint64_t tcpwheelnow(struct tcpwheel *w);
+void tcptimerinit(struct tcptimer *t, tcptimerfn *fn);
+void tcptimerarm(struct tcpwheel *w, struct tcptimer *t, uint64_t ms);
+void tcptimercancel(struct tcpwheel *w, struct tcptimer *t);
+int tcptimerarmed(struct tcptimer *t);
+int64_t tcpwheelnext(struct tcpwheel *w);
+void tcpwheeladvance(struct tcpwheel *w, uint64_t now);
+
+#endif
@@ -0,0 +1,576 @@
+/* tcptls - TLS connections for the tcp module, built on OpenSSL, with the
+ * record layer handed to kernel TLS after the handshake.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "tcp.h"
+#include "tcptls.h"
+
+/* tcptlssess is the session cache entry of a single host:port. Entries are
+ * never removed, the latest session replaces the previous one in place. */
+struct tcptlssess {
+    struct tcptlsctx *ctx;
+    /* the key, "host\0port\0" */
+    char *host;
+    char *port;
+    SSL_SESSION *sess;
+};
+
+struct tcptlsslot {
+    uint64_t hash;
+    struct tcptlssess *e;
+};
+
+struct tcptlsctx {
+    SSL_CTX *ssl;
+    int flags;
+    /* guards the session cache */
+    pthread_mutex_t mu;
+    struct tcptlsslot *slots;
+    size_t cap;
+    size_t len;
+};
+
+struct tcptls {
+    SSL *ssl;
+    int fd;
+    /* the poll(2) event the last EAGAIN is waiting for */
+    short want;
+    /* set once the connection failed, close_notify is not sent then */
+    int failed;
+    int ktls;
+    /* the cache entry the sessions of a client connection go to */
+    struct tcptlssess *sess;
+};
+
+static uint64_t tcptlshash(char host[], char port[])
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ull;
+    for(char *c = host; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    h *= 1099511628211ull;
+    for(char *c = port; *c != '\0'; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    return h;
+}
+
+/* tcptlsgrow doubles the session table. The context must be locked. */
+static int tcptlsgrow(struct tcptlsctx *ctx)
+{
+    size_t cap = ctx->cap * 2;
+    struct tcptlsslot *slots = calloc(cap, sizeof *slots);
+    if(slots == NULL) return ENOMEM;
+    for(size_t i = 0; i < ctx->cap; i++) {
+        if(ctx->slots[i].e == NULL) continue;
+        size_t j = ctx->slots[i].hash & (cap - 1);
+        while(slots[j].e != NULL) j = (j + 1) & (cap - 1);
+        slots[j] = ctx->slots[i];
+    }
+    free(ctx->slots);
+    ctx->slots = slots;
+    ctx->cap = cap;
+    return 0;
+}
+
+/* tcptlsentry returns the session cache entry of host:port, creating an
+ * empty one if needed, or NULL when out of memory. The context must be
+ * locked. */
+static struct tcptlssess *tcptlsentry(struct tcptlsctx *ctx, char host[],
+        char port[])
+{
+    uint64_t h = tcptlshash(host, port);
+    size_t i = h & (ctx->cap - 1);
+    for(; ctx->slots[i].e != NULL; i = (i + 1) & (ctx->cap - 1)) {
+        struct tcptlssess *e = ctx->slots[i].e;
+        if(ctx->slots[i].hash == h && strcmp(e->host, host) == 0 &&
+                strcmp(e->port, port) == 0) {
+            return e;
+        }
+    }
+
+    if((ctx->len + 1) * 2 > ctx->cap) {
+        if(tcptlsgrow(ctx) != 0) return NULL;
+        return tcptlsentry(ctx, host, port);
+    }
+
+    size_t hostln = strlen(host), portln = strlen(port);
+    struct tcptlssess *e = calloc(1, sizeof *e);
+    char *key = malloc(hostln + portln + 2);
+    if(e == NULL || key == NULL) {
+        free(e);
+        free(key);
+        return NULL;
+    }
+    memcpy(key, host, hostln + 1);
+    memcpy(key + hostln + 1, port, portln + 1);
+    e->ctx = ctx;
+    e->host = key;
+    e->port = key + hostln + 1;
+
+    ctx->slots[i].hash = h;
+    ctx->slots[i].e = e;
+    ctx->len++;
+    return e;
+}
+
+/* tcptlsnewsess is called by OpenSSL whenever the server hands the client
+ * a session, during the handshake with TLS 1.2 and with the first records
+ * after it with TLS 1.3. The session becomes the one the next dial to the
+ * same host:port resumes. */
+static int tcptlsnewsess(SSL *ssl, SSL_SESSION *sess)
+{
+    struct tcptls *t = SSL_get_app_data(ssl);
+    if(t == NULL || t->sess == NULL) return 0;
+
+    struct tcptlssess *e = t->sess;
+    pthread_mutex_lock(&e->ctx->mu);
+    SSL_SESSION *old = e->sess;
+    e->sess = sess;
+    pthread_mutex_unlock(&e->ctx->mu);
+    if(old != NULL) SSL_SESSION_free(old);
+    /* the reference of sess is kept by the cache */
+    return 1;
+}
+
+/* tcptlserr maps the result ret of an SSL call to an errno value. */
+static int tcptlserr(struct tcptls *t, int ret)
+{
+    switch(SSL_get_error(t->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            t->want = POLLIN;
+            return EAGAIN;
+        case SSL_ERROR_WANT_WRITE:
+            t->want = POLLOUT;
+            return EAGAIN;
+        case SSL_ERROR_SYSCALL:
+            t->failed = 1;
+            return errno != 0 ? errno : ECONNRESET;
+    }
+
+    t->failed = 1;
+    if(ERR_GET_REASON(ERR_peek_error()) ==
+            SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+        return ECONNRESET;
+    }
+    if(SSL_get_verify_result(t->ssl) != X509_V_OK) return EACCES;
+    return EPROTO;
+}
+
+/* tcptlswait waits until conn is ready for events or deadline passes. */
+static int tcptlswait(int conn, short events, struct timespec *deadline)
+{
+    struct pollfd pfd;
+    pfd.fd = conn;
+    pfd.events = events;
+    for(;;) {
+        int ms = -1;
+        if(deadline != NULL) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long left = (long long)(deadline->tv_sec - now.tv_sec) *
+                1000 + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+            if(left <= 0) return ETIMEDOUT;
+            ms = left > 0x7fffffff ? 0x7fffffff : (int)left;
+        }
+        int n = poll(&pfd, 1, ms);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) return errno;
+        if(n == 0) return ETIMEDOUT;
+        return 0;
+    }
+}
+
+/* tcptlsctxnew creates the TLS configuration shared by many connections
+ * and write it into *ctx. It can be used from several threads at once.
+ *
+ * The flags parameter is zero or the bitwise OR of TCP_TLSSERVER,
+ * TCP_TLSNOVERIFY and TCP_TLS12. cert and key are PEM files of the
+ * certificate chain and its private key; a server needs both, a client only
+ * for client authentication. ca is a PEM file of the certificates a client
+ * trusts; if it is NULL the system default ones are trusted.
+ *
+ * Kernel TLS is requested for every connection. Once the handshake is
+ * done, OpenSSL installs the keys with the TCP_ULP "tls" socket option, for
+ * the directions and ciphers the kernel and OpenSSL support; tcptlsktls
+ * tells which directions the kernel took over.
+ *
+ * A client context caches the last session of every host:port it dialed
+ * and resumes it on the next tcpdialtls, which saves a round trip and the
+ * public key operations of a full handshake.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to:
+ *
+ * EINVAL
+ * A server without cert or key, or a certificate, a key or CA file that
+ * cannot be loaded or a key that does not match the certificate. The
+ * OpenSSL error queue tells the details.
+ *
+ * ENOMEM
+ * Insufficient memory is available.
+ *
+ * Example:
+ *
+ *     struct tcptlsctx *ctx;
+ *     int err = tcptlsctxnew(&ctx, TCP_TLSSERVER, "cert.pem", "key.pem",
+ *             NULL);
+ */
+int tcptlsctxnew(struct tcptlsctx **ctx, int flags, char cert[], char key[],
+        char ca[])
+{
+    int server = flags & TCP_TLSSERVER;
+    if(server && (cert == NULL || key == NULL)) {
+        errno = EINVAL;
+        return errno;
+    }
+
+    struct tcptlsctx *c = calloc(1, sizeof *c);
+    if(c == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    pthread_mutex_init(&c->mu, NULL);
+    c->flags = flags;
+    c->cap = 16;
+    c->slots = calloc(c->cap, sizeof *c->slots);
+    c->ssl = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+    if(c->slots == NULL || c->ssl == NULL) {
+        tcptlsctxfree(c);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    SSL_CTX_set_min_proto_version(c->ssl, TLS1_2_VERSION);
+    if(flags & TCP_TLS12) {
+        SSL_CTX_set_max_proto_version(c->ssl, TLS1_2_VERSION);
+    }
+    SSL_CTX_set_options(c->ssl, SSL_OP_ENABLE_KTLS);
+    /* behave like send(2) on short writes, and keep no record buffers
+     * while a connection is idle */
+    SSL_CTX_set_mode(c->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    int ok = 1;
+    if(cert != NULL) {
+        ok = SSL_CTX_use_certificate_chain_file(c->ssl, cert) == 1 &&
+            key != NULL &&
+            SSL_CTX_use_PrivateKey_file(c->ssl, key, SSL_FILETYPE_PEM) == 1 &&
+            SSL_CTX_check_private_key(c->ssl) == 1;
+    }
+    if(server) {
+        SSL_CTX_set_session_id_context(c->ssl, (unsigned char *)"tcptls", 6);
+    } else {
+        if(!(flags & TCP_TLSNOVERIFY)) {
+            SSL_CTX_set_verify(c->ssl, SSL_VERIFY_PEER, NULL);
+            if(ca != NULL) {
+                ok = ok && SSL_CTX_load_verify_locations(c->ssl, ca, NULL);
+            } else {
+                ok = ok && SSL_CTX_set_default_verify_paths(c->ssl);
+            }
+        }
+        SSL_CTX_set_session_cache_mode(c->ssl, SSL_SESS_CACHE_CLIENT |
+                SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(c->ssl, tcptlsnewsess);
+    }
+    if(!ok) {
+        tcptlsctxfree(c);
+        errno = EINVAL;
+        return errno;
+    }
+
+    *ctx = c;
+    return 0;
+}
+
+/* tcptlsctxfree releases ctx and its cached sessions. The connections
+ * created from it must be closed first. */
+void tcptlsctxfree(struct tcptlsctx *ctx)
+{
+    for(size_t i = 0; ctx->slots != NULL && i < ctx->cap; i++) {
+        struct tcptlssess *e = ctx->slots[i].e;
+        if(e == NULL) continue;
+        if(e->sess != NULL) SSL_SESSION_free(e->sess);
+        free(e->host);
+        free(e);
+    }
+    free(ctx->slots);
+    if(ctx->ssl != NULL) SSL_CTX_free(ctx->ssl);
+    pthread_mutex_destroy(&ctx->mu);
+    free(ctx);
+}
+
+/* tcptlsnew wraps the connected socket conn in a TLS connection of ctx and
+ * write it into *tls. The handshake is driven by tcptlshandshake, which
+ * suits a non-blocking socket served by an event loop; this is how a server
+ * wraps the connections returned by tcpaccept.
+ *
+ * The connection owns conn from now on, tcptlsclose closes it. TCP_NODELAY
+ * is set on it: the handshake writes every message of a flight on its own
+ * and Nagle's algorithm would hold them back for a delayed ACK, while the
+ * application data is written in whole records anyway. It returns 0 or
+ * ENOMEM.
+ *
+ * Example:
+ *
+ *     struct tcptls *tls;
+ *     tcpaccept(&conn, ln, TCP_NONBLOCK);
+ *     tcptlsnew(&tls, ctx, conn);
+ */
+int tcptlsnew(struct tcptls **tls, struct tcptlsctx *ctx, int conn)
+{
+    struct tcptls *t = calloc(1, sizeof *t);
+    if(t == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    t->fd = conn;
+    t->ssl = SSL_new(ctx->ssl);
+    if(t->ssl == NULL || SSL_set_fd(t->ssl, conn) != 1) {
+        if(t->ssl != NULL) SSL_free(t->ssl);
+        free(t);
+        errno = ENOMEM;
+        return errno;
+    }
+    SSL_set_app_data(t->ssl, t);
+    int one = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if(ctx->flags & TCP_TLSSERVER) {
+        SSL_set_accept_state(t->ssl);
+    } else {
+        SSL_set_connect_state(t->ssl);
+    }
+
+    *tls = t;
+    return 0;
+}
+
+/* tcptlshandshake advances the handshake of tls. It returns 0 once the
+ * handshake is done, EAGAIN when the socket would block, in which case it
+ * must be called again when the socket is ready, or:
+ *
+ * EACCES
+ * The certificate of the peer could not be verified.
+ *
+ * EPROTO
+ * The handshake failed; the OpenSSL error queue tells why.
+ *
+ * ECONNRESET, ...
+ * The connection failed.
+ */
+int tcptlshandshake(struct tcptls *tls)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(tls->ssl);
+    if(ret != 1) {
+        errno = tcptlserr(tls, ret);
+        return errno;
+    }
+
+    tls->ktls = 0;
+    if(BIO_get_ktls_send(SSL_get_wbio(tls->ssl))) tls->ktls |= TCP_KTLSTX;
+    if(BIO_get_ktls_recv(SSL_get_rbio(tls->ssl))) tls->ktls |= TCP_KTLSRX;
+    return 0;
+}
+
+/* tcpdialtls connects to a TLS server like tcpdialdl and completes the
+ * handshake before deadline, which may be NULL. The name of the server is
+ * sent with SNI and, unless ctx was created with TCP_TLSNOVERIFY, must
+ * match its certificate; host may also be an IP address.
+ *
+ * The last session of host:port is resumed if the server still accepts
+ * it, see tcptlsresumed.
+ *
+ * On success the connection is in blocking mode. Besides the errors of
+ * tcpdialdl and tcptlshandshake, it returns ENOMEM.
+ *
+ * Example:
+ *
+ *     struct tcptls *tls;
+ *     struct timespec dl;
+ *     tcpdeadline(&dl, 2000);
+ *     int err = tcpdialtls(&tls, ctx, "localhost", "9443", &dl);
+ */
+int tcpdialtls(struct tcptls **tls, struct tcptlsctx *ctx, char host[],
+        char port[], struct timespec *deadline)
+{
+    int conn;
+    int err = tcpdialdl(&conn, host, port, deadline);
+    if(err != 0) return err;
+
+    struct tcptls *t;
+    err = tcptlsnew(&t, ctx, conn);
+    if(err != 0) {
+        close(conn);
+        errno = err;
+        return errno;
+    }
+
+    unsigned char ip[sizeof(struct in6_addr)];
+    if(inet_pton(AF_INET, host, ip) == 1 ||
+            inet_pton(AF_INET6, host, ip) == 1) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(t->ssl), host);
+    } else {
+        SSL_set_tlsext_host_name(t->ssl, host);
+        SSL_set1_host(t->ssl, host);
+    }
+
+    pthread_mutex_lock(&ctx->mu);
+    t->sess = tcptlsentry(ctx, host, port);
+    if(t->sess != NULL && t->sess->sess != NULL) {
+        SSL_set_session(t->ssl, t->sess->sess);
+    }
+    pthread_mutex_unlock(&ctx->mu);
+
+    int flags = fcntl(conn, F_GETFL);
+    fcntl(conn, F_SETFL, flags | O_NONBLOCK);
+    while((err = tcptlshandshake(t)) == EAGAIN) {
+        err = tcptlswait(conn, t->want, deadline);
+        if(err != 0) break;
+    }
+    fcntl(conn, F_SETFL, flags);
+    if(err != 0) {
+        t->failed = 1;
+        tcptlsclose(t);
+        errno = err;
+        return errno;
+    }
+
+    *tls = t;
+    return 0;
+}
+
+/* tcptlsread reads up to len bytes of application data into buf and write
+ * the number of bytes read into *n; like recv(2), 0 bytes means the peer
+ * closed the connection.
+ *
+ * Records the kernel decrypts are received without user space crypto; the
+ * call only handles the records that are not application data, such as
+ * session tickets and alerts.
+ *
+ * It returns 0, EAGAIN if a non-blocking socket has no data, or the errors
+ * of tcptlshandshake.
+ */
+int tcptlsread(struct tcptls *tls, void *buf, size_t len, size_t *n)
+{
+    *n = 0;
+    if(len == 0) return 0;
+
+    ERR_clear_error();
+    int ret = SSL_read_ex(tls->ssl, buf, len, n);
+    if(ret == 1) return 0;
+    if(SSL_get_error(tls->ssl, ret) == SSL_ERROR_ZERO_RETURN) return 0;
+    errno = tcptlserr(tls, ret);
+    return errno;
+}
+
+/* tcptlswrite writes up to len bytes of buf and write the number of bytes
+ * written into *n. Like send(2) on a non-blocking socket it may write less
+ * than len; after EAGAIN it must be called again with the same data.
+ *
+ * A write to a connection the peer closed raises SIGPIPE, which the caller
+ * should ignore. It returns 0, EAGAIN or the errors of tcptlshandshake.
+ */
+int tcptlswrite(struct tcptls *tls, const void *buf, size_t len, size_t *n)
+{
+    *n = 0;
+    if(len == 0) return 0;
+
+    ERR_clear_error();
+    int ret = SSL_write_ex(tls->ssl, buf, len, n);
+    if(ret == 1) return 0;
+    errno = tcptlserr(tls, ret);
+    return errno;
+}
+
+/* tcptlsfd returns the socket of tls, to wait on it or, for the directions
+ * tcptlsktls reports, to use it directly. */
+int tcptlsfd(struct tcptls *tls)
+{
+    return tls->fd;
+}
+
+/* tcptlsktls returns the bitwise OR of TCP_KTLSTX and TCP_KTLSRX for the
+ * directions the kernel encrypts and decrypts after the handshake.
+ *
+ * With TCP_KTLSTX, send(2), sendfile(2) and splice(2) to the socket send
+ * TLS records. With TCP_KTLSRX, recv(2) and splice(2) from the socket
+ * return decrypted data; a record that is not application data, such as
+ * an alert, makes them fail with EIO and is read with tcptlsread.
+ */
+int tcptlsktls(struct tcptls *tls)
+{
+    return tls->ktls;
+}
+
+/* tcptlsresumed returns non-zero if the handshake of tls resumed a cached
+ * session. */
+int tcptlsresumed(struct tcptls *tls)
+{
+    return SSL_session_reused(tls->ssl);
+}
+
+/* tcptlsclose sends a close_notify alert unless the connection failed,
+ * closes the socket and releases tls. It does not wait for the alert of the
+ * peer. */
+void tcptlsclose(struct tcptls *tls)
+{
+    if(!tls->failed && SSL_is_init_finished(tls->ssl)) {
+        ERR_clear_error();
+        SSL_shutdown(tls->ssl);
+    }
+    SSL_free(tls->ssl);
+    close(tls->fd);
+    free(tls);
+}
@@ -0,0 +1,73 @@
+/* tcptls - TLS connections for the tcp module, built on OpenSSL, with the
+ * record layer handed to kernel TLS after the handshake.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPTLS_H
+#define TCPTLS_H
+
+#include <stddef.h>
+
+/* flags for tcptlsctxnew */
+enum {
+    /* the context accepts connections, cert and key are required */
+    TCP_TLSSERVER = 1,
+    /* the client does not verify the certificate of the server */
+    TCP_TLSNOVERIFY = 2,
+    /* restrict the protocol to TLS 1.2; OpenSSL 3.0 only offloads the
+     * receive side of TLS 1.2 to the kernel */
+    TCP_TLS12 = 4
+};
+
+/* the directions of a connection whose records the kernel encrypts or
+ * decrypts, as returned by tcptlsktls */
+enum {
+    TCP_KTLSTX = 1,
+    TCP_KTLSRX = 2
+};
+
+struct timespec;
+struct tcptlsctx;
+struct tcptls;
+
+int tcptlsctxnew(struct tcptlsctx **ctx, int flags, char cert[], char key[],
+        char ca[]);
+void tcptlsctxfree(struct tcptlsctx *ctx);
+int tcpdialtls(struct tcptls **tls, struct tcptlsctx *ctx, char host[],
+        char port[], struct timespec *deadline);
+int tcptlsnew(struct tcptls **tls, struct tcptlsctx *ctx, int conn);
+int tcptlshandshake(struct tcptls *tls);
+int tcptlsread(struct tcptls *tls, void *buf, size_t len, size_t *n);
+int tcptlswrite(struct tcptls *tls, const void *buf, size_t len, size_t *n);
+int tcptlsfd(struct tcptls *tls);
+int tcptlsktls(struct tcptls *tls);
+int tcptlsresumed(struct tcptls *tls);
+void tcptlsclose(struct tcptls *tls);
+
+#endif
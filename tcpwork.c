@@ -0,0 +1,440 @@
+/* tcpwork - A pool of worker threads that runs the blocking or CPU heavy
+ * part of requests off the event loop threads.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces used to pin the workers, such as pthread_setaffinity_np(3),
+ * and eventfd(2). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tcploop.h"
+#include "tcpring.h"
+#include "tcpwork.h"
+
+/* tcpworker is a thread of the pool with its own job queue. Submitters
+ * push to the queues round robin; the worker pops its own queue and, once
+ * it is empty, the queues of the others, so a slow job only delays the
+ * jobs queued behind it until another worker is idle. */
+struct tcpworker {
+    struct tcpring q;
+    struct tcpwork *pool;
+    int id;
+    int cpu;
+    pthread_t thread;
+    /* set while the worker waits on cond, under lock */
+    int sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct tcpwork {
+    int nworkers;
+    int flags;
+    struct tcpworker *workers;
+    /* the queue of the next job */
+    unsigned next;
+    /* the number of sleeping workers */
+    int nsleeping;
+    int stop;
+};
+
+/* tcpworkport is where the jobs of one event loop come back. Workers push
+ * the finished jobs to the completion ring and wake the loop through the
+ * eventfd, which is written only by the worker that finds signaled unset,
+ * so a burst of completions costs the loop a single wakeup. */
+struct tcpworkport {
+    /* the eventfd, registered to loop */
+    struct tcpev ev;
+    struct tcpwork *pool;
+    struct tcploop *loop;
+    struct tcpring done;
+    int signaled;
+    /* the jobs submitted and not yet done, only used by the loop thread */
+    int njobs;
+    int maxjobs;
+};
+
+/* tcpworktake pops a job from the queue of w or, if stealing is enabled,
+ * from the queue of another worker. It returns NULL if every queue it
+ * looked at was empty. */
+static struct tcpjob *tcpworktake(struct tcpworker *w)
+{
+    struct tcpwork *pool = w->pool;
+    void *job;
+    if(tcpringpop(&w->q, &job) == 0) return job;
+    if(pool->flags & TCP_WORKNOSTEAL) return NULL;
+    for(int i = 1; i < pool->nworkers; i++) {
+        struct tcpworker *v = &pool->workers[(w->id + i) % pool->nworkers];
+        if(tcpringpop(&v->q, &job) == 0) return job;
+    }
+    return NULL;
+}
+
+/* tcpworkwake wakes w if it is sleeping. It returns 1 if it was. */
+static int tcpworkwake(struct tcpworker *w)
+{
+    if(!__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) return 0;
+    int woke = 0;
+    pthread_mutex_lock(&w->lock);
+    if(w->sleeping) {
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&w->pool->nsleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_signal(&w->cond);
+        woke = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return woke;
+}
+
+/* tcpworkidle puts w to sleep until a submitter wakes it or the pool
+ * stops. The worker announces itself before it looks at the queues a last
+ * time, and a submitter looks for sleepers after its push, so either the
+ * worker finds the job or the submitter finds the worker. */
+static struct tcpjob *tcpworkidle(struct tcpworker *w)
+{
+    struct tcpwork *pool = w->pool;
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->nsleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    struct tcpjob *job = tcpworktake(w);
+    while(job == NULL && w->sleeping &&
+            !__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if(w->sleeping) {
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&pool->nsleeping, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return job;
+}
+
+/* tcpworkcomplete hands a finished job back to its port. */
+static void tcpworkcomplete(struct tcpjob *job)
+{
+    struct tcpworkport *port = job->port;
+    /* the ring holds maxjobs jobs, as many as may be outstanding */
+    while(tcpringpush(&port->done, job) == EAGAIN) sched_yield();
+    if(__atomic_exchange_n(&port->signaled, 1, __ATOMIC_ACQ_REL) == 0) {
+        uint64_t one = 1;
+        while(write(port->ev.fd, &one, sizeof one) == -1 && errno == EINTR) {
+        }
+    }
+}
+
+static void *tcpworkthread(void *arg)
+{
+    struct tcpworker *w = arg;
+    struct tcpwork *pool = w->pool;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+
+    while(!__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+        struct tcpjob *job = tcpworktake(w);
+        for(int i = 0; job == NULL && i < TCP_WORKSPIN; i++) {
+            job = tcpworktake(w);
+        }
+        if(job == NULL) job = tcpworkidle(w);
+        if(job == NULL) continue;
+        job->run(job);
+        tcpworkcomplete(job);
+    }
+    return NULL;
+}
+
+/* tcpworkportev runs the done callbacks of the finished jobs of a port. */
+static void tcpworkportev(struct tcploop *loop, struct tcpev *ev, int events)
+{
+    struct tcpworkport *port = (struct tcpworkport *)ev;
+    (void)loop;
+    (void)events;
+
+    uint64_t n;
+    while(read(ev->fd, &n, sizeof n) == -1 && errno == EINTR) {
+    }
+    /* clear the flag before draining, a job pushed after the drain writes
+     * the eventfd again; the exchange also acquires the pushes of the
+     * workers that found the flag set */
+    __atomic_exchange_n(&port->signaled, 0, __ATOMIC_ACQ_REL);
+    void *p;
+    while(tcpringpopsc(&port->done, &p) == 0) {
+        struct tcpjob *job = p;
+        port->njobs--;
+        job->done(job);
+    }
+}
+
+/* tcpworkstop stops and joins the first nstarted workers of pool, then
+ * releases the queues of the first ninit workers and pool itself. */
+static void tcpworkstop(struct tcpwork *pool, int nstarted, int ninit)
+{
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    for(int i = 0; i < nstarted; i++) {
+        struct tcpworker *w = &pool->workers[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for(int i = 0; i < nstarted; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for(int i = 0; i < ninit; i++) {
+        struct tcpworker *w = &pool->workers[i];
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        tcpringdestroy(&w->q);
+    }
+    free(pool->workers);
+    free(pool);
+}
+
+/* tcpworknew creates a pool of nworkers threads, pinned round robin to the
+ * CPUs the process may run on, and write it into *pool. If nworkers is 0
+ * there is one worker per CPU. Every worker has a queue of qlen jobs,
+ * rounded up to a power of two.
+ *
+ * flags is 0 or TCP_WORKNOSTEAL.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL, ENOMEM or an error of pthread_create(3).
+ *
+ * Example:
+ *
+ *     struct tcpwork *pool;
+ *     if(tcpworknew(&pool, 0, 1024, 0) != 0) {
+ *         perror("tcpworknew");
+ *     }
+ */
+int tcpworknew(struct tcpwork **pool, int nworkers, int qlen, int flags)
+{
+    if(nworkers < 0 || qlen <= 0) {
+        errno = EINVAL;
+        return errno;
+    }
+
+    cpu_set_t set;
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    if(sched_getaffinity(0, sizeof set, &set) == 0) {
+        for(int c = 0; c < CPU_SETSIZE; c++) {
+            if(CPU_ISSET(c, &set)) cpus[ncpus++] = c;
+        }
+    }
+    if(ncpus == 0) cpus[ncpus++] = 0;
+
+    struct tcpwork *p = malloc(sizeof *p);
+    if(p == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    p->nworkers = nworkers > 0 ? nworkers : ncpus;
+    p->flags = flags;
+    p->next = 0;
+    p->nsleeping = 0;
+    p->stop = 0;
+    p->workers = calloc(p->nworkers, sizeof *p->workers);
+    if(p->workers == NULL) {
+        free(p);
+        errno = ENOMEM;
+        return errno;
+    }
+
+    int err = 0;
+    int n;
+    for(n = 0; n < p->nworkers; n++) {
+        struct tcpworker *w = &p->workers[n];
+        w->pool = p;
+        w->id = n;
+        w->cpu = cpus[n % ncpus];
+        err = tcpringinit(&w->q, qlen);
+        if(err != 0) break;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+    }
+    /* the workers steal from each other, so every queue must exist before
+     * the first one starts */
+    int started = 0;
+    while(err == 0 && started < n) {
+        struct tcpworker *w = &p->workers[started];
+        err = pthread_create(&w->thread, NULL, tcpworkthread, w);
+        if(err == 0) started++;
+    }
+    if(err != 0) {
+        tcpworkstop(p, started, n);
+        errno = err;
+        return errno;
+    }
+    *pool = p;
+    return 0;
+}
+
+/* tcpworkfree stops and joins the workers of pool and releases it. Jobs
+ * still queued are dropped without their done callback; the ports should
+ * have no outstanding jobs. */
+void tcpworkfree(struct tcpwork *pool)
+{
+    tcpworkstop(pool, pool->nworkers, pool->nworkers);
+}
+
+/* tcpworkportnew creates the port through which the event loop loop
+ * submits to pool and receives its finished jobs, and write it into *port.
+ * At most maxjobs jobs may be outstanding at once. The port must only be
+ * used by the thread that runs loop.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EINVAL, ENOMEM or an error of eventfd(2) or tcploopadd.
+ *
+ * Example:
+ *
+ *     struct tcpworkport *port;
+ *     if(tcpworkportnew(&port, pool, loop, 4096) != 0) {
+ *         perror("tcpworkportnew");
+ *     }
+ */
+int tcpworkportnew(struct tcpworkport **port, struct tcpwork *pool,
+        struct tcploop *loop, int maxjobs)
+{
+    if(maxjobs <= 0) {
+        errno = EINVAL;
+        return errno;
+    }
+    struct tcpworkport *p = malloc(sizeof *p);
+    if(p == NULL) {
+        errno = ENOMEM;
+        return errno;
+    }
+    int err = tcpringinit(&p->done, maxjobs);
+    if(err != 0) {
+        free(p);
+        return err;
+    }
+    p->ev.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(p->ev.fd == -1) {
+        err = errno;
+        tcpringdestroy(&p->done);
+        free(p);
+        errno = err;
+        return errno;
+    }
+    p->ev.fn = tcpworkportev;
+    p->pool = pool;
+    p->loop = loop;
+    p->signaled = 0;
+    p->njobs = 0;
+    p->maxjobs = maxjobs;
+    err = tcploopadd(loop, &p->ev, TCP_EVIN);
+    if(err != 0) {
+        close(p->ev.fd);
+        tcpringdestroy(&p->done);
+        free(p);
+        errno = err;
+        return errno;
+    }
+    *port = p;
+    return 0;
+}
+
+/* tcpworkportfree removes port from its event loop and releases it. The
+ * port must have no outstanding jobs. */
+void tcpworkportfree(struct tcpworkport *port)
+{
+    tcploopdel(port->loop, &port->ev);
+    close(port->ev.fd);
+    tcpringdestroy(&port->done);
+    free(port);
+}
+
+/* tcpworksubmit queues job to run on the pool of port. job->run and
+ * job->done must be set; job->done is called on the loop thread of port
+ * once job->run returned.
+ *
+ * If the function succeeds it returns 0. If the function fails, it returns
+ * and set errno to EAGAIN, when maxjobs jobs are outstanding or every
+ * queue is full, so the caller can shed load or retry from a later done
+ * callback.
+ *
+ * Example:
+ *
+ *     req->job.run = hash;
+ *     req->job.done = reply;
+ *     if(tcpworksubmit(port, &req->job) != 0) {
+ *         replybusy(req);
+ *     }
+ */
+int tcpworksubmit(struct tcpworkport *port, struct tcpjob *job)
+{
+    struct tcpwork *pool = port->pool;
+    if(port->njobs >= port->maxjobs) {
+        errno = EAGAIN;
+        return errno;
+    }
+    job->port = port;
+
+    int n = pool->nworkers;
+    unsigned first = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    int target = -1;
+    for(int i = 0; i < n; i++) {
+        int id = (first + i) % n;
+        if(tcpringpush(&pool->workers[id].q, job) == 0) {
+            target = id;
+            break;
+        }
+    }
+    if(target == -1) {
+        errno = EAGAIN;
+        return errno;
+    }
+    port->njobs++;
+
+    /* pairs with the fence of tcpworkidle */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(tcpworkwake(&pool->workers[target])) return 0;
+    /* the owner of the queue is busy, let an idle worker steal the job */
+    if(pool->flags & TCP_WORKNOSTEAL) return 0;
+    if(__atomic_load_n(&pool->nsleeping, __ATOMIC_SEQ_CST) == 0) return 0;
+    for(int i = 1; i < n; i++) {
+        if(tcpworkwake(&pool->workers[(target + i) % n])) break;
+    }
+    return 0;
+}
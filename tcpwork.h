@@ -0,0 +1,72 @@
+/* tcpwork - A pool of worker threads that runs the blocking or CPU heavy
+ * part of requests off the event loop threads.
+ *
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPWORK_H
+#define TCPWORK_H
+
+#include "tcploop.h"
+
+/* flags for tcpworknew */
+enum {
+    /* idle workers do not take jobs queued to other workers */
+    TCP_WORKNOSTEAL = 1
+};
+
+/* the number of times an idle worker looks for a job again before it goes
+ * to sleep */
+#define TCP_WORKSPIN 256
+
+struct tcpwork;
+struct tcpworkport;
+struct tcpjob;
+
+typedef void tcpjobfn(struct tcpjob *job);
+
+/* tcpjob is a unit of work. It is meant to be the first member of the
+ * caller's request object, like tcpev. run is called on a worker thread,
+ * done afterwards on the thread of the event loop of the port the job was
+ * submitted to. */
+struct tcpjob {
+    tcpjobfn *run;
+    tcpjobfn *done;
+    /* set by tcpworksubmit */
+    struct tcpworkport *port;
+};
+
+int tcpworknew(struct tcpwork **pool, int nworkers, int qlen, int flags);
+void tcpworkfree(struct tcpwork *pool);
+int tcpworkportnew(struct tcpworkport **port, struct tcpwork *pool,
+        struct tcploop *loop, int maxjobs);
+void tcpworkportfree(struct tcpworkport *port);
+int tcpworksubmit(struct tcpworkport *port, struct tcpjob *job);
+
+#endif
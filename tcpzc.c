@@ -0,0 +1,202 @@
+/* tcpzc - Zero-copy data paths for the tcp module: splice(2) through a pipe
+ * and MSG_ZEROCOPY sends.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces splice(2), pipe2(2) and MSG_ZEROCOPY. */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tcpzc.h"
+
+/* tcppipeinit creates the pipe used by tcpsplice. It returns 0 or the
+ * error of pipe2(2). */
+int tcppipeinit(struct tcppipe *p)
+{
+    if(pipe2(p->fd, O_NONBLOCK | O_CLOEXEC) == -1) return errno;
+    p->len = 0;
+    return 0;
+}
+
+void tcppipefree(struct tcppipe *p)
+{
+    close(p->fd[0]);
+    close(p->fd[1]);
+}
+
+/* tcpsplice moves data from the socket src to the socket dst through the
+ * pipe p, so the payload never enters user space. src and dst may be the
+ * same socket, which echoes the data back. *n is set to the number of bytes
+ * written to dst.
+ *
+ * It moves data until one of the sockets would block or src reaches EOF.
+ * It returns:
+ *
+ * 0
+ * src reached EOF and every byte was written to dst.
+ *
+ * EAGAIN
+ * src has no more data for now, or dst cannot take more. The bytes already
+ * read are kept in the pipe; call again when either socket is ready.
+ *
+ * Other errors of splice(2), such as ECONNRESET or EPIPE.
+ *
+ * splice(2) has no MSG_NOSIGNAL: a write to a connection the peer closed
+ * raises SIGPIPE, which kills the process by default, before EPIPE is
+ * returned. Callers must ignore or block SIGPIPE.
+ */
+int tcpsplice(int dst, int src, struct tcppipe *p, size_t *n)
+{
+    *n = 0;
+    for(;;) {
+        if(p->len > 0) {
+            ssize_t m = splice(p->fd[0], NULL, dst, NULL, p->len,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(m == -1) {
+                if(errno == EINTR) continue;
+                return errno == EWOULDBLOCK ? EAGAIN : errno;
+            }
+            p->len -= m;
+            *n += m;
+            continue;
+        }
+
+        ssize_t m = splice(src, NULL, p->fd[1], NULL, TCP_SPLICELN,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(m == -1) {
+            if(errno == EINTR) continue;
+            return errno == EWOULDBLOCK ? EAGAIN : errno;
+        }
+        if(m == 0) return 0;
+        p->len += m;
+    }
+}
+
+/* tcpzcinit enables MSG_ZEROCOPY on the socket fd. It returns 0, or the
+ * error of setsockopt(2), ENOPROTOOPT on kernels older than 4.14. */
+int tcpzcinit(struct tcpzc *zc, int fd)
+{
+    memset(zc, 0, sizeof *zc);
+    int on = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+/* tcpzcsend sends len bytes of buf and write the number of bytes sent into
+ * *n. Buffers of at least TCP_ZCMIN bytes are sent with MSG_ZEROCOPY: the
+ * kernel pins the pages instead of copying them, so buf must not be
+ * modified or freed until tcpzcbusy returns 0. Smaller buffers, and sends
+ * the kernel refuses to pin, are copied as usual.
+ *
+ * It returns 0, EAGAIN when the socket is non-blocking and full, or the
+ * error of send(2).
+ */
+int tcpzcsend(struct tcpzc *zc, int fd, const void *buf, size_t len,
+        size_t *n)
+{
+    int flags = MSG_NOSIGNAL;
+    if(len >= TCP_ZCMIN) flags |= MSG_ZEROCOPY;
+
+    for(;;) {
+        ssize_t m = send(fd, buf, len, flags);
+        if(m == -1) {
+            if(errno == EINTR) continue;
+            /* the socket ran out of optmem to track the pinned pages */
+            if(errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+            *n = 0;
+            return errno == EWOULDBLOCK ? EAGAIN : errno;
+        }
+        if(flags & MSG_ZEROCOPY) zc->next++;
+        *n = m;
+        return 0;
+    }
+}
+
+/* tcpzcreap reads the completion notifications from the error queue of
+ * fd. The queue becomes readable with EPOLLERR, so an event loop calls it
+ * on TCP_EVERR.
+ *
+ * It returns 0, or the socket error if the queue held a real error rather
+ * than a completion.
+ */
+int tcpzcreap(struct tcpzc *zc, int fd)
+{
+    for(;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return errno;
+        }
+
+        for(struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+                cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                    (cm->cmsg_level == SOL_IPV6 &&
+                     cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof serr);
+            if(serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                return serr.ee_errno != 0 ? (int)serr.ee_errno : EIO;
+            }
+            /* sends [ee_info, ee_data] completed; they complete in
+             * order on a TCP socket */
+            zc->done = serr.ee_data + 1;
+            if(serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zc->copied = 1;
+        }
+    }
+}
+
+/* tcpzcbusy returns non-zero while the kernel still references a buffer
+ * sent with MSG_ZEROCOPY. */
+int tcpzcbusy(struct tcpzc *zc)
+{
+    return zc->next != zc->done;
+}
@@ -0,0 +1,72 @@
+/* tcpzc - Zero-copy data paths for the tcp module: splice(2) through a pipe
+ * and MSG_ZEROCOPY sends.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TCPZC_H
+#define TCPZC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* the number of bytes moved by a single splice(2) */
+#define TCP_SPLICELN 65536
+/* sends smaller than this are cheaper to copy than to pin */
+#define TCP_ZCMIN 16384
+
+/* tcppipe carries data from one socket to another without copying it to
+ * user space. len is the number of bytes sitting in the pipe. */
+struct tcppipe {
+    int fd[2];
+    size_t len;
+};
+
+/* tcpzc tracks the MSG_ZEROCOPY sends of a socket. Every send gets the
+ * next sequence number; done is the number of sends the kernel no longer
+ * references. */
+struct tcpzc {
+    uint32_t next;
+    uint32_t done;
+    /* non-zero once the kernel reported that it copied the data anyway,
+     * which it does e.g. on loopback */
+    int copied;
+};
+
+int tcppipeinit(struct tcppipe *p);
+void tcppipefree(struct tcppipe *p);
+int tcpsplice(int dst, int src, struct tcppipe *p, size_t *n);
+
+int tcpzcinit(struct tcpzc *zc, int fd);
+int tcpzcsend(struct tcpzc *zc, int fd, const void *buf, size_t len,
+        size_t *n);
+int tcpzcreap(struct tcpzc *zc, int fd);
+int tcpzcbusy(struct tcpzc *zc);
+
+#endif
@@ -0,0 +1,335 @@
+/* udp - UDP sockets with batched receive and send, and UDP generic
+ * segmentation and receive offload.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * interfaces recvmmsg(2) and sendmmsg(2). */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "tcp.h"
+#include "tcpresolv.h"
+#include "udp.h"
+
+/* udpcmsg is the control buffer of a datagram, large enough for the
+ * UDP_GRO or UDP_SEGMENT message and aligned like the size_t fields of a
+ * cmsghdr */
+union udpcmsg {
+    char buf[CMSG_SPACE(sizeof(int))];
+    size_t align;
+};
+
+/* udpsockopts applies the flags of udpdial and udplisten to sock. */
+static int udpsockopts(int sock, int flags)
+{
+    int on = 1;
+    if((flags & UDP_REUSEPORT) &&
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1) {
+        return errno;
+    }
+    /* GRO is an optimization, kernels before 5.0 simply do not coalesce */
+    if(flags & UDP_COALESCE) {
+        setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof on);
+    }
+    return 0;
+}
+
+/* udpdial creates a UDP socket connected to host:port and write it into
+ * *sock. Connecting a UDP socket only sets its default destination, so
+ * udpsend can pass messages without an address, and makes the kernel
+ * report ICMP errors such as ECONNREFUSED and drop datagrams from other
+ * sources.
+ *
+ * The flags parameter is zero or the bitwise OR of UDP_NONBLOCK and
+ * UDP_COALESCE. The host is resolved through the caching resolver of
+ * tcpdial; the first address that can be connected is used.
+ *
+ * It returns 0 on success, or the errors of tcpdial for the resolution and
+ * of socket(2) and connect(2).
+ *
+ * Example:
+ *
+ *     int sock;
+ *     int errdial = udpdial(&sock, "localhost", "9090", 0);
+ */
+int udpdial(int *sock, char host[], char port[], int flags)
+{
+    struct tcpaddrs addrs;
+    int err = tcpresolve(tcpresolvdefault(), &addrs, host, port, NULL);
+    if(err != 0) {
+        errno = err;
+        return errno;
+    }
+
+    int type = SOCK_DGRAM | SOCK_CLOEXEC;
+    if(flags & UDP_NONBLOCK) type |= SOCK_NONBLOCK;
+
+    err = ENOTCONN;
+    for(int i = 0; i < addrs.n; i++) {
+        struct tcpaddr *a = &addrs.addr[i];
+        *sock = socket(a->u.sa.sa_family, type, IPPROTO_UDP);
+        if(*sock == -1) {
+            err = errno;
+            continue;
+        }
+        err = udpsockopts(*sock, flags);
+        if(err == 0 && connect(*sock, &a->u.sa, a->len) == 0) break;
+        if(err == 0) err = errno;
+        close(*sock);
+        *sock = -1;
+    }
+
+    errno = err;
+    return errno;
+}
+
+/* udplisten creates a UDP socket bound to host:port and write it into
+ * *sock. If host is NULL or an empty string, the socket is bound to the
+ * wildcard address of every available address family, as by tcplisten.
+ *
+ * The flags parameter is zero or the bitwise OR of:
+ *
+ * UDP_NONBLOCK
+ * Put the socket into non-blocking mode, udprecv returns EAGAIN when no
+ * datagram is queued.
+ *
+ * UDP_REUSEPORT
+ * Set SO_REUSEPORT, so several sockets can be bound to the same address
+ * and the kernel spreads the flows between them.
+ *
+ * UDP_COALESCE
+ * Enable UDP GRO where the kernel supports it: back to back datagrams of
+ * the same flow and size are received by udprecv as one message, whose
+ * buffer should then be UDP_MAXLN bytes. See udpgro.
+ *
+ * It returns 0 on success, or the errors of tcplisten.
+ */
+int udplisten(int *sock, char host[], char port[], int flags)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    hints.ai_flags = AI_PASSIVE;
+    if(host != NULL && host[0] == '\0') host = NULL;
+    int gaierr = getaddrinfo(host, port, &hints, &res);
+    if(gaierr != 0) {
+        return tcpgaierr(gaierr);
+    }
+
+    /* prefer the IPv6 wildcard address since it also receives IPv4
+     * datagrams as v4-mapped addresses */
+    struct addrinfo *addri = res;
+    if(host == NULL) {
+        for(struct addrinfo *a = res; a != NULL; a = a->ai_next) {
+            if(a->ai_family == AF_INET6) {
+                addri = a;
+                break;
+            }
+        }
+    }
+
+    int type = SOCK_DGRAM | SOCK_CLOEXEC;
+    if(flags & UDP_NONBLOCK) type |= SOCK_NONBLOCK;
+
+    int err = ENOTCONN;
+    for(; addri != NULL; addri = addri->ai_next) {
+        *sock = socket(addri->ai_family, type, IPPROTO_UDP);
+        if(*sock == -1) {
+            err = errno;
+            continue;
+        }
+        err = udpsockopts(*sock, flags);
+        if(err == 0 && addri->ai_family == AF_INET6 && host == NULL) {
+            int off = 0;
+            setsockopt(*sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof off);
+        }
+        if(err == 0 && bind(*sock, addri->ai_addr, addri->ai_addrlen) == 0) {
+            break;
+        }
+        if(err == 0) err = errno;
+        close(*sock);
+        *sock = -1;
+    }
+    freeaddrinfo(res);
+
+    errno = err;
+    return errno;
+}
+
+/* udprecv receives up to n datagrams, at most UDP_BATCH, with a single
+ * recvmmsg(2) and write the number received into *nrecv. The buf and len
+ * of every message must be set; len, seg and addr are replaced by the
+ * received datagram. A datagram larger than len is truncated.
+ *
+ * On a blocking socket it waits for the first datagram only, and returns
+ * the ones that are already queued with it.
+ *
+ * It returns 0, EAGAIN if a non-blocking socket has no datagram queued, or
+ * the error of recvmmsg(2).
+ *
+ * Example:
+ *
+ *     struct udpmsg msgs[UDP_BATCH];
+ *     for(int i = 0; i < UDP_BATCH; i++) {
+ *         msgs[i].buf = bufs[i];
+ *         msgs[i].len = sizeof bufs[i];
+ *     }
+ *     int n;
+ *     int errrecv = udprecv(sock, msgs, UDP_BATCH, &n);
+ */
+int udprecv(int sock, struct udpmsg msgs[], int n, int *nrecv)
+{
+    struct mmsghdr hdrs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    union udpcmsg cmsgs[UDP_BATCH];
+
+    *nrecv = 0;
+    if(n > UDP_BATCH) n = UDP_BATCH;
+    for(int i = 0; i < n; i++) {
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].len;
+        memset(&hdrs[i].msg_hdr, 0, sizeof hdrs[i].msg_hdr);
+        hdrs[i].msg_hdr.msg_name = &msgs[i].addr.u;
+        hdrs[i].msg_hdr.msg_namelen = sizeof msgs[i].addr.u;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_control = cmsgs[i].buf;
+        hdrs[i].msg_hdr.msg_controllen = sizeof cmsgs[i].buf;
+    }
+
+    int got;
+    do {
+        got = recvmmsg(sock, hdrs, n, MSG_WAITFORONE, NULL);
+    } while(got == -1 && errno == EINTR);
+    if(got == -1) {
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return errno;
+    }
+
+    for(int i = 0; i < got; i++) {
+        struct msghdr *h = &hdrs[i].msg_hdr;
+        msgs[i].len = hdrs[i].msg_len;
+        msgs[i].addr.len = h->msg_namelen;
+        msgs[i].seg = 0;
+        for(struct cmsghdr *c = CMSG_FIRSTHDR(h); c != NULL;
+                c = CMSG_NXTHDR(h, c)) {
+            if(c->cmsg_level != SOL_UDP || c->cmsg_type != UDP_GRO) continue;
+            int seg;
+            memcpy(&seg, CMSG_DATA(c), sizeof seg);
+            if(seg > 0 && (size_t)seg < msgs[i].len) msgs[i].seg = seg;
+        }
+    }
+    *nrecv = got;
+    return 0;
+}
+
+/* udpsend sends up to n messages, at most UDP_BATCH, with a single
+ * sendmmsg(2) and write the number sent into *nsent. A message with a
+ * non-zero seg is split by the kernel into datagrams of seg bytes (UDP
+ * GSO); it may hold up to UDP_GSOSEGS of them and UDP_MAXLN bytes, and the
+ * socket must support it, see udpgso.
+ *
+ * Fewer than n messages are sent if the socket buffer fills up or a later
+ * message fails; the error of the first message is returned. It returns 0,
+ * EAGAIN if a non-blocking socket buffer is full, or the error of
+ * sendmmsg(2), e.g. ECONNREFUSED on a connected socket whose peer is gone.
+ */
+int udpsend(int sock, struct udpmsg msgs[], int n, int *nsent)
+{
+    struct mmsghdr hdrs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    union udpcmsg cmsgs[UDP_BATCH];
+
+    *nsent = 0;
+    if(n > UDP_BATCH) n = UDP_BATCH;
+    for(int i = 0; i < n; i++) {
+        struct msghdr *h = &hdrs[i].msg_hdr;
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].len;
+        memset(h, 0, sizeof *h);
+        if(msgs[i].addr.len != 0) {
+            h->msg_name = &msgs[i].addr.u;
+            h->msg_namelen = msgs[i].addr.len;
+        }
+        h->msg_iov = &iovs[i];
+        h->msg_iovlen = 1;
+        if(msgs[i].seg != 0 && msgs[i].seg < msgs[i].len) {
+            uint16_t seg = msgs[i].seg;
+            memset(&cmsgs[i], 0, sizeof cmsgs[i]);
+            h->msg_control = cmsgs[i].buf;
+            h->msg_controllen = CMSG_SPACE(sizeof seg);
+            struct cmsghdr *c = CMSG_FIRSTHDR(h);
+            c->cmsg_level = SOL_UDP;
+            c->cmsg_type = UDP_SEGMENT;
+            c->cmsg_len = CMSG_LEN(sizeof seg);
+            memcpy(CMSG_DATA(c), &seg, sizeof seg);
+        }
+    }
+
+    int sent;
+    do {
+        sent = sendmmsg(sock, hdrs, n, 0);
+    } while(sent == -1 && errno == EINTR);
+    if(sent == -1) {
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return errno;
+    }
+    *nsent = sent;
+    return 0;
+}
+
+/* udpgso returns non-zero if the kernel can segment the datagrams sent on
+ * sock (UDP_SEGMENT, Linux 4.18). */
+int udpgso(int sock)
+{
+    int seg;
+    socklen_t len = sizeof seg;
+    return getsockopt(sock, SOL_UDP, UDP_SEGMENT, &seg, &len) == 0;
+}
+
+/* udpgro returns non-zero if the datagrams received on sock are coalesced
+ * (UDP_GRO, Linux 5.0). */
+int udpgro(int sock)
+{
+    int on = 0;
+    socklen_t len = sizeof on;
+    return getsockopt(sock, SOL_UDP, UDP_GRO, &on, &len) == 0 && on;
+}
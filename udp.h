@@ -0,0 +1,78 @@
+/* udp - UDP sockets with batched receive and send, and UDP generic
+ * segmentation and receive offload.
+ *
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UDP_H
+#define UDP_H
+
+#include <stddef.h>
+
+#include "tcpresolv.h"
+
+/* the largest number of datagrams moved by one udprecv or udpsend */
+#define UDP_BATCH 64
+/* the largest UDP payload, and the size of a buffer that can hold the
+ * datagrams GRO coalesces */
+#define UDP_MAXLN 65507
+/* the largest number of segments of a single GSO send */
+#define UDP_GSOSEGS 64
+
+/* flags for udpdial and udplisten */
+enum {
+    UDP_NONBLOCK = 1,
+    UDP_REUSEPORT = 2,
+    /* ask the kernel to coalesce datagrams of the same flow (GRO) */
+    UDP_COALESCE = 4
+};
+
+/* udpmsg is a datagram of a batch, or with GSO and GRO a run of datagrams
+ * of the same size. */
+struct udpmsg {
+    void *buf;
+    /* the size of buf for udprecv, which replaces it with the number of
+     * bytes received; the number of bytes to send for udpsend */
+    size_t len;
+    /* if non-zero, buf holds datagrams of seg bytes, the last one may be
+     * shorter; udprecv sets it for coalesced datagrams and udpsend splits
+     * buf with GSO */
+    size_t seg;
+    /* the source of a received datagram and the destination of a sent one;
+     * with a zero length the connected peer is used */
+    struct tcpaddr addr;
+};
+
+int udpdial(int *sock, char host[], char port[], int flags);
+int udplisten(int *sock, char host[], char port[], int flags);
+int udprecv(int sock, struct udpmsg msgs[], int n, int *nrecv);
+int udpsend(int sock, struct udpmsg msgs[], int n, int *nsent);
+int udpgso(int sock);
+int udpgro(int sock);
+
+#endif
@@ -0,0 +1,291 @@
+/* udpbench.c - Measure how many datagrams per second the udp module moves
+ * over loopback with one system call per datagram, with batches of
+ * recvmmsg(2) and sendmmsg(2), and with GSO and GRO on top of the batches.
+ * A sender thread streams datagrams to a receiver socket in the same
+ * process, keeping at most a socket buffer worth of them in flight so the
+ * kernel does not drop any.
+ *
+ * Build:
+ * % make udpbench
+ *
+ * Usage:
+ * % ./udpbench
+ * % ./udpbench -n 4000000 -s 1200 -r 5
+ *
+ * Options:
+ * -n count  number of datagrams per run (default: 1000000)
+ * -s size   payload size in bytes (default: 64)
+ * -r runs   number of timed runs; the fastest is reported (default: 3)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes system header files to expose the Linux specific
+ * SO_RCVBUFFORCE socket option. */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "udp.h"
+
+enum { BENCH_SINGLE, BENCH_MMSG, BENCH_GSO, BENCH_MODES };
+
+static const char *modename[BENCH_MODES] = { "single", "mmsg", "gso+gro" };
+
+/* the approximate kernel memory a small datagram takes in a receive
+ * buffer, used to size the window */
+#define BENCH_TRUESIZE 1024
+#define BENCH_RCVBUF (8 * 1024 * 1024)
+/* how long the receiver waits for a datagram before it gives up */
+#define BENCH_IDLEMS 200
+
+struct bench {
+    int mode;
+    long count;
+    size_t size;
+    int tx;
+    int rx;
+    long window;
+    /* the number of datagrams received so far, read by the sender */
+    long received;
+    long sent;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* sender streams b->count datagrams, never more than b->window ahead of
+ * the receiver. */
+static void *sender(void *arg)
+{
+    struct bench *b = arg;
+    int segs = 1;
+    int batch = b->mode == BENCH_SINGLE ? 1 : UDP_BATCH;
+    if(b->mode == BENCH_GSO) {
+        segs = UDP_MAXLN / b->size;
+        if(segs > UDP_GSOSEGS) segs = UDP_GSOSEGS;
+    }
+    char *buf = calloc(segs, b->size);
+    if(buf == NULL) {
+        b->err = ENOMEM;
+        return NULL;
+    }
+
+    struct udpmsg msgs[UDP_BATCH];
+    while(b->sent < b->count) {
+        long room = b->window - (b->sent -
+                __atomic_load_n(&b->received, __ATOMIC_ACQUIRE));
+        if(room > b->count - b->sent) room = b->count - b->sent;
+        if(room <= 0) {
+            sched_yield();
+            continue;
+        }
+
+        int n = 0;
+        for(; n < batch && room > 0; n++) {
+            int k = room < segs ? room : segs;
+            msgs[n].buf = buf;
+            msgs[n].len = k * b->size;
+            msgs[n].seg = k > 1 ? b->size : 0;
+            msgs[n].addr.len = 0;
+            room -= k;
+        }
+        int nsent;
+        int err = udpsend(b->tx, msgs, n, &nsent);
+        if(err == ENOBUFS || err == EAGAIN) {
+            sched_yield();
+            continue;
+        }
+        if(err != 0) {
+            b->err = err;
+            break;
+        }
+        for(int i = 0; i < nsent; i++) {
+            b->sent += msgs[i].seg != 0 ? msgs[i].len / b->size : 1;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/* run times one transfer and returns the received datagrams per second,
+ * or -1 on error. */
+static double run(int mode, long count, size_t size)
+{
+    struct bench b;
+    memset(&b, 0, sizeof b);
+    b.mode = mode;
+    b.count = count;
+    b.size = size;
+
+    int err = udplisten(&b.rx, "127.0.0.1", "0",
+            mode == BENCH_GSO ? UDP_COALESCE : 0);
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        return -1;
+    }
+    /* SO_RCVBUFFORCE needs CAP_NET_ADMIN, SO_RCVBUF is capped by
+     * net.core.rmem_max */
+    int rcvbuf = BENCH_RCVBUF;
+    if(setsockopt(b.rx, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                sizeof rcvbuf) == -1) {
+        setsockopt(b.rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    }
+    socklen_t optlen = sizeof rcvbuf;
+    getsockopt(b.rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
+    b.window = rcvbuf / (BENCH_TRUESIZE + (long)size) / 2;
+    if(b.window < 1) b.window = 1;
+    struct timeval tv = { 0, BENCH_IDLEMS * 1000 };
+    setsockopt(b.rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof addr;
+    getsockname(b.rx, (struct sockaddr *)&addr, &addrlen);
+    char port[8];
+    snprintf(port, sizeof port, "%d", ntohs(addr.sin_port));
+    err = udpdial(&b.tx, "127.0.0.1", port, 0);
+    if(err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(err));
+        close(b.rx);
+        return -1;
+    }
+
+    int batch = mode == BENCH_SINGLE ? 1 : UDP_BATCH;
+    size_t buflen = mode == BENCH_GSO ? UDP_MAXLN : size;
+    char *bufs = malloc(batch * buflen);
+    struct udpmsg msgs[UDP_BATCH];
+    if(bufs == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(ENOMEM));
+        return -1;
+    }
+
+    pthread_t thread;
+    double start = now(), last = start;
+    pthread_create(&thread, NULL, sender, &b);
+    long received = 0;
+    while(received < count) {
+        for(int i = 0; i < batch; i++) {
+            msgs[i].buf = bufs + i * buflen;
+            msgs[i].len = buflen;
+        }
+        int n;
+        err = udprecv(b.rx, msgs, batch, &n);
+        if(err == EAGAIN) break;
+        if(err != 0) {
+            fprintf(stderr, "error: %s\n", strerror(err));
+            break;
+        }
+        for(int i = 0; i < n; i++) {
+            received += msgs[i].seg != 0 ?
+                (msgs[i].len + msgs[i].seg - 1) / msgs[i].seg : 1;
+        }
+        __atomic_store_n(&b.received, received, __ATOMIC_RELEASE);
+        last = now();
+    }
+    /* let the sender finish if datagrams were lost */
+    __atomic_store_n(&b.received, count, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    free(bufs);
+    close(b.tx);
+    close(b.rx);
+    if(b.err != 0) {
+        fprintf(stderr, "error: %s\n", strerror(b.err));
+        return -1;
+    }
+    if(received < count) {
+        fprintf(stderr, "%s: %ld of %ld datagrams lost\n", modename[mode],
+                count - received, count);
+    }
+    return received / (last - start);
+}
+
+int main(int argc, char **argv)
+{
+    long count = 1000000;
+    long size = 64;
+    int runs = 3;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:r:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 's':
+                size = atol(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-s size] [-r runs]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(count <= 0 || runs <= 0 || size <= 0 || size > UDP_MAXLN) {
+        fprintf(stderr, "Invalid count, size or runs\n");
+        return 1;
+    }
+
+    int rc = 0;
+    double base = 0;
+    for(int mode = 0; mode < BENCH_MODES; mode++) {
+        double best = 0;
+        for(int r = 0; r < runs; r++) {
+            double pps = run(mode, count, size);
+            if(pps < 0) {
+                rc = 1;
+                break;
+            }
+            if(pps > best) best = pps;
+        }
+        if(mode == BENCH_SINGLE) base = best;
+        printf("%-8s %8.3f Mpps %8.1f MB/s %6.2fx\n", modename[mode],
+                best / 1e6, best * size / 1e6, base > 0 ? best / base : 0);
+    }
+    return rc;
+}
@@ -0,0 +1,243 @@
+/* udsbench.c - Compare the round trip latency of loopback TCP with Unix
+ * domain sockets. For every transport the benchmark listens, dials itself
+ * and hands the accepted connection with tcpsendfd to an echo process it
+ * forked at start, then times request and response ping-pongs between the
+ * two processes.
+ *
+ * Build:
+ * % make udsbench
+ *
+ * Usage:
+ * % ./udsbench
+ * % ./udsbench -n 200000 -s 1024 -r 5
+ *
+ * Options:
+ * -n count  number of round trips per run (default: 100000)
+ * -s size   message size in bytes (default: 64)
+ * -r runs   number of timed runs; the one with the lowest median is
+ *           reported (default: 3)
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "tcp.h"
+#include "tcphist.h"
+
+static uint64_t nowns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* full reads or writes exactly len bytes, it returns 0 or an errno
+ * value; ECONNRESET stands for an early end of file */
+static int full(int fd, char *buf, size_t len, int wr)
+{
+    while(len > 0) {
+        ssize_t n = wr ? send(fd, buf, len, MSG_NOSIGNAL) :
+            recv(fd, buf, len, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) return errno;
+        if(n == 0) return ECONNRESET;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* echo runs in the forked process: it serves every connection it receives
+ * over ctl until the parent closes its end. */
+static void echo(int ctl, size_t size)
+{
+    char *buf = malloc(size);
+    int conn;
+    while(buf != NULL && tcprecvfd(ctl, &conn) == 0) {
+        while(full(conn, buf, size, 0) == 0 &&
+                full(conn, buf, size, 1) == 0) {
+        }
+        close(conn);
+    }
+    free(buf);
+}
+
+/* benchconn dials host:port, accepts the connection on ln and passes the
+ * server side to the echo process. It write the client side into *cli. */
+static int benchconn(int *cli, int ln, char *host, char *port, int ctl)
+{
+    int err = tcpdial(cli, host, port);
+    if(err != 0) return err;
+    int one = 1;
+    setsockopt(*cli, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    int srv;
+    err = tcpaccept(&srv, ln, 0);
+    if(err == 0) {
+        setsockopt(srv, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        err = tcpsendfd(ctl, srv);
+        close(srv);
+    }
+    if(err != 0) close(*cli);
+    return err;
+}
+
+/* pingpong times count round trips of size bytes over cli into h. */
+static int pingpong(int cli, struct tcphist *h, long count, size_t size)
+{
+    char *buf = calloc(1, size);
+    if(buf == NULL) return ENOMEM;
+    int err = 0;
+    for(long i = 0; i < count && err == 0; i++) {
+        uint64_t t0 = nowns();
+        err = full(cli, buf, size, 1);
+        if(err == 0) err = full(cli, buf, size, 0);
+        tcphistadd(h, nowns() - t0);
+    }
+    free(buf);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    long count = 100000;
+    size_t size = 64;
+    int runs = 3;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:r:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-s size] [-r runs]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(count < 1 || size == 0 || runs < 1) {
+        fprintf(stderr, "Usage: %s [-n count] [-s size] [-r runs]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int ctl[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ctl) == -1) {
+        perror("socketpair");
+        return 1;
+    }
+    pid_t pid = fork();
+    if(pid == -1) {
+        perror("fork");
+        return 1;
+    }
+    if(pid == 0) {
+        close(ctl[0]);
+        echo(ctl[1], size);
+        _exit(0);
+    }
+    close(ctl[1]);
+
+    /* an abstract name leaves no file behind */
+    char unixaddr[64];
+    snprintf(unixaddr, sizeof unixaddr, "unix:@udsbench.%ld", (long)pid);
+    char *names[] = { "tcp", "unix" };
+    char *hosts[] = { "127.0.0.1", unixaddr };
+
+    static struct tcphist h, best;
+    printf("%-6s %10s %10s %10s %10s %12s\n", "", "p50 us", "p99 us",
+            "p99.9 us", "max us", "trips/s");
+    for(int t = 0; t < 2; t++) {
+        int ln = -1;
+        int err = tcplisten(&ln, hosts[t], "0", 0);
+        char port[8] = "0";
+        if(err == 0 && t == 0) {
+            struct sockaddr_in addr;
+            socklen_t addrlen = sizeof addr;
+            getsockname(ln, (struct sockaddr *)&addr, &addrlen);
+            snprintf(port, sizeof port, "%d", ntohs(addr.sin_port));
+        }
+
+        double secs = 0;
+        tcphistinit(&best);
+        for(int r = 0; r < runs && err == 0; r++) {
+            int cli;
+            err = benchconn(&cli, ln, hosts[t], port, ctl[0]);
+            if(err != 0) break;
+            /* warm up the caches and the scheduler before timing */
+            tcphistinit(&h);
+            err = pingpong(cli, &h, count / 10 + 1, size);
+            tcphistinit(&h);
+            uint64_t t0 = nowns();
+            if(err == 0) err = pingpong(cli, &h, count, size);
+            uint64_t t1 = nowns();
+            close(cli);
+            if(r == 0 || tcphistpct(&h, 50) < tcphistpct(&best, 50)) {
+                best = h;
+                secs = (t1 - t0) / 1e9;
+            }
+        }
+        if(ln != -1) close(ln);
+        if(err != 0) {
+            printf("%-6s error: %s\n", names[t], strerror(err));
+            continue;
+        }
+        printf("%-6s %10.2f %10.2f %10.2f %10.2f %12.0f\n", names[t],
+                tcphistpct(&best, 50) / 1e3, tcphistpct(&best, 99) / 1e3,
+                tcphistpct(&best, 99.9) / 1e3, best.max / 1e3, count / secs);
+    }
+
+    close(ctl[0]);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
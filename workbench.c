@@ -0,0 +1,281 @@
+/* workbench.c - Show how the tcpwork pool keeps the tail latency of jobs
+ * of varying cost flat. An event loop keeps a fixed number of jobs in
+ * flight; most jobs are short and a few are long, like requests that miss
+ * a cache. Every job is timed from its submission to its done callback,
+ * and the same sequence of jobs is run inline on the loop thread, on the
+ * pool with stealing disabled and on the pool with stealing enabled.
+ *
+ * Build:
+ * % make workbench
+ *
+ * Usage:
+ * % ./workbench
+ * % ./workbench -w 8 -n 500000 -c 64 -s 5 -l 1000 -p 2
+ *
+ * Options:
+ * -w workers  number of workers (default: one per CPU)
+ * -n count    number of jobs (default: 100000)
+ * -c count    jobs in flight (default: 4 per worker)
+ * -s us       cost of a short job in microseconds (default: 10)
+ * -l us       cost of a long job in microseconds (default: 500)
+ * -p percent  share of long jobs (default: 5)
+ *
+ * The jobs spin on the CPU; the pool only helps if there are more CPUs
+ * than the loop thread needs.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcphist.h"
+#include "tcploop.h"
+#include "tcpwork.h"
+
+enum { BENCH_INLINE, BENCH_NOSTEAL, BENCH_STEAL };
+
+static const char *modes[] = { "inline", "pool-nosteal", "pool-steal" };
+
+struct bench;
+
+struct benchjob {
+    struct tcpjob job;
+    struct bench *b;
+    uint64_t cost;
+    uint64_t start;
+};
+
+struct bench {
+    struct tcploop *loop;
+    struct tcpworkport *port;
+    struct tcphist hist;
+    long count;
+    long submitted;
+    long done;
+    uint64_t shortns;
+    uint64_t longns;
+    int pct;
+    int err;
+};
+
+static uint64_t nowns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* benchcost returns the cost of the i-th job, the same in every mode */
+static uint64_t benchcost(struct bench *b, long i)
+{
+    uint64_t x = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 29;
+    return (int)(x % 100) < b->pct ? b->longns : b->shortns;
+}
+
+static void benchrun(struct tcpjob *job)
+{
+    struct benchjob *j = (struct benchjob *)job;
+    uint64_t end = nowns() + j->cost;
+    while(nowns() < end) {
+    }
+}
+
+/* benchnext gives j the next job of the sequence, it returns 0 once every
+ * job was submitted */
+static int benchnext(struct bench *b, struct benchjob *j)
+{
+    if(b->submitted == b->count) return 0;
+    j->cost = benchcost(b, b->submitted++);
+    j->start = nowns();
+    return 1;
+}
+
+static void benchdone(struct tcpjob *job)
+{
+    struct benchjob *j = (struct benchjob *)job;
+    struct bench *b = j->b;
+    tcphistadd(&b->hist, nowns() - j->start);
+    b->done++;
+    if(b->err == 0 && benchnext(b, j)) {
+        b->err = tcpworksubmit(b->port, &j->job);
+        if(b->err != 0) b->submitted--;
+    }
+    /* after an error, the jobs in flight still have to come back */
+    if(b->done == b->submitted) tcploopstop(b->loop);
+}
+
+/* benchinline runs the jobs in order on this thread, as a loop without a
+ * pool would; a job waits for every job submitted before it */
+static void benchinline(struct bench *b, struct benchjob *jobs, int inflight)
+{
+    int head = 0;
+    for(int i = 0; i < inflight; i++) benchnext(b, &jobs[i]);
+    while(b->done < b->count) {
+        struct benchjob *j = &jobs[head];
+        head = (head + 1) % inflight;
+        benchrun(&j->job);
+        tcphistadd(&b->hist, nowns() - j->start);
+        b->done++;
+        benchnext(b, j);
+    }
+}
+
+static int benchpool(struct bench *b, struct benchjob *jobs, int inflight,
+        int nworkers, int flags)
+{
+    struct tcpwork *pool;
+    int err = tcpworknew(&pool, nworkers, inflight, flags);
+    if(err != 0) return err;
+    err = tcploopnew(&b->loop);
+    if(err != 0) {
+        tcpworkfree(pool);
+        return err;
+    }
+    err = tcpworkportnew(&b->port, pool, b->loop, inflight);
+    if(err == 0) {
+        for(int i = 0; i < inflight && benchnext(b, &jobs[i]); i++) {
+            b->err = tcpworksubmit(b->port, &jobs[i].job);
+            if(b->err != 0) {
+                b->submitted--;
+                break;
+            }
+        }
+        if(b->submitted > 0) err = tcplooprun(b->loop);
+        if(err == 0) err = b->err;
+        tcpworkportfree(b->port);
+    }
+    tcpworkfree(pool);
+    tcploopfree(b->loop);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    int nworkers = 0;
+    long count = 100000;
+    int inflight = 0;
+    long shortus = 10;
+    long longus = 500;
+    int pct = 5;
+
+    int opt;
+    while((opt = getopt(argc, argv, "w:n:c:s:l:p:")) != -1) {
+        switch(opt) {
+            case 'w':
+                nworkers = atoi(optarg);
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'c':
+                inflight = atoi(optarg);
+                break;
+            case 's':
+                shortus = atol(optarg);
+                break;
+            case 'l':
+                longus = atol(optarg);
+                break;
+            case 'p':
+                pct = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-w workers] [-n count] "
+                        "[-c count] [-s us] [-l us] [-p percent]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(nworkers <= 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nworkers <= 0) nworkers = 1;
+    if(inflight <= 0) inflight = 4 * nworkers;
+    if(count < 1 || shortus < 0 || longus < 0 || pct < 0 || pct > 100) {
+        fprintf(stderr, "Usage: %s [-w workers] [-n count] [-c count] "
+                "[-s us] [-l us] [-p percent]\n", argv[0]);
+        return 1;
+    }
+
+    struct benchjob *jobs = calloc(inflight, sizeof *jobs);
+    static struct bench b;
+    if(jobs == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    printf("%d workers, %d jobs in flight\n", nworkers, inflight);
+    printf("%-14s %10s %10s %10s %10s %10s\n", "mode", "jobs/s", "p50 us",
+            "p99 us", "p99.9 us", "max us");
+    for(int m = BENCH_INLINE; m <= BENCH_STEAL; m++) {
+        memset(&b, 0, sizeof b);
+        tcphistinit(&b.hist);
+        b.count = count;
+        b.shortns = shortus * 1000;
+        b.longns = longus * 1000;
+        b.pct = pct;
+        for(int i = 0; i < inflight; i++) {
+            jobs[i].job.run = benchrun;
+            jobs[i].job.done = benchdone;
+            jobs[i].b = &b;
+        }
+
+        uint64_t t0 = nowns();
+        int err = 0;
+        if(m == BENCH_INLINE) {
+            benchinline(&b, jobs, inflight);
+        } else {
+            err = benchpool(&b, jobs, inflight, nworkers,
+                    m == BENCH_NOSTEAL ? TCP_WORKNOSTEAL : 0);
+        }
+        uint64_t t1 = nowns();
+        if(err != 0) {
+            printf("%-14s error: %s\n", modes[m], strerror(err));
+            continue;
+        }
+        printf("%-14s %10.0f %10.1f %10.1f %10.1f %10.1f\n", modes[m],
+                count / ((t1 - t0) / 1e9), tcphistpct(&b.hist, 50) / 1e3,
+                tcphistpct(&b.hist, 99) / 1e3,
+                tcphistpct(&b.hist, 99.9) / 1e3, b.hist.max / 1e3);
+    }
+    free(jobs);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/* zcbench.c - Compare the copy, splice and zerocopy echo paths on loopback.
+ * For every mode a client streams bytes to an in-process echo thread over
+ * 127.0.0.1 and reads them back. The benchmark reports the throughput and
+ * the CPU time the echo thread spent per GB.
+ *
+ * Build:
+ * % make zcbench
+ *
+ * Usage:
+ * % ./zcbench
+ * % ./zcbench -n 1024 -b 65536
+ *
+ * Options:
+ * -n MB     megabytes echoed per mode (default: 256)
+ * -b bytes  size of the client writes and of the copy buffers
+ *           (default: 65536)
+ *
+ * On loopback the kernel has no NIC to DMA from, so MSG_ZEROCOPY sends are
+ * copied anyway; the zerocopy row then shows the cost of the notification
+ * machinery rather than the savings.
+ *
+ * License:
+ * BSD 3-clause Revised
+ * Copyright (c) 2016, Bayu Aldi Yansyah <bayualdiyansyah@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its 
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This macro causes header files to expose definitions corresponding to the
+ * POSIX.1-2008 base specification (excluding the XSI extension). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tcp.h"
+#include "tcpzc.h"
+
+enum { BENCH_COPY, BENCH_SPLICE, BENCH_ZEROCOPY };
+
+static const char *modes[] = { "copy", "splice", "zerocopy" };
+
+struct bench {
+    int mode;
+    /* the server side of the connection, non-blocking */
+    int srv;
+    /* the client side of the connection, blocking */
+    int cli;
+    size_t total;
+    size_t chunk;
+    int err;
+    int copied;
+    double cpu;
+};
+
+static int benchwait(int fd, short events)
+{
+    struct pollfd pfd = { fd, events, 0 };
+    if(poll(&pfd, 1, -1) == -1 && errno != EINTR) return errno;
+    return 0;
+}
+
+static int benchcopy(struct bench *b)
+{
+    char *buf = malloc(b->chunk);
+    if(buf == NULL) return ENOMEM;
+
+    int err = 0;
+    size_t off = 0, len = 0;
+    for(;;) {
+        if(off < len) {
+            ssize_t n = send(b->srv, buf + off, len - off, MSG_NOSIGNAL);
+            if(n == -1) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    benchwait(b->srv, POLLOUT);
+                    continue;
+                }
+                if(errno == EINTR) continue;
+                err = errno;
+                break;
+            }
+            off += n;
+            continue;
+        }
+        ssize_t n = recv(b->srv, buf, b->chunk, 0);
+        if(n == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                benchwait(b->srv, POLLIN);
+                continue;
+            }
+            if(errno == EINTR) continue;
+            err = errno;
+            break;
+        }
+        if(n == 0) break;
+        off = 0;
+        len = n;
+    }
+    free(buf);
+    return err;
+}
+
+static int benchsplice(struct bench *b)
+{
+    struct tcppipe p;
+    int err = tcppipeinit(&p);
+    if(err != 0) return err;
+
+    for(;;) {
+        size_t n;
+        err = tcpsplice(b->srv, b->srv, &p, &n);
+        if(err != EAGAIN) break;
+        benchwait(b->srv, p.len > 0 ? POLLOUT : POLLIN);
+    }
+    tcppipefree(&p);
+    return err;
+}
+
+static int benchzc(struct bench *b)
+{
+    struct tcpzc zc;
+    int err = tcpzcinit(&zc, b->srv);
+    if(err != 0) return err;
+    char *buf = malloc(b->chunk);
+    if(buf == NULL) return ENOMEM;
+
+    size_t off = 0, len = 0;
+    for(;;) {
+        if(off < len) {
+            size_t n;
+            err = tcpzcsend(&zc, b->srv, buf + off, len - off, &n);
+            if(err == EAGAIN) {
+                tcpzcreap(&zc, b->srv);
+                benchwait(b->srv, POLLOUT);
+                continue;
+            }
+            if(err != 0) break;
+            off += n;
+            continue;
+        }
+        err = tcpzcreap(&zc, b->srv);
+        if(err != 0) break;
+        if(tcpzcbusy(&zc)) {
+            /* completions are reported as POLLERR */
+            benchwait(b->srv, 0);
+            continue;
+        }
+        ssize_t n = recv(b->srv, buf, b->chunk, 0);
+        if(n == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                benchwait(b->srv, POLLIN);
+                continue;
+            }
+            if(errno == EINTR) continue;
+            err = errno;
+            break;
+        }
+        if(n == 0) break;
+        off = 0;
+        len = n;
+    }
+    b->copied = zc.copied;
+    free(buf);
+    return err;
+}
+
+static void *benchsrv(void *arg)
+{
+    struct bench *b = arg;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+    switch(b->mode) {
+        case BENCH_COPY:
+            b->err = benchcopy(b);
+            break;
+        case BENCH_SPLICE:
+            b->err = benchsplice(b);
+            break;
+        case BENCH_ZEROCOPY:
+            b->err = benchzc(b);
+            break;
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+    b->cpu = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    close(b->srv);
+    return NULL;
+}
+
+static void *benchwriter(void *arg)
+{
+    struct bench *b = arg;
+    char *buf = calloc(1, b->chunk);
+    if(buf == NULL) return NULL;
+    size_t sent = 0;
+    while(sent < b->total) {
+        size_t len = b->total - sent < b->chunk ? b->total - sent : b->chunk;
+        ssize_t n = send(b->cli, buf, len, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        sent += n;
+    }
+    shutdown(b->cli, SHUT_WR);
+    free(buf);
+    return NULL;
+}
+
+/* benchrun echoes b->total bytes in the given mode and returns the wall
+ * clock time in seconds, or a negative value on error. */
+static double benchrun(struct bench *b)
+{
+    int ln;
+    errno = tcplisten(&ln, "127.0.0.1", "0", 0);
+    if(errno != 0) return -1;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof addr;
+    getsockname(ln, (struct sockaddr *)&addr, &addrlen);
+    char port[8];
+    snprintf(port, sizeof port, "%d", ntohs(addr.sin_port));
+
+    errno = tcpdial(&b->cli, "127.0.0.1", port);
+    if(errno != 0) {
+        close(ln);
+        return -1;
+    }
+    benchwait(ln, POLLIN);
+    errno = tcpaccept(&b->srv, ln, TCP_NONBLOCK);
+    close(ln);
+    if(errno != 0) {
+        close(b->cli);
+        return -1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t srv, writer;
+    pthread_create(&srv, NULL, benchsrv, b);
+    pthread_create(&writer, NULL, benchwriter, b);
+
+    char *buf = malloc(b->chunk);
+    size_t got = 0;
+    while(buf != NULL && got < b->total) {
+        ssize_t n = recv(b->cli, buf, b->chunk, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n <= 0) break;
+        got += n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(buf);
+    /* unblocks the echo thread if it stopped early */
+    shutdown(b->cli, SHUT_RDWR);
+    pthread_join(writer, NULL);
+    pthread_join(srv, NULL);
+    close(b->cli);
+
+    if(b->err == 0 && got != b->total) b->err = ECONNRESET;
+    if(b->err != 0) {
+        errno = b->err;
+        return -1;
+    }
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t mb = 256;
+    size_t chunk = 65536;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch(opt) {
+            case 'n':
+                mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                chunk = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n MB] [-b bytes]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(mb == 0 || chunk == 0) {
+        fprintf(stderr, "Usage: %s [-n MB] [-b bytes]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %12s %14s\n", "mode", "MB/s", "cpu s/GB");
+    for(int mode = BENCH_COPY; mode <= BENCH_ZEROCOPY; mode++) {
+        struct bench b;
+        memset(&b, 0, sizeof b);
+        b.mode = mode;
+        b.total = mb << 20;
+        b.chunk = chunk;
+
+        double secs = benchrun(&b);
+        if(secs < 0) {
+            printf("%-10s error: %s\n", modes[mode], strerror(errno));
+            continue;
+        }
+        double gb = (double)b.total / (1 << 30);
+        printf("%-10s %12.1f %14.3f%s\n", modes[mode], mb / secs, b.cpu / gb,
+                b.copied ? "  (kernel copied)" : "");
+    }
+    return 0;
+}